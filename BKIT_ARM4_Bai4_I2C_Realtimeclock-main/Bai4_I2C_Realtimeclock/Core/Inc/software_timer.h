@@ -10,9 +10,17 @@
 
 #include "tim.h"
 
-extern uint16_t flag_timer2;
+// 1 = timer2_Wait() sleeps in WFI until the next interrupt; 0 = it spins
+#ifndef TIMER2_WFI
+#define TIMER2_WFI		1
+#endif
+
+extern volatile uint16_t flag_timer2;
+extern uint16_t timer2_idle;		// share of the last second spent waiting for flag_timer2, 0.1% steps
 
 void timer_init();
 void setTimer2(uint16_t duration);
+void timer2_Wait();
+void timer2_Idle(uint32_t since);
 
 #endif /* INC_SOFTWARE_TIMER_H_ */
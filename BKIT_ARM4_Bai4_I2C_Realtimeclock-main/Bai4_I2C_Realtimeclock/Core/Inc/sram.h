@@ -0,0 +1,25 @@
+/*
+ * sram.h
+ *
+ *  External SRAM on FSMC bank 1, region 3 (NE3), used as the LCD frame store.
+ */
+
+#ifndef INC_SRAM_H_
+#define INC_SRAM_H_
+
+#include "main.h"
+
+#define SRAM_SIZE		(1024UL * 1024UL)	// IS62WV51216: 512K x 16
+
+#ifndef HOST_SIM
+#define SRAM_BANK3_BASE		((uint32_t)0x68000000)
+extern SRAM_HandleTypeDef hsram3;
+#endif
+
+void sram_init(void);
+uint16_t *sram_GetBuffer(void);
+
+void sram_WriteBuffer(uint8_t *buffer, uint32_t address, uint32_t size);
+void sram_ReadBuffer(uint8_t *buffer, uint32_t address, uint32_t size);
+
+#endif /* INC_SRAM_H_ */
@@ -105,7 +105,7 @@ int main(void)
   while (1)
   {
 	  // 1. Wait for 50ms timer tick
-	  while(!flag_timer2);
+	  timer2_Wait(); // sleeps in WFI, counts idle time
 	  flag_timer2 = 0;
 
 	  // 2. Scan buttons
@@ -113,6 +113,9 @@ int main(void)
 
 	  // 3. Run the clock FSM logic
 	  clock_fsm_run();
+#if LCD_USE_FRAMEBUFFER
+	  lcd_Display(); // rows drawn this pass go out by DMA
+#endif
 
     /* USER CODE END WHILE */
 
@@ -6,15 +6,20 @@
  */
 
 #include "software_timer.h"
+#include "dwt.h"
 
 #define TIMER_CYCLE_2 1
 
 
-uint16_t flag_timer2 = 0;
+volatile uint16_t flag_timer2 = 0;
 uint16_t timer2_counter = 0;
 uint16_t timer2_MUL = 0;
+uint16_t timer2_idle = 0;
+static uint32_t idle_cycles = 0, idle_window = 0;
 
 void timer_init(){
+	dwt_init();
+	idle_window = dwt_Cycles();
 	HAL_TIM_Base_Start_IT(&htim2);
 }
 
@@ -24,6 +29,37 @@ void setTimer2(uint16_t duration){
 	flag_timer2 = 0;
 }
 
+// Sleeps until TIM2 sets flag_timer2. Interrupts are masked around the
+// check so one cannot slip in between it and WFI; a pending interrupt still
+// ends WFI and is taken as soon as they are unmasked again
+void timer2_Wait(){
+	uint32_t t0 = dwt_Cycles();
+#if TIMER2_WFI && !defined(HOST_SIM)
+	__disable_irq();
+	while(!flag_timer2){
+		__WFI();
+		__enable_irq();
+		__disable_irq();
+	}
+	__enable_irq();
+#else
+	while(!flag_timer2);
+#endif
+	timer2_Idle(t0);
+}
+
+// Counts the time since 'since' (DWT cycles) as idle; timer2_idle is
+// updated once a second has gone by
+void timer2_Idle(uint32_t since){
+	uint32_t now = dwt_Cycles(), span = now - idle_window;
+	idle_cycles += now - since;
+	if(span >= SystemCoreClock){
+		timer2_idle = (uint64_t)idle_cycles*1000/span;
+		idle_cycles = 0;
+		idle_window = now;
+	}
+}
+
 void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim){
 	if(htim->Instance == TIM2){
 		if(timer2_counter > 0){
@@ -23,6 +23,7 @@
 #include "stm32f4xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "lcd.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -58,7 +59,9 @@
 /* External variables --------------------------------------------------------*/
 extern TIM_HandleTypeDef htim2;
 /* USER CODE BEGIN EV */
-
+#if LCD_USE_FRAMEBUFFER
+extern DMA_HandleTypeDef hdma_memtomem_dma2_stream0;
+#endif
 /* USER CODE END EV */
 
 /******************************************************************************/
@@ -214,6 +217,15 @@ void TIM2_IRQHandler(void)
 }
 
 /* USER CODE BEGIN 1 */
-
+#if LCD_USE_FRAMEBUFFER
+/**
+  * @brief This function handles DMA2 stream0 global interrupt: the end of a
+  *        framebuffer flush transfer (lcd.c sets the stream up).
+  */
+void DMA2_Stream0_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_memtomem_dma2_stream0);
+}
+#endif
 /* USER CODE END 1 */
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
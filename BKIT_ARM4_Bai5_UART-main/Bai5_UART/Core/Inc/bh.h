@@ -0,0 +1,60 @@
+/*
+ * bh.h
+ *
+ *  Interrupt priorities and bottom halves
+ *
+ *  NVIC priority plan (group 4: 16 preemption levels, no sub-priority;
+ *  lower number preempts higher):
+ *     0  TIM7      PC sampler, PCS_ENABLE only: above what it samples
+ *     1  USART1    one RX byte every 87us at 115200 baud; the handler
+ *                  queues it and re-arms the receiver
+ *     2  TIM2      1ms tick (or tickless deadline): counts and pends work
+ *     3  DMA2_S0   LCD memory-to-memory transfer complete
+ *     4  EXTI      STOP_ENABLE only: the STOP wake lines, and the DS3231's
+ *                  1Hz SQW outside STOP
+ *    13  SysTick   HAL tick and kernel timeouts: above BH, so a HAL
+ *                  timeout (led7_Scan()'s HAL_SPI_Transmit) still runs out
+ *                  inside a bottom half
+ *    14  BH        bottom halves: the work the handlers above defer
+ *    15  PendSV    kernel switch
+ *
+ *  A handler above BH does a bounded amount of work and bh_Pend()s the
+ *  rest: a bit per work item and a pended BH_IRQn, which runs once no
+ *  handler above it is active. The BH is preempted by every hardware
+ *  interrupt, so a blocking SPI transfer there no longer holds a UART
+ *  byte back.
+ */
+
+#ifndef INC_BH_H_
+#define INC_BH_H_
+
+#include "main.h"
+
+// 1 = TIM2 defers led7_Scan() to the BH; 0 = it scans in its own handler
+#ifndef BH_ENABLE
+#define BH_ENABLE		1
+#endif
+
+// No peripheral here uses the RNG, so its vector is free for the BH;
+// CubeMX must not enable RNG (NVIC, Code generation), bh.c has the handler
+#define BH_IRQn			HASH_RNG_IRQn
+#define BH_PRIO			14
+
+#if TICK_INT_PRIORITY >= BH_PRIO
+#error "SysTick must preempt the BH: HAL_GetTick() stands still in bottom halves"
+#endif
+
+typedef enum {
+	BH_LED7,					// led7_Scan(): one 16-bit SPI1 transfer, blocking
+	BH_COUNT
+} bh_Work_t;
+
+#if BH_ENABLE
+void bh_init();
+void bh_Pend(uint8_t work);
+#else
+#define bh_init()			((void)0)
+#define bh_Pend(work)		((void)0)
+#endif
+
+#endif /* INC_BH_H_ */
@@ -17,4 +17,29 @@
  */
 void clock_fsm_run(void);
 
+/**
+ * @brief Current mode: 0 view, 1 set time, 2 set alarm, 3 UART update, 4 message.
+ */
+uint8_t clock_fsm_mode(void);
+
+/**
+ * @brief With EVQ_ENABLE: hands the queued key, UART, RTC and timer events
+ * to the FSM and runs clock_fsm_run() only when there were any. Returns 1
+ * if it ran.
+ */
+uint8_t clock_fsm_dispatch(void);
+
+/**
+ * @brief 1 while the screen shows only the running time (view mode, no
+ * alarm): nothing but the next second will change it.
+ */
+uint8_t clock_fsm_quiet(void);
+
+/**
+ * @brief The UART task of main.c and host_sim: feeds received bytes to the
+ * command buffer, and with UART_CMD_ENABLE takes the report commands while
+ * the FSM is not in UART update mode.
+ */
+void clock_fsm_uart(void);
+
 #endif /* INC_CLOCK_FSM_H_ */
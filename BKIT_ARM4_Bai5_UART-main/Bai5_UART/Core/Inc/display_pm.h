@@ -0,0 +1,40 @@
+/*
+ * display_pm.h
+ *
+ *  Display power manager: panel partial/idle modes and PWM backlight
+ */
+
+#ifndef INC_DISPLAY_PM_H_
+#define INC_DISPLAY_PM_H_
+
+#include "main.h"
+
+// Delays in 50ms ticks of clock_fsm_run
+#define DPM_TICK_MS			50
+#define DPM_PARTIAL_DELAY	100		// 5s of a static screen -> partial mode
+#define DPM_IDLE_DELAY		600		// 30s without a key -> idle mode
+
+// Partial area: the time and date rows drawn by displayTime()
+#define DPM_PARTIAL_Y1		100
+#define DPM_PARTIAL_Y2		159
+
+// Backlight duty in percent
+#define DPM_BL_FULL			100
+#define DPM_BL_PARTIAL		60
+#define DPM_BL_IDLE			15
+
+typedef enum {
+	DPM_FULL,
+	DPM_PARTIAL,
+	DPM_IDLE
+} dpm_Level_t;
+
+extern uint32_t dpm_wake_cycles;
+
+void dpm_init();
+void dpm_Run(uint8_t static_screen);
+void dpm_Wake();
+dpm_Level_t dpm_GetLevel();
+void dpm_SetBacklight(uint8_t percent);
+
+#endif /* INC_DISPLAY_PM_H_ */
@@ -10,6 +10,7 @@
 
 #include "i2c.h"
 #include "utils.h"
+#include "evq.h"
 
 #define ADDRESS_SEC			0x00
 #define ADDRESS_MIN			0x01
@@ -18,6 +19,10 @@
 #define ADDRESS_DATE		0x04
 #define ADDRESS_MONTH		0x05
 #define ADDRESS_YEAR		0x06
+#define ADDRESS_CONTROL		0x0E
+
+// EVQ_RTC_SEC arg from the SQW edge (stop.c): the second is not read yet
+#define DS3231_SEC_UNREAD	0xFF
 
 extern uint8_t ds3231_hours;
 extern uint8_t ds3231_min;
@@ -26,12 +31,14 @@ extern uint8_t ds3231_date;
 extern uint8_t ds3231_day;
 extern uint8_t ds3231_month;
 extern uint8_t ds3231_year;
+extern evq_Queue_t ds3231_events;
 
 void ds3231_init();
 
 void ds3231_Write(uint8_t address, uint8_t value);
 
 void ds3231_ReadTime();
+void ds3231_SquareWave();
 
 #endif /* INC_DS3231_H_ */
 
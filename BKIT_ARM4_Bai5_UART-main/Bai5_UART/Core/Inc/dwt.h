@@ -0,0 +1,30 @@
+/*
+ * dwt.h
+ *
+ *  DWT cycle counter: free-running HCLK cycles since dwt_init()
+ */
+
+#ifndef INC_DWT_H_
+#define INC_DWT_H_
+
+#include "main.h"
+
+#ifdef HOST_SIM
+// host_sim: virtual cycles from simulated time and modelled bus time
+uint32_t sim_Cycles(void);
+#define dwt_init()		((void)0)
+#define dwt_Cycles()	sim_Cycles()
+#else
+// Starts the counter once; later calls leave it running so one user does
+// not throw off the spans another one has open
+static inline void dwt_init(void)
+{
+	if(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) return;
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+#define dwt_Cycles()	(DWT->CYCCNT)
+#endif
+
+#endif /* INC_DWT_H_ */
@@ -0,0 +1,70 @@
+/*
+ * gov.h
+ *
+ *  Clock governor: HCLK down to GOV_IDLE between render bursts, back to
+ *  what SystemClock_Config() set for them
+ *
+ *  The PLL keeps running at 168MHz and only the AHB/APB prescalers move, so
+ *  a switch takes microseconds instead of a PLL relock. Every switch
+ *  re-derives what counts on the bus clocks: the TIM1/TIM2 (and TIM7 with
+ *  PCS_ENABLE) prescalers, the USART1 baud rate, I2C1's timing, the SPI1
+ *  prescaler and SysTick, each keeping the rate it had at gov_init().
+ *  FSMC timings are in HCLK cycles and only get longer in ns, DMA2 runs on
+ *  HCLK as it is.
+ *
+ *  The DWT counts HCLK cycles, so with GOV_ENABLE the cycle tables (prof,
+ *  loop, isr, sched, kernel, idle share) are only comparable for spans
+ *  that stay inside one burst. The governor's own figures are in TIM2 us.
+ */
+
+#ifndef INC_GOV_H_
+#define INC_GOV_H_
+
+#include "main.h"
+
+// 1 = timer2_Wait() and the kernel's idle thread drop to GOV_IDLE, the FSM
+// pass (render burst) ramps back up; 0 = HCLK stays at 168MHz
+#ifndef GOV_ENABLE
+#define GOV_ENABLE		0
+#endif
+
+#if GOV_ENABLE && defined(HOST_SIM)
+#error "GOV_ENABLE switches the RCC prescalers, host_sim has none"
+#endif
+
+// Idle: SYSCLK/8 = 21MHz on AHB and both APBs, so the timers still get a
+// whole number of MHz for their 1us counts and flash needs no wait state
+#define GOV_IDLE_AHB		RCC_SYSCLK_DIV8
+#define GOV_IDLE_APB1		RCC_HCLK_DIV1
+#define GOV_IDLE_APB2		RCC_HCLK_DIV1
+#define GOV_IDLE_LATENCY	FLASH_LATENCY_0		// 0WS up to 30MHz at 2.7-3.6V
+
+#define GOV_CMD			"gov"	// USART1 line that prints the table; "gov reset" also clears it
+
+typedef enum {
+	GOV_FULL,
+	GOV_IDLE,
+	GOV_COUNT
+} gov_Level_t;
+
+#if GOV_ENABLE
+void gov_init();
+void gov_Set(uint8_t level);
+uint8_t gov_Level();
+void gov_Request(uint8_t reset);
+void gov_Poll();
+void gov_Report();
+#define gov_Idle()		gov_Set(GOV_IDLE)
+#define gov_Boost()		gov_Set(GOV_FULL)
+#else
+#define gov_init()			((void)0)
+#define gov_Set(level)		((void)0)
+#define gov_Level()			GOV_FULL
+#define gov_Request(reset)	((void)0)
+#define gov_Poll()			((void)0)
+#define gov_Report()		((void)0)
+#define gov_Idle()			((void)0)
+#define gov_Boost()			((void)0)
+#endif
+
+#endif /* INC_GOV_H_ */
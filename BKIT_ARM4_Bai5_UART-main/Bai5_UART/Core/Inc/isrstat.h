@@ -0,0 +1,61 @@
+/*
+ * isrstat.h
+ *
+ *  Interrupt timing: how long each handler runs, not counting the ones
+ *  that preempt it, and how late it starts after its event
+ */
+
+#ifndef INC_ISRSTAT_H_
+#define INC_ISRSTAT_H_
+
+#include "main.h"
+
+// 1 = time the handlers in stm32f4xx_it.c and bh.c; 0 = the calls compile to nothing
+#ifndef ISR_STATS
+#define ISR_STATS		0
+#endif
+
+#define ISR_DEPTH		8			// nested handlers at once, at most
+#define ISR_CMD			"isr"		// USART1 line that prints the table; "isr reset" also clears it
+
+typedef enum {
+	ISR_USART1,
+	ISR_TIM2,
+	ISR_DMA,
+	ISR_BH,
+	ISR_SYSTICK,
+	ISR_COUNT
+} isr_Source_t;
+
+typedef struct {
+	uint32_t count;
+	uint32_t self_max;			// cycles in the handler itself, worst
+	uint64_t self_sum;
+	uint32_t lat_max;			// cycles from the event to the handler, worst
+	uint32_t lat_count;			// entries with a known event time
+	uint32_t lost;				// events the handler came too late for
+} isr_Stats_t;
+
+#if ISR_STATS
+extern isr_Stats_t isr_stats[ISR_COUNT];
+
+void isr_init();
+void isr_Enter();
+void isr_Exit(uint8_t src);
+void isr_Latency(uint8_t src, uint32_t cycles);
+void isr_Lost(uint8_t src);
+void isr_Request(uint8_t reset);
+void isr_Poll();
+void isr_Report();
+#else
+#define isr_init()					((void)0)
+#define isr_Enter()					((void)0)
+#define isr_Exit(src)				((void)0)
+#define isr_Latency(src, cycles)	((void)0)
+#define isr_Lost(src)				((void)0)
+#define isr_Request(reset)			((void)0)
+#define isr_Poll()					((void)0)
+#define isr_Report()				((void)0)
+#endif
+
+#endif /* INC_ISRSTAT_H_ */
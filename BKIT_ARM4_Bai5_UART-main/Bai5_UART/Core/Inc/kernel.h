@@ -0,0 +1,118 @@
+/*
+ * kernel.h
+ *
+ *  Small preemptive kernel: fixed-priority threads switched by PendSV,
+ *  counting semaphores and message queues, timeouts on the SysTick ms
+ */
+
+#ifndef INC_KERNEL_H_
+#define INC_KERNEL_H_
+
+#include "main.h"
+
+// 1 = main.c runs the app as the input, UART, render and RTC threads
+// below; 0 = the 50ms super-loop, as before
+#ifndef KERNEL_ENABLE
+#define KERNEL_ENABLE	0
+#endif
+
+#define K_MAX_THREADS	8			// priorities 0 (runs first) to 7, one thread each
+#define K_PRIO_IDLE		(K_MAX_THREADS - 1)
+#define K_FOREVER		0xFFFFFFFFUL
+#define K_STACK_FILL	0xA5A5A5A5UL	// unused stack words, for the high-water mark
+#define KERNEL_CMD		"kernel"	// USART1 line that prints the thread table; "kernel reset" also clears it
+
+// Thread periods in main.c
+#define KERNEL_INPUT_MS	50			// button scan, then one render pass
+#define KERNEL_RTC_MS	1000		// DS3231 read; the time rows can show a second up to this late
+#define KERNEL_UART_MS	50			// the UART thread also wakes this often to re-arm the receiver
+
+// Thread stack, 8-byte aligned as the exception frame wants
+#define K_STACK(name, words)	static uint32_t name[words] __attribute__((aligned(8)))
+
+typedef void (*k_Fn_t)(void *arg);
+
+typedef struct {
+	uint32_t *sp;				// saved stack pointer: first member, the port relies on it
+	const char *name;
+	k_Fn_t entry;
+	void *arg;
+	uint32_t *stack;
+	uint16_t stack_words;
+	uint8_t prio;
+	uint8_t timed;				// 1 while blocked with a timeout
+	uint8_t waited;				// blocked in the kernel, not yet back from it
+	uint32_t wake;				// k_ticks at which that timeout ends
+	uint32_t *waitset;			// waiter bits of the object it is blocked on, NULL if none
+	uint32_t runs;				// times switched in
+	uint64_t cycles;			// DWT cycles spent running
+} k_Thread_t;
+
+typedef struct {
+	uint16_t count;
+	uint16_t max;
+	uint32_t waiting;			// one bit per priority blocked in k_SemTake()
+} k_Sem_t;
+
+#define K_SEM_INIT(count, max)	{ (count), (max), 0 }
+
+typedef struct {
+	uint8_t *buf;				// depth messages of size bytes
+	uint16_t size;
+	uint16_t depth;
+	uint16_t head;
+	uint16_t count;
+	uint16_t high;				// most messages ever queued at once
+	uint32_t drops;				// k_QueuePut() calls that gave up on a full queue
+	uint32_t getters;			// priorities blocked on an empty queue
+	uint32_t putters;			// priorities blocked on a full one
+} k_Queue_t;
+
+#define K_QUEUE_INIT(buf, size, depth)	{ (uint8_t*)(buf), (size), (depth), 0, 0, 0, 0, 0, 0 }
+
+#if KERNEL_ENABLE
+extern k_Thread_t *volatile k_cur;
+extern volatile uint32_t k_ticks;
+
+int8_t k_Create(k_Thread_t *t, const char *name, uint8_t prio, k_Fn_t entry, void *arg, uint32_t *stack, uint16_t words);
+void k_Start();
+void k_Tick();
+void k_Sleep(uint32_t ms);
+void k_SleepUntil(uint32_t *last, uint32_t period_ms);
+int8_t k_SemTake(k_Sem_t *s, uint32_t ms);
+void k_SemGive(k_Sem_t *s);
+int8_t k_QueuePut(k_Queue_t *q, const void *msg, uint32_t ms);
+int8_t k_QueueGet(k_Queue_t *q, void *msg, uint32_t ms);
+void k_Request(uint8_t reset);
+void k_Poll();
+void k_Report();
+
+/* Kernel internals shared with the port (kernel_port.c, host_sim/kernel_host.c) */
+uint32_t *k_Switch(uint32_t *sp);
+void k_Trampoline(k_Thread_t *t);
+uint32_t *k_PortStack(k_Thread_t *t);
+void k_PortStart();
+void k_PortPend();
+void k_PortIdle();
+
+#ifdef HOST_SIM
+uint32_t k_PortLock();
+void k_PortUnlock(uint32_t pm);
+#else
+static inline uint32_t k_PortLock(){
+	uint32_t pm = __get_PRIMASK();
+	__disable_irq();
+	return pm;
+}
+// A PendSV pended inside the section is taken here
+#define k_PortUnlock(pm)	__set_PRIMASK(pm)
+#endif
+
+#else
+#define k_Tick()				((void)0)
+#define k_Request(reset)		((void)0)
+#define k_Poll()				((void)0)
+#define k_Report()				((void)0)
+#endif
+
+#endif /* INC_KERNEL_H_ */
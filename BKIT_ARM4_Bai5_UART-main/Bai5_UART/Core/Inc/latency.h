@@ -0,0 +1,44 @@
+/*
+ * latency.h
+ *
+ *  Key-to-pixel latency probe: DWT timestamps from the SW3 edge in
+ *  button_Scan() to the end of the main loop pass that redrew the field
+ */
+
+#ifndef INC_LATENCY_H_
+#define INC_LATENCY_H_
+
+#include "main.h"
+
+// 1 = probe SW3 in the set-time and set-alarm modes. Needs LCD_WINDOW_HOOK=1.
+#ifndef LAT_ENABLE
+#define LAT_ENABLE		0
+#endif
+
+#define LAT_KEY			3		// SW3, BTN_UP in clock_fsm.c
+#define LAT_DUMP_KEY	14		// button that prints the table (no FSM uses it)
+
+// Hops of one sample
+typedef enum {
+	LAT_EDGE_FSM,		// button_Scan() saw the edge -> FSM acted on it
+	LAT_FSM_DRAW,		// -> first LCD window over the field
+	LAT_DRAW_FRAME,		// -> end of the pass
+	LAT_TOTAL,			// edge -> end of the pass
+	LAT_HOPS
+} lat_Hop_t;
+
+#if LAT_ENABLE
+void lat_init();
+void lat_Key(uint16_t count);
+void lat_Handled(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+void lat_EndPass();
+void lat_Report();
+#else
+#define lat_init()				((void)0)
+#define lat_Key(count)			((void)0)
+#define lat_Handled(x, y, w, h)	((void)0)
+#define lat_EndPass()			((void)0)
+#define lat_Report()			((void)0)
+#endif
+
+#endif /* INC_LATENCY_H_ */
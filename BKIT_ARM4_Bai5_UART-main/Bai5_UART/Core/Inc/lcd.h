@@ -33,6 +33,19 @@
 #define D2U_L2R  0xa0
 #define D2U_R2L  0xe0
 
+// Draw into a frame store in external SRAM (sram.c) and let lcd_Display()
+// push it to the panel by DMA. 0 = draw straight to the panel.
+#ifndef LCD_USE_FRAMEBUFFER
+#define LCD_USE_FRAMEBUFFER	0
+#endif
+// 1 = lcd_Display() only sends rows drawn since the previous call
+#ifndef LCD_FB_DIRTY_ROWS
+#define LCD_FB_DIRTY_ROWS	1
+#endif
+#define LCD_FB_DMA_PRIO	3			// flush transfer complete (DMA2 in the plan of bh.h)
+#define LCD_FB_WIDTH	240
+#define LCD_FB_HEIGHT	320
+
 
 typedef struct
 {
@@ -42,6 +55,33 @@ typedef struct
 }_lcd_dev;
 
 extern _lcd_dev lcddev;
+
+// 1 = count bus cycles in lcd_bus (bench.c reads and clears it)
+#ifndef LCD_BUS_STATS
+#define LCD_BUS_STATS	0
+#endif
+
+typedef struct
+{
+	uint32_t reg;		// command writes
+	uint32_t data;		// data writes, pixels included
+	uint32_t windows;	// column/page address setups
+	uint32_t pixels;	// data writes after 0x2C/0x3C
+}_lcd_bus;
+
+#if LCD_BUS_STATS
+extern _lcd_bus lcd_bus;
+#endif
+
+// 1 = lcd_AddressSet passes every window to lcd_WindowHook(), which the
+// application provides (latency.c)
+#ifndef LCD_WINDOW_HOOK
+#define LCD_WINDOW_HOOK	0
+#endif
+
+#if LCD_WINDOW_HOOK
+void lcd_WindowHook(uint16_t x1,uint16_t y1,uint16_t x2,uint16_t y2);
+#endif
 typedef struct
 {
 	__IO uint16_t LCD_REG;
@@ -50,6 +90,12 @@ typedef struct
 
 #define LCD_BASE        ((uint32_t)(0x60000000 | 0x000ffffe))
 #define LCD             ((LCD_TypeDef *) LCD_BASE)
+#ifdef HOST_SIM
+// Host build: the bus goes to the ILI9341 model in host_sim/ili9341.c
+void ili9341_WriteReg(uint16_t reg);
+void ili9341_WriteData(uint16_t data);
+uint16_t ili9341_ReadData(void);
+#endif
 //////////////////////////////////////////////////////////////////////////////////
 
 
@@ -87,6 +133,9 @@ void lcd_SetCursor(uint16_t x,uint16_t y);
 void lcd_AddressSet(uint16_t x1,uint16_t y1,uint16_t x2,uint16_t y2);
 void lcd_DisplayOn(void);
 void lcd_DisplayOff(void);
+void lcd_PartialArea(uint16_t y1,uint16_t y2);
+void lcd_NormalMode(void);
+void lcd_IdleMode(uint8_t on);
 uint16_t lcd_ReadPoint(uint16_t x,uint16_t y);
 void lcd_Clear(uint16_t color);
 
@@ -110,4 +159,17 @@ void lcd_ShowStr(uint16_t x, uint16_t y,uint8_t *str,uint16_t fc, uint16_t bc,ui
 void lcd_StrCenter(uint16_t x, uint16_t y,uint8_t *str,uint16_t fc,uint16_t bc,uint8_t sizey,uint8_t mode);
 
 void lcd_ShowBackground();
+
+void lcd_Display(void);
+uint8_t lcd_DisplayBusy(void);
+void lcd_Invalidate(void);
+
+#if LCD_USE_FRAMEBUFFER && defined(HOST_SIM)
+// host_sim: 1 = a flush stops after each chunk until lcd_FbDmaIrq() plays
+// its transfer complete interrupt (0 = the whole flush inside lcd_Display()),
+// and lcd_fb_pixel_hook runs after each pixel drawn into the frame store
+extern uint8_t lcd_fb_async;
+extern void (*lcd_fb_pixel_hook)(void);
+void lcd_FbDmaIrq(void);
+#endif
 #endif /* INC_LCD_H_ */
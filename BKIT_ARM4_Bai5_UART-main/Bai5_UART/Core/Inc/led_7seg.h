@@ -12,6 +12,7 @@
 
 void led7_init();
 void led7_Scan();
+void led7_Blank();
 void led7_SetDigit(int num, int position, uint8_t show_dot);
 void led7_SetColon(uint8_t status);
 void led_On(uint8_t index);
@@ -0,0 +1,48 @@
+/*
+ * loopstat.h
+ *
+ *  Main loop timing: how long each 50ms pass runs, how late it starts
+ *  after TIM2 set flag_timer2, and how many passes overran
+ */
+
+#ifndef INC_LOOPSTAT_H_
+#define INC_LOOPSTAT_H_
+
+#include "main.h"
+
+// 1 = keep the histograms; 0 = the calls compile to nothing
+#ifndef LOOP_STATS
+#define LOOP_STATS		0
+#endif
+
+#define LOOP_PERIOD_MS	50		// setTimer2() in main.c
+#define LOOP_CMD		"loop"	// USART1 line that prints the histograms; "loop reset" also clears them
+#define LOOP_DUMP_KEY	12		// button that prints them where there is no USART
+
+typedef struct {
+	uint32_t passes;
+	uint32_t overruns;			// passes that ran longer than LOOP_PERIOD_MS
+	uint32_t exec_max_us, late_max_us;
+	uint32_t exec[64];			// run time, 1 ms buckets; the last one holds the rest
+	uint32_t late[24];			// start jitter: bucket b >= 1 holds [2^(b-1), 2^b) us
+} loop_Stats_t;
+
+#if LOOP_STATS
+extern loop_Stats_t loop_stats;
+
+void loop_init();
+void loop_Start();
+void loop_End();
+void loop_Request(uint8_t reset);
+void loop_Poll();
+void loop_Report();
+#else
+#define loop_init()			((void)0)
+#define loop_Start()		((void)0)
+#define loop_End()			((void)0)
+#define loop_Request(reset)	((void)0)
+#define loop_Poll()			((void)0)
+#define loop_Report()		((void)0)
+#endif
+
+#endif /* INC_LOOPSTAT_H_ */
@@ -0,0 +1,34 @@
+/*
+ * pcsamp.h
+ *
+ *  Statistical PC sampler: TIM7 interrupts the CPU a couple of thousand
+ *  times a second and counts the PC it interrupted, HAL busy-waits and
+ *  interrupt handlers included. host_sim/pcsamp.py turns the dump into
+ *  function names with the .elf, .map or .list of the same build.
+ */
+
+#ifndef INC_PCSAMP_H_
+#define INC_PCSAMP_H_
+
+#include "main.h"
+
+// 1 = sample from pcs_init() on; 0 = the calls compile to nothing
+#ifndef PCS_ENABLE
+#define PCS_ENABLE		0
+#endif
+
+#define PCS_PERIOD_US	487		// prime, so samples drift across the 1ms and 50ms ticks
+#define PCS_SLOTS		1024	// distinct PCs kept; power of two
+#define PCS_CMD			"pcs"	// USART1 line that dumps the counts; "pcs reset" also clears them
+
+#if PCS_ENABLE
+void pcs_init();
+void pcs_Request(uint8_t reset);
+void pcs_Poll();
+#else
+#define pcs_init()			((void)0)
+#define pcs_Request(reset)	((void)0)
+#define pcs_Poll()			((void)0)
+#endif
+
+#endif /* INC_PCSAMP_H_ */
@@ -0,0 +1,66 @@
+/*
+ * prof.h
+ *
+ *  Named-zone cycle profiler on the DWT cycle counter
+ *
+ *  PROF_ZONE("name"); after the declarations of a block times the rest of
+ *  that block: calls, min/max/total cycles including nested zones, and self
+ *  cycles with the nested zones taken out. Zones link themselves into the
+ *  table the first time they run. Main loop context only, never from an
+ *  interrupt.
+ */
+
+#ifndef INC_PROF_H_
+#define INC_PROF_H_
+
+#include "main.h"
+
+// 1 = PROF_ZONE() times its block; 0 = zones and calls compile to nothing
+#ifndef PROF_ENABLE
+#define PROF_ENABLE		0
+#endif
+
+#define PROF_DEPTH		8		// deeper zones are not timed, only counted
+#define PROF_CMD		"prof"	// USART1 line that prints the table; "prof reset" also clears it
+#define PROF_DUMP_KEY	13		// button that prints the table (no FSM uses it)
+
+typedef struct prof_Zone {
+	const char *name;
+	struct prof_Zone *next;
+	struct prof_Zone *parent;	// enclosing zone of the last call, NULL at top level
+	uint8_t linked;
+	uint32_t calls;
+	uint32_t min, max;
+	uint64_t total, self;
+} prof_Zone_t;
+
+typedef struct {
+	prof_Zone_t *zone;			// NULL when nested too deep
+	uint32_t start;
+} prof_Frame_t;
+
+#if PROF_ENABLE
+#define PROF_CAT_(a, b)		a##b
+#define PROF_CAT(a, b)		PROF_CAT_(a, b)
+// The frame is closed by the cleanup attribute when the block is left, on
+// any path out of it
+#define PROF_ZONE(name) \
+	static prof_Zone_t PROF_CAT(prof_zone_, __LINE__) = {name}; \
+	prof_Frame_t PROF_CAT(prof_frame_, __LINE__) __attribute__((cleanup(prof_Leave))) = \
+		prof_Enter(&PROF_CAT(prof_zone_, __LINE__))
+
+prof_Frame_t prof_Enter(prof_Zone_t *zone);
+void prof_Leave(prof_Frame_t *frame);
+void prof_init();
+void prof_Request(uint8_t reset);
+void prof_Poll();
+void prof_Report();
+#else
+#define PROF_ZONE(name)			((void)0)
+#define prof_init()				((void)0)
+#define prof_Request(reset)		((void)0)
+#define prof_Poll()				((void)0)
+#define prof_Report()			((void)0)
+#endif
+
+#endif /* INC_PROF_H_ */
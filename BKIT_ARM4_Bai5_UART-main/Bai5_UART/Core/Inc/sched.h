@@ -0,0 +1,72 @@
+/*
+ * sched.h
+ *
+ *  Cooperative multi-rate scheduler: tasks registered with a period, a
+ *  phase offset and a priority run to completion off the 1ms tick, and
+ *  each keeps its own deadline misses and run time
+ */
+
+#ifndef INC_SCHED_H_
+#define INC_SCHED_H_
+
+#include "main.h"
+
+// 1 = main.c runs the task table below every 1ms tick; 0 = the 50ms
+// super-loop, as before
+#ifndef SCHED_ENABLE
+#define SCHED_ENABLE	0
+#endif
+
+#define SCHED_TICK_MS	1		// setTimer2() with the scheduler
+#define SCHED_MAX_TASKS	8
+#define SCHED_CMD		"sched"	// USART1 line that prints the task table; "sched reset" also clears it
+
+// Task periods in main.c. The FSM and the buttons stay at 50ms: their
+// counters (button_count, LONG_PRESS_DURATION, blink, timeouts) count in
+// those periods. The time rows can show a second up to SCHED_RTC_MS late.
+#ifndef SCHED_UART_MS
+#define SCHED_UART_MS	5
+#endif
+#ifndef SCHED_RTC_MS
+#define SCHED_RTC_MS	1000
+#endif
+#define SCHED_FSM_MS	50
+
+typedef void (*sched_Fn_t)(void);
+
+typedef struct {
+	const char *name;
+	sched_Fn_t run;
+	uint16_t period_ms;
+	uint16_t phase_ms;			// first release, ms after sched_Start()
+	uint8_t prio;				// 0 runs first when several are due
+	uint32_t release;			// HAL_GetTick() of the pending release
+	uint32_t runs;
+	uint32_t misses;			// releases that came while the previous one was still pending
+	uint32_t late_max_ms;		// start after release
+	uint32_t run_max_us;
+	uint64_t run_cycles;
+} sched_Task_t;
+
+#if SCHED_ENABLE
+extern sched_Task_t sched_tasks[SCHED_MAX_TASKS];
+extern uint8_t sched_count;
+extern uint16_t sched_elapsed;	// releases the running task stands for: 1, more after misses
+
+void sched_init();
+int8_t sched_Add(const char *name, sched_Fn_t run, uint16_t period_ms, uint16_t phase_ms, uint8_t prio);
+void sched_Start();
+void sched_Run();
+void sched_Request(uint8_t reset);
+void sched_Poll();
+void sched_Report();
+#else
+#define sched_init()			((void)0)
+#define sched_Start()			((void)0)
+#define sched_Run()				((void)0)
+#define sched_Request(reset)	((void)0)
+#define sched_Poll()			((void)0)
+#define sched_Report()			((void)0)
+#endif
+
+#endif /* INC_SCHED_H_ */
@@ -10,9 +10,61 @@
 
 #include "tim.h"
 
-extern uint16_t flag_timer2;
+// 1 = timer2_elapsed counts every period since the last pass, for code
+// that counts passes and has to keep up after an overrun; 0 = it is always
+// 1. The FSMs time with timer_wheel.c, which keeps up on its own.
+#ifndef TIMER2_CATCH_UP
+#define TIMER2_CATCH_UP	0
+#endif
+
+// 1 = timer2_Wait() sleeps in WFI until the next interrupt; 0 = it spins
+#ifndef TIMER2_WFI
+#define TIMER2_WFI		1
+#endif
+
+// timer2_idle counts the time in WFI alone, stamped before the handler that
+// ended it runs; a spin is preempted by the handlers, which count as idle
+#if TIMER2_WFI
+#define TIMER2_IDLE_NOTE	""
+#else
+#define TIMER2_IDLE_NOTE	" incl. irqs"
+#endif
+
+// 1 = TIM2 runs free at 1MHz and only interrupts at the next deadline
+// (compare channel 1: the end of the setTimer2() period or the next
+// timer_wheel.c expiry, whichever is first); 0 = it interrupts every 1ms
+#ifndef TIMER2_TICKLESS
+#define TIMER2_TICKLESS	0
+#endif
+
+// Tickless: ms between led7_Scan() calls on compare channel 2. The clock
+// does not use the 7-segment display, so by default it is blanked once and
+// not scanned
+#ifndef TIMER2_SCAN_MS
+#define TIMER2_SCAN_MS	0
+#endif
+
+#define TIMER2_CNT_PER_MS	1000	// tickless counter rate: 1us
+
+extern volatile uint16_t flag_timer2;
+extern uint16_t timer2_missed;		// periods that ran out while flag_timer2 was still set
+extern uint32_t timer2_stamp;		// DWT cycles when flag_timer2 was last set
+extern uint16_t timer2_elapsed;		// periods the current main loop pass stands for
+extern uint16_t timer2_idle;		// share of the last second asleep waiting for flag_timer2, 0.1% steps
+extern uint32_t timer2_irqs;		// TIM2 interrupts taken
+extern uint16_t timer2_rate;		// TIM2 interrupts per second over the last second
 
 void timer_init();
 void setTimer2(uint16_t duration);
+uint16_t timer2_Take();
+void timer2_Wait();
+void timer2_Idle(uint32_t since);
+uint32_t timer2_Us();
+uint32_t timer2_Latency();
+#if TIMER2_TICKLESS
+void timer2_Wheel();
+#else
+#define timer2_Wheel()	((void)0)
+#endif
 
 #endif /* INC_SOFTWARE_TIMER_H_ */
@@ -0,0 +1,89 @@
+/*
+ * stop.h
+ *
+ *  STOP mode on a quiet clock screen: the MCU sleeps with its clocks off
+ *  and wakes once a second on the DS3231's square wave, on a key or on a
+ *  USART1 start bit
+ */
+
+#ifndef INC_STOP_H_
+#define INC_STOP_H_
+
+#include "main.h"
+#include "software_timer.h"
+
+// 1 = stop_Wait() enters STOP instead of waiting for TIM2 while the clock
+// shows the plain time screen with the display idle; 0 = it is timer2_Wait()
+#ifndef STOP_ENABLE
+#define STOP_ENABLE		0
+#endif
+
+#if STOP_ENABLE && defined(HOST_SIM)
+#error "STOP_ENABLE stops the MCU's clocks, host_sim has none"
+#endif
+
+// Wake lines, each on its falling edge, and the EXTI vector of each; stop.c
+// has the handlers, CubeMX must not enable these EXTI lines. The DS3231's
+// INT/SQW (open drain, pulled up here) is not wired on the BKIT board:
+// connect it to the X0 input terminal, or point these at the pin it is on
+#define STOP_SQW_GPIO_Port	INPUT_X0_GPIO_Port
+#define STOP_SQW_Pin		INPUT_X0_Pin
+#define STOP_SQW_IRQn		EXTI9_5_IRQn
+// SPI1 MISO: with BTN_LOAD held low the 74HC165 chain's serial output
+// follows the input button_Scan() reads first, key 12 (BTN_SAVE_NEXT).
+// The other keys are seen when held across a 1Hz wake
+#define STOP_KEY_GPIO_Port	GPIOB
+#define STOP_KEY_Pin		GPIO_PIN_4
+#define STOP_KEY_IRQn		EXTI4_IRQn
+// USART1 RX: the start bit of the first byte; that byte is lost
+#define STOP_RX_GPIO_Port	GPIOA
+#define STOP_RX_Pin			GPIO_PIN_10
+#define STOP_RX_IRQn		EXTI15_10_IRQn
+
+#define STOP_PRIO			4			// EXTI wake handlers, below DMA2 in the plan of bh.h
+#define STOP_REGULATOR		PWR_LOWPOWERREGULATOR_ON
+// TIM1 stops too, so STOP forces the backlight pin: 0 = off, the time is
+// only lit in the pass after each wake; 1 = full on, at STOP_IDD_BACKLIGHT_UA
+// on top of the MCU's STOP_IDD_STOP_UA, for a clock that has to stay
+// readable. Opt in with -DSTOP_BACKLIGHT=1
+#ifndef STOP_BACKLIGHT
+#define STOP_BACKLIGHT		0
+#endif
+#define STOP_UART_HOLD_MS	10000		// awake after a UART wake, for the rest of the line and a few more
+// USART1 line that prints the table; "stop reset" also clears it. From
+// STOP, send a line end first: its byte wakes the MCU and is lost
+#define STOP_CMD			"stop"
+
+// MCU supply current for the estimate; typical STM32F407 figures at 25C,
+// replace them with what the IDD jumper shows on the board
+#define STOP_IDD_RUN_UA		87000		// run, 168MHz from flash, peripherals on
+#define STOP_IDD_STOP_UA	450			// STOP, low-power regulator, flash in STOP
+#define STOP_IDD_BACKLIGHT_UA	60000	// the panel's LED string held full on, 3.3V rail
+
+typedef enum {
+	STOP_WAKE_RTC,
+	STOP_WAKE_KEY,
+	STOP_WAKE_UART,
+	STOP_WAKE_OTHER,				// an interrupt was pending, WFI did not stop
+	STOP_WAKES
+} stop_Wake_t;
+
+#if STOP_ENABLE
+void stop_init();
+void stop_Wait();
+uint8_t stop_Woken();
+void stop_Drawn();
+void stop_Request(uint8_t reset);
+void stop_Poll();
+void stop_Report();
+#else
+#define stop_init()			((void)0)
+#define stop_Wait()			timer2_Wait()
+#define stop_Woken()		0
+#define stop_Drawn()		((void)0)
+#define stop_Request(reset)	((void)0)
+#define stop_Poll()			((void)0)
+#define stop_Report()		((void)0)
+#endif
+
+#endif /* INC_STOP_H_ */
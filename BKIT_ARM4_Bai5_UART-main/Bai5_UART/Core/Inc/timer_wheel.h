@@ -0,0 +1,46 @@
+/*
+ * timer_wheel.h
+ *
+ *  Software timers on a hierarchical timing wheel driven by the 1ms TIM2
+ *  interrupt: one-shot or periodic, with a callback or an event count,
+ *  O(1) start, stop and expiry however many are running
+ */
+
+#ifndef INC_TIMER_WHEEL_H_
+#define INC_TIMER_WHEEL_H_
+
+#include "main.h"
+
+#define TW_BITS		6
+#define TW_SLOTS	(1 << TW_BITS)
+#define TW_LEVELS	4			// 64ms, 4s, 4.4min and 4.6h per turn; longer timers go round again
+
+typedef void (*tw_Fn_t)(void *arg);
+
+typedef struct tw_Link {
+	struct tw_Link *next, *prev;
+} tw_Link_t;
+
+typedef struct {
+	tw_Link_t link;				// first member: the slot lists link timers through it
+	uint32_t expire;			// tick it fires at
+	uint32_t period;			// ms, 0 = one-shot
+	tw_Fn_t fn;					// NULL: only tw_Active() tells it has run out
+	void *arg;
+} tw_Timer_t;
+
+// Ticks counted by the TIM2 interrupt; tw_Run() catches up with it
+extern volatile uint32_t tw_ticks;
+
+#define tw_Tick()	(tw_ticks++)
+
+void tw_init();
+void tw_Start(tw_Timer_t *t, uint32_t ms, uint32_t period_ms, tw_Fn_t fn, void *arg);
+void tw_Stop(tw_Timer_t *t);
+uint8_t tw_Active(const tw_Timer_t *t);
+uint32_t tw_Left(const tw_Timer_t *t);
+uint8_t tw_NextDue(uint32_t *tick);
+void tw_Run();
+void tw_Post(void *arg);
+
+#endif /* INC_TIMER_WHEEL_H_ */
@@ -0,0 +1,56 @@
+/*
+ * trace.h
+ *
+ *  Input trace recorder: per 50ms main loop pass, the raw button word and,
+ *  where the project has them, USART1 RX bytes and DS3231 reads, kept in
+ *  RAM for replay in host_sim
+ */
+
+#ifndef INC_TRACE_H_
+#define INC_TRACE_H_
+
+#include "main.h"
+
+// 1 = the main loop, button_Scan(), the USART1 RX callback and
+// ds3231_ReadTime() record; 0 = the hooks compile to nothing
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE	0
+#endif
+
+#define TRACE_SIZE		8192	// two halves; a full half replaces the older one
+#define TRACE_DUMP_KEY	15		// button that prints the trace (no FSM uses it)
+
+/*
+ * Stream format, one tag byte then its payload:
+ *   0x81..0xBF  n = tag & 0x3F main loop passes; events that follow belong
+ *               to the last of them
+ *   0xC0        raw button word from SPI1, LSB first (only when it changes)
+ *   0xD1..0xDF  n = tag & 0x0F USART1 RX bytes follow
+ *   0xE0        the 7 time registers ds3231_ReadTime() got (when they change)
+ *   0xF0        start of a half: pass count (4, LSB first), button word (2)
+ *               and time registers (7) at that point
+ * Events before the first pass tag happened before the main loop.
+ */
+#define TRACE_TAG_PASS		0x80
+#define TRACE_TAG_BUTTONS	0xC0
+#define TRACE_TAG_RX		0xD0
+#define TRACE_TAG_RTC		0xE0
+#define TRACE_TAG_KEY		0xF0
+
+#if TRACE_ENABLE
+void trace_init();
+void trace_Tick();
+void trace_Buttons(uint16_t raw);
+void trace_Rx(uint8_t byte);
+void trace_Rtc(const uint8_t *regs);
+void trace_Dump();
+#else
+#define trace_init()		((void)0)
+#define trace_Tick()		((void)0)
+#define trace_Buttons(raw)	((void)0)
+#define trace_Rx(byte)		((void)0)
+#define trace_Rtc(regs)		((void)0)
+#define trace_Dump()		((void)0)
+#endif
+
+#endif /* INC_TRACE_H_ */
@@ -12,10 +12,23 @@
 
 #include "usart.h"
 #include "stdint.h"
+#include "kernel.h"
+#include "evq.h"
+#include "prof.h"
+#include "pcsamp.h"
+#include "loopstat.h"
+#include "sched.h"
+#include "isrstat.h"
+#include "gov.h"
+#include "stop.h"
 
 // Kích thước bộ đệm vòng (ring buffer)
 #define UART_BUFFER_SIZE 64
 
+// 1 = USART1 cũng nhận các lệnh báo cáo ("prof", "loop", "gov", ...) ngoài
+// chế độ cập nhật qua UART của FSM
+#define UART_CMD_ENABLE (PROF_ENABLE || PCS_ENABLE || LOOP_STATS || SCHED_ENABLE || KERNEL_ENABLE || EVQ_ENABLE || ISR_STATS || GOV_ENABLE || STOP_ENABLE)
+
 void uart_init_rs232(void);
 void uart_Rs232SendString(uint8_t* str);
 void uart_Rs232SendBytes(uint8_t* bytes, uint16_t size);
@@ -34,5 +47,10 @@ void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart);
 void uart_stop_listening(void);
 
 extern volatile uint8_t uart_rx_flag;
+extern evq_Queue_t uart_events; // EVQ_UART_LINE từ ngắt nhận, mỗi khi một dòng kết thúc
+
+#if KERNEL_ENABLE
+extern k_Sem_t uart_rx_sem; // được give mỗi byte nhận, luồng UART chờ trên nó
+#endif
 
 #endif /* INC_UART_H_ */
@@ -0,0 +1,194 @@
+/*
+ * bench.c
+ *
+ *  LCD bus-traffic benchmark for clock_fsm
+ *
+ *  bench_Run() replaces button_Scan() and the UART RX interrupt with a
+ *  script and drives clock_fsm_run() through view, set-time, set-alarm,
+ *  UART update and a ringing alarm, one 50ms tick at a time. lcd_bus is
+ *  cleared before every tick and added to the scenario afterwards, so each
+ *  scenario has the total and the worst tick for every counter.
+ *
+ *  The same code runs in host_sim (clock_bench) and on the board; rows
+ *  from bench_Report() have the format of host_sim/bench_baseline.txt.
+ */
+
+#include "bench.h"
+
+#if LCD_BENCH
+
+#if !LCD_BUS_STATS
+#error "LCD_BENCH needs LCD_BUS_STATS=1"
+#endif
+
+#include "software_timer.h"
+#include "timer_wheel.h"
+#include "button.h"
+#include "ds3231.h"
+#include "uart.h"
+#include "clock_fsm.h"
+#include <stdio.h>
+
+#ifdef HOST_SIM
+uint8_t sim_Wait(void);
+#endif
+
+// Same keys as clock_fsm.c
+#define BENCH_KEY_MODE		0
+#define BENCH_KEY_UP		3
+#define BENCH_KEY_SAVE		12
+
+extern uint8_t receive_buffer1;
+
+bench_Result_t bench_results[BENCH_MAX_SCENARIOS];
+uint8_t bench_count = 0;
+
+static bench_Result_t *bench_cur;
+static uint16_t bench_keys;		// keys held down, bit = button_count index
+
+static void bench_Begin(const char *name)
+{
+	if(bench_count == BENCH_MAX_SCENARIOS) return;
+	bench_cur = &bench_results[bench_count++];
+	memset(bench_cur, 0, sizeof(*bench_cur));
+	bench_cur->name = name;
+}
+
+static void bench_Max(uint32_t *peak, uint32_t v)
+{
+	if(v > *peak) *peak = v;
+}
+
+/**
+ * @brief One 50ms pass of the main loop with scripted input
+ */
+static void bench_Tick(void)
+{
+	uint8_t i;
+#ifdef HOST_SIM
+	sim_Wait();
+#else
+	while(!flag_timer2);
+	flag_timer2 = 0;
+#endif
+	tw_Run();
+	for(i = 0; i < 16; i++){
+		if(bench_keys & (1 << i)) button_count[i]++;
+		else button_count[i] = 0;
+	}
+	memset(&lcd_bus, 0, sizeof(lcd_bus));
+	uart_process_incoming_data();
+	clock_fsm_run();
+#if LCD_USE_FRAMEBUFFER
+	lcd_Display();			// only the flush reaches the bus
+#endif
+
+	bench_cur->ticks++;
+	bench_cur->total.reg += lcd_bus.reg;
+	bench_cur->total.data += lcd_bus.data;
+	bench_cur->total.windows += lcd_bus.windows;
+	bench_cur->total.pixels += lcd_bus.pixels;
+	bench_Max(&bench_cur->peak.reg, lcd_bus.reg);
+	bench_Max(&bench_cur->peak.data, lcd_bus.data);
+	bench_Max(&bench_cur->peak.windows, lcd_bus.windows);
+	bench_Max(&bench_cur->peak.pixels, lcd_bus.pixels);
+}
+
+static void bench_Ticks(uint16_t n)
+{
+	while(n--) bench_Tick();
+}
+
+// Hold a key for 2 ticks and release it (MODE acts on release)
+static void bench_Press(uint8_t key)
+{
+	bench_keys |= 1 << key;
+	bench_Ticks(2);
+	bench_keys &= ~(1 << key);
+	bench_Tick();
+}
+
+// Bytes as the RX interrupt would deliver them
+static void bench_Uart(const char *line)
+{
+	while(*line){
+		receive_buffer1 = *line++;
+		HAL_UART_RxCpltCallback(&huart1);
+	}
+}
+
+static void bench_Answer(const char *line)
+{
+	bench_Uart(line);
+	bench_Ticks(4);
+}
+
+/**
+ * @brief Run every scenario once, from the state after power-on
+ */
+void bench_Run(void)
+{
+	bench_count = 0;
+	bench_keys = 0;
+
+	bench_Begin("view");
+	bench_Ticks(40);
+
+	bench_Begin("set_time");
+	bench_Press(BENCH_KEY_MODE);
+	bench_Ticks(20);
+	bench_Press(BENCH_KEY_UP);
+	bench_Press(BENCH_KEY_SAVE);
+	bench_Ticks(20);
+
+	bench_Begin("set_alarm");
+	bench_Press(BENCH_KEY_MODE);
+	bench_Press(BENCH_KEY_SAVE);
+	bench_Press(BENCH_KEY_SAVE);
+	bench_Press(BENCH_KEY_UP);			// alarm on
+	bench_Ticks(20);
+
+	bench_Begin("uart_update");
+	bench_Press(BENCH_KEY_MODE);
+	bench_Ticks(4);
+	bench_Answer("5\r");
+	bench_Answer("59\r");
+	bench_Answer("30\r");
+	bench_Answer("Mon\r");
+	bench_Answer("1\r");
+	bench_Answer("1\r");
+	bench_Answer("25\r");
+
+	bench_Begin("message");
+	bench_Ticks(62);
+
+	// The alarm compares against the RTC at 06:00:00 (clock_fsm default)
+	ds3231_Write(ADDRESS_HOUR, 6);
+	ds3231_Write(ADDRESS_MIN, 0);
+	ds3231_Write(ADDRESS_SEC, 0);
+	bench_Begin("alarm");
+	bench_Ticks(40);
+	bench_Press(BENCH_KEY_UP);			// stop it
+}
+
+/**
+ * @brief Print one row per scenario on USART1
+ * @note  name ticks reg data windows pixels, then the same four per-tick peaks
+ */
+void bench_Report(void)
+{
+	char line[120];
+	uint8_t i;
+	bench_Result_t *r;
+	for(i = 0; i < bench_count; i++){
+		r = &bench_results[i];
+		sprintf(line, "clock %s %u %lu %lu %lu %lu %lu %lu %lu %lu\r\n", r->name, r->ticks,
+				(unsigned long)r->total.reg, (unsigned long)r->total.data,
+				(unsigned long)r->total.windows, (unsigned long)r->total.pixels,
+				(unsigned long)r->peak.reg, (unsigned long)r->peak.data,
+				(unsigned long)r->peak.windows, (unsigned long)r->peak.pixels);
+		uart_Rs232SendString((uint8_t*)line);
+	}
+}
+
+#endif /* LCD_BENCH */
@@ -0,0 +1,83 @@
+/*
+ * bh.c
+ *
+ *  Bottom halves
+ *
+ *  bh_Pend() sets the work's bit and pends BH_IRQn; the handler takes all
+ *  bits at once and runs their work in bh_Work_t order. Work pended again
+ *  while it runs sets its bit anew and the BH runs once more straight
+ *  after. Taking the bits masks interrupts for a few instructions, the
+ *  work itself runs with them on. The priority plan is in bh.h.
+ *
+ *  host_sim has no priorities: bh_Pend() runs the work at once, inside the
+ *  interrupt callback, as before.
+ */
+
+#include "bh.h"
+
+#if BH_ENABLE
+
+#include "dwt.h"
+#include "isrstat.h"
+#include "led_7seg.h"
+
+static void (*const bh_work[BH_COUNT])(void) = {
+	led7_Scan,					// BH_LED7
+};
+
+#ifdef HOST_SIM
+
+void bh_init()
+{
+}
+
+void bh_Pend(uint8_t work)
+{
+	bh_work[work]();
+}
+
+#else
+
+static volatile uint32_t bh_pending = 0;
+static uint32_t bh_stamp;					// DWT cycles at the first bh_Pend() since the last run
+
+void bh_init()
+{
+	dwt_init();
+	HAL_NVIC_SetPriority(BH_IRQn, BH_PRIO, 0);
+	HAL_NVIC_EnableIRQ(BH_IRQn);
+}
+
+/**
+ * @brief  From a handler above BH_PRIO: run work once they are all done
+ */
+void bh_Pend(uint8_t work)
+{
+	uint32_t pm = __get_PRIMASK();
+	__disable_irq();
+	if(bh_pending == 0) bh_stamp = dwt_Cycles();
+	bh_pending |= 1UL << work;
+	__set_PRIMASK(pm);
+	NVIC_SetPendingIRQ(BH_IRQn);
+}
+
+void HASH_RNG_IRQHandler(void)
+{
+	uint32_t work, stamp;
+	uint8_t i;
+	isr_Enter();
+	__disable_irq();
+	work = bh_pending;
+	stamp = bh_stamp;
+	bh_pending = 0;
+	__enable_irq();
+	if(work) isr_Latency(ISR_BH, dwt_Cycles() - stamp);
+	for(i = 0; i < BH_COUNT; i++){
+		if(work & (1UL << i)) bh_work[i]();
+	}
+	isr_Exit(ISR_BH);
+}
+
+#endif /* HOST_SIM */
+
+#endif /* BH_ENABLE */
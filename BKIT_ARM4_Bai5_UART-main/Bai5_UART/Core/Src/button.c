@@ -5,18 +5,25 @@
  *      Author: HaHuyen
  */
 #include "button.h"
+#include "trace.h"
+#include "latency.h"
+#include "prof.h"
 
 uint16_t button_count[16];
 uint16_t spi_button = 0x0000;
+evq_Queue_t button_events = EVQ_INIT("keys");
 
 void button_init(){
 	HAL_GPIO_WritePin(BTN_LOAD_GPIO_Port, BTN_LOAD_Pin, 1);
+	evq_Add(&button_events);
 }
 
 void button_Scan(){
+	  PROF_ZONE("button_Scan");
 	  HAL_GPIO_WritePin(BTN_LOAD_GPIO_Port, BTN_LOAD_Pin, 0);
 	  HAL_GPIO_WritePin(BTN_LOAD_GPIO_Port, BTN_LOAD_Pin, 1);
 	  HAL_SPI_Receive(&hspi1, (void*)&spi_button, 2, 10);
+	  trace_Buttons(spi_button);
 	  int button_index = 0;
 	  uint16_t mask = 0x8000;
 	  for(int i = 0; i < 16; i++){
@@ -29,12 +36,19 @@ void button_Scan(){
 		  } else {
 			  button_index = 23 - i;
 		  }
-		  if(spi_button & mask) button_count[button_index] = 0;
-		  else button_count[button_index]++;
+		  if(spi_button & mask){
+			  if(button_count[button_index]) evq_Put(&button_events, EVQ_KEY_UP, button_index, button_count[button_index]);
+			  button_count[button_index] = 0;
+		  } else {
+			  button_count[button_index]++;
+			  evq_Put(&button_events, (button_count[button_index] == 1) ? EVQ_KEY_DOWN : EVQ_KEY_HOLD,
+					  button_index, button_count[button_index]);
+		  }
 //		  if(spi_button & mask) button_count[i] = 0;
 //		  else button_count[i]++;
 		  mask = mask >> 1;
 	  }
+	  lat_Key(button_count[LAT_KEY]);
 }
 
 
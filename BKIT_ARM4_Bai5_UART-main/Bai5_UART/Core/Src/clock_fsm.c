@@ -16,6 +16,15 @@
 #include "ds3231.h"
 #include <stdio.h>
 #include "uart.h"
+#include "display_pm.h"
+#include "latency.h"
+#include "prof.h"
+#include "sched.h"
+#include "kernel.h"
+#include "timer_wheel.h"
+#include "evq.h"
+#include "gov.h"
+#include "stop.h"
 #include "stdlib.h"
 #include "string.h"
 
@@ -59,11 +68,36 @@ typedef enum {
 #define AUTO_INCREMENT_PERIOD 4 // 200ms
 
 // Hằng số cho Timeout/Retry/Reset
-#define UART_TIMEOUT_PERIOD 200 // 10 giây (200 * 50ms tick)
+#define UART_TIMEOUT_MS 10000   // 10 giây
 #define UART_MAX_RETRIES 3      // 1 lần gửi + 2 lần thử lại
-#define MESSAGE_DISPLAY_PERIOD 60 // 3 giây (60 * 50ms tick)
+#define MESSAGE_DISPLAY_MS 3000 // 3 giây
+#define ALARM_DISPLAY_MS 10000  // 10 giây
+#define BLINK_HALF_MS 250       // 2Hz: 250ms ON, 250ms OFF
 #define RESET_LONG_PRESS_DURATION 60 // 3 giây (60 * 50ms tick)
 
+// Periodic RTC reads. With the scheduler the "rtc" task refreshes ds3231_*
+// every SCHED_RTC_MS and the FSM uses what is there (the "rtc" thread every
+// KERNEL_RTC_MS with the kernel). Its reads drift against the RTC's
+// seconds, so the alarm matches in the first ALARM_SEC_WINDOW seconds of
+// the minute instead of second 0 only; alarm_fired_min keeps it from ringing
+// twice in that window. With the event queues the main loop
+// reads the RTC every pass and the FSM runs on the second changing; with
+// STOP_ENABLE too the SQW edge posts the second and the dispatch reads it.
+#if SCHED_ENABLE
+#define clock_ReadTime() ((void)0)
+#define ALARM_SEC_WINDOW (SCHED_RTC_MS / 1000 + 1)
+#elif KERNEL_ENABLE
+#define clock_ReadTime() ((void)0)
+#define ALARM_SEC_WINDOW (KERNEL_RTC_MS / 1000 + 1)
+#elif EVQ_ENABLE
+#define clock_ReadTime() ((void)0)
+#define ALARM_SEC_WINDOW 1
+#else
+#define clock_ReadTime() ds3231_ReadTime()
+#define ALARM_SEC_WINDOW 1
+#endif
+#define ALARM_NOT_FIRED 0xFFFF
+
 
 /* Private variables ---------------------------------------------------------*/
 // FSM state variables
@@ -79,15 +113,26 @@ static uint8_t alarm_hour = 6;
 static uint8_t alarm_min = 0;
 static uint8_t alarm_enabled = 0;
 static uint8_t alarm_triggered = 0;
-static uint16_t alarm_display_counter = 0;
+static uint16_t alarm_fired_min = ALARM_NOT_FIRED;	// hour*60+min of the last ring
+static tw_Timer_t alarm_display_timer;
 
 // 2Hz blink logic
-static uint16_t blink_counter = 0;
+static tw_Timer_t blink_timer;
 static uint8_t blink_flag = 0;
 
 // Day names lookup table
 const char* day_names[8] = {"", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
 
+#if LAT_ENABLE
+// Screen area of each field (size 24 font), for the latency probe
+typedef struct { uint16_t x, y, w; } Field_t;
+static const Field_t time_fields[] = {
+    {70, 100, 24}, {110, 100, 24}, {150, 100, 24},     // hour, min, sec
+    {20, 130, 36}, {70, 130, 24}, {110, 130, 24}, {150, 130, 24} // day, date, month, year
+};
+static const Field_t alarm_fields[] = { {110, 170, 24}, {150, 170, 24}, {20, 200, 36} };
+#endif
+
 // UART Update FSM variables
 static SetTimeParam_t uart_update_param = SET_HOUR;
 static uint8_t uart_data_requested = 0;
@@ -95,15 +140,45 @@ static uint8_t uart_data_requested = 0;
 static uint8_t uart_rx_buffer[UART_RX_BUFFER_SIZE];
 
 // Biến cho UART Timeout/Retry và Message Display
-static uint16_t uart_timeout_counter = 0;
+static tw_Timer_t uart_timeout_timer;
 static uint8_t uart_retry_count = 0;
-static uint16_t message_display_counter = 0;
+static tw_Timer_t message_display_timer;
 static uint8_t message_buffer[30];
 static uint16_t message_color = GREEN; // Biến lưu màu cho thông báo
 
 // Biến cho logic nút MODE (SỬA LỖI RESET)
 static uint16_t mode_btn_last_count = 0;
 
+// Event dispatch: the timers post to clock_timers when they run out, and
+// fsm_again asks for one more run when the FSM has work left that no
+// event will announce (a mode just entered, a UART request to send)
+enum { TIMER_BLINK, TIMER_ALARM, TIMER_MESSAGE, TIMER_UART };
+#if EVQ_ENABLE
+static evq_Queue_t clock_timers = EVQ_INIT("timers");
+static uint8_t fsm_again = 1;
+static void clock_timer_fired(void *arg);
+#define CLOCK_TIMER_FN clock_timer_fired
+// The FSM's inputs come from the events: key_count holds what the key
+// events said (DOWN 1, HOLD the scans so far, UP 0), sec_event that this
+// run took a new second. The *_fresh marks are events the FSM has not run
+// on yet; a second one for the same key or line runs it in between
+static uint16_t key_count[16];
+static uint16_t key_fresh = 0;
+static uint8_t line_fresh = 0;
+static uint8_t sec_event = 0;
+#define clock_NewSecond() sec_event
+#else
+#define CLOCK_TIMER_FN NULL
+#define key_count button_count
+#define clock_NewSecond() 1
+#endif
+
+// STOP mode (stop.h) sleeps only while the last run drew the plain time
+// screen; the run after a wake draws only the time digits that changed
+static uint8_t time_shown = 0;
+static uint8_t time_was_shown = 0;
+static uint8_t shown_hours, shown_min, shown_sec, shown_date;
+
 
 /* Private function prototypes -----------------------------------------------*/
 static void displayTime(void);
@@ -120,10 +195,33 @@ static void decrement_setting(void);
 static void increment_alarm_setting(void);
 static void decrement_alarm_setting(void);
 static void enter_message_display_mode(const char* lcd_msg, uint16_t color, const char* uart_msg);
+static uint8_t any_key_pressed(void);
 
 
 /* Function Implementation ---------------------------------------------------*/
 
+/**
+ * @brief blink_timer: đảo blink_flag mỗi BLINK_HALF_MS
+ */
+static void blink_toggle(void *arg) {
+    blink_flag = !blink_flag;
+#if EVQ_ENABLE
+    // Only these screens blink; elsewhere the flag waits for the next run
+    if (current_mode == MODE_SET_TIME || current_mode == MODE_SET_ALARM || alarm_triggered) {
+        evq_Put(&clock_timers, EVQ_TIMER, TIMER_BLINK, 0);
+    }
+#endif
+}
+
+#if EVQ_ENABLE
+/**
+ * @brief A one-shot timer ran out; arg is its TIMER_ id
+ */
+static void clock_timer_fired(void *arg) {
+    evq_Put(&clock_timers, EVQ_TIMER, (uint8_t)(uintptr_t)arg, 0);
+}
+#endif
+
 /**
  * @brief Chuyển FSM sang trạng thái hiển thị thông báo
  */
@@ -137,7 +235,7 @@ static void enter_message_display_mode(const char* lcd_msg, uint16_t color, cons
         uart_Rs232SendString((uint8_t*)uart_msg);
     }
 
-    message_display_counter = MESSAGE_DISPLAY_PERIOD; // Bắt đầu đếm 3 giây
+    tw_Start(&message_display_timer, MESSAGE_DISPLAY_MS, 0, CLOCK_TIMER_FN, (void*)TIMER_MESSAGE); // Bắt đầu đếm 3 giây
     current_mode = MODE_MESSAGE_DISPLAY; // Chuyển sang mode hiển thị
 }
 
@@ -148,9 +246,7 @@ static void handle_message_display_mode(void) {
     // Hiển thị lại thông báo (để chống bị ghi đè)
     lcd_ShowStr(20, 170, message_buffer, message_color, BLACK, 16, 0);
 
-    if (message_display_counter > 0) {
-        message_display_counter--;
-    } else {
+    if (!tw_Active(&message_display_timer)) {
         current_mode = MODE_VIEW_TIME;
         // Xóa màn hình khi thoát
         lcd_Fill(0, 100, 240, 220, BLACK);
@@ -279,7 +375,7 @@ static void handle_mode_switch(void) {
         uart_update_param = SET_HOUR;
         uart_data_requested = 0;
         uart_retry_count = 0; // Reset số lần thử
-        uart_timeout_counter = UART_TIMEOUT_PERIOD; // Đặt 10 giây
+        tw_Start(&uart_timeout_timer, UART_TIMEOUT_MS, 0, CLOCK_TIMER_FN, (void*)TIMER_UART); // Đặt 10 giây
 
         lcd_Fill(0, 100, 240, 220, BLACK);
         uart_Rs232SendString((uint8_t*)"\r\n--- ENTERING UART UPDATE MODE ---\r\n");
@@ -293,16 +389,14 @@ static void handle_mode_switch(void) {
 
 static void handle_view_time_mode(void) {
     // Stop alarm
-    if (alarm_triggered && (button_count[BTN_UP] == 1 || button_count[BTN_DOWN] == 1 || button_count[BTN_SAVE_NEXT] == 1)) {
+    if (alarm_triggered && (key_count[BTN_UP] == 1 || key_count[BTN_DOWN] == 1 || key_count[BTN_SAVE_NEXT] == 1)) {
         alarm_triggered = 0;
         lcd_Fill(60, 160, 180, 200, BLACK);
     }
 
     if (alarm_triggered) {
         // Handle alarm timeout (10s)
-        if (alarm_display_counter > 0) {
-            alarm_display_counter--;
-        } else {
+        if (!tw_Active(&alarm_display_timer)) {
             alarm_triggered = 0;
             lcd_Fill(60, 170, 180, 200, BLACK);
         }
@@ -318,17 +412,24 @@ static void handle_view_time_mode(void) {
 
     } else {
         // Read time from RTC
-        ds3231_ReadTime();
+        clock_ReadTime();
 
-        // Check for alarm trigger
+        // Check for alarm trigger (with the event queues once per second),
+        // at most once per minute so a dismissed alarm does not ring again
+        // later in the window
+        if (alarm_fired_min != ds3231_hours * 60 + ds3231_min)
+            alarm_fired_min = ALARM_NOT_FIRED;
         if (alarm_enabled &&
             !alarm_triggered &&
+            alarm_fired_min == ALARM_NOT_FIRED &&
+            clock_NewSecond() &&
             ds3231_hours == alarm_hour &&
             ds3231_min == alarm_min &&
-            ds3231_sec == 0)
+            ds3231_sec < ALARM_SEC_WINDOW)
         {
             alarm_triggered = 1;
-            alarm_display_counter = 200; // 10s
+            alarm_fired_min = ds3231_hours * 60 + ds3231_min;
+            tw_Start(&alarm_display_timer, ALARM_DISPLAY_MS, 0, CLOCK_TIMER_FN, (void*)TIMER_ALARM); // 10s
         }
 
         // Normal time display
@@ -339,25 +440,28 @@ static void handle_view_time_mode(void) {
 
 static void handle_set_time_mode(void) {
     // Handle UP button
-    if (button_count[BTN_UP] == 1) {
+    if (key_count[BTN_UP] == 1) {
         increment_setting();
-    } else if (button_count[BTN_UP] > LONG_PRESS_DURATION) {
-        if (button_count[BTN_UP] % AUTO_INCREMENT_PERIOD == 0) {
+#if LAT_ENABLE
+        lat_Handled(time_fields[set_time_param].x, time_fields[set_time_param].y, time_fields[set_time_param].w, 24);
+#endif
+    } else if (key_count[BTN_UP] > LONG_PRESS_DURATION) {
+        if (key_count[BTN_UP] % AUTO_INCREMENT_PERIOD == 0) {
             increment_setting();
         }
     }
 
     // Handle DOWN button
-    if (button_count[BTN_DOWN] == 1) {
+    if (key_count[BTN_DOWN] == 1) {
         decrement_setting();
-    } else if (button_count[BTN_DOWN] > LONG_PRESS_DURATION) {
-        if (button_count[BTN_DOWN] % AUTO_INCREMENT_PERIOD == 0) {
+    } else if (key_count[BTN_DOWN] > LONG_PRESS_DURATION) {
+        if (key_count[BTN_DOWN] % AUTO_INCREMENT_PERIOD == 0) {
             decrement_setting();
         }
     }
 
     // Handle SAVE/NEXT button
-    if (button_count[BTN_SAVE_NEXT] == 1) {
+    if (key_count[BTN_SAVE_NEXT] == 1) {
         set_time_param = (set_time_param + 1);
         if (set_time_param > SET_YEAR) {
             set_time_param = SET_HOUR;
@@ -426,29 +530,32 @@ static void handle_set_time_mode(void) {
 
 
 static void handle_set_alarm_mode(void) {
-    ds3231_ReadTime();
+    clock_ReadTime();
     displayTime();
 
     // Handle UP button
-    if (button_count[BTN_UP] == 1) {
+    if (key_count[BTN_UP] == 1) {
         increment_alarm_setting();
-    } else if (button_count[BTN_UP] > LONG_PRESS_DURATION) {
-        if (button_count[BTN_UP] % AUTO_INCREMENT_PERIOD == 0) {
+#if LAT_ENABLE
+        lat_Handled(alarm_fields[set_alarm_param].x, alarm_fields[set_alarm_param].y, alarm_fields[set_alarm_param].w, 24);
+#endif
+    } else if (key_count[BTN_UP] > LONG_PRESS_DURATION) {
+        if (key_count[BTN_UP] % AUTO_INCREMENT_PERIOD == 0) {
             increment_alarm_setting();
         }
     }
 
     // Handle DOWN button
-    if (button_count[BTN_DOWN] == 1) {
+    if (key_count[BTN_DOWN] == 1) {
         decrement_alarm_setting();
-    } else if (button_count[BTN_DOWN] > LONG_PRESS_DURATION) {
-        if (button_count[BTN_DOWN] % AUTO_INCREMENT_PERIOD == 0) {
+    } else if (key_count[BTN_DOWN] > LONG_PRESS_DURATION) {
+        if (key_count[BTN_DOWN] % AUTO_INCREMENT_PERIOD == 0) {
             decrement_alarm_setting();
         }
     }
 
     // Handle SAVE/NEXT button
-    if (button_count[BTN_SAVE_NEXT] == 1) {
+    if (key_count[BTN_SAVE_NEXT] == 1) {
         set_alarm_param = (set_alarm_param + 1) % 3;
     }
 
@@ -502,7 +609,7 @@ static void handle_uart_update_mode(void) {
 
         // Nếu chưa quá 3 lần, gửi request
         uart_retry_count++; // Tăng số lần thử
-        uart_timeout_counter = UART_TIMEOUT_PERIOD; // Đặt lại 10 giây
+        tw_Start(&uart_timeout_timer, UART_TIMEOUT_MS, 0, CLOCK_TIMER_FN, (void*)TIMER_UART); // Đặt lại 10 giây
 
         lcd_Fill(0, 170, 240, 200, BLACK);
         switch(uart_update_param) {
@@ -617,9 +724,7 @@ static void handle_uart_update_mode(void) {
     } else {
         // --- KHÔNG CÓ LỆNH MỚI (CHƯA NHẬN ĐƯỢC) ---
         // Kiểm tra logic timeout
-        if (uart_timeout_counter > 0) {
-            uart_timeout_counter--; // Giảm bộ đếm 50ms
-        } else {
+        if (!tw_Active(&uart_timeout_timer)) {
             // TIMEOUT (10 giây đã trôi qua)
 
             // --- SỬA LỖI HAL_BUSY ---
@@ -666,18 +771,39 @@ static void display_mode_status(void) {
 }
 
 
+/**
+ * @brief 1 if this run follows a wake from STOP and the plain time screen
+ * is still up: only its time digits need drawing
+ */
+static uint8_t time_only(void) {
+    return time_was_shown && stop_Woken() && current_mode == MODE_VIEW_TIME && !alarm_triggered;
+}
+
+
 /**
  * @brief Display time and date on LCD
  */
 static void displayTime(void){
     char str_buff[5];
+    uint8_t digits_only = time_only() && ds3231_date == shown_date;
+    PROF_ZONE("displayTime");
 
-    // Display Time (HH:MM:SS)
+    // Display Time (HH:MM:SS); after a STOP wake only the digits that changed
+    if (!digits_only || ds3231_hours != shown_hours)
 	lcd_ShowIntNum(70, 100, ds3231_hours, 2, GREEN, BLACK, 24);
-	lcd_ShowStr(100, 100, (uint8_t*)":", GREEN, BLACK, 24, 0);
+    if (!digits_only) lcd_ShowStr(100, 100, (uint8_t*)":", GREEN, BLACK, 24, 0);
+    if (!digits_only || ds3231_min != shown_min)
 	lcd_ShowIntNum(110, 100, ds3231_min, 2, GREEN, BLACK, 24);
-	lcd_ShowStr(140, 100, (uint8_t*)":", GREEN, BLACK, 24, 0);
+    if (!digits_only) lcd_ShowStr(140, 100, (uint8_t*)":", GREEN, BLACK, 24, 0);
+    if (!digits_only || ds3231_sec != shown_sec)
 	lcd_ShowIntNum(150, 100, ds3231_sec, 2, GREEN, BLACK, 24);
+    shown_hours = ds3231_hours;
+    shown_min = ds3231_min;
+    shown_sec = ds3231_sec;
+    shown_date = ds3231_date;
+    time_shown = (current_mode == MODE_VIEW_TIME && !alarm_triggered);
+    stop_Drawn();
+    if (digits_only) return;
 
     // Display Date (Day, DD/MM/YY)
     if (ds3231_day > 0 && ds3231_day <= 7) {
@@ -700,19 +826,43 @@ static void displayTime(void){
 }
 
 
+/**
+ * @brief 1 if any of the 16 keys went down in this tick
+ */
+static uint8_t any_key_pressed(void) {
+    for (int i = 0; i < 16; i++) {
+        if (key_count[i] == 1) return 1;
+    }
+    return 0;
+}
+
+
 /**
  * @brief Main FSM execution function. Call this from the main loop.
  * (ĐÃ SỬA LỖI XUNG ĐỘT NÚT RESET)
  */
 void clock_fsm_run(void) {
 
-    uint16_t mode_btn_current_count = button_count[BTN_MODE_SWITCH];
+    uint16_t mode_btn_current_count = key_count[BTN_MODE_SWITCH];
+    PROF_ZONE("clock_fsm_run");
+
+    // What the last run left on screen; displayTime() sets it again
+    time_was_shown = time_shown;
+    time_shown = 0;
+
+    // Any key brings the display back to full brightness
+    if (any_key_pressed()) {
+        dpm_Wake();
+    }
 
     // --- XỬ LÝ NHẤN GIỮ NÚT MODE (ƯU TIÊN CAO NHẤT) ---
 
     // 1. KIỂM TRA RESET (Nhấn giữ > 3 giây)
     if (mode_btn_current_count > RESET_LONG_PRESS_DURATION) {
         button_count[BTN_MODE_SWITCH] = 0; // Xóa (để tránh lặp lại reset)
+#if EVQ_ENABLE
+        key_count[BTN_MODE_SWITCH] = 0;
+#endif
         mode_btn_last_count = 0;         // Reset bộ theo dõi
 
         // 1. Reset RTC time
@@ -748,6 +898,7 @@ void clock_fsm_run(void) {
 
         // Khi ở mode MESSAGE, FSM chỉ chạy logic của mode đó
         handle_message_display_mode();
+        dpm_Run(0); // Message is outside the partial area
         return; // Bỏ qua FSM chính và thanh trạng thái
     }
 
@@ -765,9 +916,11 @@ void clock_fsm_run(void) {
     mode_btn_last_count = mode_btn_current_count;
 
 
-    // --- Update 2Hz blink flag ---
-    blink_counter = (blink_counter + 1) % 10; // 10 * 50ms = 500ms (2Hz)
-    blink_flag = (blink_counter < 5) ? 1 : 0; // 250ms ON (1), 250ms OFF (0)
+    // --- 2Hz blink flag: blink_timer toggles it, started on the first pass ---
+    if (!tw_Active(&blink_timer)) {
+        blink_flag = 1;
+        tw_Start(&blink_timer, BLINK_HALF_MS, BLINK_HALF_MS, blink_toggle, (void*)TIMER_BLINK);
+    }
 
 
     // --- FSM logic ---
@@ -788,6 +941,113 @@ void clock_fsm_run(void) {
             break;
     }
 
-    // --- Display current mode status ---
-    display_mode_status();
+    // --- Display current mode status (unchanged after a STOP wake) ---
+    if (!time_only()) {
+        display_mode_status();
+    }
+
+    // --- Display power: only the time rows change while viewing ---
+    dpm_Run(current_mode == MODE_VIEW_TIME && !alarm_triggered);
+}
+
+#if EVQ_ENABLE
+/**
+ * @brief One FSM run on the inputs the events gave so far
+ */
+static void clock_fsm_take(void) {
+    gov_Boost();
+    clock_fsm_run();
+    key_fresh = 0;
+    line_fresh = 0;
+    sec_event = 0;
+}
+
+/**
+ * @brief Hand the queued events to the FSM and run it if there were any,
+ * or it asked to run again. Key events set key_count, a line event puts
+ * the line together for uart_get_command(), a second event marks the run
+ * for the alarm check (and reads the RTC when SQW posted it). A key or a
+ * line with a second event before the FSM saw the first runs it in
+ * between, so a pass that queued both edges of a short press loses neither.
+ * @retval 1 if it ran
+ */
+uint8_t clock_fsm_dispatch(void) {
+    static uint8_t added = 0;
+    evq_Event_t ev;
+    uint8_t n = 0, mode = current_mode;
+    if (!added) {
+        evq_Add(&uart_events);
+        evq_Add(&clock_timers);
+        added = 1;
+    }
+    while (evq_Get(&button_events, &ev)) {
+        if (key_fresh & (1u << ev.arg)) {
+            clock_fsm_take();
+        }
+        key_count[ev.arg] = (ev.type == EVQ_KEY_UP) ? 0 : ev.count;
+        key_fresh |= 1u << ev.arg;
+        n = 1;
+    }
+    while (evq_Get(&uart_events, &ev)) {
+        if (line_fresh) {
+            clock_fsm_take();
+        }
+        // The line end may have come in after task_Uart() in this pass
+        uart_process_incoming_data();
+        line_fresh = 1;
+        n = 1;
+    }
+    while (evq_Get(&ds3231_events, &ev)) {
+        if (ev.arg == DS3231_SEC_UNREAD) {
+            ds3231_ReadTime();
+        }
+        sec_event = 1;
+        n = 1;
+    }
+    n |= evq_Drain(&clock_timers);
+    if (n == 0 && !fsm_again) {
+        evq_Ran(0);
+        return 0;
+    }
+    clock_fsm_take();
+    // A new mode draws its screen on the next run, and a UART request
+    // still to be sent has no event of its own
+    fsm_again = (current_mode != mode) ||
+                (current_mode == MODE_UPDATE_VIA_UART && uart_data_requested == 0);
+    evq_Ran(1);
+    return 1;
+}
+#endif
+
+/**
+ * @brief 1 while the last run drew the plain time screen: view mode, no
+ * alarm ringing. stop.c only goes into STOP then.
+ */
+uint8_t clock_fsm_quiet(void) {
+    return time_shown;
+}
+
+/**
+ * @brief Current mode, in ClockMode_t order: view, set time, set alarm,
+ * UART update, message. host_sim reports mode changes with it.
+ */
+uint8_t clock_fsm_mode(void) {
+    return current_mode;
+}
+
+/**
+ * @brief Process incoming UART bytes into the command buffer. With
+ * UART_CMD_ENABLE, outside UART update mode the FSM does not listen on
+ * USART1: keep the receiver armed for the report commands and drop any
+ * other line.
+ */
+void clock_fsm_uart(void) {
+    uart_process_incoming_data();
+#if UART_CMD_ENABLE
+    if (current_mode != MODE_UPDATE_VIA_UART) {
+        uint8_t line[32];
+        uart_init_rs232();
+        uart_get_command(line);
+    }
+#endif
 }
@@ -0,0 +1,132 @@
+/*
+ * display_pm.c
+ *
+ *  Display power manager
+ *
+ *  FULL:    normal display mode, full colour, full backlight.
+ *  PARTIAL: the screen has been static for DPM_PARTIAL_DELAY, only the
+ *           time rows are scanned (0x30/0x12) and the backlight is dimmed.
+ *  IDLE:    no key for DPM_IDLE_DELAY, the panel also drops to 8 colours
+ *           (0x39) and the backlight goes down to DPM_BL_IDLE.
+ *
+ *  GRAM keeps being written in every level, so going back to FULL only
+ *  needs the mode commands; the panel shows the whole frame on its next
+ *  scan.
+ */
+
+#include "display_pm.h"
+#include "lcd.h"
+#include "tim.h"
+#include "evq.h"
+#include "dwt.h"
+
+static dpm_Level_t dpm_level = DPM_FULL;
+static uint16_t dpm_static_ticks = 0;
+static uint16_t dpm_quiet_ticks = 0;
+#if EVQ_ENABLE
+static uint32_t dpm_last_ms = 0;			// HAL_GetTick() the counts are up to
+#endif
+
+// CPU cycles spent in the last wake-up (mode commands + backlight)
+uint32_t dpm_wake_cycles = 0;
+
+/**
+  * @brief  Set backlight brightness
+  * @param  percent Duty cycle 0..100 on TIM1_CH1 (PA8)
+  * @retval None
+  */
+void dpm_SetBacklight(uint8_t percent){
+	if(percent > 100) percent = 100;
+	__HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_1, percent);
+}
+
+static void dpm_Enter(dpm_Level_t level)
+{
+	if(level == dpm_level) return;
+	switch(level){
+	case DPM_FULL:
+		if(dpm_level == DPM_IDLE) lcd_IdleMode(0);
+		lcd_NormalMode();
+		dpm_SetBacklight(DPM_BL_FULL);
+		break;
+	case DPM_PARTIAL:
+		if(dpm_level == DPM_IDLE) lcd_IdleMode(0);
+		else lcd_PartialArea(DPM_PARTIAL_Y1, DPM_PARTIAL_Y2);
+		dpm_SetBacklight(DPM_BL_PARTIAL);
+		break;
+	case DPM_IDLE:
+		if(dpm_level == DPM_FULL) lcd_PartialArea(DPM_PARTIAL_Y1, DPM_PARTIAL_Y2);
+		lcd_IdleMode(1);
+		dpm_SetBacklight(DPM_BL_IDLE);
+		break;
+	}
+	dpm_level = level;
+}
+
+/**
+  * @brief  Start the backlight PWM at full brightness
+  * @param  None
+  * @retval None
+  */
+void dpm_init(){
+	dpm_level = DPM_FULL;
+	dpm_static_ticks = 0;
+	dpm_quiet_ticks = 0;
+#if EVQ_ENABLE
+	dpm_last_ms = HAL_GetTick();
+#endif
+	dpm_SetBacklight(DPM_BL_FULL);
+	HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_1);
+	dwt_init();	// cycle counter for dpm_wake_cycles
+}
+
+/**
+  * @brief  Return to full display at once
+  * @param  None
+  * @note  	Call on any key press or when the screen stops being static
+  * @retval None
+  */
+void dpm_Wake(){
+	uint32_t start;
+	dpm_static_ticks = 0;
+	dpm_quiet_ticks = 0;
+#if EVQ_ENABLE
+	dpm_last_ms = HAL_GetTick();
+#endif
+	if(dpm_level == DPM_FULL) return;
+	start = dwt_Cycles();
+	dpm_Enter(DPM_FULL);
+	dpm_wake_cycles = dwt_Cycles() - start;
+}
+
+/**
+  * @brief  Step the power levels
+  * @param  static_screen 1 if only the time rows change on screen
+  * @note  	Call every 50ms; with EVQ_ENABLE whenever the FSM runs, it
+  * 		counts the 50ms ticks that went by since
+  * @retval None
+  */
+void dpm_Run(uint8_t static_screen){
+	uint32_t n = 1;
+#if EVQ_ENABLE
+	n = (HAL_GetTick() - dpm_last_ms)/DPM_TICK_MS;
+	dpm_last_ms += n*DPM_TICK_MS;
+#endif
+	if(!static_screen){
+		dpm_Wake();
+		return;
+	}
+	dpm_static_ticks = (dpm_static_ticks + n < DPM_PARTIAL_DELAY) ? dpm_static_ticks + n : DPM_PARTIAL_DELAY;
+	dpm_quiet_ticks = (dpm_quiet_ticks + n < DPM_IDLE_DELAY) ? dpm_quiet_ticks + n : DPM_IDLE_DELAY;
+	if(dpm_quiet_ticks >= DPM_IDLE_DELAY) dpm_Enter(DPM_IDLE);
+	else if(dpm_static_ticks >= DPM_PARTIAL_DELAY) dpm_Enter(DPM_PARTIAL);
+}
+
+/**
+  * @brief  Current power level
+  * @param  None
+  * @retval DPM_FULL, DPM_PARTIAL or DPM_IDLE
+  */
+dpm_Level_t dpm_GetLevel(){
+	return dpm_level;
+}
@@ -6,6 +6,9 @@
  */
 
 #include "ds3231.h"
+#include "trace.h"
+#include "prof.h"
+#include "stop.h"
 
 #define DS3231_ADDRESS 0x68<<1
 
@@ -19,6 +22,11 @@ uint8_t ds3231_day;
 uint8_t ds3231_month;
 uint8_t ds3231_year;
 
+// EVQ_RTC_SEC once per second. With STOP_ENABLE the SQW edge's interrupt
+// posts it (stop.c) and the dispatch reads the time; otherwise SQW is not
+// set up and the producer is the ds3231_ReadTime() poll finding a new second
+evq_Queue_t ds3231_events = EVQ_INIT("rtc");
+
 void ds3231_init(){
 	ds3231_buffer[0] = DEC2BCD(30); //second
 	ds3231_buffer[1] = DEC2BCD(22); //minute
@@ -27,6 +35,7 @@ void ds3231_init(){
 	ds3231_buffer[4] = DEC2BCD(15); //date
 	ds3231_buffer[5] = DEC2BCD(9);  //month
 	ds3231_buffer[6] = DEC2BCD(23); //year
+	evq_Add(&ds3231_events);
 	if(HAL_I2C_IsDeviceReady(&hi2c1, DS3231_ADDRESS, 3, 50) != HAL_OK){
 		while(1);
 	};
@@ -38,7 +47,12 @@ void ds3231_Write(uint8_t address, uint8_t value){
 }
 
 void ds3231_ReadTime(){
+	PROF_ZONE("ds3231_ReadTime");
 	HAL_I2C_Mem_Read(&hi2c1, DS3231_ADDRESS, 0x00, I2C_MEMADD_SIZE_8BIT, ds3231_buffer, 7, 10);
+	trace_Rtc(ds3231_buffer);
+#if EVQ_ENABLE && !STOP_ENABLE
+	if(BCD2DEC(ds3231_buffer[0]) != ds3231_sec) evq_Put(&ds3231_events, EVQ_RTC_SEC, BCD2DEC(ds3231_buffer[0]), 0);
+#endif
 	ds3231_sec = BCD2DEC(ds3231_buffer[0]);
 	ds3231_min = BCD2DEC(ds3231_buffer[1]);
 	ds3231_hours = BCD2DEC(ds3231_buffer[2]);
@@ -47,3 +61,10 @@ void ds3231_ReadTime(){
 	ds3231_month = BCD2DEC(ds3231_buffer[5]);
 	ds3231_year = BCD2DEC(ds3231_buffer[6]);
 }
+
+// INT/SQW as a 1Hz square wave: INTCN = 0, RS2:RS1 = 00. Its falling edge
+// is the seconds update; the alarm is matched in clock_fsm.c, not here
+void ds3231_SquareWave(){
+	uint8_t ctrl = 0x00;
+	HAL_I2C_Mem_Write(&hi2c1, DS3231_ADDRESS, ADDRESS_CONTROL, I2C_MEMADD_SIZE_8BIT, &ctrl, 1, 10);
+}
@@ -0,0 +1,160 @@
+/*
+ * evq.c
+ *
+ *  Event queues
+ *
+ *  Each queue has exactly one producer (an interrupt, or one task) and one
+ *  consumer (the FSM's dispatch), so it needs no lock: the producer only
+ *  writes head and the slots in front of it, the consumer only tail. An
+ *  event is written into its slot before head moves past it, and the
+ *  compiler barrier keeps the two stores in that order; the M4 has no
+ *  cache or store reordering a second core would see, so that is enough.
+ *  head and tail run free and wrap together, their difference is the
+ *  count. A full queue drops the new event and counts it.
+ *
+ *  The counters are written by one side each: high, posted and drops by
+ *  the producer, age_max by the consumer.
+ */
+
+#include "evq.h"
+
+#if EVQ_ENABLE
+
+#include <stdio.h>
+#include <string.h>
+#include "report.h"
+
+#define EVQ_MASK		(EVQ_LEN - 1)
+#define evq_Barrier()	__asm volatile("" ::: "memory")
+
+static evq_Queue_t *evq_all[EVQ_MAX];
+static uint8_t evq_count = 0;
+static uint32_t evq_passes = 0, evq_runs = 0;
+static uint8_t evq_req = 0;					// 1 = print, 2 = print and clear
+
+/**
+ * @brief  List a queue in evq_Report(), from its owner's init
+ */
+void evq_Add(evq_Queue_t *q)
+{
+	uint8_t i;
+	for(i = 0; i < evq_count; i++) if(evq_all[i] == q) return;	// init ran again
+	if(evq_count < EVQ_MAX) evq_all[evq_count++] = q;
+}
+
+/**
+ * @brief  Producer side, from an interrupt or a task
+ * @retval 1, 0 when the queue was full and the event is dropped
+ */
+uint8_t evq_Put(evq_Queue_t *q, uint8_t type, uint8_t arg, uint16_t count)
+{
+	uint16_t head = q->head;
+	uint16_t n = (uint16_t)(head - q->tail);
+	evq_Event_t *ev;
+	if(n >= EVQ_LEN){
+		q->drops++;
+		return 0;
+	}
+	ev = &q->buf[head & EVQ_MASK];
+	ev->type = type;
+	ev->arg = arg;
+	ev->count = count;
+	ev->tick = HAL_GetTick();
+	evq_Barrier();				// the slot is complete before head publishes it
+	q->head = head + 1;
+	q->posted++;
+	if(n + 1 > q->high) q->high = n + 1;
+	return 1;
+}
+
+/**
+ * @brief  Consumer side: take the oldest event
+ * @retval 1, 0 when the queue is empty
+ */
+uint8_t evq_Get(evq_Queue_t *q, evq_Event_t *ev)
+{
+	uint16_t tail = q->tail;
+	uint32_t age;
+	if(tail == q->head) return 0;
+	evq_Barrier();				// head is read before the slot it covers
+	*ev = q->buf[tail & EVQ_MASK];
+	evq_Barrier();				// the slot is copied before tail frees it
+	q->tail = tail + 1;
+	age = HAL_GetTick() - ev->tick;
+	if(age > q->age_max) q->age_max = age;
+	return 1;
+}
+
+/**
+ * @brief  Take every queued event
+ * @retval How many there were, 255 at most
+ */
+uint8_t evq_Drain(evq_Queue_t *q)
+{
+	evq_Event_t ev;
+	uint8_t n = 0;
+	while(evq_Get(q, &ev)) if(n < 255) n++;
+	return n;
+}
+
+/**
+ * @brief  Call once per pass from the dispatch: ran = 1 when the FSM ran
+ */
+void evq_Ran(uint8_t ran)
+{
+	evq_passes++;
+	evq_runs += ran;
+}
+
+static void evq_Clear()
+{
+	uint8_t i;
+	for(i = 0; i < evq_count; i++){
+		evq_all[i]->high = 0;
+		evq_all[i]->posted = 0;
+		evq_all[i]->drops = 0;
+		evq_all[i]->age_max = 0;
+	}
+	evq_passes = evq_runs = 0;
+}
+
+/**
+ * @brief  Ask for the table at the next evq_Poll(); reset = 1 also clears
+ *         the counters once printed
+ */
+void evq_Request(uint8_t reset)
+{
+	rpt_Request(&evq_req, reset);
+}
+
+/**
+ * @brief  Call from the main loop, outside the FSM
+ */
+void evq_Poll()
+{
+	uint8_t req = rpt_Take(&evq_req);
+	if(req == RPT_NONE) return;
+	evq_Report();
+	if(req == RPT_CLEAR) evq_Clear();
+}
+
+/**
+ * @brief  Print how many passes ran the FSM, then one row per queue
+ */
+void evq_Report()
+{
+	char line[128];
+	uint16_t n, share = evq_passes ? (uint16_t)((uint64_t)evq_runs*1000/evq_passes) : 0;
+	uint8_t i;
+	n = sprintf(line, "\r\nEVENTS %lu passes, FSM ran in %lu (%u.%u%%)\r\nqueue      posted  high/len  drops  age max ms\r\n",
+			(unsigned long)evq_passes, (unsigned long)evq_runs, share/10, share%10);
+	rpt_Write(line, n);
+	for(i = 0; i < evq_count; i++){
+		evq_Queue_t *q = evq_all[i];
+		n = sprintf(line, "%-8s %8lu %5u/%-3u %6lu %11lu\r\n", q->name, (unsigned long)q->posted,
+				q->high, EVQ_LEN, (unsigned long)q->drops, (unsigned long)q->age_max);
+		rpt_Write(line, n);
+	}
+}
+
+#endif /* EVQ_ENABLE */
@@ -0,0 +1,283 @@
+/*
+ * gov.c
+ *
+ *  Clock governor
+ *
+ *  gov_Set() runs with interrupts masked, so no handler sees a peripheral
+ *  half retimed. Before it, USART1 finishes the byte it is sending and
+ *  SPI1 the word it is shifting; I2C1 is only used from the main loop (or
+ *  under io_sem by the threads), never across a call. A byte that is on
+ *  the USART1 RX wire during the few us of a switch can still be lost.
+ *
+ *  Cost of a switch: DWT cycles up to the CFGR write at the old HCLK, the
+ *  rest at the new one. Energy: the time at each level on TIM2 (1us counts
+ *  at both), weighted by HCLK. Dynamic current goes with HCLK in run and in
+ *  sleep alike, so that product against 168MHz throughout is an estimate of
+ *  the dynamic share; the PLL, regulator and leakage do not scale, which
+ *  IDD on the board's ammeter jumper shows.
+ */
+
+#include "gov.h"
+
+#if GOV_ENABLE
+
+#include "dwt.h"
+#include "tim.h"
+#include "spi.h"
+#include "i2c.h"
+#include "usart.h"
+#include "report.h"
+#include "software_timer.h"
+#include "pcsamp.h"
+#include <stdio.h>
+#include <string.h>
+
+#define GOV_CFGR_MASK	(RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2)
+#define GOV_TIMERS		3
+
+typedef struct {
+	uint32_t cfgr;				// HPRE, PPRE1, PPRE2
+	uint32_t latency;			// flash wait states
+	uint32_t hclk, pclk1, pclk2;
+} gov_Clocks_t;
+
+typedef struct {
+	TIM_TypeDef *tim;
+	uint8_t apb;				// 1 or 2
+	uint32_t hz;				// count rate it keeps
+} gov_Timer_t;
+
+typedef struct {
+	uint32_t count;
+	uint32_t max_ns;
+	uint64_t sum_ns;
+} gov_Switch_t;
+
+static gov_Clocks_t gov_clk[GOV_COUNT];
+static gov_Timer_t gov_tim[GOV_TIMERS];
+static uint8_t gov_ntim;
+static uint32_t gov_spi_hz;					// SPI1 SCK at gov_init(), not exceeded later
+static uint8_t gov_level = GOV_FULL;
+static uint32_t gov_since;					// timer2_Us() at the last switch or clear
+static uint64_t gov_us[GOV_COUNT];			// time at each level
+static gov_Switch_t gov_sw[GOV_COUNT];		// switches into each level
+static uint8_t gov_req;						// 1 = print, 2 = print and clear
+
+static const char *const gov_name[GOV_COUNT] = {"full", "idle"};
+
+// Bus clocks of a set of CFGR prescalers
+static void gov_Derive(gov_Clocks_t *c, uint32_t sysclk)
+{
+	c->hclk = sysclk >> AHBPrescTable[(c->cfgr & RCC_CFGR_HPRE) >> RCC_CFGR_HPRE_Pos];
+	c->pclk1 = c->hclk >> APBPrescTable[(c->cfgr & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_Pos];
+	c->pclk2 = c->hclk >> APBPrescTable[(c->cfgr & RCC_CFGR_PPRE2) >> RCC_CFGR_PPRE2_Pos];
+}
+
+// The timers of a divided APB run at twice its clock
+static uint32_t gov_TimClk(const gov_Clocks_t *c, uint8_t apb)
+{
+	uint32_t pclk = (apb == 1) ? c->pclk1 : c->pclk2;
+	return (pclk == c->hclk) ? pclk : 2*pclk;
+}
+
+static void gov_AddTimer(TIM_TypeDef *tim, uint8_t apb)
+{
+	gov_Timer_t *t = &gov_tim[gov_ntim++];
+	t->tim = tim;
+	t->apb = apb;
+	t->hz = gov_TimClk(&gov_clk[GOV_FULL], apb)/(tim->PSC + 1);
+}
+
+static void gov_Clear()
+{
+	memset(gov_us, 0, sizeof(gov_us));
+	memset(gov_sw, 0, sizeof(gov_sw));
+	gov_since = timer2_Us();
+}
+
+/**
+ * @brief  After SystemClock_Config() and the MX_*_Init(), with the rates
+ *         to keep set up: after timer_init() and pcs_init()
+ */
+void gov_init()
+{
+	uint32_t sysclk = HAL_RCC_GetSysClockFreq();
+	gov_Clocks_t *full = &gov_clk[GOV_FULL], *idle = &gov_clk[GOV_IDLE];
+	uint8_t i;
+	dwt_init();
+	full->cfgr = RCC->CFGR & GOV_CFGR_MASK;
+	full->latency = __HAL_FLASH_GET_LATENCY();
+	gov_Derive(full, sysclk);
+	idle->cfgr = GOV_IDLE_AHB | GOV_IDLE_APB1 | (GOV_IDLE_APB2 << 3);	// as HAL_RCC_ClockConfig
+	idle->latency = GOV_IDLE_LATENCY;
+	gov_Derive(idle, sysclk);
+
+	gov_ntim = 0;
+	gov_AddTimer(TIM1, 2);			// backlight PWM
+	gov_AddTimer(TIM2, 1);			// tick, TIMER2_CNT_PER_MS
+#if PCS_ENABLE
+	gov_AddTimer(TIM7, 1);
+#endif
+	gov_spi_hz = full->pclk2 >> (((SPI1->CR1 & SPI_CR1_BR) >> SPI_CR1_BR_Pos) + 1);
+	// Every rate has to come out whole at the idle clocks too
+	for(i = 0; i < gov_ntim; i++){
+		if(gov_TimClk(idle, gov_tim[i].apb) % gov_tim[i].hz) Error_Handler();
+	}
+	if(I2C_MIN_PCLK_FREQ(idle->pclk1, hi2c1.Init.ClockSpeed)) Error_Handler();
+
+	gov_level = GOV_FULL;
+	gov_req = 0;
+	gov_Clear();
+}
+
+// VAL can only be cleared, so the rest of the running ms is loaded for one
+// reload at the new rate and the ms period after it; the tick keeps its phase
+static void gov_Systick(uint32_t from, uint32_t to)
+{
+	uint32_t left = (uint64_t)SysTick->VAL*to/from;
+	SysTick->LOAD = (left > 16) ? left : 16;
+	SysTick->VAL = 0;
+	while(SysTick->VAL == 0);
+	SysTick->LOAD = to/(1000U/uwTickFreq) - 1;
+}
+
+// PSC only loads on an update: one is forced with URS set, which raises no
+// interrupt, and the count put back
+static void gov_Timer(const gov_Timer_t *t, const gov_Clocks_t *c)
+{
+	TIM_TypeDef *tim = t->tim;
+	uint32_t cnt = tim->CNT, urs = tim->CR1 & TIM_CR1_URS;
+	tim->PSC = gov_TimClk(c, t->apb)/t->hz - 1;
+	tim->CR1 |= TIM_CR1_URS;
+	tim->EGR = TIM_EGR_UG;
+	tim->CNT = cnt;
+	tim->CR1 = (tim->CR1 & ~TIM_CR1_URS) | urs;
+}
+
+// As HAL_I2C_Init() for the new PCLK1
+static void gov_I2c(const gov_Clocks_t *c)
+{
+	uint32_t range = I2C_FREQRANGE(c->pclk1);
+	I2C1->CR1 &= ~I2C_CR1_PE;
+	MODIFY_REG(I2C1->CR2, I2C_CR2_FREQ, range);
+	MODIFY_REG(I2C1->TRISE, I2C_TRISE_TRISE, I2C_RISE_TIME(range, hi2c1.Init.ClockSpeed));
+	MODIFY_REG(I2C1->CCR, (I2C_CCR_FS | I2C_CCR_DUTY | I2C_CCR_CCR), I2C_SPEED(c->pclk1, hi2c1.Init.ClockSpeed, hi2c1.Init.DutyCycle));
+	I2C1->CR1 |= I2C_CR1_PE;
+}
+
+// Smallest divider that does not take SCK over gov_spi_hz; the HAL turns
+// SPE back on with the next transfer
+static void gov_Spi(const gov_Clocks_t *c)
+{
+	uint32_t br = 0, cr1 = SPI1->CR1 & ~SPI_CR1_SPE;
+	while(br < 7 && (c->pclk2 >> (br + 1)) > gov_spi_hz) br++;
+	SPI1->CR1 = cr1;
+	SPI1->CR1 = (cr1 & ~SPI_CR1_BR) | (br << SPI_CR1_BR_Pos);
+}
+
+/**
+ * @brief  Switch HCLK to a level and retime the peripherals; from thread
+ *         mode, not from a handler
+ */
+void gov_Set(uint8_t level)
+{
+	const gov_Clocks_t *from = &gov_clk[gov_level], *to;
+	gov_Switch_t *s;
+	uint32_t pm, now, c0, c1, c2, ns;
+	uint8_t i;
+	if(level == gov_level || level >= GOV_COUNT) return;
+	to = &gov_clk[level];
+	while(!(USART1->SR & USART_SR_TC));		// the last byte out at the old baud rate
+	pm = __get_PRIMASK();
+	__disable_irq();
+	while(SPI1->SR & SPI_SR_BSY);
+	now = timer2_Us();
+	c0 = dwt_Cycles();
+	if(to->latency > from->latency){
+		__HAL_FLASH_SET_LATENCY(to->latency);
+		while(__HAL_FLASH_GET_LATENCY() != to->latency);
+	}
+	MODIFY_REG(RCC->CFGR, GOV_CFGR_MASK, to->cfgr);
+	c1 = dwt_Cycles();
+	if(to->latency < from->latency) __HAL_FLASH_SET_LATENCY(to->latency);
+	SystemCoreClock = to->hclk;
+	gov_Systick(from->hclk, to->hclk);
+	for(i = 0; i < gov_ntim; i++) gov_Timer(&gov_tim[i], to);
+	USART1->BRR = (huart1.Init.OverSampling == UART_OVERSAMPLING_8) ?
+			UART_BRR_SAMPLING8(to->pclk2, huart1.Init.BaudRate) : UART_BRR_SAMPLING16(to->pclk2, huart1.Init.BaudRate);
+	gov_I2c(to);
+	gov_Spi(to);
+	c2 = dwt_Cycles();
+	gov_us[gov_level] += now - gov_since;
+	gov_since = now;
+	gov_level = level;
+	__set_PRIMASK(pm);
+
+	ns = (uint64_t)(c1 - c0)*1000000000/from->hclk + (uint64_t)(c2 - c1)*1000000000/to->hclk;
+	s = &gov_sw[level];
+	s->count++;
+	s->sum_ns += ns;
+	if(ns > s->max_ns) s->max_ns = ns;
+}
+
+uint8_t gov_Level()
+{
+	return gov_level;
+}
+
+/**
+ * @brief  Ask for the table at the next gov_Poll(); reset = 1 also clears
+ *         it once printed
+ */
+void gov_Request(uint8_t reset)
+{
+	rpt_Request(&gov_req, reset);
+}
+
+/**
+ * @brief  Call from the main loop
+ */
+void gov_Poll()
+{
+	uint8_t req = rpt_Take(&gov_req);
+	if(req == RPT_NONE) return;
+	gov_Report();
+	if(req == RPT_CLEAR) gov_Clear();
+}
+
+/**
+ * @brief  Print the time at each level with the switches into it, then
+ *         HCLK x time against 168MHz throughout
+ */
+void gov_Report()
+{
+	char line[128], a[16], b[16];
+	uint64_t us[GOV_COUNT], total = 0, weighted = 0;
+	uint32_t share;
+	uint16_t n;
+	uint8_t i;
+	memcpy(us, gov_us, sizeof(us));
+	us[gov_level] += timer2_Us() - gov_since;
+	for(i = 0; i < GOV_COUNT; i++){
+		total += us[i];
+		weighted += us[i]*(gov_clk[i].hclk/1000000);
+	}
+	if(total == 0) total = 1;
+	n = sprintf(line, "\r\nGOV level  MHz    time ms   share   switches in  max us  mean us\r\n");
+	rpt_Write(line, n);
+	for(i = 0; i < GOV_COUNT; i++){
+		gov_Switch_t *s = &gov_sw[i];
+		share = us[i]*1000/total;
+		n = sprintf(line, "%-9s %4lu %10lu %5lu.%lu%% %14lu %7s %8s\r\n", gov_name[i],
+				(unsigned long)(gov_clk[i].hclk/1000000), (unsigned long)(us[i]/1000),
+				(unsigned long)(share/10), (unsigned long)(share%10), (unsigned long)s->count,
+				rpt_Us(a, s->max_ns), rpt_Us(b, s->count ? (uint32_t)(s->sum_ns/s->count) : 0));
+		rpt_Write(line, n);
+	}
+	share = weighted*1000/(total*(gov_clk[GOV_FULL].hclk/1000000));
+	n = sprintf(line, "HCLK x time %lu.%lu%% of %lu MHz throughout: dynamic energy estimate\r\n",
+			(unsigned long)(share/10), (unsigned long)(share%10), (unsigned long)(gov_clk[GOV_FULL].hclk/1000000));
+	rpt_Write(line, n);
+}
+
+#endif /* GOV_ENABLE */
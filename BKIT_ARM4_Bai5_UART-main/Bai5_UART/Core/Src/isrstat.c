@@ -0,0 +1,144 @@
+/*
+ * isrstat.c
+ *
+ *  Interrupt timing
+ *
+ *  isr_Enter() at the top of a handler pushes its DWT start time,
+ *  isr_Exit() pops it. A handler that preempts another one adds its whole
+ *  run to the one below it on the stack, which subtracts it again, so each
+ *  row is the handler's own time and the sum of the rows is the CPU time
+ *  spent in them. The push and pop are not atomic, but a handler that
+ *  preempts them leaves the stack as it found it.
+ *
+ *  Latency needs the time of the event, so it is only known where the
+ *  hardware keeps one: TIM2's counter runs on from the update or compare
+ *  event (timer2_Latency(), 1us steps), and bh_Pend() stamps the pend.
+ *  USART1 has no such time; what shows there instead is "lost", the
+ *  overruns: a byte that arrived before the handler took the one before.
+ */
+
+#include "isrstat.h"
+
+#if ISR_STATS
+
+#include "dwt.h"
+#include "bh.h"
+#include "report.h"
+#include <stdio.h>
+#include <string.h>
+
+isr_Stats_t isr_stats[ISR_COUNT];
+static uint32_t isr_start[ISR_DEPTH];
+static uint32_t isr_nested[ISR_DEPTH];		// cycles taken by the handlers that preempted this one
+static uint8_t isr_depth = 0;
+static uint8_t isr_req;						// 1 = print, 2 = print and clear
+
+static const char *const isr_name[ISR_COUNT] = {"usart1", "tim2", "dma2s0", "bh", "systick"};
+static const IRQn_Type isr_irq[ISR_COUNT] = {USART1_IRQn, TIM2_IRQn, DMA2_Stream0_IRQn, BH_IRQn, SysTick_IRQn};
+
+void isr_init()
+{
+	dwt_init();
+	memset(isr_stats, 0, sizeof(isr_stats));
+	isr_req = 0;
+}
+
+/**
+ * @brief  First thing in a handler
+ */
+void isr_Enter()
+{
+	uint8_t d = isr_depth;
+	if(d >= ISR_DEPTH) return;
+	isr_nested[d] = 0;
+	isr_start[d] = dwt_Cycles();
+	isr_depth = d + 1;
+}
+
+/**
+ * @brief  Last thing in the handler of src
+ */
+void isr_Exit(uint8_t src)
+{
+	uint8_t d = isr_depth;
+	uint32_t run, self;
+	isr_Stats_t *s = &isr_stats[src];
+	if(d == 0 || d > ISR_DEPTH) return;
+	d--;
+	run = dwt_Cycles() - isr_start[d];
+	self = run - isr_nested[d];
+	if(d > 0) isr_nested[d - 1] += run;
+	isr_depth = d;
+	s->count++;
+	s->self_sum += self;
+	if(self > s->self_max) s->self_max = self;
+}
+
+/**
+ * @brief  The event src is handling happened this many cycles ago
+ */
+void isr_Latency(uint8_t src, uint32_t cycles)
+{
+	isr_Stats_t *s = &isr_stats[src];
+	s->lat_count++;
+	if(cycles > s->lat_max) s->lat_max = cycles;
+}
+
+void isr_Lost(uint8_t src)
+{
+	isr_stats[src].lost++;
+}
+
+/**
+ * @brief  Ask for the table at the next isr_Poll(); reset = 1 also clears
+ *         it once printed
+ */
+void isr_Request(uint8_t reset)
+{
+	rpt_Request(&isr_req, reset);
+}
+
+/**
+ * @brief  Call from the main loop, outside the handlers
+ */
+void isr_Poll()
+{
+	uint8_t req = rpt_Take(&isr_req);
+	if(req == RPT_NONE) return;
+	isr_Report();
+	if(req == RPT_CLEAR){
+		__disable_irq();
+		memset(isr_stats, 0, sizeof(isr_stats));
+		__enable_irq();
+	}
+}
+
+// Cycles as "us.hh"
+static char *isr_Us(char *buf, uint64_t cycles)
+{
+	return rpt_Us(buf, (uint32_t)(cycles*1000/(SystemCoreClock/1000000)));
+}
+
+/**
+ * @brief  Print one row per handler: priority, count, own run time (worst
+ *         and mean), worst latency where it is known, lost events
+ */
+void isr_Report()
+{
+	char line[128], a[16], b[16], c[16];
+	uint16_t n;
+	uint8_t i;
+	n = sprintf(line, "\r\nISR      prio     count   max us  mean us  late max us   lost\r\n");
+	rpt_Write(line, n);
+	for(i = 0; i < ISR_COUNT; i++){
+		isr_Stats_t s = isr_stats[i];
+		if(s.lat_count) isr_Us(c, s.lat_max);
+		else strcpy(c, "-");
+		n = sprintf(line, "%-8s %4lu %9lu %8s %8s %12s %6lu\r\n", isr_name[i], (unsigned long)NVIC_GetPriority(isr_irq[i]),
+				(unsigned long)s.count, isr_Us(a, s.self_max), isr_Us(b, s.count ? s.self_sum/s.count : 0),
+				c, (unsigned long)s.lost);
+		rpt_Write(line, n);
+	}
+}
+
+#endif /* ISR_STATS */
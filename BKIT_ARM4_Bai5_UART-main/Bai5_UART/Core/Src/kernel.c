@@ -0,0 +1,406 @@
+/*
+ * kernel.c
+ *
+ *  Preemptive fixed-priority kernel, the part that does not depend on the
+ *  CPU
+ *
+ *  Each priority holds at most one thread, so the ready set is a bitmap
+ *  and the thread to run is its lowest set bit. Whatever changes that set
+ *  (a semaphore given, a message queued, a timeout in k_Tick(), from a
+ *  thread or an interrupt) pends a switch through the port, and the port
+ *  calls k_Switch() to save the old stack pointer and pick the new one:
+ *  PendSV on the board (kernel_port.c), ucontext in the host sim
+ *  (host_sim/kernel_host.c).
+ *
+ *  Blocking objects keep a bitmap of the priorities waiting on them. A
+ *  thread that is woken takes what it waited for again from the top, so a
+ *  higher priority thread that got there first is simply waited for again
+ *  until the timeout.
+ *
+ *  Switch time is measured from the pend to the first instruction of the
+ *  thread that was woken, with DWT->CYCCNT.
+ */
+
+#include "kernel.h"
+
+#if KERNEL_ENABLE
+
+#include "dwt.h"
+#include <stdio.h>
+#include <string.h>
+#include "report.h"
+
+k_Thread_t *volatile k_cur = NULL;
+volatile uint32_t k_ticks = 0;
+
+static k_Thread_t *k_threads[K_MAX_THREADS];
+static volatile uint32_t k_ready = 0;		// bit p: the thread of priority p can run
+static uint8_t k_running = 0;
+static uint32_t k_since;					// DWT cycles when k_cur was switched in
+static uint32_t k_pend_at;					// DWT cycles of the pending switch
+static uint8_t k_pending = 0;				// 1 while a switch is timed from k_pend_at
+
+static uint32_t k_switches = 0;
+static uint32_t k_sw_n = 0, k_sw_min = 0xFFFFFFFF, k_sw_max = 0;
+static uint64_t k_sw_sum = 0;
+static uint32_t k_stats_since;				// DWT cycles when the stats were cleared
+static uint8_t k_req = 0;					// 1 = print, 2 = print and clear
+
+static k_Thread_t k_idle;
+K_STACK(k_idle_stack, 128);
+
+/**
+ * @brief  Register a thread; it first runs once k_Start() is called
+ * @param  prio 0 runs first; each priority holds one thread, and
+ *         K_PRIO_IDLE is the kernel's
+ * @param  stack Its own stack of 'words' words, from K_STACK()
+ * @retval 0, -1 when the priority is taken or out of range
+ */
+int8_t k_Create(k_Thread_t *t, const char *name, uint8_t prio, k_Fn_t entry, void *arg, uint32_t *stack, uint16_t words)
+{
+	uint16_t i;
+	if(prio >= K_MAX_THREADS || k_threads[prio] != NULL || entry == NULL) return -1;
+	memset(t, 0, sizeof(*t));
+	t->name = name;
+	t->entry = entry;
+	t->arg = arg;
+	t->stack = stack;
+	t->stack_words = words;
+	t->prio = prio;
+	t->waited = 1;				// starts in k_Trampoline(), which ends a wait too
+	for(i = 0; i < words; i++) stack[i] = K_STACK_FILL;
+	t->sp = k_PortStack(t);
+	k_threads[prio] = t;
+	k_ready |= 1UL << prio;
+	return 0;
+}
+
+static void k_IdleThread(void *arg)
+{
+	for(;;) k_PortIdle();
+}
+
+static void k_Clear()
+{
+	uint8_t p;
+	for(p = 0; p < K_MAX_THREADS; p++){
+		if(k_threads[p] == NULL) continue;
+		k_threads[p]->runs = 0;
+		k_threads[p]->cycles = 0;
+	}
+	k_switches = 0;
+	k_sw_n = 0;
+	k_sw_min = 0xFFFFFFFF;
+	k_sw_max = 0;
+	k_sw_sum = 0;
+	k_stats_since = dwt_Cycles();
+}
+
+/**
+ * @brief  Run the highest priority thread; does not return on the board
+ *         (the host sim comes back here once the run is over)
+ */
+void k_Start()
+{
+	dwt_init();
+	k_Create(&k_idle, "idle", K_PRIO_IDLE, k_IdleThread, NULL, k_idle_stack, sizeof(k_idle_stack)/4);
+	k_Clear();
+	k_since = dwt_Cycles();
+	k_running = 1;
+	k_PortStart();
+}
+
+static void k_Pend()
+{
+	if(!k_pending){
+		k_pend_at = dwt_Cycles();
+		k_pending = 1;
+	}
+	k_PortPend();
+}
+
+// After a wait: the switch that brought this thread back is over
+static void k_Resumed()
+{
+	uint32_t d;
+	k_cur->waited = 0;
+	if(!k_pending) return;
+	d = dwt_Cycles() - k_pend_at;
+	k_pending = 0;
+	k_sw_n++;
+	k_sw_sum += d;
+	if(d < k_sw_min) k_sw_min = d;
+	if(d > k_sw_max) k_sw_max = d;
+}
+
+/**
+ * @brief  Called by the port with interrupts masked: keep 'sp' as the
+ *         stack pointer of the thread that stops and return the one of the
+ *         thread that runs next
+ */
+uint32_t *k_Switch(uint32_t *sp)
+{
+	k_Thread_t *next = k_threads[__builtin_ctz(k_ready)];	// the idle thread is always ready
+	uint32_t now = dwt_Cycles();
+	if(k_cur != NULL){
+		k_cur->sp = sp;
+		k_cur->cycles += now - k_since;
+	}
+	if(next != k_cur){
+		next->runs++;
+		k_switches++;
+	}
+	// Only a thread coming back from a wait times the switch; one that was
+	// preempted resumes wherever it was
+	if(next == k_cur || !next->waited) k_pending = 0;
+	k_since = now;
+	k_cur = next;
+	return next->sp;
+}
+
+/**
+ * @brief  First code of every thread
+ */
+void k_Trampoline(k_Thread_t *t)
+{
+	uint32_t pm;
+	k_Resumed();
+	t->entry(t->arg);
+	// The thread returned: it never runs again
+	pm = k_PortLock();
+	k_ready &= ~(1UL << t->prio);
+	k_Pend();
+	k_PortUnlock(pm);
+	for(;;);
+}
+
+// Locked: the highest waiter of 'set' can run again
+static void k_WakeOne(uint32_t *set)
+{
+	k_Thread_t *t = k_threads[__builtin_ctz(*set)];
+	*set &= ~(1UL << t->prio);
+	t->waitset = NULL;
+	t->timed = 0;
+	k_ready |= 1UL << t->prio;
+	if(k_cur == NULL || t->prio < k_cur->prio) k_Pend();
+}
+
+// Locked: k_cur stops until it is woken from 'set' or 'ms' go by; the
+// switch happens when the caller unlocks
+static void k_Block(uint32_t *set, uint32_t ms)
+{
+	k_Thread_t *t = k_cur;
+	t->waitset = set;
+	if(set != NULL) *set |= 1UL << t->prio;
+	t->timed = (ms != K_FOREVER);
+	t->wake = k_ticks + ms;
+	t->waited = 1;
+	k_ready &= ~(1UL << t->prio);
+	k_Pend();
+}
+
+// Locked, after a wakeup: 1 when a wait that started at 'start' for 'ms'
+// is over
+static uint8_t k_TimedOut(uint32_t start, uint32_t ms)
+{
+	return ms != K_FOREVER && k_ticks - start >= ms;
+}
+
+/**
+ * @brief  1ms tick, from SysTick: ends the timeouts that ran out
+ */
+void k_Tick()
+{
+	uint32_t pm;
+	uint8_t p;
+	if(!k_running) return;
+	pm = k_PortLock();
+	k_ticks++;
+	for(p = 0; p < K_MAX_THREADS; p++){
+		k_Thread_t *t = k_threads[p];
+		if(t == NULL || !t->timed || (int32_t)(k_ticks - t->wake) < 0) continue;
+		if(t->waitset != NULL) *t->waitset &= ~(1UL << p);
+		t->waitset = NULL;
+		t->timed = 0;
+		k_ready |= 1UL << p;
+		if(k_cur == NULL || p < k_cur->prio) k_Pend();
+	}
+	k_PortUnlock(pm);
+}
+
+void k_Sleep(uint32_t ms)
+{
+	uint32_t pm;
+	if(ms == 0) return;
+	pm = k_PortLock();
+	k_Block(NULL, ms);
+	k_PortUnlock(pm);
+	k_Resumed();
+}
+
+/**
+ * @brief  Sleep until *last + period_ms and move *last there, for a
+ *         periodic thread; a thread that is already late does not sleep
+ *         and picks up the period from now
+ */
+void k_SleepUntil(uint32_t *last, uint32_t period_ms)
+{
+	uint32_t pm = k_PortLock();
+	int32_t left;
+	*last += period_ms;
+	left = (int32_t)(*last - k_ticks);
+	if(left <= 0){
+		*last = k_ticks;
+		k_PortUnlock(pm);
+		return;
+	}
+	k_Block(NULL, left);
+	k_PortUnlock(pm);
+	k_Resumed();
+}
+
+/**
+ * @brief  Take one count, waiting up to ms (0 = not at all, K_FOREVER)
+ * @retval 0, -1 on timeout
+ */
+int8_t k_SemTake(k_Sem_t *s, uint32_t ms)
+{
+	uint32_t pm = k_PortLock();
+	uint32_t start = k_ticks;
+	while(s->count == 0){
+		if(k_TimedOut(start, ms)){
+			k_PortUnlock(pm);
+			return -1;
+		}
+		k_Block(&s->waiting, (ms == K_FOREVER) ? K_FOREVER : ms - (k_ticks - start));
+		k_PortUnlock(pm);
+		k_Resumed();
+		pm = k_PortLock();
+	}
+	s->count--;
+	k_PortUnlock(pm);
+	return 0;
+}
+
+/**
+ * @brief  Give one count, up to max; also from an interrupt
+ */
+void k_SemGive(k_Sem_t *s)
+{
+	uint32_t pm = k_PortLock();
+	if(s->count < s->max) s->count++;
+	if(s->waiting) k_WakeOne(&s->waiting);
+	k_PortUnlock(pm);
+}
+
+/**
+ * @brief  Copy one message in, waiting up to ms for room; from an
+ *         interrupt with ms = 0
+ * @retval 0, -1 when the queue stayed full (counted in drops)
+ */
+int8_t k_QueuePut(k_Queue_t *q, const void *msg, uint32_t ms)
+{
+	uint32_t pm = k_PortLock();
+	uint32_t start = k_ticks;
+	while(q->count == q->depth){
+		if(k_TimedOut(start, ms)){
+			q->drops++;
+			k_PortUnlock(pm);
+			return -1;
+		}
+		k_Block(&q->putters, (ms == K_FOREVER) ? K_FOREVER : ms - (k_ticks - start));
+		k_PortUnlock(pm);
+		k_Resumed();
+		pm = k_PortLock();
+	}
+	memcpy(q->buf + (uint32_t)((q->head + q->count) % q->depth)*q->size, msg, q->size);
+	q->count++;
+	if(q->count > q->high) q->high = q->count;
+	if(q->getters) k_WakeOne(&q->getters);
+	k_PortUnlock(pm);
+	return 0;
+}
+
+/**
+ * @brief  Copy the oldest message out, waiting up to ms for one
+ * @retval 0, -1 when the queue stayed empty
+ */
+int8_t k_QueueGet(k_Queue_t *q, void *msg, uint32_t ms)
+{
+	uint32_t pm = k_PortLock();
+	uint32_t start = k_ticks;
+	while(q->count == 0){
+		if(k_TimedOut(start, ms)){
+			k_PortUnlock(pm);
+			return -1;
+		}
+		k_Block(&q->getters, (ms == K_FOREVER) ? K_FOREVER : ms - (k_ticks - start));
+		k_PortUnlock(pm);
+		k_Resumed();
+		pm = k_PortLock();
+	}
+	memcpy(msg, q->buf + (uint32_t)q->head*q->size, q->size);
+	q->head = (q->head + 1) % q->depth;
+	q->count--;
+	if(q->putters) k_WakeOne(&q->putters);
+	k_PortUnlock(pm);
+	return 0;
+}
+
+/**
+ * @brief  Ask for the thread table at the next k_Poll(); reset = 1 also
+ *         clears the stats once printed
+ */
+void k_Request(uint8_t reset)
+{
+	rpt_Request(&k_req, reset);
+}
+
+/**
+ * @brief  Call from a thread, outside the code being measured
+ */
+void k_Poll()
+{
+	uint8_t req = rpt_Take(&k_req);
+	if(req == RPT_NONE) return;
+	k_Report();
+	if(req == RPT_CLEAR) k_Clear();
+}
+
+// Stack words never written since k_Create()
+static uint16_t k_StackFree(const k_Thread_t *t)
+{
+	uint16_t n = 0;
+	while(n < t->stack_words && t->stack[n] == K_STACK_FILL) n++;
+	return n;
+}
+
+/**
+ * @brief  Print one row per thread: switches in, CPU share since the stats
+ *         were cleared and free stack words; then the switch time
+ */
+void k_Report()
+{
+	char line[128];
+	uint32_t span = dwt_Cycles() - k_stats_since;
+	uint32_t mhz = SystemCoreClock/1000000;
+	uint16_t n, load;
+	uint8_t p;
+	n = sprintf(line, "\r\nKERNEL %lu ms, %lu switches\r\nthread   prio     runs   load  stack free\r\n",
+			(unsigned long)(span/(SystemCoreClock/1000)), (unsigned long)k_switches);
+	rpt_Write(line, n);
+	for(p = 0; p < K_MAX_THREADS; p++){
+		k_Thread_t *t = k_threads[p];
+		if(t == NULL) continue;
+		load = span ? (uint16_t)(t->cycles*1000/span) : 0;
+		n = sprintf(line, "%-8s %4u %8lu %3u.%u%% %5u/%u\r\n", t->name, t->prio, (unsigned long)t->runs,
+				load/10, load%10, k_StackFree(t), t->stack_words);
+		rpt_Write(line, n);
+	}
+	n = sprintf(line, "switch to a woken thread: %lu times, min %lu avg %lu max %lu cycles (%lu MHz)\r\n",
+			(unsigned long)k_sw_n, (unsigned long)(k_sw_n ? k_sw_min : 0),
+			(unsigned long)(k_sw_n ? k_sw_sum/k_sw_n : 0), (unsigned long)k_sw_max, (unsigned long)mhz);
+	rpt_Write(line, n);
+}
+
+#endif /* KERNEL_ENABLE */
@@ -0,0 +1,98 @@
+/*
+ * kernel_port.c
+ *
+ *  Cortex-M4F port of kernel.c
+ *
+ *  Threads run in thread mode on PSP; interrupts and the code before
+ *  k_Start() use MSP. A switch is PendSV at the lowest priority, so it
+ *  only runs once no interrupt is active and tail-chains behind the one
+ *  that woke a thread. The hardware stacks r0-r3, r12, lr, pc and xPSR;
+ *  PendSV adds r4-r11 and its EXC_RETURN. A thread that used the FPU has
+ *  bit 4 of EXC_RETURN clear: then s16-s31 are added too, and the
+ *  VSTMDB makes the lazily reserved s0-s15 get written first. A thread
+ *  that never touches the FPU costs nothing for it.
+ *
+ *  CubeMX must not generate PendSV_Handler (NVIC, Code generation), this
+ *  file has it.
+ */
+
+#include "kernel.h"
+#include "gov.h"
+
+#if KERNEL_ENABLE && !defined(HOST_SIM)
+
+#if defined(__FPU_USED) && (__FPU_USED == 1U)
+#define K_PORT_FPU	1
+#else
+#define K_PORT_FPU	0
+#endif
+
+#define K_EXC_RETURN	0xFFFFFFFDUL	// thread mode, PSP, no FP frame
+#define K_XPSR_THUMB	0x01000000UL
+
+// PSP while the first PendSV saves a context nobody resumes
+static uint32_t k_boot_frame[32] __attribute__((aligned(8)));
+
+/**
+ * @brief  Initial stack of a thread: a frame PendSV returns from into
+ *         k_Trampoline(t)
+ */
+uint32_t *k_PortStack(k_Thread_t *t)
+{
+	uint32_t *sp = (uint32_t*)((uint32_t)(t->stack + t->stack_words) & ~7UL);
+	uint8_t i;
+	*--sp = K_XPSR_THUMB;
+	*--sp = (uint32_t)k_Trampoline & ~1UL;		// pc
+	*--sp = 0;									// lr: k_Trampoline() does not return
+	for(i = 0; i < 4; i++) *--sp = 0;			// r12, r3, r2, r1
+	*--sp = (uint32_t)t;						// r0
+	*--sp = K_EXC_RETURN;
+	for(i = 0; i < 8; i++) *--sp = 0;			// r11-r4
+	return sp;
+}
+
+void k_PortPend()
+{
+	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+void k_PortStart()
+{
+	NVIC_SetPriority(PendSV_IRQn, (1UL << __NVIC_PRIO_BITS) - 1);
+	__set_PSP((uint32_t)(k_boot_frame + 32));
+	k_PortPend();
+	__enable_irq();
+	for(;;);									// PendSV leaves main() for good
+}
+
+void k_PortIdle()
+{
+	gov_Idle();
+	__WFI();
+}
+
+__attribute__((naked)) void PendSV_Handler(void)
+{
+	__asm volatile(
+		"	mrs		r0, psp				\n"
+#if K_PORT_FPU
+		"	tst		lr, #0x10			\n"
+		"	it		eq					\n"
+		"	vstmdbeq	r0!, {s16-s31}	\n"
+#endif
+		"	stmdb	r0!, {r4-r11, lr}	\n"
+		"	cpsid	i					\n"
+		"	bl		k_Switch			\n"		// r0: old sp in, new sp out
+		"	cpsie	i					\n"
+		"	ldmia	r0!, {r4-r11, lr}	\n"
+#if K_PORT_FPU
+		"	tst		lr, #0x10			\n"
+		"	it		eq					\n"
+		"	vldmiaeq	r0!, {s16-s31}	\n"
+#endif
+		"	msr		psp, r0				\n"
+		"	bx		lr					\n"
+	);
+}
+
+#endif /* KERNEL_ENABLE && !HOST_SIM */
@@ -0,0 +1,166 @@
+/*
+ * latency.c
+ *
+ *  Key-to-pixel latency probe
+ *
+ *  A sample starts when button_Scan() sees button_count[LAT_KEY] reach 1,
+ *  gets its FSM stamp when clock_fsm acts on the press and names the field
+ *  it changed, its draw stamp from the first lcd_AddressSet() window that
+ *  overlaps that field, and ends at lat_EndPass() after clock_fsm_run().
+ *  A press the FSM ignores (view mode) is dropped at the end of the pass.
+ *
+ *  Each hop keeps min/max/sum and a log-linear histogram (4 buckets per
+ *  power of two, so a bucket is at most 25% wide) for the p99.
+ */
+
+#include "latency.h"
+
+#if LAT_ENABLE
+
+#if !LCD_WINDOW_HOOK
+#error "LAT_ENABLE needs LCD_WINDOW_HOOK=1"
+#endif
+
+#include "dwt.h"
+#include "lcd.h"
+#include "uart.h"
+#include <stdio.h>
+#include <string.h>
+
+#define LAT_BUCKETS		124
+
+typedef struct {
+	uint32_t n;
+	uint32_t min, max;
+	uint64_t sum;
+	uint16_t hist[LAT_BUCKETS];
+} lat_Stat_t;
+
+static lat_Stat_t lat_stat[LAT_HOPS];
+
+static struct {
+	uint8_t state;			// 0 idle, 1 edge seen, 2 handled, 3 drawn
+	uint32_t t_edge, t_fsm, t_draw;
+	uint16_t x1, y1, x2, y2;
+} lat_cur;
+
+static uint8_t lat_Bucket(uint32_t v)
+{
+	uint8_t msb = 31;
+	if(v < 4) return v;
+	while(!(v & (1UL << msb))) msb--;
+	return 4*(msb - 1) + ((v >> (msb - 2)) & 3);
+}
+
+// Largest value that falls in bucket b
+static uint32_t lat_BucketTop(uint8_t b)
+{
+	uint8_t msb;
+	if(b < 4) return b;
+	msb = b/4 + 1;
+	return (((uint32_t)(4 + b%4) + 1) << (msb - 2)) - 1;
+}
+
+static void lat_Add(lat_Hop_t hop, uint32_t v)
+{
+	lat_Stat_t *s = &lat_stat[hop];
+	if(s->n == 0 || v < s->min) s->min = v;
+	if(v > s->max) s->max = v;
+	s->sum += v;
+	s->n++;
+	if(s->hist[lat_Bucket(v)] < 0xffff) s->hist[lat_Bucket(v)]++;
+}
+
+void lat_init()
+{
+	dwt_init();
+	memset(lat_stat, 0, sizeof(lat_stat));
+	lat_cur.state = 0;
+}
+
+/**
+ * @brief  From button_Scan(): count of LAT_KEY after this scan
+ */
+void lat_Key(uint16_t count)
+{
+	if(count != 1 || lat_cur.state != 0) return;
+	lat_cur.t_edge = dwt_Cycles();
+	lat_cur.state = 1;
+}
+
+/**
+ * @brief  From the FSM: the press changed the field at x,y (w x h pixels)
+ */
+void lat_Handled(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+	if(lat_cur.state != 1) return;
+	lat_cur.t_fsm = dwt_Cycles();
+	lat_cur.x1 = x;
+	lat_cur.y1 = y;
+	lat_cur.x2 = x + w - 1;
+	lat_cur.y2 = y + h - 1;
+	lat_cur.state = 2;
+}
+
+/**
+ * @brief  From lcd_AddressSet(): every window the drawing code opens
+ */
+void lcd_WindowHook(uint16_t x1,uint16_t y1,uint16_t x2,uint16_t y2)
+{
+	if(lat_cur.state != 2) return;
+	if(x2 < lat_cur.x1 || x1 > lat_cur.x2 || y2 < lat_cur.y1 || y1 > lat_cur.y2) return;
+	lat_cur.t_draw = dwt_Cycles();
+	lat_cur.state = 3;
+}
+
+/**
+ * @brief  After clock_fsm_run(): closes the sample of this pass
+ */
+void lat_EndPass()
+{
+	uint32_t t;
+	if(lat_cur.state == 3){
+		t = dwt_Cycles();
+		lat_Add(LAT_EDGE_FSM, lat_cur.t_fsm - lat_cur.t_edge);
+		lat_Add(LAT_FSM_DRAW, lat_cur.t_draw - lat_cur.t_fsm);
+		lat_Add(LAT_DRAW_FRAME, t - lat_cur.t_draw);
+		lat_Add(LAT_TOTAL, t - lat_cur.t_edge);
+	}
+	lat_cur.state = 0;
+}
+
+static uint32_t lat_P99(const lat_Stat_t *s)
+{
+	uint32_t need = s->n - s->n/100, seen = 0;
+	uint8_t b;
+	for(b = 0; b < LAT_BUCKETS; b++){
+		seen += s->hist[b];
+		if(seen >= need) return (lat_BucketTop(b) < s->max) ? lat_BucketTop(b) : s->max;
+	}
+	return s->max;
+}
+
+/**
+ * @brief  Print the table on USART1, times in microseconds
+ */
+void lat_Report()
+{
+	static const char *name[LAT_HOPS] = {"edge->fsm", "fsm->draw", "draw->frame", "total"};
+	char line[96];
+	uint32_t mhz = SystemCoreClock/1000000;
+	uint8_t i;
+	const lat_Stat_t *s;
+	sprintf(line, "\r\nlatency SW%u n=%lu (us)\r\nhop              min      avg      p99      max\r\n",
+			LAT_KEY, (unsigned long)lat_stat[LAT_TOTAL].n);
+	uart_Rs232SendString((uint8_t*)line);
+	for(i = 0; i < LAT_HOPS; i++){
+		s = &lat_stat[i];
+		if(s->n == 0) continue;
+		sprintf(line, "%-12s %8lu %8lu %8lu %8lu\r\n", name[i], (unsigned long)(s->min/mhz),
+				(unsigned long)(s->sum/s->n/mhz), (unsigned long)(lat_P99(s)/mhz),
+				(unsigned long)(s->max/mhz));
+		uart_Rs232SendString((uint8_t*)line);
+	}
+}
+
+#endif /* LAT_ENABLE */
@@ -7,30 +7,109 @@
 
 #include "lcd.h"
 #include "lcdfont.h"
+#include "prof.h"
+#if LCD_USE_FRAMEBUFFER
+#include "sram.h"
+#endif
 
 unsigned char s[50];
 
 _lcd_dev lcddev;
 
+#if LCD_BUS_STATS
+_lcd_bus lcd_bus;
+static uint8_t lcd_bus_gram;	// data cycles are pixels after 0x2C/0x3C
+#endif
+
 void LCD_WR_REG(uint16_t reg) //
 {
+#if LCD_BUS_STATS
+	lcd_bus.reg++;
+	if(reg==0x2b)lcd_bus.windows++;
+	lcd_bus_gram=(reg==0x2c||reg==0x3c);
+#endif
+#ifdef HOST_SIM
+	ili9341_WriteReg(reg);
+#else
 	LCD->LCD_REG=reg;
+#endif
 }
 
 void LCD_WR_DATA(uint16_t data)
 {
+#if LCD_BUS_STATS
+	lcd_bus.data++;
+	lcd_bus.pixels+=lcd_bus_gram;
+#endif
+#ifdef HOST_SIM
+	ili9341_WriteData(data);
+#else
 	LCD->LCD_RAM=data;
+#endif
 }
 
 uint16_t LCD_RD_DATA(void)
 {
+#ifdef HOST_SIM
+	return ili9341_ReadData();
+#else
 	__IO uint16_t ram;
 	ram=LCD->LCD_RAM;
 	return ram;
+#endif
+}
+
+#if LCD_USE_FRAMEBUFFER
+// Frame store in external SRAM. lcd_AddressSet only moves a window over it and
+// pixels are written with the same auto-increment as the panel's GRAM, so the
+// drawing primitives do not care which backend is active.
+static uint16_t *fb;
+static uint16_t fb_x1,fb_y1,fb_x2,fb_y2;	// current window
+static uint16_t fb_x,fb_y;					// next pixel in the window
+static uint32_t fb_dirty[(LCD_FB_HEIGHT+31)/32];	// one bit per row, main loop only
+
+// lcd_Display() moves fb_dirty here and the flush walks only this copy, so
+// a row drawn while the DMA runs stays in fb_dirty for the next flush even
+// when the DMA sent it half drawn
+static volatile uint8_t fb_flush_busy=0;
+static uint32_t fb_flush_rows[(LCD_FB_HEIGHT+31)/32];
+static uint16_t fb_flush_row;
+static const uint16_t *fb_flush_src;
+static uint32_t fb_flush_left;
+
+static void lcd_FbFlushNext(void);
+static void lcd_FbFlushChunk(void);
+static void lcd_FbWait(void);
+#ifdef HOST_SIM
+uint8_t lcd_fb_async=0;
+void (*lcd_fb_pixel_hook)(void)=NULL;
+static uint8_t fb_dma_pending=0;
+#else
+DMA_HandleTypeDef hdma_memtomem_dma2_stream0;
+static void lcd_FbDmaCplt(DMA_HandleTypeDef *hdma);
+static void lcd_FbDmaInit(void);
+#endif
+#endif
+
+static inline void lcd_WritePixel(uint16_t color)
+{
+#if LCD_USE_FRAMEBUFFER
+	if(fb_x<lcddev.width&&fb_y<lcddev.height)fb[fb_y*lcddev.width+fb_x]=color;
+#ifdef HOST_SIM
+	if(lcd_fb_pixel_hook)lcd_fb_pixel_hook();
+#endif
+	if(fb_x++==fb_x2)
+	{
+		fb_x=fb_x1;
+		if(fb_y++==fb_y2)fb_y=fb_y1;
+	}
+#else
+	LCD_WR_DATA(color);
+#endif
 }
 
 
-void lcd_AddressSet(uint16_t x1,uint16_t y1,uint16_t x2,uint16_t y2)
+static void lcd_PanelAddressSet(uint16_t x1,uint16_t y1,uint16_t x2,uint16_t y2)
 {
 		LCD_WR_REG(0x2a);
 		LCD_WR_DATA(x1>>8);
@@ -45,6 +124,23 @@ void lcd_AddressSet(uint16_t x1,uint16_t y1,uint16_t x2,uint16_t y2)
 		LCD_WR_REG(0x2c);
 }
 
+void lcd_AddressSet(uint16_t x1,uint16_t y1,uint16_t x2,uint16_t y2)
+{
+#if LCD_WINDOW_HOOK
+	lcd_WindowHook(x1,y1,x2,y2);
+#endif
+#if LCD_USE_FRAMEBUFFER
+	uint16_t y;
+	fb_x1=fb_x=x1;
+	fb_y1=fb_y=y1;
+	fb_x2=x2;
+	fb_y2=y2;
+	for(y=y1;y<=y2&&y<LCD_FB_HEIGHT;y++)fb_dirty[y>>5]|=1UL<<(y&31);
+#else
+	lcd_PanelAddressSet(x1,y1,x2,y2);
+#endif
+}
+
 
 void lcd_SetCursor(uint16_t x,uint16_t y)
 {
@@ -56,18 +152,66 @@ void lcd_SetCursor(uint16_t x,uint16_t y)
 	LCD_WR_DATA(y&0xff);
 }
 
+// Commands must not land in the middle of a framebuffer flush
+static void lcd_PanelIdle(void)
+{
+#if LCD_USE_FRAMEBUFFER
+	lcd_FbWait();
+#endif
+}
+
 void lcd_DisplayOn(void)
 {
+	lcd_PanelIdle();
 	LCD_WR_REG(0X29);
 }
 
 void lcd_DisplayOff(void)
 {
+	lcd_PanelIdle();
 	LCD_WR_REG(0X28);
 }
 
+/**
+  * @brief  Only scan panel lines y1..y2, the rest shows black
+  * @note   Lines are GRAM rows in the portrait orientation set by lcd_init.
+  *         GRAM outside the area keeps its contents.
+  */
+void lcd_PartialArea(uint16_t y1,uint16_t y2)
+{
+	lcd_PanelIdle();
+	LCD_WR_REG(0x30);
+	LCD_WR_DATA(y1>>8);
+	LCD_WR_DATA(y1&0xff);
+	LCD_WR_DATA(y2>>8);
+	LCD_WR_DATA(y2&0xff);
+	LCD_WR_REG(0x12);
+}
+
+/**
+  * @brief  Leave partial mode, scan the whole panel
+  */
+void lcd_NormalMode(void)
+{
+	lcd_PanelIdle();
+	LCD_WR_REG(0x13);
+}
+
+/**
+  * @brief  1 = idle mode (8 colours, lower frame rate), 0 = full colour
+  */
+void lcd_IdleMode(uint8_t on)
+{
+	lcd_PanelIdle();
+	LCD_WR_REG(on?0x39:0x38);
+}
+
 uint16_t lcd_ReadPoint(uint16_t x,uint16_t y)
 {
+#if LCD_USE_FRAMEBUFFER
+	if(x>=lcddev.width||y>=lcddev.height)return 0;
+	return fb[y*lcddev.width+x];
+#else
  	uint16_t r=0,g=0,b=0;
 	lcd_SetCursor(x,y);
 	LCD_WR_REG(0X2E);
@@ -77,22 +221,20 @@ uint16_t lcd_ReadPoint(uint16_t x,uint16_t y)
 	g=r&0XFF;
 	g<<=8;
 	return (((r>>11)<<11)|((g>>10)<<5)|(b>>11));
+#endif
 }
 
 
 void lcd_Clear(uint16_t color) //
 {
 	uint16_t i,j;
-	uint8_t buffer[2];
-	buffer[0] = color >> 8;
-	buffer[1] = color;
+	PROF_ZONE("lcd_Clear");
 	lcd_AddressSet(0,0,lcddev.width-1,lcddev.height-1);
 	for(i=0;i<lcddev.width;i++)
 	{
 		for(j=0;j<lcddev.height;j++)
 		{
-			LCD_WR_DATA(color);
-//			sram_WriteBuffer(&buffer, (i*lcddev.width+j)*4, 2);
+			lcd_WritePixel(color);
 		}
 	}
 }
@@ -100,12 +242,13 @@ void lcd_Clear(uint16_t color) //
 void lcd_Fill(uint16_t xsta,uint16_t ysta,uint16_t xend,uint16_t yend,uint16_t color) //add a hcn = 1 mau car been trogn
 {
 	uint16_t i,j;
+	PROF_ZONE("lcd_Fill");
 	lcd_AddressSet(xsta,ysta,xend-1,yend-1);
 	for(i=ysta;i<yend;i++)
 	{
 		for(j=xsta;j<xend;j++)
 		{
-			LCD_WR_DATA(color);
+			lcd_WritePixel(color);
 		}
 	}
 }
@@ -113,7 +256,7 @@ void lcd_Fill(uint16_t xsta,uint16_t ysta,uint16_t xend,uint16_t yend,uint16_t c
 void lcd_DrawPoint(uint16_t x,uint16_t y,uint16_t color) // 1 ddieemr anhr
 {
 	lcd_AddressSet(x,y,x,y);//ÉèÖÃ¹â±êÎ»ÖÃ
-	LCD_WR_DATA(color);
+	lcd_WritePixel(color);
 }
 
 void lcd_DrawLine(uint16_t x1,uint16_t y1,uint16_t x2,uint16_t y2,uint16_t color) // ve duong
@@ -121,6 +264,7 @@ void lcd_DrawLine(uint16_t x1,uint16_t y1,uint16_t x2,uint16_t y2,uint16_t color
 	uint16_t t;
 	int xerr=0,yerr=0,delta_x,delta_y,distance;
 	int incx,incy,uRow,uCol;
+	PROF_ZONE("lcd_DrawLine");
 	delta_x=x2-x1;
 	delta_y=y2-y1;
 	uRow=x1;
@@ -154,52 +298,84 @@ void lcd_DrawLine(uint16_t x1,uint16_t y1,uint16_t x2,uint16_t y2,uint16_t color
 
 void lcd_DrawRectangle(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2,uint16_t color) // ve hcn(vien
 {
+	PROF_ZONE("lcd_DrawRectangle");
 	lcd_DrawLine(x1,y1,x2,y1,color);
 	lcd_DrawLine(x1,y1,x1,y2,color);
 	lcd_DrawLine(x1,y2,x2,y2,color);
 	lcd_DrawLine(x2,y1,x2,y2,color);
 }
 
+// Glyph blitters, one per font geometry. The row emitters are unrolled bit by
+// bit and the glyph width, bytes per row and table are fixed per function.
+// With PROF_ENABLE each whole-glyph blitter is its own zone, so the "prof"
+// table gives the cycles per opaque glyph of every size.
+#define LCD_PIX(m)		lcd_WritePixel((bits&(m))?fc:bc)
+#define LCD_BITS4(r)	{uint8_t bits=(r);LCD_PIX(0x01);LCD_PIX(0x02);LCD_PIX(0x04);LCD_PIX(0x08);}
+#define LCD_BITS6(r)	{uint8_t bits=(r);LCD_PIX(0x01);LCD_PIX(0x02);LCD_PIX(0x04);LCD_PIX(0x08); \
+						LCD_PIX(0x10);LCD_PIX(0x20);}
+#define LCD_BITS8(r)	{uint8_t bits=(r);LCD_PIX(0x01);LCD_PIX(0x02);LCD_PIX(0x04);LCD_PIX(0x08); \
+						LCD_PIX(0x10);LCD_PIX(0x20);LCD_PIX(0x40);LCD_PIX(0x80);}
+
+#define LCD_FONT(name,sizey,bpr,ROW) \
+static void lcd_Row##name(const uint8_t *g,uint16_t fc,uint16_t bc) \
+{ \
+	ROW \
+} \
+static void lcd_Blit##name(const uint8_t *g,uint16_t fc,uint16_t bc) \
+{ \
+	uint8_t r; \
+	PROF_ZONE("lcd_Blit" #name); \
+	for(r=0;r<sizey;r++,g+=bpr) {ROW} \
+}
+
+LCD_FONT(1206,12,1,LCD_BITS6(g[0]))
+LCD_FONT(1608,16,1,LCD_BITS8(g[0]))
+LCD_FONT(2412,24,2,LCD_BITS8(g[0]) LCD_BITS4(g[1]))
+LCD_FONT(3216,32,2,LCD_BITS8(g[0]) LCD_BITS8(g[1]))
+
+typedef struct
+{
+	const uint8_t *table;		// glyph of ' '
+	uint8_t bytes;				// bytes per glyph
+	uint8_t bpr;				// bytes per glyph row
+	void (*row)(const uint8_t *g,uint16_t fc,uint16_t bc);
+	void (*blit)(const uint8_t *g,uint16_t fc,uint16_t bc);
+}lcd_Font_t;
+
+// Indexed by sizey/4
+static const lcd_Font_t lcd_font[9]={
+	[3]={ascii_1206[0],sizeof(ascii_1206[0]),1,lcd_Row1206,lcd_Blit1206},
+	[4]={ascii_1608[0],sizeof(ascii_1608[0]),1,lcd_Row1608,lcd_Blit1608},
+	[6]={ascii_2412[0],sizeof(ascii_2412[0]),2,lcd_Row2412,lcd_Blit2412},
+	[8]={ascii_3216[0],sizeof(ascii_3216[0]),2,lcd_Row3216,lcd_Blit3216},
+};
+
+static const lcd_Font_t *lcd_FontFor(uint8_t sizey)
+{
+	if((sizey&3)||sizey>32||lcd_font[sizey>>2].blit==NULL) return NULL;
+	return &lcd_font[sizey>>2];
+}
+
 void lcd_ShowChar(uint16_t x,uint16_t y,uint8_t num,uint16_t fc,uint16_t bc,uint8_t sizey,uint8_t mode) // 1ky tu size = 12 16 24 32, fc: mau chuw, bc, mauf neefn, mode: hien neen
 {
-	uint8_t temp,sizex,t,m=0;
-	uint16_t i,TypefaceNum;
-	uint16_t x0=x;
-	sizex=sizey/2;
-	TypefaceNum=(sizex/8+((sizex%8)?1:0))*sizey;
-	num=num-' ';
-	lcd_AddressSet(x,y,x+sizex-1,y+sizey-1);
-	for(i=0;i<TypefaceNum;i++)
+	const lcd_Font_t *f=lcd_FontFor(sizey);
+	const uint8_t *g;
+	uint8_t sizex=sizey/2,r,t,temp;
+	PROF_ZONE("lcd_ShowChar");
+	if(f==NULL||num<' '||num>'~') return;
+	g=f->table+(num-' ')*f->bytes;
+	if(!mode)
+	{
+		lcd_AddressSet(x,y,x+sizex-1,y+sizey-1);
+		f->blit(g,fc,bc);
+		return;
+	}
+	for(r=0;r<sizey;r++)
 	{
-		if(sizey==12);
-		else if(sizey==16)temp=ascii_1608[num][i];
-		else if(sizey==24)temp=ascii_2412[num][i];
-		else if(sizey==32)temp=ascii_3216[num][i];
-		else return;
-		for(t=0;t<8;t++)
+		for(t=0;t<sizex;t++)
 		{
-			if(!mode)
-			{
-				if(temp&(0x01<<t))LCD_WR_DATA(fc);
-				else LCD_WR_DATA(bc);
-				m++;
-				if(m%sizex==0)
-				{
-					m=0;
-					break;
-				}
-			}
-			else
-			{
-				if(temp&(0x01<<t))lcd_DrawPoint(x,y,fc);
-				x++;
-				if((x-x0)==sizex)
-				{
-					x=x0;
-					y++;
-					break;
-				}
-			}
+			temp=g[r*f->bpr+(t>>3)];
+			if(temp&(0x01<<(t&7)))lcd_DrawPoint(x+t,y+r,fc);
 		}
 	}
 }
@@ -216,6 +392,7 @@ void lcd_ShowIntNum(uint16_t x,uint16_t y,uint16_t num,uint8_t len,uint16_t fc,u
 	uint8_t t,temp;
 	uint8_t enshow=0;
 	uint8_t sizex=sizey/2;
+	PROF_ZONE("lcd_ShowIntNum");
 	for(t=0;t<len;t++)
 	{
 		temp=(num/mypow(10,len-t-1))%10;
@@ -237,6 +414,7 @@ void lcd_ShowFloatNum1(uint16_t x,uint16_t y,float num,uint8_t len,uint16_t fc,u
 {
 	uint8_t t,temp,sizex;
 	uint16_t num1;
+	PROF_ZONE("lcd_ShowFloatNum1");
 	sizex=sizey/2;
 	num1=num*100;
 	for(t=0;t<len;t++)
@@ -257,6 +435,7 @@ void lcd_ShowPicture(uint16_t x,uint16_t y,uint16_t length,uint16_t width,const
 	uint8_t picH,picL;
 	uint16_t i,j;
 	uint32_t k=0;
+	PROF_ZONE("lcd_ShowPicture");
 	lcd_AddressSet(x,y,x+length-1,y+width-1);
 	for(i=0;i<length;i++)
 	{
@@ -264,7 +443,7 @@ void lcd_ShowPicture(uint16_t x,uint16_t y,uint16_t length,uint16_t width,const
 		{
 			picH=pic[k*2];
 			picL=pic[k*2+1];
-			LCD_WR_DATA(picH<<8|picL);
+			lcd_WritePixel(picH<<8|picL);
 			k++;
 		}
 	}
@@ -287,6 +466,13 @@ void lcd_SetDir(uint8_t dir) //chinh huong man hinh
 
 void lcd_init(void)
 {
+#if LCD_USE_FRAMEBUFFER
+	sram_init();
+	fb=sram_GetBuffer();
+#ifndef HOST_SIM
+	lcd_FbDmaInit();
+#endif
+#endif
 	HAL_GPIO_WritePin(FSMC_RES_GPIO_Port, FSMC_RES_Pin, GPIO_PIN_RESET);
 	HAL_Delay(500);
 	HAL_GPIO_WritePin(FSMC_RES_GPIO_Port, FSMC_RES_Pin, GPIO_PIN_SET);
@@ -418,6 +604,7 @@ void _draw_circle_8(int xc, int yc, int x, int y, uint16_t c)
 void lcd_DrawCircle(int xc, int yc,uint16_t c,int r, int fill) //ve duong or hinh, c: color
 {
 	int x = 0, y = r, yi, d;
+	PROF_ZONE("lcd_DrawCircle");
 
 	d = 3 - 2 * r;
 
@@ -451,30 +638,105 @@ void lcd_DrawCircle(int xc, int yc,uint16_t c,int r, int fill) //ve duong or hin
 	}
 }
 
+static uint8_t lcd_IsGlyph(uint8_t c)
+{
+	return c>=' '&&c<='~';
+}
+
+// n glyphs on one line behind a single address window: glyph row 0 of every
+// character left to right, then row 1, and so on
+static void lcd_ShowRun(uint16_t x,uint16_t y,const uint8_t *str,uint16_t n,uint16_t fc,uint16_t bc,uint8_t sizey)
+{
+	const lcd_Font_t *f=lcd_FontFor(sizey);
+	uint8_t row;
+	uint16_t i;
+	lcd_AddressSet(x,y,x+n*(sizey/2)-1,y+sizey-1);
+	for(row=0;row<sizey;row++)
+	{
+		for(i=0;i<n;i++)
+		{
+			f->row(f->table+(str[i]-' ')*f->bytes+row*f->bpr,fc,bc);
+		}
+	}
+}
+
+#define FIND_GB(tbl)	for(k=0;k<sizeof(tbl)/sizeof(tbl[0]);k++) \
+							if(tbl[k].Index[0]==s[0]&&tbl[k].Index[1]==s[1]){msk=tbl[k].Msk;break;}
+
+// Two byte GB2312 code from tfont16/24/32. Codes missing from the table are
+// drawn as an empty cell so the rest of the string stays aligned; sizes
+// without a table draw nothing, the caller still moves past the cell.
+static void lcd_ShowChinese(uint16_t x,uint16_t y,const uint8_t *s,uint16_t fc,uint16_t bc,uint8_t sizey,uint8_t mode)
+{
+	const uint8_t *msk=NULL;
+	uint16_t k;
+	uint8_t bpr=sizey/8,row,b,t,temp;
+	switch(sizey)
+	{
+	case 16: FIND_GB(tfont16); break;
+	case 24: FIND_GB(tfont24); break;
+	case 32: FIND_GB(tfont32); break;
+	default: return;
+	}
+	if(!mode)lcd_AddressSet(x,y,x+sizey-1,y+sizey-1);
+	for(row=0;row<sizey;row++)
+	{
+		for(b=0;b<bpr;b++)
+		{
+			temp=msk?msk[row*bpr+b]:0;
+			for(t=0;t<8;t++)
+			{
+				if(!mode)
+				{
+					if(temp&(0x01<<t))lcd_WritePixel(fc);
+					else lcd_WritePixel(bc);
+				}
+				else if(temp&(0x01<<t))lcd_DrawPoint(x+b*8+t,y+row,fc);
+			}
+		}
+	}
+}
+
 void lcd_ShowStr(uint16_t x, uint16_t y,uint8_t *str,uint16_t fc, uint16_t bc,uint8_t sizey,uint8_t mode)
 {
 	uint16_t x0=x;
-  uint8_t bHz=0;
+	uint8_t sizex=sizey/2;
+	uint16_t n,i;
+	PROF_ZONE("lcd_ShowStr");
+	if(lcd_FontFor(sizey)==NULL) return;
 	while(*str!=0)
 	{
-		if(!bHz)
+		if(y>(lcddev.height-sizey)) return;
+		if(*str=='\r'||*str=='\n')
+		{
+			if(str[0]=='\r'&&str[1]=='\n') str++;
+			str++;
+			y+=sizey;
+			x=x0;
+		}
+		else if(*str>=0x80)
+		{
+			if(str[1]==0||x>(lcddev.width-sizey)) return;
+			lcd_ShowChinese(x,y,str,fc,bc,sizey,mode);
+			str+=2;
+			x+=sizey;
+		}
+		else if(!lcd_IsGlyph(*str))
 		{
-			if(x>(lcddev.width-sizey/2)||y>(lcddev.height-sizey)) return;
-			if(*str>0x80)bHz=1;
-			else
+			str++;
+		}
+		else
+		{
+			// Measure the run of glyphs that still fit on this line
+			for(n=0;lcd_IsGlyph(str[n])&&x+(n+1)*sizex<=lcddev.width;n++);
+			if(n==0) return;
+			if(mode)
 			{
-				if(*str==0x0D)
-				{
-					y+=sizey;
-					x=x0;
-					str++;
-				}else
-				{
-					lcd_ShowChar(x,y,*str,fc,bc,sizey,mode);
-					x+=sizey/2;
-				}
-			  str++;
+				for(i=0;i<n;i++) lcd_ShowChar(x+i*sizex,y,str[i],fc,bc,sizey,1);
 			}
+			else lcd_ShowRun(x,y,str,n,fc,bc,sizey);
+			str+=n;
+			x+=n*sizex;
 		}
 	}
 }
@@ -500,22 +762,157 @@ void DrawTestPage(uint8_t *str)
 //	  lcd_ShowPicture(0, 20, 240, 280, gImage_traffic);
 //}
 
-void lcd_Display(){
-	uint16_t i,j;
-	uint8_t buffer[2];
-	uint16_t send;
-	lcd_AddressSet(0,0,lcddev.width-1,lcddev.height-1);//ÉèÖÃÏÔÊ¾·¶Î§
-	for(i=0;i<lcddev.width;i++)
+#if LCD_USE_FRAMEBUFFER
+static uint8_t lcd_FbRowQueued(uint16_t y)
+{
+	return (fb_flush_rows[y>>5]>>(y&31))&1;
+}
+
+static void lcd_FbChunkDone(void)
+{
+	if(fb_flush_left)lcd_FbFlushChunk();
+	else lcd_FbFlushNext();
+}
+
+static void lcd_FbFlushChunk(void)
+{
+	uint32_t n=(fb_flush_left>0xFFFF)?0xFFFF:fb_flush_left;	// DMA NDTR is 16 bit
+	const uint16_t *src=fb_flush_src;
+	fb_flush_src+=n;
+	fb_flush_left-=n;
+#ifdef HOST_SIM
+	while(n--)LCD_WR_DATA(*src++);
+	if(lcd_fb_async)fb_dma_pending=1;
+	else lcd_FbChunkDone();
+#else
+#if LCD_BUS_STATS
+	lcd_bus.data+=n;
+	lcd_bus.pixels+=n;
+#endif
+	HAL_DMA_Start_IT(&hdma_memtomem_dma2_stream0,(uint32_t)src,(uint32_t)&LCD->LCD_RAM,n);
+#endif
+}
+
+// Send the next run of consecutive dirty rows, or finish the flush
+static void lcd_FbFlushNext(void)
+{
+	uint16_t y0;
+	while(fb_flush_row<lcddev.height&&!lcd_FbRowQueued(fb_flush_row))fb_flush_row++;
+	if(fb_flush_row>=lcddev.height)
 	{
-		for(j=0;j<lcddev.height;j++)
-		{
-//			sram_ReadBuffer(buffer, (i*lcddev.width+j)*4, 2);
-//			sram_ReadBuffer(&buffer[1], (i*lcddev.width+j+1)*4, 1);
-//			send = buffer[0];
-//			send = send << 8;
-//			send |= buffer[1];
-			LCD_WR_DATA(send);
-		}
+		fb_flush_busy=0;
+		return;
 	}
+	y0=fb_flush_row;
+	while(fb_flush_row<lcddev.height&&lcd_FbRowQueued(fb_flush_row))fb_flush_row++;
+	lcd_PanelAddressSet(0,y0,lcddev.width-1,fb_flush_row-1);
+	fb_flush_src=&fb[y0*lcddev.width];
+	fb_flush_left=(uint32_t)(fb_flush_row-y0)*lcddev.width;
+	lcd_FbFlushChunk();
 }
 
+static void lcd_FbWait(void)
+{
+	while(fb_flush_busy)
+	{
+#ifdef HOST_SIM
+		lcd_FbDmaIrq();
+#endif
+	}
+}
+
+#ifdef HOST_SIM
+/**
+  * @brief  With lcd_fb_async: the transfer complete interrupt of the chunk
+  *         on the bus, if there is one
+  */
+void lcd_FbDmaIrq(void)
+{
+	if(!fb_dma_pending)return;
+	fb_dma_pending=0;
+	lcd_FbChunkDone();
+}
+#else
+static void lcd_FbDmaCplt(DMA_HandleTypeDef *hdma)
+{
+	lcd_FbChunkDone();
+}
+
+// DMA2 stream 0, memory to memory: the peripheral port walks the frame store,
+// the memory port stays on LCD->LCD_RAM. Not in the .ioc, so DMA2 stays off
+// on boards without the SRAM; the IRQ handler is in stm32f4xx_it.c.
+static void lcd_FbDmaInit(void)
+{
+	__HAL_RCC_DMA2_CLK_ENABLE();
+	hdma_memtomem_dma2_stream0.Instance=DMA2_Stream0;
+	hdma_memtomem_dma2_stream0.Init.Channel=DMA_CHANNEL_0;
+	hdma_memtomem_dma2_stream0.Init.Direction=DMA_MEMORY_TO_MEMORY;
+	hdma_memtomem_dma2_stream0.Init.PeriphInc=DMA_PINC_ENABLE;
+	hdma_memtomem_dma2_stream0.Init.MemInc=DMA_MINC_DISABLE;
+	hdma_memtomem_dma2_stream0.Init.PeriphDataAlignment=DMA_PDATAALIGN_HALFWORD;
+	hdma_memtomem_dma2_stream0.Init.MemDataAlignment=DMA_MDATAALIGN_HALFWORD;
+	hdma_memtomem_dma2_stream0.Init.Mode=DMA_NORMAL;
+	hdma_memtomem_dma2_stream0.Init.Priority=DMA_PRIORITY_HIGH;
+	hdma_memtomem_dma2_stream0.Init.FIFOMode=DMA_FIFOMODE_ENABLE;
+	hdma_memtomem_dma2_stream0.Init.FIFOThreshold=DMA_FIFO_THRESHOLD_FULL;
+	hdma_memtomem_dma2_stream0.Init.MemBurst=DMA_MBURST_SINGLE;
+	hdma_memtomem_dma2_stream0.Init.PeriphBurst=DMA_PBURST_SINGLE;
+	if(HAL_DMA_Init(&hdma_memtomem_dma2_stream0)!=HAL_OK)Error_Handler();
+	HAL_DMA_RegisterCallback(&hdma_memtomem_dma2_stream0,HAL_DMA_XFER_CPLT_CB_ID,lcd_FbDmaCplt);
+	HAL_NVIC_SetPriority(DMA2_Stream0_IRQn,LCD_FB_DMA_PRIO,0);
+	HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+}
+#endif
+#endif
+
+/**
+  * @brief  Mark the whole frame for the next lcd_Display()
+  */
+void lcd_Invalidate(void)
+{
+#if LCD_USE_FRAMEBUFFER
+	uint16_t i;
+	for(i=0;i<sizeof(fb_dirty)/sizeof(fb_dirty[0]);i++)fb_dirty[i]=0xFFFFFFFF;
+#endif
+}
+
+/**
+  * @brief  1 while a framebuffer flush is still running on the DMA
+  */
+uint8_t lcd_DisplayBusy(void)
+{
+#if LCD_USE_FRAMEBUFFER
+	return fb_flush_busy;
+#else
+	return 0;
+#endif
+}
+
+/**
+  * @brief  Push the frame store to the panel
+  * @note   Only rows drawn since the last call are sent unless
+  *         LCD_FB_DIRTY_ROWS is 0. Returns as soon as the first DMA transfer
+  *         is started; rows drawn while it runs go out with the next call.
+  *         Without a frame store the panel is already up to date.
+  */
+void lcd_Display(void)
+{
+#if LCD_USE_FRAMEBUFFER
+	uint16_t i;
+#endif
+	PROF_ZONE("lcd_Display");
+#if LCD_USE_FRAMEBUFFER
+	lcd_FbWait();
+#if !LCD_FB_DIRTY_ROWS
+	lcd_Invalidate();
+#endif
+	for(i=0;i<sizeof(fb_dirty)/sizeof(fb_dirty[0]);i++)
+	{
+		fb_flush_rows[i]=fb_dirty[i];
+		fb_dirty[i]=0;
+	}
+	fb_flush_row=0;
+	fb_flush_busy=1;
+	lcd_FbFlushNext();
+#endif
+}
@@ -16,6 +16,14 @@ void led7_init(){
 	  HAL_GPIO_WritePin(LD_LATCH_GPIO_Port, LD_LATCH_Pin, 1);
 }
 
+// Turns every digit off; led7_Scan() lights them again
+void led7_Blank(){
+	spi_buffer |= 0xfff0;
+	HAL_GPIO_WritePin(LD_LATCH_GPIO_Port, LD_LATCH_Pin, 0);
+	HAL_SPI_Transmit(&hspi1, (void*)&spi_buffer, 2, 1);
+	HAL_GPIO_WritePin(LD_LATCH_GPIO_Port, LD_LATCH_Pin, 1);
+}
+
 void led7_Scan(){
 	spi_buffer &= 0x00ff;
 	spi_buffer |= led7seg[led7_index] << 8;
@@ -23,8 +23,23 @@
 #include "picture.h"
 #include "ds3231.h"
 #include "clock_fsm.h"
+#include "display_pm.h"
+#include "bench.h"
 #include "uart.h"
 #include "usart.h"
+#include "trace.h"
+#include "latency.h"
+#include "prof.h"
+#include "pcsamp.h"
+#include "loopstat.h"
+#include "sched.h"
+#include "timer_wheel.h"
+#include "kernel.h"
+#include "evq.h"
+#include "bh.h"
+#include "isrstat.h"
+#include "gov.h"
+#include "stop.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -34,6 +49,15 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+#if KERNEL_ENABLE && SCHED_ENABLE
+#error "KERNEL_ENABLE and SCHED_ENABLE both run the tasks, enable one"
+#endif
+#if KERNEL_ENABLE && EVQ_ENABLE
+#error "EVQ_ENABLE gates the FSM in the loop or the scheduler; the kernel threads already block on their sources"
+#endif
+#if STOP_ENABLE && (KERNEL_ENABLE || SCHED_ENABLE)
+#error "STOP_ENABLE sleeps in the main loop's wait; the scheduler and the kernel keep their own time on TIM2"
+#endif
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -45,6 +69,15 @@
 
 /* USER CODE BEGIN PV */
 uint8_t count_led_debug = 0;
+#if KERNEL_ENABLE
+static k_Thread_t input_thread, uart_thread, render_thread, rtc_thread;
+K_STACK(input_stack, 256);
+K_STACK(uart_stack, 512);
+K_STACK(render_stack, 1024);
+K_STACK(rtc_stack, 256);
+static k_Sem_t render_sem = K_SEM_INIT(0, 1);	// input -> render, once per scan
+static k_Sem_t io_sem = K_SEM_INIT(1, 1);		// I2C1 and USART1 TX, one thread at a time
+#endif
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -53,6 +86,14 @@ void SystemClock_Config(void);
 void system_init();
 void test_LedDebug();
 void updateTime(void); // Function to set current time
+void task_Input(void);
+void task_Uart(void);
+void task_Fsm(void);
+void task_Rtc(void);
+void thread_Input(void *arg);
+void thread_Uart(void *arg);
+void thread_Render(void *arg);
+void thread_Rtc(void *arg);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
@@ -89,6 +130,7 @@ int main(void)
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
   MX_TIM2_Init();
+  MX_TIM1_Init();
   MX_SPI1_Init();
   MX_FSMC_Init();
   MX_I2C1_Init();
@@ -103,22 +145,65 @@ int main(void)
 
   // updateTime(); // Tắt hàm này đi để không ghi đè thời gian mỗi khi reset
 
+  trace_init();
+  lat_init();
+  prof_init();
+  pcs_init();
+  isr_init();
+  gov_init(); // keeps the rates TIM1/2/7, USART1, I2C1 and SPI1 have now
+  stop_init(); // DS3231 SQW at 1Hz, EXTI wake lines
+  loop_init();
   ds3231_ReadTime(); // Initial time read
 
+#if LCD_BENCH
+  bench_Run();
+  bench_Report();
+#endif
+
+#if SCHED_ENABLE
+  sched_init();
+  sched_Add("input", task_Input, SCHED_FSM_MS, 0, 0);
+  sched_Add("uart", task_Uart, SCHED_UART_MS, 1, 1);
+  sched_Add("fsm", task_Fsm, SCHED_FSM_MS, 0, 2);
+  sched_Add("rtc", task_Rtc, SCHED_RTC_MS, 25, 3);
+  setTimer2(SCHED_TICK_MS);
+  sched_Start();
+#endif
+
+#if KERNEL_ENABLE
+  k_Create(&input_thread, "input", 0, thread_Input, NULL, input_stack, sizeof(input_stack)/4);
+  k_Create(&uart_thread, "uart", 1, thread_Uart, NULL, uart_stack, sizeof(uart_stack)/4);
+  k_Create(&render_thread, "render", 2, thread_Render, NULL, render_stack, sizeof(render_stack)/4);
+  k_Create(&rtc_thread, "rtc", 3, thread_Rtc, NULL, rtc_stack, sizeof(rtc_stack)/4);
+  k_Start(); // the threads below take over, the loop is not reached
+#endif
+
   while (1)
   {
-	  // 1. Wait for 50ms timer tick
-	  while(!flag_timer2);
-	  flag_timer2 = 0;
-
-	  // 2. Scan buttons
-	  button_Scan();
-
-	  // 3. [THÊM VÀO] Process incoming UART bytes into command buffer
-	  uart_process_incoming_data();
-
-	  // 4. Run the clock FSM logic
-	  clock_fsm_run();
+	  // 1. Wait for the timer tick (50ms, 1ms with the scheduler) or a STOP wake
+	  stop_Wait(); // sleeps in WFI, counts idle time; in STOP on a quiet clock screen
+	  timer2_Take();
+	  tw_Run(); // software timers that ran out, callbacks run here
+	  prof_Poll();
+	  pcs_Poll();
+	  isr_Poll();
+	  gov_Poll();
+	  stop_Poll();
+
+#if SCHED_ENABLE
+	  // 2. Each task at its own rate
+	  sched_Run();
+	  sched_Poll();
+#else
+	  // 2. Scan buttons, process UART, run the clock FSM
+	  PROF_ZONE("main_loop");	// closes at the end of the pass
+	  task_Input();
+	  task_Uart();
+#if EVQ_ENABLE && !STOP_ENABLE
+	  task_Rtc(); // the FSM runs when the second changes, not every pass
+#endif
+	  task_Fsm();
+#endif
 
     /* USER CODE END WHILE */
 
@@ -176,14 +261,127 @@ void system_init(){
 	  HAL_GPIO_WritePin(OUTPUT_Y0_GPIO_Port, OUTPUT_Y0_Pin, 0);
 	  HAL_GPIO_WritePin(OUTPUT_Y1_GPIO_Port, OUTPUT_Y1_Pin, 0);
 	  HAL_GPIO_WritePin(DEBUG_LED_GPIO_Port, DEBUG_LED_Pin, 0);
+	  bh_init(); // before TIM2 starts pending work for it
 	  timer_init();
 	  led7_init();
 	  button_init();
 	  lcd_init();
+	  dpm_init();
 	  ds3231_init();
 	  setTimer2(50); // Set timer tick to 50ms
 }
 
+/**
+ * @brief Scan buttons; the 50ms pass starts here
+ */
+void task_Input(){
+	loop_Start();
+	trace_Tick();
+	button_Scan();
+#if TRACE_ENABLE
+	if(button_count[TRACE_DUMP_KEY] == 1) trace_Dump();
+#endif
+#if LAT_ENABLE
+	if(button_count[LAT_DUMP_KEY] == 1) lat_Report();
+#endif
+}
+
+/**
+ * @brief Process incoming UART bytes into the command buffer
+ */
+void task_Uart(){
+	clock_fsm_uart();
+}
+
+/**
+ * @brief Run the clock FSM logic (only on an event with EVQ_ENABLE); the
+ *        50ms pass ends here
+ */
+void task_Fsm(){
+#if EVQ_ENABLE
+	clock_fsm_dispatch(); // ramps the clock up only when the FSM runs
+#else
+	gov_Boost(); // render burst at full speed, timer2_Wait() drops it again
+	clock_fsm_run();
+#endif
+#if LCD_USE_FRAMEBUFFER
+	lcd_Display(); // rows drawn this pass go out by DMA
+#endif
+	lat_EndPass();
+	loop_End();
+	loop_Poll();
+	evq_Poll();
+}
+
+/**
+ * @brief Refresh ds3231_* for the FSM (scheduler and kernel once a second,
+ *        every pass with the event queues unless STOP_ENABLE has the SQW
+ *        edge post the second)
+ */
+void task_Rtc(){
+	ds3231_ReadTime();
+}
+
+#if KERNEL_ENABLE
+/**
+ * @brief Highest priority: buttons every KERNEL_INPUT_MS, even in the
+ *        middle of a redraw, then one render pass
+ */
+void thread_Input(void *arg){
+	uint32_t last = k_ticks;
+	for(;;){
+		k_SleepUntil(&last, KERNEL_INPUT_MS);
+		task_Input();
+		k_SemGive(&render_sem);
+	}
+}
+
+/**
+ * @brief Woken by each received byte; the reports wait for a pass that
+ *        does not hold USART1
+ */
+void thread_Uart(void *arg){
+	for(;;){
+		k_SemTake(&uart_rx_sem, KERNEL_UART_MS);
+		task_Uart();
+		if(k_SemTake(&io_sem, 0) == 0){
+			prof_Poll();
+			pcs_Poll();
+			isr_Poll();
+			gov_Poll();
+			k_Poll();
+			k_SemGive(&io_sem);
+		}
+	}
+}
+
+/**
+ * @brief The clock FSM and the LCD: software timers, UART lines, redraw
+ */
+void thread_Render(void *arg){
+	for(;;){
+		k_SemTake(&render_sem, K_FOREVER);
+		k_SemTake(&io_sem, K_FOREVER);
+		tw_Run();
+		task_Fsm();
+		k_SemGive(&io_sem);
+	}
+}
+
+/**
+ * @brief Refresh ds3231_* every KERNEL_RTC_MS
+ */
+void thread_Rtc(void *arg){
+	uint32_t last = k_ticks;
+	for(;;){
+		k_SleepUntil(&last, KERNEL_RTC_MS);
+		k_SemTake(&io_sem, K_FOREVER);
+		task_Rtc();
+		k_SemGive(&io_sem);
+	}
+}
+#endif
+
 void test_LedDebug(){
 	count_led_debug = (count_led_debug + 1)%20;
 	if(count_led_debug == 0){
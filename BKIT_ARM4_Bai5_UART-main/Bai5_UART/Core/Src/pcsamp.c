@@ -0,0 +1,123 @@
+/*
+ * pcsamp.c
+ *
+ *  Statistical PC sampler on TIM7
+ *
+ *  TIM7 runs at priority 0, above every other handler in the plan of bh.h,
+ *  so their handlers are sampled too. The handler
+ *  takes the interrupted PC from the exception frame (MSP or PSP, from
+ *  EXC_RETURN) and counts it in an open-addressed table. PCs that find no
+ *  free slot within a few probes are only counted as dropped.
+ *
+ *  Dump, on USART1:
+ *    PCS <period us> <samples> <in handlers> <dropped>
+ *    <pc hex> <count>        one line per distinct PC
+ *    END
+ */
+
+#include "pcsamp.h"
+
+#if PCS_ENABLE
+
+#include "report.h"
+#include <stdio.h>
+#include <string.h>
+
+#define PCS_PROBES		8
+
+static TIM_HandleTypeDef htim7;
+static uint32_t pcs_pc[PCS_SLOTS];
+static uint32_t pcs_count[PCS_SLOTS];
+static volatile uint32_t pcs_samples, pcs_handler, pcs_dropped;
+static uint8_t pcs_req;						// 1 = dump, 2 = dump and clear
+
+void pcs_init()
+{
+	uint32_t clk = HAL_RCC_GetPCLK1Freq();
+	if(RCC->CFGR & RCC_CFGR_PPRE1_2) clk *= 2;		// APB1 timers run at 2x PCLK1 when divided
+	htim7.Instance = TIM7;
+	htim7.Init.Prescaler = clk/1000000 - 1;			// 1us counts
+	htim7.Init.CounterMode = TIM_COUNTERMODE_UP;
+	htim7.Init.Period = PCS_PERIOD_US - 1;
+	htim7.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+	__HAL_RCC_TIM7_CLK_ENABLE();
+	HAL_TIM_Base_Init(&htim7);
+
+	HAL_NVIC_SetPriority(TIM7_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(TIM7_IRQn);
+	pcs_req = 0;
+	HAL_TIM_Base_Start_IT(&htim7);
+}
+
+/**
+ * @brief  From TIM7_IRQHandler with the stacked r0-r3, r12, lr, pc, xpsr
+ */
+void pcs_Sample(const uint32_t *frame, uint32_t exc_return)
+{
+	uint32_t pc = frame[6], h;
+	uint8_t i;
+	TIM7->SR = ~TIM_SR_UIF;
+	pcs_samples++;
+	if((exc_return & 0x08) == 0) pcs_handler++;		// returns to handler mode
+	h = ((pc >> 1)*2654435761UL) >> 16;
+	for(i = 0; i < PCS_PROBES; i++, h++){
+		h &= PCS_SLOTS - 1;
+		if(pcs_pc[h] == pc || pcs_count[h] == 0){
+			pcs_pc[h] = pc;
+			pcs_count[h]++;
+			return;
+		}
+	}
+	pcs_dropped++;
+}
+
+// Naked so the frame pointer is still the stack pointer at entry
+__attribute__((naked)) void TIM7_IRQHandler(void)
+{
+	__asm volatile(
+		"tst lr, #4		\n"
+		"ite eq			\n"
+		"mrseq r0, msp	\n"
+		"mrsne r0, psp	\n"
+		"mov r1, lr		\n"
+		"b pcs_Sample	\n");
+}
+
+/**
+ * @brief  Ask for a dump at the next pcs_Poll(); reset = 1 also clears the
+ *         counts once it is sent
+ */
+void pcs_Request(uint8_t reset)
+{
+	rpt_Request(&pcs_req, reset);
+}
+
+/**
+ * @brief  Call from the main loop. Sampling stops while the dump is sent.
+ */
+void pcs_Poll()
+{
+	char line[48];
+	uint16_t i, n;
+	uint8_t req;
+	req = rpt_Take(&pcs_req);
+	if(req == RPT_NONE) return;
+	HAL_NVIC_DisableIRQ(TIM7_IRQn);
+	n = sprintf(line, "\r\nPCS %u %lu %lu %lu\r\n", PCS_PERIOD_US, (unsigned long)pcs_samples,
+			(unsigned long)pcs_handler, (unsigned long)pcs_dropped);
+	rpt_Write(line, n);
+	for(i = 0; i < PCS_SLOTS; i++){
+		if(pcs_count[i] == 0) continue;
+		n = sprintf(line, "%08lX %lu\r\n", (unsigned long)pcs_pc[i], (unsigned long)pcs_count[i]);
+		rpt_Write(line, n);
+	}
+	rpt_Write("END\r\n", 5);
+	if(req == RPT_CLEAR){
+		memset(pcs_count, 0, sizeof(pcs_count));
+		pcs_samples = pcs_handler = pcs_dropped = 0;
+	}
+	__HAL_TIM_CLEAR_FLAG(&htim7, TIM_FLAG_UPDATE);
+	HAL_NVIC_EnableIRQ(TIM7_IRQn);
+}
+
+#endif /* PCS_ENABLE */
@@ -0,0 +1,35 @@
+/*
+ * report.c
+ *
+ *  Output of the statistics tables
+ */
+
+#include "report.h"
+#include <stdio.h>
+#ifdef HAL_UART_MODULE_ENABLED
+#include "usart.h"
+#endif
+
+/**
+ * @brief  Send n bytes of a table: USART1, stdout in the host sim, else SWO
+ */
+void rpt_Write(const char *p, uint16_t n)
+{
+#if defined(HAL_UART_MODULE_ENABLED)
+	HAL_UART_Transmit(&huart1, (uint8_t*)p, n, 100);
+#elif defined(HOST_SIM)
+	fwrite(p, 1, n, stdout);
+#else
+	while(n--) ITM_SendChar(*p++);		// no USART in this project: SWO
+#endif
+}
+
+/**
+ * @brief  ns as "us.hh" in buf, which needs 14 bytes
+ * @retval buf
+ */
+char *rpt_Us(char *buf, uint32_t ns)
+{
+	sprintf(buf, "%lu.%02lu", (unsigned long)(ns/1000), (unsigned long)(ns%1000/10));
+	return buf;
+}
@@ -0,0 +1,175 @@
+/*
+ * sched.c
+ *
+ *  Cooperative multi-rate scheduler
+ *
+ *  Time is HAL_GetTick(). sched_Run() is called once per TIM2 tick and
+ *  runs every task whose release has come, highest priority (lowest
+ *  number) first, re-reading the time after each run so that a long task
+ *  makes the ones behind it due in the same call. Tasks are not
+ *  preempted: a task that runs past another one's release delays it.
+ *
+ *  The deadline is the next release. A task that starts after its next
+ *  release already came runs once for all of them; the skipped ones are
+ *  counted as misses and sched_elapsed tells it how many periods that
+ *  run stands for. Run time comes from DWT->CYCCNT.
+ */
+
+#include "sched.h"
+
+#if SCHED_ENABLE
+
+#include "dwt.h"
+#include "software_timer.h"
+#include <stdio.h>
+#include <string.h>
+#include "report.h"
+
+sched_Task_t sched_tasks[SCHED_MAX_TASKS];
+uint8_t sched_count;
+uint16_t sched_elapsed = 1;
+static uint32_t sched_since;				// HAL_GetTick() when the stats were cleared
+static uint8_t sched_req;					// 1 = print, 2 = print and clear
+
+void sched_init()
+{
+	dwt_init();
+	memset(sched_tasks, 0, sizeof(sched_tasks));
+	sched_count = 0;
+	sched_req = 0;
+}
+
+/**
+ * @brief  Register a task; returns its index, -1 when the table is full
+ * @param  period_ms Run every period_ms, > 0
+ * @param  phase_ms First release after sched_Start(), to spread tasks
+ *         with the same period over different ticks
+ * @param  prio 0 runs first when several tasks are due
+ */
+int8_t sched_Add(const char *name, sched_Fn_t run, uint16_t period_ms, uint16_t phase_ms, uint8_t prio)
+{
+	sched_Task_t *t;
+	if(sched_count >= SCHED_MAX_TASKS || run == NULL || period_ms == 0) return -1;
+	t = &sched_tasks[sched_count];
+	memset(t, 0, sizeof(*t));
+	t->name = name;
+	t->run = run;
+	t->period_ms = period_ms;
+	t->phase_ms = phase_ms;
+	t->prio = prio;
+	return sched_count++;
+}
+
+static void sched_Clear(uint32_t now)
+{
+	uint8_t i;
+	for(i = 0; i < sched_count; i++){
+		sched_tasks[i].runs = 0;
+		sched_tasks[i].misses = 0;
+		sched_tasks[i].late_max_ms = 0;
+		sched_tasks[i].run_max_us = 0;
+		sched_tasks[i].run_cycles = 0;
+	}
+	sched_since = now;
+}
+
+/**
+ * @brief  Release every task at its phase from now; call once all are added
+ */
+void sched_Start()
+{
+	uint32_t now = HAL_GetTick();
+	uint8_t i;
+	for(i = 0; i < sched_count; i++) sched_tasks[i].release = now + sched_tasks[i].phase_ms;
+	sched_Clear(now);
+}
+
+// Highest priority task that is due at 'now', NULL if none
+static sched_Task_t *sched_Next(uint32_t now)
+{
+	sched_Task_t *best = NULL;
+	uint8_t i;
+	for(i = 0; i < sched_count; i++){
+		sched_Task_t *t = &sched_tasks[i];
+		if((int32_t)(now - t->release) < 0) continue;
+		if(best == NULL || t->prio < best->prio) best = t;
+	}
+	return best;
+}
+
+/**
+ * @brief  Run the tasks that are due; call after every TIM2 tick
+ */
+void sched_Run()
+{
+	sched_Task_t *t;
+	uint32_t now, late, due, cycles, us;
+	while((t = sched_Next(now = HAL_GetTick())) != NULL){
+		late = now - t->release;
+		due = late/t->period_ms + 1;
+		if(late > t->late_max_ms) t->late_max_ms = late;
+		t->misses += due - 1;
+		t->release += due*t->period_ms;
+		sched_elapsed = (due < 0xFFFF) ? due : 0xFFFF;
+
+		cycles = dwt_Cycles();
+		t->run();
+		cycles = dwt_Cycles() - cycles;
+
+		t->runs++;
+		t->run_cycles += cycles;
+		us = cycles/(SystemCoreClock/1000000);
+		if(us > t->run_max_us) t->run_max_us = us;
+	}
+	sched_elapsed = 1;
+}
+
+/**
+ * @brief  Ask for the task table at the next sched_Poll(); reset = 1 also
+ *         clears the stats once printed
+ */
+void sched_Request(uint8_t reset)
+{
+	rpt_Request(&sched_req, reset);
+}
+
+/**
+ * @brief  Call from a task, outside the code being measured
+ */
+void sched_Poll()
+{
+	uint8_t req = rpt_Take(&sched_req);
+	if(req == RPT_NONE) return;
+	sched_Report();
+	if(req == RPT_CLEAR) sched_Clear(HAL_GetTick());
+}
+
+/**
+ * @brief  Print one row per task; load is run time over the time since
+ *         the stats were cleared
+ */
+void sched_Report()
+{
+	char line[112];
+	uint32_t span = HAL_GetTick() - sched_since;
+	uint64_t window = (uint64_t)(span ? span : 1)*(SystemCoreClock/1000);
+	uint16_t n, load;
+	uint8_t i;
+	n = sprintf(line, "\r\nSCHED %lu ms, idle %u.%u%%%s, %u periods missed\r\n",
+			(unsigned long)span, timer2_idle/10, timer2_idle%10, TIMER2_IDLE_NOTE, timer2_missed);
+	rpt_Write(line, n);
+	n = sprintf(line, "task     period phase prio     runs   miss late_ms  avg_us  max_us  load\r\n");
+	rpt_Write(line, n);
+	for(i = 0; i < sched_count; i++){
+		sched_Task_t *t = &sched_tasks[i];
+		load = (uint16_t)(t->run_cycles*1000/window);
+		n = sprintf(line, "%-8s %6u %5u %4u %8lu %6lu %7lu %7lu %7lu %3u.%u%%\r\n",
+				t->name, t->period_ms, t->phase_ms, t->prio,
+				(unsigned long)t->runs, (unsigned long)t->misses, (unsigned long)t->late_max_ms,
+				(unsigned long)(t->runs ? t->run_cycles/t->runs/(SystemCoreClock/1000000) : 0),
+				(unsigned long)t->run_max_us, load/10, load%10);
+		rpt_Write(line, n);
+	}
+}
+
+#endif /* SCHED_ENABLE */
@@ -6,34 +6,302 @@
  */
 
 #include "software_timer.h"
+#include "dwt.h"
+#include "timer_wheel.h"
+#include "led_7seg.h"
+#include "bh.h"
+#include "gov.h"
 
 #define TIMER_CYCLE_2 1
 
 
-uint16_t flag_timer2 = 0;
+volatile uint16_t flag_timer2 = 0;
 uint16_t timer2_counter = 0;
 uint16_t timer2_MUL = 0;
+uint16_t timer2_missed = 0;
+uint32_t timer2_stamp = 0;
+uint16_t timer2_elapsed = 1;
+uint16_t timer2_idle = 0;
+uint32_t timer2_irqs = 0;
+uint16_t timer2_rate = 0;
+static volatile uint16_t timer2_periods = 0;	// written by the interrupt only
+static uint16_t timer2_taken = 0;
+static uint32_t idle_cycles = 0, idle_window = 0, irqs_window = 0;
+
+// The SPI1 transfer of the next digit: in the bottom half when there is one
+#if BH_ENABLE
+#define timer2_Led7()	bh_Pend(BH_LED7)
+#else
+#define timer2_Led7()	led7_Scan()
+#endif
+
+#if TIMER2_TICKLESS
+static uint32_t tl_last = 0;		// counter at the last whole ms counted into tw_ticks
+static uint32_t tl_due = 0;			// counter at the end of the running period
+static uint32_t tl_wheel = 0;		// counter at the next timer_wheel.c expiry
+static volatile uint8_t tl_wheel_on = 0;	// tl_wheel is set and not reached yet
+static volatile uint8_t tl_wheel_hit = 0;	// it was reached, timer2_Wheel() has timers to run
+static uint8_t tl_armed = 0;		// timer2_Wheel() set tl_wheel since the last timer2_Take()
+#define timer2_WheelHit()	tl_wheel_hit
+
+// Code shared with the interrupt masks it; the host sim runs the interrupt
+// between calls, never inside one
+#ifdef HOST_SIM
+#define timer2_Lock()		0
+#define timer2_Unlock(pm)	((void)(pm))
+#else
+static inline uint32_t timer2_Lock(){
+	uint32_t pm = __get_PRIMASK();
+	__disable_irq();
+	return pm;
+}
+#define timer2_Unlock(pm)	__set_PRIMASK(pm)
+#endif
+
+// Counts the whole ms since tl_last into tw_ticks
+static void timer2_Sync(){
+	uint32_t ms = (__HAL_TIM_GET_COUNTER(&htim2) - tl_last)/TIMER2_CNT_PER_MS;
+	tl_last += ms*TIMER2_CNT_PER_MS;
+	tw_ticks += ms;
+}
+
+// Sets flag_timer2 for the periods that ran out and points compare channel
+// 1 at the earlier of the end of the next one and the wheel's next expiry.
+// A deadline that goes by while it is being set would only match again once
+// the counter wraps, so it is taken here
+static void timer2_Due(){
+	uint32_t next;
+	do{
+		timer2_Sync();
+		if(tl_wheel_on && (int32_t)(tl_last - tl_wheel) >= 0){
+			tl_wheel_on = 0;
+			tl_wheel_hit = 1;
+		}
+		if(timer2_MUL == 0) return;
+		while((int32_t)(tl_last - tl_due) >= 0){
+			if(flag_timer2) timer2_missed++;
+			timer2_periods++;
+			timer2_stamp = dwt_Cycles();
+			flag_timer2 = 1;
+			tl_due += timer2_MUL*TIMER2_CNT_PER_MS;
+		}
+		next = (tl_wheel_on && (int32_t)(tl_wheel - tl_due) < 0) ? tl_wheel : tl_due;
+		__HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_1, next);
+	}while((int32_t)(next - __HAL_TIM_GET_COUNTER(&htim2)) <= 0);
+}
+
+// While the main loop waits: runs the wheel's timers once their expiry
+// came up, and sets tl_wheel to the next one. Does nothing in between, so
+// the wait can call it after every wake
+void timer2_Wheel(){
+	uint32_t tick = 0, pm;
+	uint8_t on, late;
+	if(tl_armed && !tl_wheel_hit) return;
+	do{
+		tl_wheel_hit = 0;
+		tw_Run();
+		on = tw_NextDue(&tick);
+		pm = timer2_Lock();
+		timer2_Sync();
+		late = on && (int32_t)(tick - tw_ticks) <= 0;
+		tl_wheel = tl_last + (tick - tw_ticks)*TIMER2_CNT_PER_MS;
+		tl_wheel_on = on && !late;
+		if(!late) timer2_Due();
+		timer2_Unlock(pm);
+	}while(late);
+	tl_armed = 1;
+}
+
+#if TIMER2_SCAN_MS
+// Next digit on compare channel 2; after a late interrupt the scan slips
+// instead of catching up
+static void timer2_Scan(){
+	uint32_t step = TIMER2_SCAN_MS*TIMER2_CNT_PER_MS;
+	uint32_t next = __HAL_TIM_GET_COMPARE(&htim2, TIM_CHANNEL_2) + step;
+	if((int32_t)(next - __HAL_TIM_GET_COUNTER(&htim2)) <= 0) next = __HAL_TIM_GET_COUNTER(&htim2) + step;
+	__HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_2, next);
+	timer2_Led7();
+}
+#endif
+
+// Same input clock, but counting TIMER2_CNT_PER_MS per ms over all 32 bits
+// with no update interrupt; the compare channels take its place
+static void timer2_StartTickless(){
+	htim2.Init.Prescaler = (htim2.Init.Prescaler + 1)*(htim2.Init.Period + 1)/TIMER2_CNT_PER_MS - 1;
+	htim2.Init.Period = 0xFFFFFFFF;
+	if(HAL_TIM_Base_Init(&htim2) != HAL_OK) Error_Handler();
+	tl_last = tl_due = __HAL_TIM_GET_COUNTER(&htim2);
+#if TIMER2_SCAN_MS
+	__HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_2, tl_last + TIMER2_SCAN_MS*TIMER2_CNT_PER_MS);
+	HAL_TIM_OC_Start_IT(&htim2, TIM_CHANNEL_2);
+#else
+	led7_Blank();
+#endif
+	__HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_1, tl_last - 1);	// nothing due before setTimer2()
+	HAL_TIM_OC_Start_IT(&htim2, TIM_CHANNEL_1);
+}
+#else
+#define timer2_WheelHit()	0
+#endif /* TIMER2_TICKLESS */
 
 void timer_init(){
+	dwt_init();
+	tw_init();
+	idle_window = dwt_Cycles();
+#if TIMER2_TICKLESS
+	timer2_StartTickless();
+#else
 	HAL_TIM_Base_Start_IT(&htim2);
+#endif
 }
 
 void setTimer2(uint16_t duration){
+#if TIMER2_TICKLESS
+	uint32_t pm = timer2_Lock();
+	timer2_Sync();
+	tl_due = tl_last + duration/TIMER_CYCLE_2*TIMER2_CNT_PER_MS;
+#endif
 	timer2_MUL = duration/TIMER_CYCLE_2;
 	timer2_counter = timer2_MUL;
 	flag_timer2 = 0;
+	timer2_taken = timer2_periods;
+#if TIMER2_TICKLESS
+	timer2_Due();
+	timer2_Unlock(pm);
+#endif
+}
+
+// Start of a main loop pass: clears flag_timer2 and takes the periods that
+// ran out since the last pass
+uint16_t timer2_Take(){
+	// Count first, then clear: a period that ends in between loses its flag
+	// and is counted by the next pass
+	uint16_t now, due;
+#if TIMER2_TICKLESS
+	// The wheel has no interrupt of its own: bring tw_ticks up to date for
+	// tw_Run(), even when this pass started late
+	uint32_t pm = timer2_Lock();
+	timer2_Sync();
+	timer2_Unlock(pm);
+	tl_armed = 0;	// the pass may start and stop timers: set tl_wheel again
+#endif
+	now = timer2_periods;
+	due = now - timer2_taken;
+	timer2_taken = now;
+	flag_timer2 = 0;
+	timer2_elapsed = (TIMER2_CATCH_UP && due > 0) ? due : 1;
+	return timer2_elapsed;
+}
+
+// Once a second has gone by: timer2_idle and timer2_rate over it
+static void timer2_IdleWindow(uint32_t now){
+	uint32_t span = now - idle_window;
+	if(span >= SystemCoreClock){
+		timer2_idle = (uint64_t)idle_cycles*1000/span;
+		timer2_rate = (uint64_t)(timer2_irqs - irqs_window)*SystemCoreClock/span;
+		idle_cycles = 0;
+		idle_window = now;
+		irqs_window = timer2_irqs;
+	}
+}
+
+// Sleeps until TIM2 sets flag_timer2. Interrupts are masked around the
+// check so one cannot slip in between it and WFI; a pending interrupt still
+// ends WFI and is taken as soon as they are unmasked again. Only the time
+// in WFI is idle: the wake is stamped before that interrupt's handler runs.
+// Tickless, the wheel's timers run at their own expiry on the way
+// (timer2_Wheel()). Spinning (TIMER2_WFI 0) counts the whole wait,
+// handlers included
+void timer2_Wait(){
+	uint32_t t0;
+	timer2_Wheel();
+	t0 = dwt_Cycles();
+	if(!flag_timer2) gov_Idle(); // the pass is over, wait at the idle clock
+#if TIMER2_WFI && !defined(HOST_SIM)
+	__disable_irq();
+	while(!flag_timer2){
+		if(!timer2_WheelHit()){
+			t0 = dwt_Cycles();
+			__WFI();
+			idle_cycles += dwt_Cycles() - t0;	// still masked: the handler has not run yet
+		}
+		__enable_irq();
+		if(timer2_WheelHit()) timer2_Wheel();
+		__disable_irq();
+	}
+	__enable_irq();
+	timer2_IdleWindow(dwt_Cycles());
+#else
+	while(!flag_timer2) timer2_Wheel();
+	timer2_Idle(t0);
+#endif
+}
+
+// Counts the time since 'since' (DWT cycles) as idle, for a wait that
+// spins; timer2_idle is updated once a second has gone by
+void timer2_Idle(uint32_t since){
+	uint32_t now = dwt_Cycles();
+	idle_cycles += now - since;
+	timer2_IdleWindow(now);
+}
+
+// Microseconds on the TIM2 time base, wrapping every 71.6 min. Without
+// TIMER2_TICKLESS it is the 1ms tick plus the counter, and reads up to 1ms
+// low while an update interrupt is pending
+uint32_t timer2_Us(){
+#if TIMER2_TICKLESS
+	return __HAL_TIM_GET_COUNTER(&htim2)*(1000/TIMER2_CNT_PER_MS);
+#else
+	uint32_t ms, cnt;
+	do{
+		ms = tw_ticks;
+		cnt = __HAL_TIM_GET_COUNTER(&htim2);
+	}while(ms != tw_ticks);
+	return ms*1000 + cnt*1000/(htim2.Init.Period + 1);
+#endif
+}
+
+// Cycles since the event the TIM2 interrupt about to run is for: the
+// counter keeps counting from the update (or the compare match when
+// tickless), so this is exact to its 1us step. From TIM2_IRQHandler,
+// before HAL_TIM_IRQHandler() clears the flags
+uint32_t timer2_Latency(){
+	uint32_t cnt = __HAL_TIM_GET_COUNTER(&htim2), us;
+#if TIMER2_TICKLESS
+	if(__HAL_TIM_GET_FLAG(&htim2, TIM_FLAG_CC1)) us = cnt - __HAL_TIM_GET_COMPARE(&htim2, TIM_CHANNEL_1);
+	else us = cnt - __HAL_TIM_GET_COMPARE(&htim2, TIM_CHANNEL_2);
+#else
+	us = cnt*1000/(htim2.Init.Period + 1);
+#endif
+	return us*(SystemCoreClock/1000000);
 }
 
 void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim){
-	if(htim->Instance == TIM2){
+	if(htim == &htim2){
+		timer2_irqs++;
 		if(timer2_counter > 0){
 			timer2_counter--;
 			if(timer2_counter == 0) {
+				if(flag_timer2) timer2_missed++;
+				timer2_periods++;
+				timer2_stamp = dwt_Cycles();
 				flag_timer2 = 1;
 				timer2_counter = timer2_MUL;
 			}
 		}
-		led7_Scan();
+		tw_Tick();
+		timer2_Led7();
 	}
 }
 
+#if TIMER2_TICKLESS
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim){
+	if(htim == &htim2){
+		timer2_irqs++;
+		if(htim->Channel == HAL_TIM_ACTIVE_CHANNEL_1) timer2_Due();
+#if TIMER2_SCAN_MS
+		else if(htim->Channel == HAL_TIM_ACTIVE_CHANNEL_2) timer2_Scan();
+#endif
+	}
+}
+#endif
@@ -0,0 +1,111 @@
+/*
+ * sram.c
+ *
+ *  External SRAM on FSMC bank 1, region 3 (NE3).
+ *  The LCD already owns NE1 and the shared data/control pins (see fsmc.c),
+ *  so only the address, byte-lane and chip-select pins are set up here.
+ *  On the host build the SRAM is a plain array of the same size.
+ */
+
+#include "sram.h"
+
+#ifdef HOST_SIM
+static uint16_t sram_mem[SRAM_SIZE / 2];
+#define SRAM_MEM	((uint8_t *)sram_mem)
+#else
+SRAM_HandleTypeDef hsram3;
+#define SRAM_MEM	((uint8_t *)SRAM_BANK3_BASE)
+#endif
+
+#ifndef HOST_SIM
+static void sram_GpioInit(void)
+{
+	GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+	__HAL_RCC_GPIOD_CLK_ENABLE();
+	__HAL_RCC_GPIOE_CLK_ENABLE();
+	__HAL_RCC_GPIOF_CLK_ENABLE();
+	__HAL_RCC_GPIOG_CLK_ENABLE();
+
+	GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+	GPIO_InitStruct.Pull = GPIO_NOPULL;
+	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+	GPIO_InitStruct.Alternate = GPIO_AF12_FSMC;
+
+	// PF0..PF5 -> A0..A5, PF12..PF15 -> A6..A9
+	GPIO_InitStruct.Pin = GPIO_PIN_0|GPIO_PIN_1|GPIO_PIN_2|GPIO_PIN_3
+						|GPIO_PIN_4|GPIO_PIN_5|GPIO_PIN_12|GPIO_PIN_13
+						|GPIO_PIN_14|GPIO_PIN_15;
+	HAL_GPIO_Init(GPIOF, &GPIO_InitStruct);
+
+	// PG0..PG5 -> A10..A15, PG10 -> NE3
+	GPIO_InitStruct.Pin = GPIO_PIN_0|GPIO_PIN_1|GPIO_PIN_2|GPIO_PIN_3
+						|GPIO_PIN_4|GPIO_PIN_5|GPIO_PIN_10;
+	HAL_GPIO_Init(GPIOG, &GPIO_InitStruct);
+
+	// PD11..PD13 -> A16..A18
+	GPIO_InitStruct.Pin = GPIO_PIN_11|GPIO_PIN_12|GPIO_PIN_13;
+	HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
+
+	// PE0 -> NBL0, PE1 -> NBL1
+	GPIO_InitStruct.Pin = GPIO_PIN_0|GPIO_PIN_1;
+	HAL_GPIO_Init(GPIOE, &GPIO_InitStruct);
+}
+#endif
+
+void sram_init(void)
+{
+#ifndef HOST_SIM
+	FSMC_NORSRAM_TimingTypeDef Timing = {0};
+
+	sram_GpioInit();
+
+	hsram3.Instance = FSMC_NORSRAM_DEVICE;
+	hsram3.Extended = FSMC_NORSRAM_EXTENDED_DEVICE;
+	hsram3.Init.NSBank = FSMC_NORSRAM_BANK3;
+	hsram3.Init.DataAddressMux = FSMC_DATA_ADDRESS_MUX_DISABLE;
+	hsram3.Init.MemoryType = FSMC_MEMORY_TYPE_SRAM;
+	hsram3.Init.MemoryDataWidth = FSMC_NORSRAM_MEM_BUS_WIDTH_16;
+	hsram3.Init.BurstAccessMode = FSMC_BURST_ACCESS_MODE_DISABLE;
+	hsram3.Init.WaitSignalPolarity = FSMC_WAIT_SIGNAL_POLARITY_LOW;
+	hsram3.Init.WrapMode = FSMC_WRAP_MODE_DISABLE;
+	hsram3.Init.WaitSignalActive = FSMC_WAIT_TIMING_BEFORE_WS;
+	hsram3.Init.WriteOperation = FSMC_WRITE_OPERATION_ENABLE;
+	hsram3.Init.WaitSignal = FSMC_WAIT_SIGNAL_DISABLE;
+	hsram3.Init.ExtendedMode = FSMC_EXTENDED_MODE_DISABLE;
+	hsram3.Init.AsynchronousWait = FSMC_ASYNCHRONOUS_WAIT_DISABLE;
+	hsram3.Init.WriteBurst = FSMC_WRITE_BURST_DISABLE;
+	hsram3.Init.PageSize = FSMC_PAGE_SIZE_NONE;
+
+	// 55ns part at HCLK = 168MHz (~6ns per cycle)
+	Timing.AddressSetupTime = 0;
+	Timing.AddressHoldTime = 0;
+	Timing.DataSetupTime = 8;
+	Timing.BusTurnAroundDuration = 0;
+	Timing.CLKDivision = 2;
+	Timing.DataLatency = 2;
+	Timing.AccessMode = FSMC_ACCESS_MODE_A;
+
+	if (HAL_SRAM_Init(&hsram3, &Timing, NULL) != HAL_OK)
+	{
+		Error_Handler();
+	}
+#endif
+}
+
+uint16_t *sram_GetBuffer(void)
+{
+	return (uint16_t *)SRAM_MEM;
+}
+
+void sram_WriteBuffer(uint8_t *buffer, uint32_t address, uint32_t size)
+{
+	uint8_t *dst = SRAM_MEM + address;
+	while (size--) *dst++ = *buffer++;
+}
+
+void sram_ReadBuffer(uint8_t *buffer, uint32_t address, uint32_t size)
+{
+	uint8_t *src = SRAM_MEM + address;
+	while (size--) *buffer++ = *src++;
+}
@@ -23,6 +23,10 @@
 #include "stm32f4xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "lcd.h"
+#include "kernel.h"
+#include "isrstat.h"
+#include "software_timer.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -59,7 +63,9 @@
 extern TIM_HandleTypeDef htim2;
 extern UART_HandleTypeDef huart1;
 /* USER CODE BEGIN EV */
-
+#if LCD_USE_FRAMEBUFFER
+extern DMA_HandleTypeDef hdma_memtomem_dma2_stream0;
+#endif
 /* USER CODE END EV */
 
 /******************************************************************************/
@@ -166,30 +172,18 @@ void DebugMon_Handler(void)
   /* USER CODE END DebugMonitor_IRQn 1 */
 }
 
-/**
-  * @brief This function handles Pendable request for system service.
-  */
-void PendSV_Handler(void)
-{
-  /* USER CODE BEGIN PendSV_IRQn 0 */
-
-  /* USER CODE END PendSV_IRQn 0 */
-  /* USER CODE BEGIN PendSV_IRQn 1 */
-
-  /* USER CODE END PendSV_IRQn 1 */
-}
-
 /**
   * @brief This function handles System tick timer.
   */
 void SysTick_Handler(void)
 {
   /* USER CODE BEGIN SysTick_IRQn 0 */
-
+  isr_Enter();
   /* USER CODE END SysTick_IRQn 0 */
   HAL_IncTick();
   /* USER CODE BEGIN SysTick_IRQn 1 */
-
+  k_Tick(); // kernel timeouts; PendSV_Handler is in kernel_port.c
+  isr_Exit(ISR_SYSTICK);
   /* USER CODE END SysTick_IRQn 1 */
 }
 
@@ -206,11 +200,12 @@ void SysTick_Handler(void)
 void TIM2_IRQHandler(void)
 {
   /* USER CODE BEGIN TIM2_IRQn 0 */
-
+  isr_Enter();
+  isr_Latency(ISR_TIM2, timer2_Latency());
   /* USER CODE END TIM2_IRQn 0 */
   HAL_TIM_IRQHandler(&htim2);
   /* USER CODE BEGIN TIM2_IRQn 1 */
-
+  isr_Exit(ISR_TIM2); // with BH_ENABLE, led7_Scan() runs later in bh.c
   /* USER CODE END TIM2_IRQn 1 */
 }
 
@@ -220,15 +215,27 @@ void TIM2_IRQHandler(void)
 void USART1_IRQHandler(void)
 {
   /* USER CODE BEGIN USART1_IRQn 0 */
-
+  isr_Enter();
+  if(USART1->SR & USART_SR_ORE) isr_Lost(ISR_USART1); // a byte came in before the last one was taken
   /* USER CODE END USART1_IRQn 0 */
   HAL_UART_IRQHandler(&huart1);
   /* USER CODE BEGIN USART1_IRQn 1 */
-
+  isr_Exit(ISR_USART1);
   /* USER CODE END USART1_IRQn 1 */
 }
 
 /* USER CODE BEGIN 1 */
-
+#if LCD_USE_FRAMEBUFFER
+/**
+  * @brief This function handles DMA2 stream0 global interrupt: the end of a
+  *        framebuffer flush transfer (lcd.c sets the stream up).
+  */
+void DMA2_Stream0_IRQHandler(void)
+{
+  isr_Enter();
+  HAL_DMA_IRQHandler(&hdma_memtomem_dma2_stream0);
+  isr_Exit(ISR_DMA);
+}
+#endif
 /* USER CODE END 1 */
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -0,0 +1,335 @@
+/*
+ * stop.c
+ *
+ *  STOP mode
+ *
+ *  stop_Wait() goes into STOP when the last FSM run drew the plain time
+ *  screen, the display is in DPM_IDLE (30s without a key), no key is down
+ *  and no UART wake is being held; otherwise it is timer2_Wait(). Every
+ *  clock but LSI/LSE stops: TIM1/TIM2, SysTick, the DWT and USART1 with
+ *  them, the RAM and the pins keep their state. The wake that follows is
+ *  one main loop pass like any other, so the FSM reads the DS3231 and
+ *  checks its alarm once a second, and the pass after a wake redraws only
+ *  the time digits that changed (clock_fsm.c, stop_Woken()).
+ *
+ *  The SQW line stays unmasked outside STOP too: an edge during the pass
+ *  sets stop_sqw, and the next stop_Wait() runs another pass instead of
+ *  sleeping through that second. With EVQ_ENABLE every edge also posts the
+ *  FSM's EVQ_RTC_SEC, and the main loop stops polling the DS3231. The key and RX lines toggle with every
+ *  SPI1 transfer and UART byte, so they are only unmasked while in STOP.
+ *
+ *  Figures: the DWT stands still in STOP and counts from the wake on, at
+ *  HSI (16MHz) until stop_Clock() has the PLL back, then at HCLK.
+ *  "restore" is the HSI part, "to pixel" the wake up to the end of the
+ *  digits' redraw (stop_Drawn()). The STOP exit itself (regulator and flash
+ *  wake-up, tWUSTOP in the datasheet) comes before the first counted cycle
+ *  and is not in them. Awake time is TIM2's (it stops with the rest)
+ *  plus the restores, the window the DS3231's seconds, and the average
+ *  current weights the two with the STOP_IDD_* figures.
+ */
+
+#include "stop.h"
+
+#if STOP_ENABLE
+
+#include "dwt.h"
+#include "tim.h"
+#include "report.h"
+#include "button.h"
+#include "led_7seg.h"
+#include "ds3231.h"
+#include "display_pm.h"
+#include "clock_fsm.h"
+#include "gov.h"
+#include <stdio.h>
+#include <string.h>
+
+#define STOP_WAKE_LINES		(STOP_KEY_Pin | STOP_RX_Pin)	// unmasked in STOP only
+#define STOP_LINES			(STOP_SQW_Pin | STOP_WAKE_LINES)
+
+typedef struct {
+	uint32_t count;
+	uint32_t restore_max_ns;
+	uint32_t pixel_count;		// wakes that reached a redraw
+	uint32_t pixel_max_ns;
+	uint64_t pixel_sum_ns;
+} stop_Stats_t;
+
+// PLL lock and the switch to it, on the DWT at HSI: SysTick does not run
+// with interrupts masked, so the HAL's HAL_GetTick() timeouts would not end
+#define STOP_CLK_TIMEOUT	(HSI_VALUE/1000*2)		// 2ms
+
+static stop_Stats_t stop_stats[STOP_WAKES];
+static volatile uint8_t stop_sqw = 0;		// SQW edge since the pass started
+static uint8_t stop_woken = 0;				// this pass follows a wake
+static uint8_t stop_src = STOP_WAKES;		// wake still waiting for its pixel
+static uint32_t stop_clk_cycles;			// DWT once the PLL was back
+static uint32_t stop_restore_ns;
+static uint8_t stop_hold = 0;				// UART wake: awake until stop_hold_ms
+static uint32_t stop_hold_ms;
+static uint32_t stop_run_since;				// timer2_Us() when the MCU last woke
+static uint64_t stop_awake_us;
+static uint32_t stop_since_sec;				// DS3231 seconds of the day at the clear
+static uint8_t stop_req;					// 1 = print, 2 = print and clear
+
+static const char *const stop_name[STOP_WAKES] = {"rtc", "key", "uart", "other"};
+
+static uint32_t stop_Sec()
+{
+	return ds3231_hours*3600UL + ds3231_min*60UL + ds3231_sec;
+}
+
+static void stop_Clear()
+{
+	memset(stop_stats, 0, sizeof(stop_stats));
+	stop_awake_us = 0;
+	stop_run_since = timer2_Us();
+	stop_since_sec = stop_Sec();
+}
+
+// Falling edge of a pin on its EXTI line, masked until stop_Enter()
+static void stop_Line(GPIO_TypeDef *port, uint16_t pin)
+{
+	uint32_t line = POSITION_VAL(pin), shift = 4*(line & 3);
+	MODIFY_REG(SYSCFG->EXTICR[line >> 2], 0x0FUL << shift, (uint32_t)GPIO_GET_INDEX(port) << shift);
+	EXTI->IMR &= ~pin;
+	EXTI->EMR &= ~pin;
+	EXTI->RTSR &= ~pin;
+	EXTI->FTSR |= pin;
+}
+
+/**
+ * @brief  After ds3231_init() and gov_init()
+ */
+void stop_init()
+{
+	uint32_t line = POSITION_VAL(STOP_SQW_Pin);
+	dwt_init();
+	__HAL_RCC_SYSCFG_CLK_ENABLE();
+	MODIFY_REG(STOP_SQW_GPIO_Port->PUPDR, GPIO_PUPDR_PUPD0 << (2*line), GPIO_PULLUP << (2*line));
+	stop_Line(STOP_SQW_GPIO_Port, STOP_SQW_Pin);
+	stop_Line(STOP_KEY_GPIO_Port, STOP_KEY_Pin);
+	stop_Line(STOP_RX_GPIO_Port, STOP_RX_Pin);
+	ds3231_SquareWave();
+	EXTI->PR = STOP_LINES;
+	EXTI->IMR |= STOP_SQW_Pin;
+	HAL_NVIC_SetPriority(STOP_SQW_IRQn, STOP_PRIO, 0);
+	HAL_NVIC_SetPriority(STOP_KEY_IRQn, STOP_PRIO, 0);
+	HAL_NVIC_SetPriority(STOP_RX_IRQn, STOP_PRIO, 0);
+	HAL_NVIC_EnableIRQ(STOP_SQW_IRQn);
+	HAL_NVIC_EnableIRQ(STOP_KEY_IRQn);
+	HAL_NVIC_EnableIRQ(STOP_RX_IRQn);
+	stop_req = 0;
+	stop_Clear();
+}
+
+static uint8_t stop_Ready()
+{
+	uint8_t i;
+	if(!clock_fsm_quiet() || dpm_GetLevel() != DPM_IDLE) return 0;
+	if(stop_hold){
+		if((int32_t)(HAL_GetTick() - stop_hold_ms) < 0) return 0;
+		stop_hold = 0;
+	}
+	for(i = 0; i < 16; i++){
+		if(button_count[i]) return 0;
+	}
+	return 1;
+}
+
+// Force the backlight pin while TIM1 stands still, or give it back to the PWM
+static uint32_t stop_Backlight(uint32_t ccmr1)
+{
+	uint32_t was = TIM1->CCMR1;
+	TIM1->CCMR1 = ccmr1;
+	return was;
+}
+
+// Back to SystemClock_Config()'s PLL after a wake. STOP only turns the PLL
+// off and SYSCLK over to HSI: PLLCFGR, the prescalers, the flash latency and
+// the voltage scale keep their values, and so SystemCoreClock stays right
+static void stop_Clock()
+{
+	uint32_t c0 = dwt_Cycles();
+	RCC->CR |= RCC_CR_PLLON;
+	while(!(RCC->CR & RCC_CR_PLLRDY)){
+		if(dwt_Cycles() - c0 > STOP_CLK_TIMEOUT) Error_Handler();
+	}
+	MODIFY_REG(RCC->CFGR, RCC_CFGR_SW, RCC_CFGR_SW_PLL);
+	while((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL){
+		if(dwt_Cycles() - c0 > STOP_CLK_TIMEOUT) Error_Handler();
+	}
+}
+
+// 1 = the pass runs now: after a wake, or at once for an SQW edge that came
+// during the pass
+static uint8_t stop_Enter()
+{
+	uint32_t ccmr1, pr, c0, ns;
+	uint8_t src;
+	gov_Boost();							// stop_Clock() brings these clocks back
+	while(!(USART1->SR & USART_SR_TC));		// the last byte out before USART1 stops
+	__disable_irq();
+	if(stop_sqw){							// the second changed during the pass
+		__enable_irq();
+		return 1;
+	}
+	stop_awake_us += timer2_Us() - stop_run_since;
+	led7_Blank();							// the scan stops with TIM2, a lit digit would stay lit
+	ccmr1 = stop_Backlight((TIM1->CCMR1 & ~TIM_CCMR1_OC1M) |
+			(STOP_BACKLIGHT ? TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1M_0 : TIM_CCMR1_OC1M_2));
+	HAL_GPIO_WritePin(BTN_LOAD_GPIO_Port, BTN_LOAD_Pin, 0);
+	EXTI->PR = STOP_WAKE_LINES;
+	EXTI->IMR |= STOP_WAKE_LINES;
+	HAL_SuspendTick();
+	HAL_PWR_EnterSTOPMode(STOP_REGULATOR, PWR_STOPENTRY_WFI);
+	c0 = dwt_Cycles();
+	pr = EXTI->PR & STOP_LINES;
+	HAL_ResumeTick();
+	if(__HAL_RCC_GET_SYSCLK_SOURCE() != RCC_SYSCLKSOURCE_STATUS_PLLCLK) stop_Clock();
+	stop_clk_cycles = dwt_Cycles();
+	EXTI->IMR &= ~STOP_WAKE_LINES;
+	HAL_GPIO_WritePin(BTN_LOAD_GPIO_Port, BTN_LOAD_Pin, 1);
+	stop_Backlight(ccmr1);
+	stop_run_since = timer2_Us();
+	__enable_irq();							// stop_Exti() takes the line's pending bit
+
+	if(pr & STOP_SQW_Pin) src = STOP_WAKE_RTC;
+	else if(pr & STOP_KEY_Pin) src = STOP_WAKE_KEY;
+	else if(pr & STOP_RX_Pin) src = STOP_WAKE_UART;
+	else src = STOP_WAKE_OTHER;
+	if(src == STOP_WAKE_UART){
+		stop_hold = 1;
+		stop_hold_ms = HAL_GetTick() + STOP_UART_HOLD_MS;
+	}
+	ns = (uint64_t)(stop_clk_cycles - c0)*1000/(HSI_VALUE/1000000);
+	stop_restore_ns = ns;
+	stop_awake_us += ns/1000;
+	stop_stats[src].count++;
+	if(ns > stop_stats[src].restore_max_ns) stop_stats[src].restore_max_ns = ns;
+	stop_src = src;
+	stop_woken = 1;
+	return 1;
+}
+
+/**
+ * @brief  In place of timer2_Wait() at the top of the main loop pass
+ */
+void stop_Wait()
+{
+	stop_woken = 0;
+	stop_src = STOP_WAKES;
+	if(!stop_Ready() || !stop_Enter()) timer2_Wait();
+	stop_sqw = 0;
+}
+
+/**
+ * @brief  1 if this pass follows a wake from STOP
+ */
+uint8_t stop_Woken()
+{
+	return stop_woken;
+}
+
+/**
+ * @brief  The time digits are on the panel: stamps the wake's "to pixel"
+ */
+void stop_Drawn()
+{
+	stop_Stats_t *s;
+	uint32_t ns;
+	if(stop_src >= STOP_WAKES) return;
+	s = &stop_stats[stop_src];
+	ns = stop_restore_ns + (uint64_t)(dwt_Cycles() - stop_clk_cycles)*1000/(SystemCoreClock/1000000);
+	s->pixel_count++;
+	s->pixel_sum_ns += ns;
+	if(ns > s->pixel_max_ns) s->pixel_max_ns = ns;
+	stop_src = STOP_WAKES;
+}
+
+static void stop_Exti()
+{
+	uint32_t pr = EXTI->PR & STOP_LINES;
+	EXTI->PR = pr;
+	if(pr & STOP_SQW_Pin){
+		stop_sqw = 1;
+		evq_Put(&ds3231_events, EVQ_RTC_SEC, DS3231_SEC_UNREAD, 0);
+	}
+}
+
+void EXTI4_IRQHandler(void)
+{
+	stop_Exti();
+}
+
+void EXTI9_5_IRQHandler(void)
+{
+	stop_Exti();
+}
+
+void EXTI15_10_IRQHandler(void)
+{
+	stop_Exti();
+}
+
+/**
+ * @brief  Ask for the table at the next stop_Poll(); reset = 1 also clears
+ *         it once printed
+ */
+void stop_Request(uint8_t reset)
+{
+	rpt_Request(&stop_req, reset);
+}
+
+/**
+ * @brief  Call from the main loop
+ */
+void stop_Poll()
+{
+	uint8_t req = rpt_Take(&stop_req);
+	if(req == RPT_NONE) return;
+	stop_Report();
+	if(req == RPT_CLEAR) stop_Clear();
+}
+
+/**
+ * @brief  Print one row per wake source, then the awake share of the
+ *         window and the average MCU current it comes to
+ */
+void stop_Report()
+{
+	char line[128], a[16], b[16], c[16];
+	uint64_t awake_us, window_us, ua;
+	uint32_t window_s, share;
+	uint16_t n;
+	uint8_t i;
+	n = sprintf(line, "\r\nSTOP wake     count  restore max us  to pixel max us  mean us\r\n");
+	rpt_Write(line, n);
+	for(i = 0; i < STOP_WAKES; i++){
+		stop_Stats_t *s = &stop_stats[i];
+		n = sprintf(line, "%-9s %9lu %15s %16s %8s\r\n", stop_name[i], (unsigned long)s->count,
+				rpt_Us(a, s->restore_max_ns), rpt_Us(b, s->pixel_max_ns),
+				rpt_Us(c, s->pixel_count ? (uint32_t)(s->pixel_sum_ns/s->pixel_count) : 0));
+		rpt_Write(line, n);
+	}
+	awake_us = stop_awake_us + (timer2_Us() - stop_run_since);
+	window_s = (stop_Sec() + 86400UL - stop_since_sec) % 86400UL;	// a window under a day
+	window_us = (uint64_t)window_s*1000000;
+	if(window_us < awake_us) window_us = awake_us;
+	if(window_us == 0) window_us = 1;
+	share = awake_us*1000/window_us;
+	ua = (awake_us*STOP_IDD_RUN_UA + (window_us - awake_us)*STOP_IDD_STOP_UA)/window_us;
+	n = sprintf(line, "awake %lu ms of %lu s (DS3231): %lu.%lu%%\r\n", (unsigned long)(awake_us/1000),
+			(unsigned long)window_s, (unsigned long)(share/10), (unsigned long)(share%10));
+	rpt_Write(line, n);
+	n = sprintf(line, "average MCU current %lu uA at %lu/%lu uA run/STOP (typical, not measured)\r\n",
+			(unsigned long)ua, (unsigned long)STOP_IDD_RUN_UA, (unsigned long)STOP_IDD_STOP_UA);
+	rpt_Write(line, n);
+#if STOP_BACKLIGHT
+	n = sprintf(line, "plus the backlight held on in STOP: %lu uA (STOP_BACKLIGHT=1)\r\n",
+			(unsigned long)((window_us - awake_us)*STOP_IDD_BACKLIGHT_UA/window_us));
+	rpt_Write(line, n);
+#endif
+}
+
+#endif /* STOP_ENABLE */
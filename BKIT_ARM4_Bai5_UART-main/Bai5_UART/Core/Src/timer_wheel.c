@@ -0,0 +1,183 @@
+/*
+ * timer_wheel.c
+ *
+ *  Hierarchical timing wheel
+ *
+ *  TW_LEVELS wheels of TW_SLOTS slots; a slot of level l spans 64^l ticks.
+ *  A timer is filed by how far away it is: under 64 ticks into level 0 at
+ *  the tick it fires, further out into the slot of the first level that
+ *  covers the distance. Each time a level-l slot comes up, its timers are
+ *  filed again one level down, so every timer moves at most TW_LEVELS - 1
+ *  times and expiry only ever looks at one level-0 slot per tick. Slots
+ *  are circular doubly linked lists, so start and stop are O(1) too.
+ *
+ *  The TIM2 interrupt only counts ticks. tw_Run() advances the wheel to
+ *  that count and calls the callbacks from the main loop, where they can
+ *  draw and start or stop timers, themselves included.
+ */
+
+#include "timer_wheel.h"
+
+#define TW_MASK		(TW_SLOTS - 1)
+#define TW_SPAN		(1UL << (TW_BITS*TW_LEVELS))
+
+volatile uint32_t tw_ticks = 0;
+static uint32_t tw_now = 0;					// last tick tw_Run() handled
+static tw_Link_t tw_wheel[TW_LEVELS][TW_SLOTS];
+
+void tw_init()
+{
+	uint8_t l;
+	uint16_t s;
+	for(l = 0; l < TW_LEVELS; l++){
+		for(s = 0; s < TW_SLOTS; s++) tw_wheel[l][s].next = tw_wheel[l][s].prev = &tw_wheel[l][s];
+	}
+	tw_now = tw_ticks;
+}
+
+static void tw_Unlink(tw_Timer_t *t)
+{
+	t->link.prev->next = t->link.next;
+	t->link.next->prev = t->link.prev;
+	t->link.next = t->link.prev = NULL;
+}
+
+static void tw_Insert(tw_Link_t *slot, tw_Timer_t *t)
+{
+	t->link.prev = slot->prev;
+	t->link.next = slot;
+	slot->prev->next = &t->link;
+	slot->prev = &t->link;
+}
+
+// File t by its distance from tw_now; a timer already due fires next tick
+static void tw_Add(tw_Timer_t *t)
+{
+	uint32_t delta = t->expire - tw_now, at = t->expire;
+	uint8_t l = 0;
+	if((int32_t)delta <= 0){
+		t->expire = at = tw_now + 1;
+		delta = 1;
+	}
+	if(delta >= TW_SPAN) at = tw_now + TW_SPAN - 1;	// parked; filed again when its slot comes up
+	while(l < TW_LEVELS - 1 && (at - tw_now) >> (TW_BITS*(l + 1))) l++;
+	tw_Insert(&tw_wheel[l][(at >> (TW_BITS*l)) & TW_MASK], t);
+}
+
+/**
+ * @brief  Start (or restart) a timer
+ * @param  ms Fires ms after the last tick tw_Run() handled; 0 = next tick
+ * @param  period_ms Then again every period_ms, without drift; 0 = once
+ * @param  fn Called from tw_Run() with arg; may be NULL
+ */
+void tw_Start(tw_Timer_t *t, uint32_t ms, uint32_t period_ms, tw_Fn_t fn, void *arg)
+{
+	if(t->link.next != NULL) tw_Unlink(t);
+	t->expire = tw_now + ms;
+	t->period = period_ms;
+	t->fn = fn;
+	t->arg = arg;
+	tw_Add(t);
+}
+
+void tw_Stop(tw_Timer_t *t)
+{
+	if(t->link.next != NULL) tw_Unlink(t);
+}
+
+/**
+ * @brief  1 while the timer is running: a one-shot timer stops once it fired
+ */
+uint8_t tw_Active(const tw_Timer_t *t)
+{
+	return t->link.next != NULL;
+}
+
+/**
+ * @brief  ms until the timer fires, 0 if it is not running
+ */
+uint32_t tw_Left(const tw_Timer_t *t)
+{
+	return (t->link.next != NULL) ? t->expire - tw_now : 0;
+}
+
+/**
+ * @brief  Tick the earliest running timer fires at, for a tickless TIM2 to
+ *         wake at; call after tw_Run()
+ * @retval 1 with *tick set, 0 if no timer is running
+ */
+uint8_t tw_NextDue(uint32_t *tick)
+{
+	tw_Link_t *head, *p;
+	uint32_t d, best = 0;
+	uint8_t l, found = 0;
+	uint16_t i;
+	for(l = 0; l < TW_LEVELS; l++){
+		// Slots in the order they come up; past the first one in use a
+		// level only holds later timers, except parked ones on the last
+		for(i = 1; i <= TW_SLOTS; i++){
+			head = &tw_wheel[l][((tw_now >> (TW_BITS*l)) + i) & TW_MASK];
+			if(head->next == head) continue;
+			for(p = head->next; p != head; p = p->next){
+				d = ((tw_Timer_t*)p)->expire - tw_now;
+				if(!found || d < best){
+					best = d;
+					found = 1;
+				}
+			}
+			if(l < TW_LEVELS - 1) break;
+		}
+	}
+	if(found) *tick = tw_now + best;
+	return found;
+}
+
+/**
+ * @brief  Callback that posts an event: adds one to the uint8_t at arg;
+ *         the owner takes them with if(n){ n--; ... }
+ */
+void tw_Post(void *arg)
+{
+	(*(uint8_t*)arg)++;
+}
+
+// Slot 'slot' of level l came up: file its timers again, one level down
+static void tw_Cascade(uint8_t l, uint8_t slot)
+{
+	tw_Link_t *head = &tw_wheel[l][slot];
+	while(head->next != head){
+		tw_Timer_t *t = (tw_Timer_t*)head->next;
+		tw_Unlink(t);
+		// Due this very tick: the level-0 slot is expired right after
+		if(t->expire == tw_now) tw_Insert(&tw_wheel[0][tw_now & TW_MASK], t);
+		else tw_Add(t);
+	}
+}
+
+/**
+ * @brief  Expire the timers of every tick counted since the last call; call
+ *         from the main loop, callbacks run here
+ */
+void tw_Run()
+{
+	tw_Link_t *head;
+	tw_Timer_t *t;
+	uint8_t l;
+	while(tw_now != tw_ticks){
+		tw_now++;
+		for(l = 1; l < TW_LEVELS; l++){
+			if(tw_now & ((1UL << (TW_BITS*l)) - 1)) break;
+			tw_Cascade(l, (tw_now >> (TW_BITS*l)) & TW_MASK);
+		}
+		head = &tw_wheel[0][tw_now & TW_MASK];
+		while(head->next != head){
+			t = (tw_Timer_t*)head->next;
+			tw_Unlink(t);
+			if(t->period){
+				t->expire += t->period;
+				tw_Add(t);
+			}
+			if(t->fn != NULL) t->fn(t->arg);
+		}
+	}
+}
@@ -10,6 +10,16 @@
 #include "stdlib.h" // Thêm thư viện để dùng atoi
 #include "string.h" // Thêm thư viện để dùng strlen
 #include "usart.h"   // *** THÊM THƯ VIỆN NÀY ĐỂ NHẬN DIỆN 'huart1' ***
+#include "trace.h"
+#include "prof.h"
+#include "pcsamp.h"
+#include "loopstat.h"
+#include "sched.h"
+#include "kernel.h"
+#include "evq.h"
+#include "isrstat.h"
+#include "gov.h"
+#include "stop.h"
 
 uint8_t receive_buffer1 = 0;
 uint8_t msg[100];
@@ -26,6 +36,21 @@ static uint8_t uart_cmd_buffer[UART_CMD_BUFFER_SIZE];
 static uint16_t uart_cmd_index = 0;
 volatile uint8_t uart_cmd_ready_flag = 0; // Cờ báo có lệnh mới
 
+// Sự kiện "có lệnh" cho FSM; bên gửi là ngắt nhận, ở byte kết thúc dòng.
+// Byte đó có thể đến sau task_Uart() trong lượt này, nên dispatch của FSM
+// tự gọi uart_process_incoming_data() để ghép lệnh trước khi chạy FSM
+evq_Queue_t uart_events = EVQ_INIT("uart");
+static uint8_t rx_eol = 1; // byte trước là CR/LF (chỉ ngắt dùng)
+
+#if KERNEL_ENABLE
+// Với kernel: ngắt nhận đánh thức luồng UART, các lệnh hoàn chỉnh xếp hàng
+// cho FSM thay vì cờ uart_cmd_ready_flag
+#define UART_LINES 4
+k_Sem_t uart_rx_sem = K_SEM_INIT(0, 1);
+static uint8_t uart_line_buf[UART_LINES][UART_CMD_BUFFER_SIZE];
+static k_Queue_t uart_lines = K_QUEUE_INIT(uart_line_buf, UART_CMD_BUFFER_SIZE, UART_LINES);
+#endif
+
 /**
  * @brief Hàm mypow (được sao chép từ lcd.c) để uart_Rs232SendNum hoạt động.
  */
@@ -113,11 +138,84 @@ int16_t uart_ReadByte(void) {
     }
 }
 
+#if UART_CMD_ENABLE
+// "prof" / "pcs" / "loop" / "sched" / "kernel" / "events" / "isr" / "gov" / "stop", có thể kèm " reset": trả về 1 nếu đã xử lý
+static uint8_t uart_profiler_command(const char *cmd) {
+#if PROF_ENABLE
+    if (strcmp(cmd, PROF_CMD) == 0 || strcmp(cmd, PROF_CMD " reset") == 0) {
+        prof_Request(cmd[sizeof(PROF_CMD) - 1] != '\0');
+        return 1;
+    }
+#endif
+#if PCS_ENABLE
+    if (strcmp(cmd, PCS_CMD) == 0 || strcmp(cmd, PCS_CMD " reset") == 0) {
+        pcs_Request(cmd[sizeof(PCS_CMD) - 1] != '\0');
+        return 1;
+    }
+#endif
+#if LOOP_STATS
+    if (strcmp(cmd, LOOP_CMD) == 0 || strcmp(cmd, LOOP_CMD " reset") == 0) {
+        loop_Request(cmd[sizeof(LOOP_CMD) - 1] != '\0');
+        return 1;
+    }
+#endif
+#if SCHED_ENABLE
+    if (strcmp(cmd, SCHED_CMD) == 0 || strcmp(cmd, SCHED_CMD " reset") == 0) {
+        sched_Request(cmd[sizeof(SCHED_CMD) - 1] != '\0');
+        return 1;
+    }
+#endif
+#if KERNEL_ENABLE
+    if (strcmp(cmd, KERNEL_CMD) == 0 || strcmp(cmd, KERNEL_CMD " reset") == 0) {
+        k_Request(cmd[sizeof(KERNEL_CMD) - 1] != '\0');
+        return 1;
+    }
+#endif
+#if EVQ_ENABLE
+    if (strcmp(cmd, EVQ_CMD) == 0 || strcmp(cmd, EVQ_CMD " reset") == 0) {
+        evq_Request(cmd[sizeof(EVQ_CMD) - 1] != '\0');
+        return 1;
+    }
+#endif
+#if ISR_STATS
+    if (strcmp(cmd, ISR_CMD) == 0 || strcmp(cmd, ISR_CMD " reset") == 0) {
+        isr_Request(cmd[sizeof(ISR_CMD) - 1] != '\0');
+        return 1;
+    }
+#endif
+#if GOV_ENABLE
+    if (strcmp(cmd, GOV_CMD) == 0 || strcmp(cmd, GOV_CMD " reset") == 0) {
+        gov_Request(cmd[sizeof(GOV_CMD) - 1] != '\0');
+        return 1;
+    }
+#endif
+#if STOP_ENABLE
+    if (strcmp(cmd, STOP_CMD) == 0 || strcmp(cmd, STOP_CMD " reset") == 0) {
+        stop_Request(cmd[sizeof(STOP_CMD) - 1] != '\0');
+        return 1;
+    }
+#endif
+    return 0;
+}
+#endif
+
 // *** HÀM ĐÃ SỬA LỖI VÒNG LẶP VÔ HẠN (PHIÊN BẢN CHÍNH XÁC) ***
 // Các hàm xử lý lệnh UART
 void uart_process_incoming_data(void) {
     int16_t byte;
 
+    // Lệnh trước chưa được FSM lấy: để các byte sau nằm trong ring buffer
+    // (với bộ lập lịch, hàm này chạy nhiều lần giữa hai lượt FSM)
+#if KERNEL_ENABLE
+    if (uart_lines.count == uart_lines.depth) {
+        return;
+    }
+#else
+    if (uart_cmd_ready_flag) {
+        return;
+    }
+#endif
+
     // Vòng lặp while(1) để lấy TẤT CẢ các byte
     while(1) {
         byte = uart_ReadByte(); // Đọc 1 byte từ ring buffer
@@ -130,6 +228,23 @@ void uart_process_incoming_data(void) {
         if (byte == '\r' || byte == '\n') { // Nếu là ký tự kết thúc lệnh
             if (uart_cmd_index > 0) { // Nếu đã có nội dung lệnh
                 uart_cmd_buffer[uart_cmd_index] = '\0'; // Kết thúc chuỗi
+#if UART_CMD_ENABLE
+                // Lệnh của profiler không đến FSM, kết quả được in ở vòng lặp chính
+                if (uart_profiler_command((char*)uart_cmd_buffer)) {
+                    uart_cmd_index = 0;
+                    continue;
+                }
+#endif
+#if KERNEL_ENABLE
+                // Xếp hàng cho FSM; khi hàng đợi đầy, các byte sau nằm lại
+                // trong ring buffer như với cờ
+                k_QueuePut(&uart_lines, uart_cmd_buffer, 0);
+                uart_cmd_index = 0;
+                if (uart_lines.count < uart_lines.depth) {
+                    continue;
+                }
+                break;
+#endif
                 uart_cmd_ready_flag = 1; // Bật cờ báo lệnh sẵn sàng
                 uart_cmd_index = 0; // Reset chỉ số bộ đệm lệnh
 
@@ -147,6 +262,10 @@ void uart_process_incoming_data(void) {
 
 
 uint8_t uart_get_command(uint8_t* buffer) {
+#if KERNEL_ENABLE
+    // buffer phải chứa được UART_CMD_BUFFER_SIZE byte
+    return k_QueueGet(&uart_lines, buffer, 0) == 0;
+#endif
     if (uart_cmd_ready_flag) {
         strcpy((char*)buffer, (char*)uart_cmd_buffer); // Sao chép lệnh
         uart_cmd_ready_flag = 0; // Xóa cờ
@@ -164,6 +283,7 @@ int32_t uart_parse_num_from_string(uint8_t* str) {
 // Callback ngắt nhận UART
 void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart){
 	if(huart->Instance == USART1){
+		trace_Rx(receive_buffer1);
 
 		// Tính vị trí head tiếp theo
 		uint16_t next_head = (rx_head + 1) % UART_BUFFER_SIZE;
@@ -176,11 +296,22 @@ void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart){
 
 			// Bật cờ báo cho vòng lặp main (cờ này chỉ báo là có byte mới)
 			uart_rx_flag = 1;
+
+			// CR/LF đầu tiên sau nội dung: một dòng đã đủ, báo FSM
+			if (receive_buffer1 == '\r' || receive_buffer1 == '\n') {
+				if (!rx_eol) evq_Put(&uart_events, EVQ_UART_LINE, 0, 0);
+				rx_eol = 1;
+			} else {
+				rx_eol = 0;
+			}
 		} else {
 			// Buffer đầy, dữ liệu bị mất (có thể xử lý lỗi ở đây)
 		}
 
 		// Kích hoạt lại ngắt nhận UART cho byte tiếp theo
 		HAL_UART_Receive_IT(&huart1, &receive_buffer1, 1);
+#if KERNEL_ENABLE
+		k_SemGive(&uart_rx_sem); // đánh thức luồng UART
+#endif
 	}
 }
@@ -0,0 +1,34 @@
+/*
+ * bench.h
+ *
+ *  LCD bus-traffic benchmark: scripted traffic_fsm scenarios with per-tick
+ *  counts of FSMC cycles
+ */
+
+#ifndef INC_BENCH_H_
+#define INC_BENCH_H_
+
+#include "lcd.h"
+
+// 1 = main() runs bench_Run()/bench_Report() before the normal loop.
+// Needs LCD_BUS_STATS=1 as well.
+#ifndef LCD_BENCH
+#define LCD_BENCH	0
+#endif
+
+#define BENCH_MAX_SCENARIOS	9
+
+typedef struct {
+	const char *name;
+	uint16_t ticks;			// 50ms ticks measured
+	_lcd_bus total;			// sum over all ticks
+	_lcd_bus peak;			// worst single tick, per counter
+} bench_Result_t;
+
+extern bench_Result_t bench_results[BENCH_MAX_SCENARIOS];
+extern uint8_t bench_count;
+
+void bench_Run(void);
+void bench_Report(void);
+
+#endif /* INC_BENCH_H_ */
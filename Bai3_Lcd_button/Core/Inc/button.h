@@ -10,8 +10,10 @@
 
 #include "spi.h"
 #include "gpio.h"
+#include "evq.h"
 
 extern uint16_t button_count[16];
+extern evq_Queue_t button_events;	// edges, and a hold event per scan while a key is down
 
 void button_init();
 void button_Scan();
@@ -0,0 +1,70 @@
+/*
+ * evq.h
+ *
+ *  Event queues: one lock-free single-producer/single-consumer ring per
+ *  input source, so the FSM only runs when something happened
+ */
+
+#ifndef INC_EVQ_H_
+#define INC_EVQ_H_
+
+#include "main.h"
+
+// 1 = the FSM runs only in passes that took an event; 0 = every pass, and
+// the calls compile to nothing
+#ifndef EVQ_ENABLE
+#define EVQ_ENABLE		0
+#endif
+
+#define EVQ_LEN			16			// events per queue, a power of two
+#define EVQ_MAX			6			// queues evq_Report() lists
+#define EVQ_CMD			"events"	// USART1 line that prints the queues; "events reset" also clears them
+#define EVQ_DUMP_KEY	11			// button that prints them where there is no USART
+
+typedef enum {
+	EVQ_KEY_DOWN,				// arg = key
+	EVQ_KEY_HOLD,				// arg = key, count = scans held so far; every scan
+	EVQ_KEY_UP,					// arg = key, count = scans it was held
+	EVQ_UART_LINE,				// the RX interrupt took a line end
+	EVQ_RTC_SEC,				// arg = the new second, DS3231_SEC_UNREAD from SQW
+	EVQ_TIMER					// arg = the FSM's timer id
+} evq_Type_t;
+
+typedef struct {
+	uint8_t type;				// evq_Type_t
+	uint8_t arg;
+	uint16_t count;
+	uint32_t tick;				// HAL_GetTick() when posted
+} evq_Event_t;
+
+typedef struct {
+	const char *name;
+	evq_Event_t buf[EVQ_LEN];
+	volatile uint16_t head;		// free-running; only the producer writes it
+	volatile uint16_t tail;		// free-running; only the consumer writes it
+	uint16_t high;				// most events queued at once
+	uint32_t posted;
+	uint32_t drops;				// evq_Put() calls that found the queue full
+	uint32_t age_max;			// ms from evq_Put() to evq_Get(), worst
+} evq_Queue_t;
+
+#define EVQ_INIT(name)	{ (name) }
+
+#if EVQ_ENABLE
+void evq_Add(evq_Queue_t *q);
+uint8_t evq_Put(evq_Queue_t *q, uint8_t type, uint8_t arg, uint16_t count);
+uint8_t evq_Get(evq_Queue_t *q, evq_Event_t *ev);
+uint8_t evq_Drain(evq_Queue_t *q);
+void evq_Ran(uint8_t ran);
+void evq_Request(uint8_t reset);
+void evq_Poll();
+void evq_Report();
+#else
+#define evq_Add(q)						((void)0)
+#define evq_Put(q, type, arg, count)	((void)0)
+#define evq_Request(reset)				((void)0)
+#define evq_Poll()						((void)0)
+#define evq_Report()					((void)0)
+#endif
+
+#endif /* INC_EVQ_H_ */
@@ -42,6 +42,23 @@ typedef struct
 }_lcd_dev;
 
 extern _lcd_dev lcddev;
+
+// 1 = count bus cycles in lcd_bus (bench.c reads and clears it)
+#ifndef LCD_BUS_STATS
+#define LCD_BUS_STATS	0
+#endif
+
+typedef struct
+{
+	uint32_t reg;		// command writes
+	uint32_t data;		// data writes, pixels included
+	uint32_t windows;	// column/page address setups
+	uint32_t pixels;	// data writes after 0x2C/0x3C
+}_lcd_bus;
+
+#if LCD_BUS_STATS
+extern _lcd_bus lcd_bus;
+#endif
 typedef struct
 {
 	__IO uint16_t LCD_REG;
@@ -50,6 +67,12 @@ typedef struct
 
 #define LCD_BASE        ((uint32_t)(0x60000000 | 0x000ffffe))
 #define LCD             ((LCD_TypeDef *) LCD_BASE)
+#ifdef HOST_SIM
+// Host build: the bus goes to the ILI9341 model in host_sim/ili9341.c
+void ili9341_WriteReg(uint16_t reg);
+void ili9341_WriteData(uint16_t data);
+uint16_t ili9341_ReadData(void);
+#endif
 //////////////////////////////////////////////////////////////////////////////////
 
 
@@ -80,6 +80,11 @@ void Error_Handler(void);
 #define FSMC_BLK_GPIO_Port GPIOA
 #define BTN_LOAD_Pin GPIO_PIN_3
 #define BTN_LOAD_GPIO_Port GPIOD
+#define TP_IRQ_Pin GPIO_PIN_1
+#define TP_IRQ_GPIO_Port GPIOB
+#define TP_IRQ_EXTI_IRQn EXTI1_IRQn
+#define TP_CS_Pin GPIO_PIN_12
+#define TP_CS_GPIO_Port GPIOB
 /* USER CODE BEGIN Private defines */
 
 /* USER CODE END Private defines */
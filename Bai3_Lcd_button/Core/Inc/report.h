@@ -0,0 +1,38 @@
+/*
+ * report.h
+ *
+ *  Shared by the statistics modules: the print request a command leaves
+ *  for the main loop, where the tables go, and the time format they use
+ *
+ *  Each module keeps one request byte: x_Request(reset) calls
+ *  rpt_Request(&x_req, reset) and x_Poll() prints when rpt_Take(&x_req)
+ *  is not RPT_NONE, then clears its counters on RPT_CLEAR.
+ */
+
+#ifndef INC_REPORT_H_
+#define INC_REPORT_H_
+
+#include "main.h"
+
+#define RPT_NONE	0
+#define RPT_PRINT	1
+#define RPT_CLEAR	2		// print, then clear
+
+// A print-and-clear request is not downgraded by a plain one
+static inline void rpt_Request(uint8_t *req, uint8_t reset)
+{
+	if(*req < RPT_PRINT + reset) *req = RPT_PRINT + reset;
+}
+
+// The pending request, which is dropped
+static inline uint8_t rpt_Take(uint8_t *req)
+{
+	uint8_t r = *req;
+	*req = RPT_NONE;
+	return r;
+}
+
+void rpt_Write(const char *p, uint16_t n);
+char *rpt_Us(char *buf, uint32_t ns);
+
+#endif /* INC_REPORT_H_ */
@@ -0,0 +1,61 @@
+/*
+ * touch.h
+ *
+ *  Resistive touch panel on an XPT2046 controller (SPI2)
+ */
+
+#ifndef INC_TOUCH_H_
+#define INC_TOUCH_H_
+
+#include "main.h"
+
+#define TOUCH_SAMPLES		5		// conversions per axis in one burst, median taken
+#define TOUCH_PERIOD_MS		10		// burst rate while the pen is down
+#define TOUCH_Z_MIN			100		// Z1 pressure below this counts as pen up
+#define TOUCH_QUEUE_LEN		16
+
+typedef enum {
+	TOUCH_DOWN,
+	TOUCH_MOVE,
+	TOUCH_UP
+} touch_EventType_t;
+
+typedef struct {
+	touch_EventType_t type;
+	uint16_t x;				// screen pixels after calibration
+	uint16_t y;
+	uint32_t tick;			// HAL_GetTick() when the burst finished
+} touch_Event_t;
+
+/*
+ * Raw-to-screen mapping in Q16:
+ *   x = (ax*rx + bx*ry + cx) >> 16
+ *   y = (ay*rx + by*ry + cy) >> 16
+ */
+typedef struct {
+	int32_t ax, bx, cx;
+	int32_t ay, by, cy;
+} touch_Cal_t;
+
+extern uint32_t touch_dropped;
+
+void touch_init();
+void touch_Tick(uint8_t ms);
+uint8_t touch_Polling();
+void touch_PollCallback();
+uint8_t touch_GetEvent(touch_Event_t *ev);
+uint8_t touch_Pending();
+
+void touch_SetCalibration(const touch_Cal_t *cal);
+uint8_t touch_Calibrate(const uint16_t raw[3][2], const uint16_t scr[3][2]);
+
+void touch_PenIrq();
+void touch_BurstDone();
+
+#ifdef HOST_SIM
+// Mock controller: raw 12-bit ADC readings the next bursts will return
+void touch_MockPress(uint16_t rx, uint16_t ry, uint16_t z1);
+void touch_MockRelease();
+#endif
+
+#endif /* INC_TOUCH_H_ */
@@ -9,6 +9,16 @@
 #ifndef INC_TRAFFIC_FSM_H_
 #define INC_TRAFFIC_FSM_H_
 
+#include <stdint.h>
+
+// 1 = đo độ trễ của mỗi lần chuyển pha so với thời điểm đã lên lịch và sai
+// số độ dài mỗi pha; 0 = các lời gọi biên dịch thành rỗng
+#ifndef PHASE_STATS
+#define PHASE_STATS		0
+#endif
+
+#define PHASE_DUMP_KEY	14		// nút in bảng sai số pha (không FSM nào dùng)
+
 // 1. Các chế độ hệ thống (4 chế độ)
 typedef enum {
     MODE_NORMAL = 1,
@@ -40,5 +50,44 @@ void fsm_traffic_init();
  */
 void fsm_traffic_run();
 
+/**
+ * @brief Với EVQ_ENABLE: đưa các lần nhấn phím (EVQ_KEY_DOWN) cho FSM và chỉ
+ * gọi fsm_traffic_run() khi có sự kiện (phím, chạm, timer). Trả về 1 nếu FSM
+ * đã chạy.
+ */
+uint8_t fsm_traffic_dispatch();
+
+/**
+ * @brief Trạng thái đèn hiện tại (bench.c dùng để chia kết quả theo trạng thái).
+ */
+Traffic_State_t fsm_traffic_state();
+
+/**
+ * @brief Chế độ hiện tại (host_sim dùng khi phát lại trace).
+ */
+System_Mode_t fsm_traffic_mode();
+
+#if PHASE_STATS
+/**
+ * @brief Yêu cầu in bảng sai số pha ở lần fsm_traffic_poll() tới; reset = 1
+ * thì xóa bảng sau khi in.
+ */
+void fsm_traffic_request(uint8_t reset);
+
+/**
+ * @brief Gọi trong vòng lặp chính, sau FSM: in bảng nếu đã có yêu cầu.
+ */
+void fsm_traffic_poll();
+
+/**
+ * @brief In bảng: mỗi trạng thái một dòng (số lần chuyển, độ trễ, sai số độ dài pha).
+ */
+void fsm_traffic_report();
+#else
+#define fsm_traffic_request(reset)	((void)0)
+#define fsm_traffic_poll()			((void)0)
+#define fsm_traffic_report()		((void)0)
+#endif
+
 
 #endif /* INC_TRAFFIC_FSM_H_ */
@@ -0,0 +1,159 @@
+/*
+ * bench.c
+ *
+ *  LCD bus-traffic benchmark for traffic_fsm
+ *
+ *  bench_Run() replaces button_Scan() with a script and drives
+ *  fsm_traffic_run() through one full light cycle at the default periods
+ *  and the three modify modes, one 50ms tick at a time. lcd_bus is cleared
+ *  before every tick; cycle ticks are added to the scenario of the state
+ *  the tick ended in, so each traffic state gets its own row.
+ *
+ *  The same code runs in host_sim (traffic_bench) and on the board, where
+ *  bench_Report() puts the table on the LCD (full numbers in bench_results).
+ */
+
+#include "bench.h"
+
+#if LCD_BENCH
+
+#if !LCD_BUS_STATS
+#error "LCD_BENCH needs LCD_BUS_STATS=1"
+#endif
+
+#include "software_timer.h"
+#include "timer_wheel.h"
+#include "button.h"
+#include "traffic_fsm.h"
+#include <stdio.h>
+
+#ifdef HOST_SIM
+uint8_t sim_Wait(void);
+#endif
+
+// Same keys as traffic_fsm.c
+#define BENCH_KEY_MODE		0
+#define BENCH_KEY_ADJUST	1
+#define BENCH_KEY_CONFIRM	2
+
+// Rows 0..5 follow Traffic_State_t
+static const char *bench_names[BENCH_MAX_SCENARIOS] = {
+	"r1_green", "r1_yellow", "all_red_1", "r2_green", "r2_yellow", "all_red_2",
+	"modify_red", "modify_green", "modify_yellow"
+};
+
+bench_Result_t bench_results[BENCH_MAX_SCENARIOS];
+uint8_t bench_count = 0;
+
+static uint16_t bench_keys;		// keys held down, bit = button_count index
+
+static void bench_Max(uint32_t *peak, uint32_t v)
+{
+	if(v > *peak) *peak = v;
+}
+
+/**
+ * @brief One 50ms pass of the main loop with scripted input
+ * @param row Scenario to add the tick to, -1 = the traffic state after the tick
+ */
+static void bench_Tick(int8_t row)
+{
+	uint8_t i;
+	bench_Result_t *r;
+#ifdef HOST_SIM
+	sim_Wait();
+#else
+	while(!flag_timer2);
+	flag_timer2 = 0;
+#endif
+	tw_Run();
+	for(i = 0; i < 16; i++){
+		if(bench_keys & (1 << i)) button_count[i]++;
+		else button_count[i] = 0;
+	}
+	memset(&lcd_bus, 0, sizeof(lcd_bus));
+	fsm_traffic_run();
+
+	r = &bench_results[(row < 0) ? fsm_traffic_state() : row];
+	r->ticks++;
+	r->total.reg += lcd_bus.reg;
+	r->total.data += lcd_bus.data;
+	r->total.windows += lcd_bus.windows;
+	r->total.pixels += lcd_bus.pixels;
+	bench_Max(&r->peak.reg, lcd_bus.reg);
+	bench_Max(&r->peak.data, lcd_bus.data);
+	bench_Max(&r->peak.windows, lcd_bus.windows);
+	bench_Max(&r->peak.pixels, lcd_bus.pixels);
+}
+
+static void bench_Ticks(int8_t row, uint16_t n)
+{
+	while(n--) bench_Tick(row);
+}
+
+// Hold a key for 2 ticks and release it
+static void bench_Press(int8_t row, uint8_t key)
+{
+	bench_keys |= 1 << key;
+	bench_Ticks(row, 2);
+	bench_keys &= ~(1 << key);
+	bench_Tick(row);
+}
+
+static void bench_Modify(int8_t row)
+{
+	bench_Press(row, BENCH_KEY_MODE);
+	bench_Ticks(row, 20);
+	bench_Press(row, BENCH_KEY_ADJUST);
+	bench_Press(row, BENCH_KEY_CONFIRM);
+}
+
+/**
+ * @brief Run every scenario once, right after fsm_traffic_init()
+ */
+void bench_Run(void)
+{
+	uint8_t i;
+	memset(bench_results, 0, sizeof(bench_results));
+	for(i = 0; i < BENCH_MAX_SCENARIOS; i++) bench_results[i].name = bench_names[i];
+	bench_count = BENCH_MAX_SCENARIOS;
+	bench_keys = 0;
+
+	// 5+2+2 s per direction at the default periods
+	bench_Ticks(-1, 18*20);
+
+	bench_Modify(6);
+	bench_Modify(7);
+	bench_Modify(8);
+	bench_Press(STATE_R1_GREEN_R2_RED, BENCH_KEY_MODE);	// back to normal
+}
+
+/**
+ * @brief Show ticks, average and worst-tick data cycles per scenario on the
+ *        LCD until a key is pressed
+ */
+void bench_Report(void)
+{
+	char line[48];
+	uint8_t i;
+	bench_Result_t *r;
+	lcd_Clear(BLACK);
+	lcd_ShowStr(10, 10, "scenario     ticks  data/t   peak", WHITE, BLACK, 12, 0);
+	for(i = 0; i < bench_count; i++){
+		r = &bench_results[i];
+		sprintf(line, "%-13s%5u %7lu %7lu", r->name, r->ticks,
+				(unsigned long)(r->ticks ? r->total.data / r->ticks : 0),
+				(unsigned long)r->peak.data);
+		lcd_ShowStr(10, 30 + i*16, line, WHITE, BLACK, 12, 0);
+	}
+	for(;;){
+		while(!flag_timer2);
+		flag_timer2 = 0;
+		button_Scan();
+		for(i = 0; i < 16; i++){
+			if(button_count[i] == 1) return;
+		}
+	}
+}
+
+#endif /* LCD_BENCH */
@@ -5,9 +5,12 @@
  *      Author: HaHuyen
  */
 #include "button.h"
+#include "trace.h"
+#include "prof.h"
 
 uint16_t button_count[16];
 uint16_t spi_button = 0x0000;
+evq_Queue_t button_events = EVQ_INIT("keys");
 
 /**
   * @brief  Init matrix button
@@ -16,6 +19,7 @@ uint16_t spi_button = 0x0000;
   */
 void button_init(){
 	HAL_GPIO_WritePin(BTN_LOAD_GPIO_Port, BTN_LOAD_Pin, 1);
+	evq_Add(&button_events);
 }
 
 /**
@@ -25,9 +29,11 @@ void button_init(){
   * @retval None
   */
 void button_Scan(){
+	  PROF_ZONE("button_Scan");
 	  HAL_GPIO_WritePin(BTN_LOAD_GPIO_Port, BTN_LOAD_Pin, 0);
 	  HAL_GPIO_WritePin(BTN_LOAD_GPIO_Port, BTN_LOAD_Pin, 1);
 	  HAL_SPI_Receive(&hspi1, (void*)&spi_button, 2, 10);
+	  trace_Buttons(spi_button);
 	  int button_index = 0;
 	  uint16_t mask = 0x8000;
 	  for(int i = 0; i < 16; i++){
@@ -40,8 +46,14 @@ void button_Scan(){
 		  } else {
 			  button_index = 23 - i;
 		  }
-		  if(spi_button & mask) button_count[button_index] = 0;
-		  else button_count[button_index]++;
+		  if(spi_button & mask){
+			  if(button_count[button_index]) evq_Put(&button_events, EVQ_KEY_UP, button_index, button_count[button_index]);
+			  button_count[button_index] = 0;
+		  } else {
+			  button_count[button_index]++;
+			  evq_Put(&button_events, (button_count[button_index] == 1) ? EVQ_KEY_DOWN : EVQ_KEY_HOLD,
+					  button_index, button_count[button_index]);
+		  }
 		  mask = mask >> 1;
 	  }
 }
@@ -7,26 +7,53 @@
 
 #include "lcd.h"
 #include "lcdfont.h"
+#include "prof.h"
 
 unsigned char s[50];
 
 _lcd_dev lcddev;
 
+#if LCD_BUS_STATS
+_lcd_bus lcd_bus;
+static uint8_t lcd_bus_gram;	// data cycles are pixels after 0x2C/0x3C
+#endif
+
 void LCD_WR_REG(uint16_t reg)
 {
+#if LCD_BUS_STATS
+	lcd_bus.reg++;
+	if(reg==0x2b)lcd_bus.windows++;
+	lcd_bus_gram=(reg==0x2c||reg==0x3c);
+#endif
+#ifdef HOST_SIM
+	ili9341_WriteReg(reg);
+#else
 	LCD->LCD_REG=reg;
+#endif
 }
 
 void LCD_WR_DATA(uint16_t data)
 {
+#if LCD_BUS_STATS
+	lcd_bus.data++;
+	lcd_bus.pixels+=lcd_bus_gram;
+#endif
+#ifdef HOST_SIM
+	ili9341_WriteData(data);
+#else
 	LCD->LCD_RAM=data;
+#endif
 }
 
 uint16_t LCD_RD_DATA(void)
 {
+#ifdef HOST_SIM
+	return ili9341_ReadData();
+#else
 	__IO uint16_t ram;
 	ram=LCD->LCD_RAM;
 	return ram;
+#endif
 }
 
 
@@ -87,6 +114,7 @@ uint16_t lcd_ReadPoint(uint16_t x,uint16_t y)
 void lcd_Clear(uint16_t color) //
 {
 	uint16_t i,j;
+	PROF_ZONE("lcd_Clear");
 	lcd_AddressSet(0,0,lcddev.width-1,lcddev.height-1);
 	for(i=0;i<lcddev.width;i++)
 	{
@@ -109,6 +137,7 @@ void lcd_Clear(uint16_t color) //
 void lcd_Fill(uint16_t xsta,uint16_t ysta,uint16_t xend,uint16_t yend,uint16_t color) //add a hcn = 1 mau car been trogn
 {
 	uint16_t i,j;
+	PROF_ZONE("lcd_Fill");
 	lcd_AddressSet(xsta,ysta,xend-1,yend-1);
 	for(i=ysta;i<yend;i++)
 	{
@@ -146,6 +175,7 @@ void lcd_DrawLine(uint16_t x1,uint16_t y1,uint16_t x2,uint16_t y2,uint16_t color
 	uint16_t t;
 	int xerr=0,yerr=0,delta_x,delta_y,distance;
 	int incx,incy,uRow,uCol;
+	PROF_ZONE("lcd_DrawLine");
 	delta_x=x2-x1;
 	delta_y=y2-y1;
 	uRow=x1;
@@ -179,52 +209,84 @@ void lcd_DrawLine(uint16_t x1,uint16_t y1,uint16_t x2,uint16_t y2,uint16_t color
 
 void lcd_DrawRectangle(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2,uint16_t color) // ve hcn(vien
 {
+	PROF_ZONE("lcd_DrawRectangle");
 	lcd_DrawLine(x1,y1,x2,y1,color);
 	lcd_DrawLine(x1,y1,x1,y2,color);
 	lcd_DrawLine(x1,y2,x2,y2,color);
 	lcd_DrawLine(x2,y1,x2,y2,color);
 }
 
+// Glyph blitters, one per font geometry. The row emitters are unrolled bit by
+// bit and the glyph width, bytes per row and table are fixed per function.
+// With PROF_ENABLE each whole-glyph blitter is its own zone, so the "prof"
+// table gives the cycles per opaque glyph of every size.
+#define LCD_PIX(m)		LCD_WR_DATA((bits&(m))?fc:bc)
+#define LCD_BITS4(r)	{uint8_t bits=(r);LCD_PIX(0x01);LCD_PIX(0x02);LCD_PIX(0x04);LCD_PIX(0x08);}
+#define LCD_BITS6(r)	{uint8_t bits=(r);LCD_PIX(0x01);LCD_PIX(0x02);LCD_PIX(0x04);LCD_PIX(0x08); \
+						LCD_PIX(0x10);LCD_PIX(0x20);}
+#define LCD_BITS8(r)	{uint8_t bits=(r);LCD_PIX(0x01);LCD_PIX(0x02);LCD_PIX(0x04);LCD_PIX(0x08); \
+						LCD_PIX(0x10);LCD_PIX(0x20);LCD_PIX(0x40);LCD_PIX(0x80);}
+
+#define LCD_FONT(name,sizey,bpr,ROW) \
+static void lcd_Row##name(const uint8_t *g,uint16_t fc,uint16_t bc) \
+{ \
+	ROW \
+} \
+static void lcd_Blit##name(const uint8_t *g,uint16_t fc,uint16_t bc) \
+{ \
+	uint8_t r; \
+	PROF_ZONE("lcd_Blit" #name); \
+	for(r=0;r<sizey;r++,g+=bpr) {ROW} \
+}
+
+LCD_FONT(1206,12,1,LCD_BITS6(g[0]))
+LCD_FONT(1608,16,1,LCD_BITS8(g[0]))
+LCD_FONT(2412,24,2,LCD_BITS8(g[0]) LCD_BITS4(g[1]))
+LCD_FONT(3216,32,2,LCD_BITS8(g[0]) LCD_BITS8(g[1]))
+
+typedef struct
+{
+	const uint8_t *table;		// glyph of ' '
+	uint8_t bytes;				// bytes per glyph
+	uint8_t bpr;				// bytes per glyph row
+	void (*row)(const uint8_t *g,uint16_t fc,uint16_t bc);
+	void (*blit)(const uint8_t *g,uint16_t fc,uint16_t bc);
+}lcd_Font_t;
+
+// Indexed by sizey/4
+static const lcd_Font_t lcd_font[9]={
+	[3]={ascii_1206[0],sizeof(ascii_1206[0]),1,lcd_Row1206,lcd_Blit1206},
+	[4]={ascii_1608[0],sizeof(ascii_1608[0]),1,lcd_Row1608,lcd_Blit1608},
+	[6]={ascii_2412[0],sizeof(ascii_2412[0]),2,lcd_Row2412,lcd_Blit2412},
+	[8]={ascii_3216[0],sizeof(ascii_3216[0]),2,lcd_Row3216,lcd_Blit3216},
+};
+
+static const lcd_Font_t *lcd_FontFor(uint8_t sizey)
+{
+	if((sizey&3)||sizey>32||lcd_font[sizey>>2].blit==NULL) return NULL;
+	return &lcd_font[sizey>>2];
+}
+
 void lcd_ShowChar(uint16_t x,uint16_t y,uint8_t character,uint16_t fc,uint16_t bc,uint8_t sizey,uint8_t mode) // 1ky tu size = 12 16 24 32, fc: mau chuw, bc, mauf neefn, mode: hien neen
 {
-	uint8_t temp,sizex,t,m=0;
-	uint16_t i,TypefaceNum;
-	uint16_t x0=x;
-	sizex=sizey/2;
-	TypefaceNum=(sizex/8+((sizex%8)?1:0))*sizey;
-	character=character-' ';
-	lcd_AddressSet(x,y,x+sizex-1,y+sizey-1);
-	for(i=0;i<TypefaceNum;i++)
+	const lcd_Font_t *f=lcd_FontFor(sizey);
+	const uint8_t *g;
+	uint8_t sizex=sizey/2,r,t,temp;
+	PROF_ZONE("lcd_ShowChar");
+	if(f==NULL||character<' '||character>'~') return;
+	g=f->table+(character-' ')*f->bytes;
+	if(!mode)
 	{
-		if(sizey==12);
-		else if(sizey==16)temp=ascii_1608[character][i];
-		else if(sizey==24)temp=ascii_2412[character][i];
-		else if(sizey==32)temp=ascii_3216[character][i];
-		else return;
-		for(t=0;t<8;t++)
+		lcd_AddressSet(x,y,x+sizex-1,y+sizey-1);
+		f->blit(g,fc,bc);
+		return;
+	}
+	for(r=0;r<sizey;r++)
+	{
+		for(t=0;t<sizex;t++)
 		{
-			if(!mode)
-			{
-				if(temp&(0x01<<t))LCD_WR_DATA(fc);
-				else LCD_WR_DATA(bc);
-				m++;
-				if(m%sizex==0)
-				{
-					m=0;
-					break;
-				}
-			}
-			else
-			{
-				if(temp&(0x01<<t))lcd_DrawPoint(x,y,fc);
-				x++;
-				if((x-x0)==sizex)
-				{
-					x=x0;
-					y++;
-					break;
-				}
-			}
+			temp=g[r*f->bpr+(t>>3)];
+			if(temp&(0x01<<(t&7)))lcd_DrawPoint(x+t,y+r,fc);
 		}
 	}
 }
@@ -241,6 +303,7 @@ void lcd_ShowIntNum(uint16_t x,uint16_t y,uint16_t num,uint8_t len,uint16_t fc,u
 	uint8_t t,temp;
 	uint8_t enshow=0;
 	uint8_t sizex=sizey/2;
+	PROF_ZONE("lcd_ShowIntNum");
 	for(t=0;t<len;t++)
 	{
 		temp=(num/mypow(10,len-t-1))%10;
@@ -262,6 +325,7 @@ void lcd_ShowFloatNum(uint16_t x,uint16_t y,float num,uint8_t len,uint16_t fc,ui
 {
 	uint8_t t,temp,sizex;
 	uint16_t num1;
+	PROF_ZONE("lcd_ShowFloatNum");
 	sizex=sizey/2;
 	num1=num*100;
 	for(t=0;t<len;t++)
@@ -282,6 +346,7 @@ void lcd_ShowPicture(uint16_t x,uint16_t y,uint16_t length,uint16_t width,const
 	uint8_t picH,picL;
 	uint16_t i,j;
 	uint32_t k=0;
+	PROF_ZONE("lcd_ShowPicture");
 	lcd_AddressSet(x,y,x+length-1,y+width-1);
 	for(i=0;i<length;i++)
 	{
@@ -442,6 +507,7 @@ static void _draw_circle_8(int xc, int yc, int x, int y, uint16_t c)
 void lcd_DrawCircle(int xc, int yc,uint16_t c,int r, int fill) //ve duong or hinh, c: color
 {
 	int x = 0, y = r, yi, d;
+	PROF_ZONE("lcd_DrawCircle");
 
 	d = 3 - 2 * r;
 
@@ -475,30 +541,106 @@ void lcd_DrawCircle(int xc, int yc,uint16_t c,int r, int fill) //ve duong or hin
 	}
 }
 
-void lcd_ShowStr(uint16_t x, uint16_t y,char *str,uint16_t fc, uint16_t bc,uint8_t sizey,uint8_t mode)
+static uint8_t lcd_IsGlyph(uint8_t c)
 {
-	uint16_t x0=x;
-  uint8_t bHz=0;
-	while(*str!=0)
+	return c>=' '&&c<='~';
+}
+
+// n glyphs on one line behind a single address window: glyph row 0 of every
+// character left to right, then row 1, and so on
+static void lcd_ShowRun(uint16_t x,uint16_t y,const uint8_t *str,uint16_t n,uint16_t fc,uint16_t bc,uint8_t sizey)
+{
+	const lcd_Font_t *f=lcd_FontFor(sizey);
+	uint8_t row;
+	uint16_t i;
+	lcd_AddressSet(x,y,x+n*(sizey/2)-1,y+sizey-1);
+	for(row=0;row<sizey;row++)
+	{
+		for(i=0;i<n;i++)
+		{
+			f->row(f->table+(str[i]-' ')*f->bytes+row*f->bpr,fc,bc);
+		}
+	}
+}
+
+#define FIND_GB(tbl)	for(k=0;k<sizeof(tbl)/sizeof(tbl[0]);k++) \
+							if(tbl[k].Index[0]==s[0]&&tbl[k].Index[1]==s[1]){msk=tbl[k].Msk;break;}
+
+// Two byte GB2312 code from tfont16/24/32. Codes missing from the table are
+// drawn as an empty cell so the rest of the string stays aligned; sizes
+// without a table draw nothing, the caller still moves past the cell.
+static void lcd_ShowChinese(uint16_t x,uint16_t y,const uint8_t *s,uint16_t fc,uint16_t bc,uint8_t sizey,uint8_t mode)
+{
+	const uint8_t *msk=NULL;
+	uint16_t k;
+	uint8_t bpr=sizey/8,row,b,t,temp;
+	switch(sizey)
+	{
+	case 16: FIND_GB(tfont16); break;
+	case 24: FIND_GB(tfont24); break;
+	case 32: FIND_GB(tfont32); break;
+	default: return;
+	}
+	if(!mode)lcd_AddressSet(x,y,x+sizey-1,y+sizey-1);
+	for(row=0;row<sizey;row++)
 	{
-		if(!bHz)
+		for(b=0;b<bpr;b++)
 		{
-			if(x>(lcddev.width-sizey/2)||y>(lcddev.height-sizey)) return;
-			if(*str>0x80)bHz=1;
-			else
+			temp=msk?msk[row*bpr+b]:0;
+			for(t=0;t<8;t++)
 			{
-				if(*str==0x0D)
-				{
-					y+=sizey;
-					x=x0;
-					str++;
-				}else
+				if(!mode)
 				{
-					lcd_ShowChar(x,y,*str,fc,bc,sizey,mode);
-					x+=sizey/2;
+					if(temp&(0x01<<t))LCD_WR_DATA(fc);
+					else LCD_WR_DATA(bc);
 				}
-			  str++;
+				else if(temp&(0x01<<t))lcd_DrawPoint(x+b*8+t,y+row,fc);
+			}
+		}
+	}
+}
+
+void lcd_ShowStr(uint16_t x, uint16_t y,char *s,uint16_t fc, uint16_t bc,uint8_t sizey,uint8_t mode)
+{
+	const uint8_t *str=(const uint8_t *)s;
+	uint16_t x0=x;
+	uint8_t sizex=sizey/2;
+	uint16_t n,i;
+	PROF_ZONE("lcd_ShowStr");
+	if(lcd_FontFor(sizey)==NULL) return;
+	while(*str!=0)
+	{
+		if(y>(lcddev.height-sizey)) return;
+		if(*str=='\r'||*str=='\n')
+		{
+			if(str[0]=='\r'&&str[1]=='\n') str++;
+			str++;
+			y+=sizey;
+			x=x0;
+		}
+		else if(*str>=0x80)
+		{
+			if(str[1]==0||x>(lcddev.width-sizey)) return;
+			lcd_ShowChinese(x,y,str,fc,bc,sizey,mode);
+			str+=2;
+			x+=sizey;
+		}
+		else if(!lcd_IsGlyph(*str))
+		{
+			str++;
+		}
+		else
+		{
+			// Measure the run of glyphs that still fit on this line
+			for(n=0;lcd_IsGlyph(str[n])&&x+(n+1)*sizex<=lcddev.width;n++);
+			if(n==0) return;
+			if(mode)
+			{
+				for(i=0;i<n;i++) lcd_ShowChar(x+i*sizex,y,str[i],fc,bc,sizey,1);
 			}
+			else lcd_ShowRun(x,y,str,n,fc,bc,sizey);
+			str+=n;
+			x+=n*sizex;
 		}
 	}
 }
@@ -20,6 +20,18 @@ void led7_init(){
 	  HAL_GPIO_WritePin(LD_LATCH_GPIO_Port, LD_LATCH_Pin, 1);
 }
 
+/**
+  * @brief  Turn every digit off; led7_Scan() lights them again
+  * @param  None
+  * @retval None
+  */
+void led7_Blank(){
+	spi_buffer |= 0xfff0;
+	HAL_GPIO_WritePin(LD_LATCH_GPIO_Port, LD_LATCH_Pin, 0);
+	HAL_SPI_Transmit(&hspi1, (void*)&spi_buffer, 2, 1);
+	HAL_GPIO_WritePin(LD_LATCH_GPIO_Port, LD_LATCH_Pin, 1);
+}
+
 /**
   * @brief  Scan led 7 segment
   * @param  None
@@ -0,0 +1,118 @@
+/*
+ * loopstat.c
+ *
+ *  Main loop timing
+ *
+ *  loop_Start() runs right after timer2_Take() and measures the start
+ *  jitter against timer2_stamp, the DWT time the TIM2 interrupt set
+ *  flag_timer2. loop_End() closes the pass. Both histograms are in
+ *  microseconds from DWT->CYCCNT, which wraps after 25 s at 168 MHz; a
+ *  pass that long is counted in the last bucket anyway.
+ *
+ *  Passes that overran are counted here; the 50ms periods that went by
+ *  without a pass noticing are timer2_missed, and the idle share is
+ *  timer2_idle, both in software_timer.c, as is timer2_rate, the TIM2
+ *  interrupts per second that the tickless mode cuts down.
+ */
+
+#include "loopstat.h"
+
+#if LOOP_STATS
+
+#include "dwt.h"
+#include "software_timer.h"
+#include <stdio.h>
+#include <string.h>
+#include "report.h"
+
+loop_Stats_t loop_stats;
+static uint32_t loop_t0;
+static uint8_t loop_req;					// 1 = print, 2 = print and clear
+
+void loop_init()
+{
+	dwt_init();
+	memset(&loop_stats, 0, sizeof(loop_stats));
+	loop_req = 0;
+}
+
+static uint32_t loop_Us(uint32_t cycles)
+{
+	return cycles/(SystemCoreClock/1000000);
+}
+
+void loop_Start()
+{
+	uint32_t late, b = 0;
+	loop_t0 = dwt_Cycles();
+	late = loop_Us(loop_t0 - timer2_stamp);
+	while(b < 23 && (late >> b)) b++;
+	loop_stats.late[b]++;
+	if(late > loop_stats.late_max_us) loop_stats.late_max_us = late;
+}
+
+void loop_End()
+{
+	uint32_t us = loop_Us(dwt_Cycles() - loop_t0);
+	loop_stats.passes++;
+	if(us > LOOP_PERIOD_MS*1000UL) loop_stats.overruns++;
+	if(us > loop_stats.exec_max_us) loop_stats.exec_max_us = us;
+	loop_stats.exec[(us/1000 < 63) ? us/1000 : 63]++;
+}
+
+/**
+ * @brief  Ask for the histograms at the next loop_Poll(); reset = 1 also
+ *         clears them once printed
+ */
+void loop_Request(uint8_t reset)
+{
+	rpt_Request(&loop_req, reset);
+}
+
+/**
+ * @brief  Call between loop_End() and the next loop_Start()
+ */
+void loop_Poll()
+{
+	uint8_t req = rpt_Take(&loop_req);
+	if(req == RPT_NONE) return;
+	loop_Report();
+	if(req == RPT_CLEAR){
+		memset(&loop_stats, 0, sizeof(loop_stats));
+		timer2_missed = 0;
+	}
+}
+
+/**
+ * @brief  Print the counters and the non-empty buckets of both histograms
+ */
+void loop_Report()
+{
+	char line[128];
+	uint16_t n;
+	uint8_t b;
+	n = sprintf(line, "\r\nLOOP %lu passes, %lu over %u ms, %u periods missed, catch-up %s\r\n",
+			(unsigned long)loop_stats.passes, (unsigned long)loop_stats.overruns,
+			LOOP_PERIOD_MS, timer2_missed, TIMER2_CATCH_UP ? "on" : "off");
+	rpt_Write(line, n);
+	n = sprintf(line, "run max %lu us, start late max %lu us, idle %u.%u%%%s, TIM2 %u irq/s%s\r\nrun ms        passes\r\n",
+			(unsigned long)loop_stats.exec_max_us, (unsigned long)loop_stats.late_max_us,
+			timer2_idle/10, timer2_idle%10, TIMER2_IDLE_NOTE, timer2_rate, TIMER2_TICKLESS ? " (tickless)" : "");
+	rpt_Write(line, n);
+	for(b = 0; b < 64; b++){
+		if(loop_stats.exec[b] == 0) continue;
+		if(b < 63) n = sprintf(line, "%2u-%-2u      %6lu\r\n", b, b + 1, (unsigned long)loop_stats.exec[b]);
+		else n = sprintf(line, "63+        %6lu\r\n", (unsigned long)loop_stats.exec[b]);
+		rpt_Write(line, n);
+	}
+	n = sprintf(line, "late us       passes\r\n");
+	rpt_Write(line, n);
+	for(b = 0; b < 24; b++){
+		if(loop_stats.late[b] == 0) continue;
+		if(b == 0) n = sprintf(line, "0          %6lu\r\n", (unsigned long)loop_stats.late[b]);
+		else n = sprintf(line, "%-10lu %6lu\r\n", 1UL << (b - 1), (unsigned long)loop_stats.late[b]);
+		rpt_Write(line, n);
+	}
+}
+
+#endif /* LOOP_STATS */
@@ -19,6 +19,7 @@
 /* USER CODE END Header */
 /* Includes ------------------------------------------------------------------*/
 #include "main.h"
+#include "dma.h"
 #include "spi.h"
 #include "tim.h"
 #include "gpio.h"
@@ -31,7 +32,14 @@
 #include "button.h"
 #include "lcd.h"
 #include "picture.h"
+#include "touch.h"
 #include "traffic_fsm.h" // <<< THÊM FILE HEADER CỦA FSM
+#include "bench.h"
+#include "trace.h"
+#include "prof.h"
+#include "loopstat.h"
+#include "timer_wheel.h"
+#include "evq.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -93,12 +101,22 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_TIM2_Init();
   MX_SPI1_Init();
   MX_FSMC_Init();
+  MX_SPI2_Init();
   /* USER CODE BEGIN 2 */
   system_init();
   fsm_traffic_init(); // <<< KHỞI TẠO MÁY TRẠNG THÁI
+#if LCD_BENCH
+  bench_Run();
+  bench_Report(); // Bảng kết quả giữ trên LCD đến khi nhấn nút
+  fsm_traffic_init();
+#endif
+  trace_init();
+  prof_init();
+  loop_init();
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -106,12 +124,40 @@ int main(void)
   while (1)
   {
 	  // Chờ cho đến khi cờ timer 50ms được bật lên
-	  while(!flag_timer2);
-	  flag_timer2 = 0; // Xóa cờ
+	  timer2_Wait(); // Ngủ (WFI) đến khi có ngắt, cộng dồn thời gian rảnh
+	  timer2_Take(); // Xóa cờ, đếm số chu kỳ 50ms đã trôi qua
+	  tw_Run(); // Các software timer đã hết hạn, callback chạy tại đây
+	  loop_Start();
+	  prof_Poll();
+	  PROF_ZONE("main_loop");	// đóng lại ở cuối vòng lặp
+	  trace_Tick();
 
 	  button_Scan(); // Quét trạng thái các nút nhấn
-
+#if TRACE_ENABLE
+	  if(button_count[TRACE_DUMP_KEY] == 1) trace_Dump();
+#endif
+#if PROF_ENABLE
+	  if(button_count[PROF_DUMP_KEY] == 1) prof_Request(0);
+#endif
+#if LOOP_STATS
+	  if(button_count[LOOP_DUMP_KEY] == 1) loop_Request(0);
+#endif
+#if EVQ_ENABLE
+	  if(button_count[EVQ_DUMP_KEY] == 1) evq_Request(0);
+#endif
+#if PHASE_STATS
+	  if(button_count[PHASE_DUMP_KEY] == 1) fsm_traffic_request(0);
+#endif
+
+#if EVQ_ENABLE
+	  fsm_traffic_dispatch(); // chỉ chạy FSM khi có sự kiện (phím, chạm, timer)
+#else
 	  fsm_traffic_run(); // <<< CHẠY MÁY TRẠNG THÁI (Đã bao gồm xử lý và hiển thị)
+#endif
+	  loop_End();
+	  loop_Poll();
+	  evq_Poll();
+	  fsm_traffic_poll();
 
     /* USER CODE END WHILE */
 
@@ -173,6 +219,7 @@ void system_init(){
 	  led7_init();
 	  button_init();
 	  lcd_init();
+	  touch_init();
 	  setTimer2(50); // Thiết lập timer 2 để tạo cờ 'flag_timer2' mỗi 50ms
 }
 
@@ -0,0 +1,134 @@
+/*
+ * prof.c
+ *
+ *  Named-zone cycle profiler
+ *
+ *  Open zones form a stack. Each level keeps the cycles its nested zones
+ *  took, so a zone's self time is its own span minus that, and its span is
+ *  added to the level above when it closes. CYCCNT wraps every 25 s at
+ *  168 MHz; spans are taken as unsigned differences, so a single zone may
+ *  not stay open that long.
+ *
+ *  A report asked for through PROF_CMD or PROF_DUMP_KEY is only printed at
+ *  prof_Poll(), outside every zone, so the time spent sending the table
+ *  does not show up in it.
+ */
+
+#include "prof.h"
+
+#if PROF_ENABLE
+
+#include "dwt.h"
+#include <stdio.h>
+#include "report.h"
+
+static prof_Zone_t *prof_head, *prof_tail;
+static prof_Zone_t *prof_open[PROF_DEPTH];
+static uint32_t prof_child[PROF_DEPTH];		// cycles of closed nested zones, per level
+static uint8_t prof_depth;
+static uint32_t prof_too_deep;
+static uint8_t prof_req;					// 1 = print, 2 = print and clear
+
+void prof_init()
+{
+	dwt_init();
+	prof_depth = 0;
+	prof_req = 0;
+}
+
+prof_Frame_t prof_Enter(prof_Zone_t *zone)
+{
+	prof_Frame_t f = {NULL, 0};
+	if(prof_depth >= PROF_DEPTH){
+		prof_too_deep++;
+		return f;
+	}
+	if(!zone->linked){
+		zone->linked = 1;
+		if(prof_tail) prof_tail->next = zone;
+		else prof_head = zone;
+		prof_tail = zone;
+	}
+	zone->parent = prof_depth ? prof_open[prof_depth - 1] : NULL;
+	prof_open[prof_depth] = zone;
+	prof_child[prof_depth] = 0;
+	prof_depth++;
+	f.zone = zone;
+	f.start = dwt_Cycles();
+	return f;
+}
+
+void prof_Leave(prof_Frame_t *frame)
+{
+	uint32_t span = dwt_Cycles() - frame->start;
+	prof_Zone_t *z = frame->zone;
+	if(z == NULL) return;
+	prof_depth--;
+	if(prof_depth) prof_child[prof_depth - 1] += span;
+	if(z->calls == 0 || span < z->min) z->min = span;
+	if(span > z->max) z->max = span;
+	z->total += span;
+	z->self += span - prof_child[prof_depth];
+	z->calls++;
+}
+
+/**
+ * @brief  Ask for the table at the next prof_Poll(); reset = 1 also clears
+ *         the counts once it is printed
+ */
+void prof_Request(uint8_t reset)
+{
+	rpt_Request(&prof_req, reset);
+}
+
+/**
+ * @brief  Call from the main loop outside every zone
+ */
+void prof_Poll()
+{
+	prof_Zone_t *z;
+	uint8_t req;
+	req = rpt_Take(&prof_req);
+	if(req == RPT_NONE) return;
+	prof_Report();
+	if(req == RPT_CLEAR){
+		for(z = prof_head; z; z = z->next){
+			z->calls = 0;
+			z->min = z->max = 0;
+			z->total = z->self = 0;
+		}
+		prof_too_deep = 0;
+	}
+}
+
+/**
+ * @brief  Print one line per zone in first-run order; cycle counts, totals
+ *         in thousands
+ */
+void prof_Report()
+{
+	char line[128];
+	uint16_t n;
+	prof_Zone_t *z;
+	n = sprintf(line, "\r\nPROF %lu MHz, cycles\r\n", (unsigned long)(SystemCoreClock/1000000));
+	rpt_Write(line, n);
+	n = sprintf(line, "%-16s %-16s %8s %8s %8s %8s %10s %10s\r\n", "zone", "parent",
+			"calls", "min", "avg", "max", "total_k", "self_k");
+	rpt_Write(line, n);
+	for(z = prof_head; z; z = z->next){
+		if(z->calls == 0) continue;
+		n = sprintf(line, "%-16.16s %-16.16s %8lu %8lu %8lu %8lu %10lu %10lu\r\n",
+				z->name, z->parent ? z->parent->name : "-", (unsigned long)z->calls,
+				(unsigned long)z->min, (unsigned long)(z->total/z->calls),
+				(unsigned long)z->max, (unsigned long)(z->total/1000),
+				(unsigned long)(z->self/1000));
+		rpt_Write(line, n);
+	}
+	if(prof_too_deep){
+		n = sprintf(line, "%lu calls nested deeper than %u not timed\r\n",
+				(unsigned long)prof_too_deep, PROF_DEPTH);
+		rpt_Write(line, n);
+	}
+}
+
+#endif /* PROF_ENABLE */
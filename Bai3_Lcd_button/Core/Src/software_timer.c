@@ -6,13 +6,164 @@
  */
 
 #include "software_timer.h"
+#include "dwt.h"
+#include "timer_wheel.h"
 
 #define TIMER_CYCLE_2 1
 
 //software timer variable
-uint16_t flag_timer2 = 0;
+volatile uint16_t flag_timer2 = 0;
 uint16_t timer2_counter = 0;
 uint16_t timer2_MUL = 0;
+uint16_t timer2_missed = 0;
+uint32_t timer2_stamp = 0;
+uint16_t timer2_elapsed = 1;
+uint16_t timer2_idle = 0;
+uint32_t timer2_irqs = 0;
+uint16_t timer2_rate = 0;
+static volatile uint16_t timer2_periods = 0;	// written by the interrupt only
+static uint16_t timer2_taken = 0;
+static uint32_t idle_cycles = 0, idle_window = 0, irqs_window = 0;
+
+#if TIMER2_TICKLESS
+static uint32_t tl_last = 0;		// counter at the last whole ms counted into tw_ticks
+static uint32_t tl_due = 0;			// counter at the end of the running period
+static uint32_t tl_wheel = 0;		// counter at the next timer_wheel.c expiry
+static volatile uint8_t tl_wheel_on = 0;	// tl_wheel is set and not reached yet
+static volatile uint8_t tl_wheel_hit = 0;	// it was reached, timer2_Wheel() has timers to run
+static uint8_t tl_armed = 0;		// timer2_Wheel() set tl_wheel since the last timer2_Take()
+#define timer2_WheelHit()	tl_wheel_hit
+
+// Code shared with the interrupt masks it; the host sim runs the interrupt
+// between calls, never inside one
+#ifdef HOST_SIM
+#define timer2_Lock()		0
+#define timer2_Unlock(pm)	((void)(pm))
+#else
+static inline uint32_t timer2_Lock(){
+	uint32_t pm = __get_PRIMASK();
+	__disable_irq();
+	return pm;
+}
+#define timer2_Unlock(pm)	__set_PRIMASK(pm)
+#endif
+
+// Count the whole ms since tl_last into tw_ticks
+static void timer2_Sync(){
+	uint32_t ms = (__HAL_TIM_GET_COUNTER(&htim2) - tl_last)/TIMER2_CNT_PER_MS;
+	tl_last += ms*TIMER2_CNT_PER_MS;
+	tw_ticks += ms;
+}
+
+// Set flag_timer2 for the periods that ran out and point compare channel 1
+// at the earlier of the end of the next one and the wheel's next expiry.
+// A deadline that goes by while it is being set would only match again once
+// the counter wraps, so it is taken here
+static void timer2_Due(){
+	uint32_t next;
+	do{
+		timer2_Sync();
+		if(tl_wheel_on && (int32_t)(tl_last - tl_wheel) >= 0){
+			tl_wheel_on = 0;
+			tl_wheel_hit = 1;
+		}
+		if(timer2_MUL == 0) return;
+		while((int32_t)(tl_last - tl_due) >= 0){
+			if(flag_timer2) timer2_missed++;
+			timer2_periods++;
+			timer2_stamp = dwt_Cycles();
+			flag_timer2 = 1;
+			tl_due += timer2_MUL*TIMER2_CNT_PER_MS;
+		}
+		next = (tl_wheel_on && (int32_t)(tl_wheel - tl_due) < 0) ? tl_wheel : tl_due;
+		__HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_1, next);
+	}while((int32_t)(next - __HAL_TIM_GET_COUNTER(&htim2)) <= 0);
+}
+
+/**
+  * @brief  While the main loop waits: run the wheel's timers once their
+  *         expiry came up and set tl_wheel to the next one
+  * @param  None
+  * @retval None
+  * @note	Does nothing in between, so the wait can call it after every wake
+  */
+void timer2_Wheel(){
+	uint32_t tick = 0, pm;
+	uint8_t on, late;
+	if(tl_armed && !tl_wheel_hit) return;
+	do{
+		tl_wheel_hit = 0;
+		tw_Run();
+		on = tw_NextDue(&tick);
+		pm = timer2_Lock();
+		timer2_Sync();
+		late = on && (int32_t)(tick - tw_ticks) <= 0;
+		tl_wheel = tl_last + (tick - tw_ticks)*TIMER2_CNT_PER_MS;
+		tl_wheel_on = on && !late;
+		if(!late) timer2_Due();
+		timer2_Unlock(pm);
+	}while(late);
+	tl_armed = 1;
+}
+
+// Compare channel 'ch' 'step' counts after its last match; after a late
+// interrupt it slips instead of catching up
+static void timer2_Rearm(uint32_t ch, uint32_t step){
+	uint32_t next = __HAL_TIM_GET_COMPARE(&htim2, ch) + step;
+	if((int32_t)(next - __HAL_TIM_GET_COUNTER(&htim2)) <= 0) next = __HAL_TIM_GET_COUNTER(&htim2) + step;
+	__HAL_TIM_SET_COMPARE(&htim2, ch, next);
+}
+
+#if TIMER2_SCAN_MS
+// Next 7-segment digit on compare channel 2
+static void timer2_Scan(){
+	timer2_Rearm(TIM_CHANNEL_2, TIMER2_SCAN_MS*TIMER2_CNT_PER_MS);
+	led7_Scan();
+}
+#endif
+
+// Touch bursts on compare channel 3, one touch_Tick() per TOUCH_PERIOD_MS
+// while the pen is down. Once it is up the channel turns itself off; the
+// check is masked so a pen-down in between cannot arm it just before
+static void timer2_Touch(){
+	uint32_t pm;
+	touch_Tick(TOUCH_PERIOD_MS);
+	pm = timer2_Lock();
+	if(touch_Polling()) timer2_Rearm(TIM_CHANNEL_3, TOUCH_PERIOD_MS*TIMER2_CNT_PER_MS);
+	else __HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC3);
+	timer2_Unlock(pm);
+}
+
+/**
+  * @brief  Pen down: start the touch_Tick() channel
+  * @param  None
+  * @retval None
+  */
+void touch_PollCallback(){
+	__HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_3, __HAL_TIM_GET_COUNTER(&htim2) + TOUCH_PERIOD_MS*TIMER2_CNT_PER_MS);
+	__HAL_TIM_CLEAR_FLAG(&htim2, (uint32_t)TIM_FLAG_CC3);	// drop a stale match; the cast keeps the ~ 32 bit on the host
+	__HAL_TIM_ENABLE_IT(&htim2, TIM_IT_CC3);
+}
+
+// Same input clock, but counting TIMER2_CNT_PER_MS per ms over all 32 bits
+// with no update interrupt; the compare channels take its place
+static void timer2_StartTickless(){
+	htim2.Init.Prescaler = (htim2.Init.Prescaler + 1)*(htim2.Init.Period + 1)/TIMER2_CNT_PER_MS - 1;
+	htim2.Init.Period = 0xFFFFFFFF;
+	if(HAL_TIM_Base_Init(&htim2) != HAL_OK) Error_Handler();
+	tl_last = tl_due = __HAL_TIM_GET_COUNTER(&htim2);
+#if TIMER2_SCAN_MS
+	__HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_2, tl_last + TIMER2_SCAN_MS*TIMER2_CNT_PER_MS);
+	HAL_TIM_OC_Start_IT(&htim2, TIM_CHANNEL_2);
+#else
+	led7_Blank();
+#endif
+	__HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_1, tl_last - 1);	// nothing due before setTimer2()
+	HAL_TIM_OC_Start_IT(&htim2, TIM_CHANNEL_1);
+}
+#else
+#define timer2_WheelHit()	0
+#endif /* TIMER2_TICKLESS */
 
 
 /**
@@ -21,7 +172,14 @@ uint16_t timer2_MUL = 0;
   * @retval None
   */
 void timer_init(){
+	dwt_init();
+	tw_init();
+	idle_window = dwt_Cycles();
+#if TIMER2_TICKLESS
+	timer2_StartTickless();
+#else
 	HAL_TIM_Base_Start_IT(&htim2);
+#endif
 }
 
 
@@ -31,9 +189,125 @@ void timer_init(){
   * @retval None
   */
 void setTimer2(uint16_t duration){
+#if TIMER2_TICKLESS
+	uint32_t pm = timer2_Lock();
+	timer2_Sync();
+	tl_due = tl_last + duration/TIMER_CYCLE_2*TIMER2_CNT_PER_MS;
+#endif
 	timer2_MUL = duration/TIMER_CYCLE_2;
 	timer2_counter = timer2_MUL;
 	flag_timer2 = 0;
+	timer2_taken = timer2_periods;
+#if TIMER2_TICKLESS
+	timer2_Due();
+	timer2_Unlock(pm);
+#endif
+}
+
+/**
+  * @brief  Start of a main loop pass: clear flag_timer2 and take the
+  *         periods that ran out since the last pass
+  * @param  None
+  * @retval timer2_elapsed
+  */
+uint16_t timer2_Take(){
+	// Count first, then clear: a period that ends in between loses its flag
+	// and is counted by the next pass
+	uint16_t now, due;
+#if TIMER2_TICKLESS
+	// The wheel has no interrupt of its own: bring tw_ticks up to date for
+	// tw_Run(), even when this pass started late
+	uint32_t pm = timer2_Lock();
+	timer2_Sync();
+	timer2_Unlock(pm);
+	tl_armed = 0;	// the pass may start and stop timers: set tl_wheel again
+#endif
+	now = timer2_periods;
+	due = now - timer2_taken;
+	timer2_taken = now;
+	flag_timer2 = 0;
+	timer2_elapsed = (TIMER2_CATCH_UP && due > 0) ? due : 1;
+	return timer2_elapsed;
+}
+
+// Once a second has gone by: timer2_idle and timer2_rate over it
+static void timer2_IdleWindow(uint32_t now){
+	uint32_t span = now - idle_window;
+	if(span >= SystemCoreClock){
+		timer2_idle = (uint64_t)idle_cycles*1000/span;
+		timer2_rate = (uint64_t)(timer2_irqs - irqs_window)*SystemCoreClock/span;
+		idle_cycles = 0;
+		idle_window = now;
+		irqs_window = timer2_irqs;
+	}
+}
+
+/**
+  * @brief  Sleep until TIM2 sets flag_timer2
+  * @param  None
+  * @retval None
+  * @note	Interrupts are masked around the check so one cannot slip in
+  *         between it and WFI; a pending interrupt still ends WFI and is
+  *         taken as soon as they are unmasked again. Only the time in WFI
+  *         is idle: the wake is stamped before that interrupt's handler
+  *         runs. Tickless, the wheel's timers run at their own expiry on
+  *         the way (timer2_Wheel()). Spinning (TIMER2_WFI 0) counts the
+  *         whole wait, handlers included
+  */
+void timer2_Wait(){
+	uint32_t t0;
+	timer2_Wheel();
+	t0 = dwt_Cycles();
+#if TIMER2_WFI && !defined(HOST_SIM)
+	__disable_irq();
+	while(!flag_timer2){
+		if(!timer2_WheelHit()){
+			t0 = dwt_Cycles();
+			__WFI();
+			idle_cycles += dwt_Cycles() - t0;	// still masked: the handler has not run yet
+		}
+		__enable_irq();
+		if(timer2_WheelHit()) timer2_Wheel();
+		__disable_irq();
+	}
+	__enable_irq();
+	timer2_IdleWindow(dwt_Cycles());
+#else
+	while(!flag_timer2) timer2_Wheel();
+	timer2_Idle(t0);
+#endif
+}
+
+/**
+  * @brief  Count the time since 'since' (DWT cycles) as idle and update
+  *         timer2_idle once a second has gone by; for a wait that spins
+  * @param  since DWT cycles when the wait started
+  * @retval None
+  */
+void timer2_Idle(uint32_t since){
+	uint32_t now = dwt_Cycles();
+	idle_cycles += now - since;
+	timer2_IdleWindow(now);
+}
+
+/**
+  * @brief  Microseconds on the TIM2 time base, wrapping every 71.6 min
+  * @param  None
+  * @retval The counter with TIMER2_TICKLESS
+  * @note	Without it this is the 1ms tick plus the counter, and reads up
+  *         to 1ms low while an update interrupt is pending
+  */
+uint32_t timer2_Us(){
+#if TIMER2_TICKLESS
+	return __HAL_TIM_GET_COUNTER(&htim2)*(1000/TIMER2_CNT_PER_MS);
+#else
+	uint32_t ms, cnt;
+	do{
+		ms = tw_ticks;
+		cnt = __HAL_TIM_GET_COUNTER(&htim2);
+	}while(ms != tw_ticks);
+	return ms*1000 + cnt*1000/(htim2.Init.Period + 1);
+#endif
 }
 
 /**
@@ -43,16 +317,39 @@ void setTimer2(uint16_t duration){
   * @retval None
   */
 void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim){
-	if(htim->Instance == TIM2){
+	if(htim == &htim2){
+		timer2_irqs++;
 		if(timer2_counter > 0){
 			timer2_counter--;
 			if(timer2_counter == 0) {
+				if(flag_timer2) timer2_missed++;
+				timer2_periods++;
+				timer2_stamp = dwt_Cycles();
 				flag_timer2 = 1;
 				timer2_counter = timer2_MUL;
 			}
 		}
 		// 1ms interrupt here
+		tw_Tick();
 		led7_Scan();
+		touch_Tick(1);
 	}
 }
 
+#if TIMER2_TICKLESS
+/**
+  * @brief  Tickless TIM2: compare match routine
+  * @param  htim TIM handle, Channel tells which compare matched
+  * @retval None
+  */
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim){
+	if(htim == &htim2){
+		timer2_irqs++;
+		if(htim->Channel == HAL_TIM_ACTIVE_CHANNEL_1) timer2_Due();
+#if TIMER2_SCAN_MS
+		else if(htim->Channel == HAL_TIM_ACTIVE_CHANNEL_2) timer2_Scan();
+#endif
+		else if(htim->Channel == HAL_TIM_ACTIVE_CHANNEL_3) timer2_Touch();
+	}
+}
+#endif
@@ -0,0 +1,360 @@
+/*
+ * touch.c
+ *
+ *  Resistive touch panel on an XPT2046 controller (SPI2)
+ *
+ *  Nothing runs while the panel is idle: the controller's PENIRQ line
+ *  wakes the driver through EXTI, a DMA burst reads X/Y/Z1 several
+ *  times, the ISR takes the median, maps it to pixels and queues an
+ *  event. Bursts repeat every TOUCH_PERIOD_MS from touch_Tick() until
+ *  the pressure drops, then PENIRQ is armed again. touch_PollCallback()
+ *  tells a timer that only ticks on demand when to start calling it.
+ *
+ *  PENIRQ (EXTI1) and the SPI2 DMA streams sit at preemption priority 1,
+ *  above TIM2 at 2, so a pen-down or a finished burst is not held up
+ *  by led7_Scan()'s blocking SPI1 transfer in the TIM2 interrupt.
+ *  touch_Tick() only starts a burst while none is running, so the two
+ *  levels never touch the same state at once.
+ */
+
+#include "touch.h"
+#include "spi.h"
+#include "lcd.h"
+
+// Control byte: S | A2..A0 | 12 bit | differential | PD1..PD0
+#define XPT_X			0xD1		// PD=01: ADC on, PENIRQ off during the burst
+#define XPT_Y			0x91
+#define XPT_Z1			0xB1
+#define XPT_IDLE		0x90		// PD=00: power down, PENIRQ enabled
+
+#define TOUCH_FRAMES	(TOUCH_SAMPLES*3+1)
+#define TOUCH_BYTES		(TOUCH_FRAMES*3)
+
+enum {
+	TOUCH_OFF,			// before touch_init
+	TOUCH_IDLE,			// waiting for PENIRQ
+	TOUCH_PRESSING,		// PENIRQ fired, first burst not checked yet
+	TOUCH_PRESSED
+};
+
+static volatile uint8_t touch_state = TOUCH_OFF;
+static volatile uint8_t touch_busy = 0;
+static volatile uint8_t touch_countdown = 0;	// ms to the next burst
+static uint16_t touch_lastx, touch_lasty;
+
+static uint8_t touch_tx[TOUCH_BYTES];
+static uint8_t touch_rx[TOUCH_BYTES];
+
+static touch_Event_t touch_queue[TOUCH_QUEUE_LEN];
+static volatile uint8_t touch_head = 0, touch_tail = 0;
+uint32_t touch_dropped = 0;
+
+// Raw 200..3900 over the full panel, until touch_Calibrate is run
+static touch_Cal_t touch_cal = {
+	4251, 0, -850200,
+	0, 5668, -1133600
+};
+
+#ifdef HOST_SIM
+static uint8_t mock_down = 0;
+static uint8_t mock_irq = 0;
+static uint16_t mock_x, mock_y, mock_z1;
+
+static uint8_t touch_PenIsDown() { return mock_down; }
+static void touch_IrqArm() { mock_irq = 1; }
+static void touch_IrqDisarm() { mock_irq = 0; }
+
+static void touch_StartBurst()
+{
+	uint16_t i, v;
+	for(i = 0; i < TOUCH_FRAMES - 1; i++){
+		if(!mock_down) v = 0;
+		else if(touch_tx[i*3] == XPT_X) v = mock_x;
+		else if(touch_tx[i*3] == XPT_Y) v = mock_y;
+		else v = mock_z1;
+		touch_rx[i*3+1] = v >> 5;
+		touch_rx[i*3+2] = v << 3;
+	}
+	touch_BurstDone();
+}
+
+/**
+  * @brief  Put the pen down on the mock controller
+  * @param  rx, ry Raw 12-bit X/Y readings
+  * @param  z1 Raw Z1 pressure reading
+  * @retval None
+  */
+void touch_MockPress(uint16_t rx, uint16_t ry, uint16_t z1){
+	mock_x = rx;
+	mock_y = ry;
+	mock_z1 = z1;
+	mock_down = 1;
+	if(mock_irq) touch_PenIrq();
+}
+
+/**
+  * @brief  Lift the pen on the mock controller
+  * @param  None
+  * @retval None
+  */
+void touch_MockRelease(){
+	mock_down = 0;
+}
+#else
+static uint8_t touch_PenIsDown()
+{
+	return HAL_GPIO_ReadPin(TP_IRQ_GPIO_Port, TP_IRQ_Pin) == GPIO_PIN_RESET;
+}
+
+// PENIRQ toggles while the ADC converts, so the line stays masked between
+// pen-down and pen-up
+static void touch_IrqArm()
+{
+	__HAL_GPIO_EXTI_CLEAR_IT(TP_IRQ_Pin);
+	EXTI->IMR |= TP_IRQ_Pin;
+}
+
+static void touch_IrqDisarm()
+{
+	EXTI->IMR &= ~TP_IRQ_Pin;
+}
+
+static void touch_StartBurst()
+{
+	HAL_GPIO_WritePin(TP_CS_GPIO_Port, TP_CS_Pin, 0);
+	if(HAL_SPI_TransmitReceive_DMA(&hspi2, touch_tx, touch_rx, TOUCH_BYTES) != HAL_OK){
+		HAL_GPIO_WritePin(TP_CS_GPIO_Port, TP_CS_Pin, 1);
+		touch_busy = 0;
+		touch_countdown = 1;	// retry on the next tick
+	}
+}
+#endif
+
+static void touch_Push(touch_EventType_t type, uint16_t x, uint16_t y, uint32_t tick)
+{
+	uint8_t next = (touch_head + 1) % TOUCH_QUEUE_LEN;
+	if(next == touch_tail){
+		touch_dropped++;
+		return;
+	}
+	touch_queue[touch_head].type = type;
+	touch_queue[touch_head].x = x;
+	touch_queue[touch_head].y = y;
+	touch_queue[touch_head].tick = tick;
+	touch_head = next;
+}
+
+static uint16_t touch_Median(uint8_t first)
+{
+	uint16_t v[TOUCH_SAMPLES], t;
+	uint8_t i, j;
+	for(i = 0; i < TOUCH_SAMPLES; i++){
+		t = ((touch_rx[(first + i*3)*3 + 1] << 8) | touch_rx[(first + i*3)*3 + 2]) >> 3;
+		for(j = i; j > 0 && v[j-1] > t; j--) v[j] = v[j-1];
+		v[j] = t;
+	}
+	return v[TOUCH_SAMPLES/2];
+}
+
+static uint16_t touch_Map(int32_t a, int32_t b, int32_t c, uint16_t rx, uint16_t ry, uint16_t max)
+{
+	int32_t v = (a*rx + b*ry + c) >> 16;
+	if(v < 0) return 0;
+	if(v >= max) return max - 1;
+	return v;
+}
+
+/**
+  * @brief  Init touch controller and arm the pen-down interrupt
+  * @param  None
+  * @retval None
+  */
+void touch_init(){
+	uint8_t i;
+	for(i = 0; i < TOUCH_SAMPLES; i++){
+		touch_tx[(i*3)*3] = XPT_X;
+		touch_tx[(i*3+1)*3] = XPT_Y;
+		touch_tx[(i*3+2)*3] = XPT_Z1;
+	}
+	touch_tx[(TOUCH_FRAMES-1)*3] = XPT_IDLE;
+	touch_busy = 0;
+	touch_head = touch_tail = 0;
+#ifndef HOST_SIM
+	HAL_GPIO_WritePin(TP_CS_GPIO_Port, TP_CS_Pin, 1);
+	// Leave the controller in PD=00 so PENIRQ is live
+	HAL_GPIO_WritePin(TP_CS_GPIO_Port, TP_CS_Pin, 0);
+	HAL_SPI_TransmitReceive(&hspi2, &touch_tx[(TOUCH_FRAMES-1)*3], touch_rx, 3, 10);
+	HAL_GPIO_WritePin(TP_CS_GPIO_Port, TP_CS_Pin, 1);
+#endif
+	touch_state = TOUCH_IDLE;
+	touch_IrqArm();
+}
+
+/**
+  * @brief  Pen-down interrupt
+  * @param  None
+  * @note  	Called from HAL_GPIO_EXTI_Callback
+  * @retval None
+  */
+void touch_PenIrq(){
+	if(touch_state != TOUCH_IDLE) return;
+	touch_IrqDisarm();
+	touch_state = TOUCH_PRESSING;
+	touch_busy = 1;
+	touch_StartBurst();
+	touch_PollCallback();
+}
+
+/**
+  * @brief  Bursts are due from now on, until touch_Polling() reads 0
+  * @param  None
+  * @note  	Called from touch_PenIrq; a timer that ticks touch_Tick() only
+  *         while the pen is down starts here
+  * @retval None
+  */
+__weak void touch_PollCallback(){
+}
+
+/**
+  * @brief  The pen is down: touch_Tick() has bursts to schedule
+  * @param  None
+  * @retval 1 until the pen is up and PENIRQ armed again
+  */
+uint8_t touch_Polling(){
+	return touch_state > TOUCH_IDLE;
+}
+
+/**
+  * @brief  Schedule the next burst while the pen is down
+  * @param  ms Time since the last call
+  * @note  	Call every 1ms or every TOUCH_PERIOD_MS, does nothing while idle
+  * @retval None
+  */
+void touch_Tick(uint8_t ms){
+	if(touch_state <= TOUCH_IDLE || touch_busy) return;
+	if(touch_countdown > ms){
+		touch_countdown -= ms;
+		return;
+	}
+	touch_countdown = 0;
+	touch_busy = 1;
+	touch_StartBurst();
+}
+
+/**
+  * @brief  Burst finished: filter, calibrate and queue an event
+  * @param  None
+  * @note  	Called from HAL_SPI_TxRxCpltCallback
+  * @retval None
+  */
+void touch_BurstDone(){
+	uint16_t rx, ry, x, y;
+	uint32_t tick = HAL_GetTick();
+#ifndef HOST_SIM
+	HAL_GPIO_WritePin(TP_CS_GPIO_Port, TP_CS_Pin, 1);
+#endif
+	touch_busy = 0;
+	if(touch_Median(2) < TOUCH_Z_MIN){
+		if(touch_state == TOUCH_PRESSED)
+			touch_Push(TOUCH_UP, touch_lastx, touch_lasty, tick);
+		if(touch_PenIsDown()){
+			// Too light to trust, look again next period without an event
+			touch_state = TOUCH_PRESSING;
+			touch_countdown = TOUCH_PERIOD_MS;
+			return;
+		}
+		touch_state = TOUCH_IDLE;
+		touch_IrqArm();
+		return;
+	}
+	rx = touch_Median(0);
+	ry = touch_Median(1);
+	x = touch_Map(touch_cal.ax, touch_cal.bx, touch_cal.cx, rx, ry, lcddev.width);
+	y = touch_Map(touch_cal.ay, touch_cal.by, touch_cal.cy, rx, ry, lcddev.height);
+	if(touch_state == TOUCH_PRESSING){
+		touch_state = TOUCH_PRESSED;
+		touch_Push(TOUCH_DOWN, x, y, tick);
+	}
+	else if(x != touch_lastx || y != touch_lasty){
+		touch_Push(TOUCH_MOVE, x, y, tick);
+	}
+	touch_lastx = x;
+	touch_lasty = y;
+	touch_countdown = TOUCH_PERIOD_MS;
+}
+
+/**
+  * @brief  Take the oldest touch event
+  * @param  ev Filled in when an event is available
+  * @retval 1 if an event was taken, 0 if the queue is empty
+  */
+uint8_t touch_GetEvent(touch_Event_t *ev){
+	if(touch_tail == touch_head) return 0;
+	*ev = touch_queue[touch_tail];
+	touch_tail = (touch_tail + 1) % TOUCH_QUEUE_LEN;
+	return 1;
+}
+
+/**
+  * @brief  Whether touch_GetEvent() has an event, without taking it
+  * @retval 1 if the queue is not empty
+  */
+uint8_t touch_Pending(){
+	return touch_tail != touch_head;
+}
+
+/**
+  * @brief  Replace the raw-to-screen mapping
+  * @param  cal Q16 coefficients
+  * @retval None
+  */
+void touch_SetCalibration(const touch_Cal_t *cal){
+	touch_cal = *cal;
+}
+
+/**
+  * @brief  Compute the mapping from three touched reference points
+  * @param  raw Raw readings {rx, ry} at each point
+  * @param  scr Screen coordinates {x, y} of each point
+  * @note  	The points must not be on one line
+  * @retval 1 on success, 0 if the points are degenerate
+  */
+uint8_t touch_Calibrate(const uint16_t raw[3][2], const uint16_t scr[3][2]){
+	int32_t x0 = raw[0][0] - raw[2][0], y0 = raw[0][1] - raw[2][1];
+	int32_t x1 = raw[1][0] - raw[2][0], y1 = raw[1][1] - raw[2][1];
+	int32_t sx0 = scr[0][0] - scr[2][0], sx1 = scr[1][0] - scr[2][0];
+	int32_t sy0 = scr[0][1] - scr[2][1], sy1 = scr[1][1] - scr[2][1];
+	int32_t det = x0*y1 - x1*y0;
+	touch_Cal_t c;
+	if(det == 0) return 0;
+	c.ax = ((int64_t)(sx0*y1 - sx1*y0) << 16) / det;
+	c.bx = ((int64_t)(x0*sx1 - x1*sx0) << 16) / det;
+	c.cx = ((int32_t)scr[2][0] << 16) - c.ax*raw[2][0] - c.bx*raw[2][1];
+	c.ay = ((int64_t)(sy0*y1 - sy1*y0) << 16) / det;
+	c.by = ((int64_t)(x0*sy1 - x1*sy0) << 16) / det;
+	c.cy = ((int32_t)scr[2][1] << 16) - c.ay*raw[2][0] - c.by*raw[2][1];
+	touch_cal = c;
+	return 1;
+}
+
+#ifndef HOST_SIM
+/**
+  * @brief  EXTI line detection callback
+  * @param  GPIO_Pin Line that fired
+  * @note	This callback function is called by system
+  * @retval None
+  */
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin){
+	if(GPIO_Pin == TP_IRQ_Pin) touch_PenIrq();
+}
+
+/**
+  * @brief  SPI full-duplex DMA transfer complete callback
+  * @param  hspi SPI handle
+  * @note	This callback function is called by system
+  * @retval None
+  */
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi){
+	if(hspi->Instance == SPI2) touch_BurstDone();
+}
+#endif
@@ -0,0 +1,175 @@
+/*
+ * trace.c
+ *
+ *  Input trace recorder
+ *
+ *  The buffer is two halves. Records go into the current half; when it is
+ *  full the other half is cleared and starts with a key record holding the
+ *  inputs at that point, so the dump is always the older half followed by
+ *  the current one and each half decodes on its own. Passes with no new
+ *  input only bump the last pass tag, so an idle clock costs one byte per
+ *  3 seconds plus one RTC record per second.
+ *
+ *  RX bytes arrive in interrupt context. They go through a small SPSC ring
+ *  (the ISR only moves the head) and are copied into the stream at the
+ *  next trace_Tick(), which is when uart_process_incoming_data() gets them.
+ *  Everything else runs in the main loop.
+ */
+
+#include "trace.h"
+
+#if TRACE_ENABLE
+
+#include <stdio.h>
+#include <string.h>
+#include "report.h"
+
+#define TRACE_HALF		(TRACE_SIZE/2)
+#define TRACE_RX_RING	32
+#define TRACE_KEY_LEN	14
+
+static uint8_t trace_buf[2][TRACE_HALF];
+static uint16_t trace_len[2];
+static uint8_t trace_cur;
+static int16_t trace_pass_at;			// open pass tag in the current half, -1 = none
+static uint32_t trace_passes;
+static uint16_t trace_buttons;
+static uint8_t trace_rtc[7];
+
+static uint8_t trace_rx[TRACE_RX_RING];
+static volatile uint8_t trace_rx_head;	// written by the ISR only
+static volatile uint8_t trace_rx_tail;	// written by trace_Tick() only
+uint32_t trace_rx_lost;
+
+/**
+ * @brief  Append n bytes, switching halves when they do not fit
+ */
+static void trace_Put(const uint8_t *p, uint8_t n)
+{
+	uint8_t key[TRACE_KEY_LEN];
+	if(trace_len[trace_cur] + n > TRACE_HALF){
+		trace_cur ^= 1;
+		key[0] = TRACE_TAG_KEY;
+		key[1] = trace_passes;
+		key[2] = trace_passes >> 8;
+		key[3] = trace_passes >> 16;
+		key[4] = trace_passes >> 24;
+		key[5] = trace_buttons;
+		key[6] = trace_buttons >> 8;
+		memcpy(&key[7], trace_rtc, 7);
+		memcpy(trace_buf[trace_cur], key, TRACE_KEY_LEN);
+		trace_len[trace_cur] = TRACE_KEY_LEN;
+	}
+	memcpy(&trace_buf[trace_cur][trace_len[trace_cur]], p, n);
+	trace_len[trace_cur] += n;
+	trace_pass_at = -1;
+}
+
+void trace_init()
+{
+	trace_len[0] = trace_len[1] = 0;
+	trace_cur = 0;
+	trace_pass_at = -1;
+	trace_passes = 0;
+	trace_buttons = 0xffff;			// nothing pressed
+	memset(trace_rtc, 0, sizeof(trace_rtc));
+	trace_rx_tail = trace_rx_head;
+	trace_rx_lost = 0;
+}
+
+/**
+ * @brief  Start of a main loop pass, right after flag_timer2
+ */
+void trace_Tick()
+{
+	uint8_t tag = TRACE_TAG_PASS | 1;
+	uint8_t rec[16];
+	uint8_t n = 0;
+	trace_passes++;
+	if(trace_pass_at >= 0 && (trace_buf[trace_cur][trace_pass_at] & 0x3f) < 0x3f){
+		trace_buf[trace_cur][trace_pass_at]++;
+	} else {
+		trace_Put(&tag, 1);
+		trace_pass_at = trace_len[trace_cur] - 1;
+	}
+	while(trace_rx_tail != trace_rx_head){
+		rec[1 + n++] = trace_rx[trace_rx_tail];
+		trace_rx_tail = (trace_rx_tail + 1) % TRACE_RX_RING;
+		if(n == 15 || trace_rx_tail == trace_rx_head){
+			rec[0] = TRACE_TAG_RX | n;
+			trace_Put(rec, n + 1);
+			n = 0;
+		}
+	}
+}
+
+/**
+ * @brief  Raw SPI1 word from button_Scan()
+ */
+void trace_Buttons(uint16_t raw)
+{
+	uint8_t rec[3];
+	if(raw == trace_buttons) return;
+	trace_buttons = raw;
+	rec[0] = TRACE_TAG_BUTTONS;
+	rec[1] = raw;
+	rec[2] = raw >> 8;
+	trace_Put(rec, 3);
+}
+
+/**
+ * @brief  One byte from the USART1 RX interrupt
+ */
+void trace_Rx(uint8_t byte)
+{
+	uint8_t next = (trace_rx_head + 1) % TRACE_RX_RING;
+	if(next == trace_rx_tail){
+		trace_rx_lost++;
+		return;
+	}
+	trace_rx[trace_rx_head] = byte;
+	trace_rx_head = next;
+}
+
+/**
+ * @brief  Time registers 0x00..0x06 as read from the DS3231
+ */
+void trace_Rtc(const uint8_t *regs)
+{
+	uint8_t rec[8];
+	if(memcmp(regs, trace_rtc, 7) == 0) return;
+	memcpy(trace_rtc, regs, 7);
+	rec[0] = TRACE_TAG_RTC;
+	memcpy(&rec[1], regs, 7);
+	trace_Put(rec, 8);
+}
+
+/**
+ * @brief  Print the trace as text: a "TRACE passes bytes" line, 32 bytes of
+ *         hex per line, then "END"
+ */
+void trace_Dump()
+{
+	static const char hex[] = "0123456789ABCDEF";
+	char line[72];
+	uint8_t h, half;
+	uint16_t i, k;
+	k = sprintf(line, "\r\nTRACE %lu %u\r\n", (unsigned long)trace_passes,
+			trace_len[0] + trace_len[1]);
+	rpt_Write(line, k);
+	for(h = 0; h < 2; h++){
+		half = trace_cur ^ 1 ^ h;		// older half first
+		for(i = 0; i < trace_len[half]; i += 32){
+			for(k = 0; k < 32 && i + k < trace_len[half]; k++){
+				line[2*k] = hex[trace_buf[half][i + k] >> 4];
+				line[2*k + 1] = hex[trace_buf[half][i + k] & 0x0f];
+			}
+			line[2*k] = '\r';
+			line[2*k + 1] = '\n';
+			rpt_Write(line, 2*k + 2);
+		}
+	}
+	rpt_Write("END\r\n", 5);
+}
+
+#endif /* TRACE_ENABLE */
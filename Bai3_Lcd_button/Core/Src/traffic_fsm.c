@@ -14,14 +14,30 @@
 #include "lcd.h"
 #include "button.h"
 #include "software_timer.h" // For flag_timer2
+#include "timer_wheel.h"
 #include "led_7seg.h"
+#include "touch.h"
+#include "prof.h"
+#include "evq.h"
 #include <stdio.h> // For sprintf
+#include <string.h>
+#include "report.h"
 
 // --- Button Definitions ---
 #define BUTTON_MODE     0
 #define BUTTON_ADJUST   1
 #define BUTTON_CONFIRM  2
 
+// --- On-screen touch keys (same actions as buttons 1..3) ---
+#define TKEY_Y          260
+#define TKEY_H          40
+#define TKEY_W          70
+#define TKEY_X(i)       (10 + (i) * 75)
+
+// --- Timer periods ---
+#define SECOND_US       1000000UL
+#define BLINK_HALF_MS   250 // 2Hz: 250ms ON, 250ms OFF
+
 // --- Static State Variables ---
 static System_Mode_t current_mode;
 static Traffic_State_t traffic_state;
@@ -37,19 +53,62 @@ static int temp_period_value = 0; // Temporary value during modification
 static int r1_timer = 5; // Countdown timer for Route 1 (LEDs 2&3 - Right)
 static int r2_timer = 9; // Countdown timer for Route 2 (LEDs 0&1 - Left)
 
-// --- Internal Timers ---
-static int second_counter = 0;    // ms counter to create a 1-second tick
-static int blink_counter = 0;     // ms counter to create a 2Hz blink
+// --- Phase schedule ---
+// Each phase ends a whole number of seconds after the deadline of the one
+// before, on the monotonic us count of traffic_now(), not after the pass
+// that noticed it: a late pass delays one transition, never the ones after
+static uint64_t phase_due = 0;    // traffic_now() at which the current phase ends
+static uint64_t now_us = 0;       // traffic_now(): timer2_Us() extended to 64 bits
+static uint32_t now_last = 0;     // timer2_Us() counted into now_us so far
+
+#if PHASE_STATS
+// How late each transition was applied against its deadline, per state
+// entered, and how far each phase's length came out from its period
+typedef struct {
+    uint32_t count;
+    uint32_t late_max_us;
+    uint64_t late_sum_us;
+    uint32_t len_err_max_us;      // |applied length - period|
+} Phase_Stats_t;
+
+static Phase_Stats_t phase_stats[6];
+static uint32_t phase_prev_late = 0;  // lateness of the transition that started this phase
+static uint64_t phase_drift_us = 0;   // sum of the lateness: a schedule restarted at each
+                                      // applied transition would be this far behind
+static uint8_t phase_req = 0;         // 1 = print, 2 = print and clear
+#endif
+
+// --- Internal Timers (timer_wheel.c) ---
+static tw_Timer_t second_timer;   // One-shot: the countdown shown changes (a run with EVQ_ENABLE)
+static tw_Timer_t blink_timer;    // Toggles blink_state every BLINK_HALF_MS
 static int blink_state = 0;       // Current blink state (0 = OFF, 1 = ON)
 
 static char lcd_buffer[50]; // String buffer for LCD display
 
+static int touch_button = -1; // Touch key hit in this cycle, -1 if none
+
+// --- Event dispatch (EVQ_ENABLE) ---
+// The timers post here; fsm_again asks for another run when the mode just
+// changed; key_down holds the keys whose EVQ_KEY_DOWN the FSM has not run on
+enum { TIMER_SECOND, TIMER_BLINK };
+#if EVQ_ENABLE
+static evq_Queue_t traffic_timers = EVQ_INIT("timers");
+static uint8_t fsm_again = 1;
+static uint16_t key_down = 0;
+#endif
+
 // --- Static Function Prototypes ---
 static int is_button_pressed(int button_index);
 static void fsm_normal_mode_run();
 static void fsm_modify_mode_run();
 static void draw_traffic_lights(int r1_state, int r2_state, int blink_r, int blink_g, int blink_y);
 static void update_lcd_display();
+static void draw_touch_keys();
+static void read_touch_keys();
+static void blink_toggle(void *arg);
+static void second_tick(void *arg);
+static uint64_t traffic_now();
+static void phase_start();
 
 /**
  * @brief Initializes the Traffic Light State Machine.
@@ -63,22 +122,113 @@ void fsm_traffic_init() {
     r1_timer = period_green;
     r2_timer = period_green + period_yellow + period_red; // Total red time for R2
 
-    second_counter = 0;
-    blink_counter = 0;
+    phase_start();
     blink_state = 0;
+    tw_Start(&blink_timer, BLINK_HALF_MS, BLINK_HALF_MS, blink_toggle, NULL);
     lcd_Clear(BLACK); // Clear the screen
+    draw_touch_keys();
+    evq_Add(&traffic_timers);
+}
+
+/**
+ * @brief blink_timer callback: toggles the 2Hz blink state.
+ */
+static void blink_toggle(void *arg) {
+    blink_state = !blink_state;
+#if EVQ_ENABLE
+    // Only the modify modes blink
+    if (current_mode != MODE_NORMAL) evq_Put(&traffic_timers, EVQ_TIMER, TIMER_BLINK, 0);
+#endif
+}
+
+/**
+ * @brief second_timer callback: the countdown shown is about to change. The
+ * FSM works out what changed from traffic_now(); this only makes it run.
+ */
+static void second_tick(void *arg) {
+#if EVQ_ENABLE
+    if (current_mode == MODE_NORMAL) evq_Put(&traffic_timers, EVQ_TIMER, TIMER_SECOND, 0);
+#endif
+}
+
+/**
+ * @brief Monotonic microseconds: timer2_Us() extended to 64 bits, so it does
+ * not wrap after 71.6 min. Without TIMER2_TICKLESS a read can come out up to
+ * 1ms low while a TIM2 update is pending; such a step back is not counted.
+ * Needs a call at least every 35 min; every FSM run makes one.
+ */
+static uint64_t traffic_now() {
+    uint32_t us = timer2_Us();
+    if ((int32_t)(us - now_last) > 0) {
+        now_us += us - now_last;
+        now_last = us;
+    }
+    return now_us;
+}
+
+/**
+ * @brief Length of a state's phase in seconds.
+ */
+static int phase_seconds(Traffic_State_t state) {
+    switch (state) {
+        case STATE_R1_GREEN_R2_RED:
+        case STATE_R1_RED_R2_GREEN:  return period_green;
+        case STATE_R1_YELLOW_R2_RED:
+        case STATE_R1_RED_R2_YELLOW: return period_yellow;
+        case STATE_ALL_RED_1:
+        case STATE_ALL_RED_2:
+        default:                     return period_red;
+    }
 }
 
+/**
+ * @brief Starts the cycle at STATE_R1_GREEN_R2_RED, now.
+ */
+static void phase_start() {
+    traffic_state = STATE_R1_GREEN_R2_RED;
+    phase_due = traffic_now() + (uint64_t)period_green * SECOND_US;
+#if PHASE_STATS
+    phase_prev_late = 0;
+#endif
+    tw_Start(&second_timer, 0, 0, second_tick, NULL);
+}
+
+#if PHASE_STATS
+/**
+ * @brief A transition into 'state' was applied late_us after its deadline.
+ */
+static void phase_record(Traffic_State_t state, uint32_t late_us) {
+    Phase_Stats_t *p = &phase_stats[state];
+    uint32_t err = (late_us > phase_prev_late) ? late_us - phase_prev_late : phase_prev_late - late_us;
+    p->count++;
+    p->late_sum_us += late_us;
+    if (late_us > p->late_max_us) p->late_max_us = late_us;
+    // The phase that just ended started phase_prev_late after its own deadline
+    if (err > phase_stats[(state + 5) % 6].len_err_max_us) phase_stats[(state + 5) % 6].len_err_max_us = err;
+    phase_prev_late = late_us;
+    phase_drift_us += late_us;
+}
+#else
+#define phase_record(state, late_us) ((void)0)
+#endif
+
 /**
  * @brief Checks if a specific button was just pressed (rising edge detection).
  * @param button_index The index (0-15) of the button to check.
  * @retval 1 if pressed (count == 1), 0 otherwise.
  */
 static int is_button_pressed(int button_index) {
-    // Relies on button_count[] from button.c
-    if (button_count[button_index] == 1) {
+#if EVQ_ENABLE
+    // A DOWN event from the dispatch, or a touch key hit this cycle
+    if ((key_down & (1u << button_index)) || touch_button == button_index) {
+        return 1;
+    }
+#else
+    // Relies on button_count[] from button.c, or a touch key hit this cycle
+    if (button_count[button_index] == 1 || touch_button == button_index) {
         return 1;
     }
+#endif
     return 0;
 }
 
@@ -87,15 +237,11 @@ static int is_button_pressed(int button_index) {
  * Handles timers, button inputs for mode switching, and calls the appropriate sub-FSM.
  */
 void fsm_traffic_run() {
-    // --- Update internal timers (called every 50ms) ---
-    blink_counter += 50;
-    second_counter += 50;
-
-    // 2Hz = 500ms period (250ms ON, 250ms OFF)
-    if (blink_counter >= 250) {
-        blink_counter = 0;
-        blink_state = !blink_state; // Toggle blink state
-    }
+    PROF_ZONE("fsm_traffic_run");
+    traffic_now(); // keeps the 64-bit count up with timer2_Us() in every mode
+    read_touch_keys();
+
+    // (second_timer and blink_timer run on their own in timer_wheel.c)
 
     // --- Handle Mode Switching (Button 1) ---
     if (is_button_pressed(BUTTON_MODE)) {
@@ -104,17 +250,16 @@ void fsm_traffic_run() {
             current_mode = MODE_NORMAL;
         }
 
-        blink_counter = 0; // Reset blink timer
         blink_state = 1;   // Always start in ON state when switching mode
+        tw_Start(&blink_timer, BLINK_HALF_MS, BLINK_HALF_MS, blink_toggle, NULL); // Restart blink phase
 
         // Load current period value into temp variable for editing
         switch(current_mode) {
             case MODE_NORMAL:
                 // Reset to default traffic state and timers
-                traffic_state = STATE_R1_GREEN_R2_RED;
                 r1_timer = period_green;
                 r2_timer = period_green + period_yellow + period_red;
-                second_counter = 0; // Reset 1-second tick
+                phase_start(); // The schedule starts again from now
                 break;
             case MODE_MODIFY_RED:
                 temp_period_value = period_red;
@@ -140,67 +285,87 @@ void fsm_traffic_run() {
     update_lcd_display();
 }
 
+#if EVQ_ENABLE
 /**
- * @brief Handles the logic for MODE_NORMAL.
- * Runs a 1-second countdown timer and transitions the 6 traffic light states.
+ * @brief Hands the key presses to fsm_traffic_run() and runs it only when a
+ * press, a touch or a timer has something for it. Only EVQ_KEY_DOWN counts;
+ * a key pressed twice before the FSM saw the first runs it in between. The
+ * touch keys still come from the touch queue.
+ * @retval 1 if it ran
  */
-static void fsm_normal_mode_run() {
-    // --- Create 1-second tick ---
-    if (second_counter < 1000) {
-        return; // Not 1 second yet, exit
+uint8_t fsm_traffic_dispatch() {
+    evq_Event_t ev;
+    uint8_t n = 0;
+    System_Mode_t mode = current_mode;
+    while (evq_Get(&button_events, &ev)) {
+        if (ev.type != EVQ_KEY_DOWN) continue;
+        if (key_down & (1u << ev.arg)) {
+            fsm_traffic_run();
+            key_down = 0;
+        }
+        key_down |= 1u << ev.arg;
+        n = 1;
     }
-    second_counter = 0; // Reset ms counter
+    n |= evq_Drain(&traffic_timers);
+    if (n == 0 && !touch_Pending() && !fsm_again) {
+        evq_Ran(0);
+        return 0;
+    }
+    fsm_traffic_run();
+    key_down = 0;
+    fsm_again = (current_mode != mode);
+    evq_Ran(1);
+    return 1;
+}
+#endif
 
-    // --- Decrement countdown timers (in seconds) ---
-    r1_timer--;
-    r2_timer--;
+/**
+ * @brief Returns the current traffic light state.
+ */
+Traffic_State_t fsm_traffic_state() {
+    return traffic_state;
+}
 
-    // --- Handle state transitions based on which timer reached 0 ---
-    switch (traffic_state) {
-        case STATE_R1_GREEN_R2_RED:
-            if (r1_timer == 0) { // R1 Green time finished
-                traffic_state = STATE_R1_YELLOW_R2_RED;
-                r1_timer = period_yellow; // Load R1 Yellow time
-            }
-            break;
+/**
+ * @brief Returns the current system mode.
+ */
+System_Mode_t fsm_traffic_mode() {
+    return current_mode;
+}
 
-        case STATE_R1_YELLOW_R2_RED:
-            if (r1_timer == 0) { // R1 Yellow time finished
-                traffic_state = STATE_ALL_RED_1;
-                r1_timer = period_red; // Load "All Red" time
-            }
-            break;
+/**
+ * @brief Handles the logic for MODE_NORMAL.
+ * Applies every phase transition whose deadline has passed, then shows the
+ * seconds left, rounded up, and arms second_timer for the next change.
+ */
+static void fsm_normal_mode_run() {
+    uint64_t now = traffic_now(), left;
+    int secs;
+
+    // --- Transitions on the absolute schedule ---
+    // A run that comes late takes each phase that ended since, each one from
+    // the deadline of the one before, so their lengths stay exact
+    while (now >= phase_due) {
+        traffic_state = (traffic_state == STATE_ALL_RED_2) ? STATE_R1_GREEN_R2_RED : traffic_state + 1;
+        phase_record(traffic_state, (uint32_t)(now - phase_due));
+        phase_due += (uint64_t)phase_seconds(traffic_state) * SECOND_US;
+    }
 
+    // --- Countdown timers (in seconds), from the time left ---
+    left = phase_due - now;
+    secs = (int)((left + SECOND_US - 1) / SECOND_US);
+    switch (traffic_state) {
+        case STATE_R1_GREEN_R2_RED:  r1_timer = secs; r2_timer = secs + period_yellow + period_red; break;
+        case STATE_R1_YELLOW_R2_RED: r1_timer = secs; r2_timer = secs + period_red; break;
+        case STATE_R1_RED_R2_GREEN:  r2_timer = secs; r1_timer = secs + period_yellow + period_red; break;
+        case STATE_R1_RED_R2_YELLOW: r2_timer = secs; r1_timer = secs + period_red; break;
         case STATE_ALL_RED_1:
-             if (r1_timer == 0) { // "All Red 1" time finished (R2 timer also 0)
-                traffic_state = STATE_R1_RED_R2_GREEN;
-                r1_timer = period_green + period_yellow + period_red; // Load R1 total Red time
-                r2_timer = period_green;                 // Load R2 Green time
-            }
-            break;
-
-        case STATE_R1_RED_R2_GREEN:
-             if (r2_timer == 0) { // R2 Green time finished
-                traffic_state = STATE_R1_RED_R2_YELLOW;
-                r2_timer = period_yellow; // Load R2 Yellow time
-            }
-            break;
-
-        case STATE_R1_RED_R2_YELLOW:
-            if (r2_timer == 0) { // R2 Yellow time finished
-                traffic_state = STATE_ALL_RED_2;
-                r2_timer = period_red; // Load "All Red" time
-            }
-            break;
-
-        case STATE_ALL_RED_2:
-            if (r2_timer == 0) { // "All Red 2" time finished (R1 timer also 0)
-                traffic_state = STATE_R1_GREEN_R2_RED;
-                r1_timer = period_green;                 // Load R1 Green time
-                r2_timer = period_green + period_yellow + period_red; // Load R2 total Red time
-            }
-            break;
+        case STATE_ALL_RED_2:        r1_timer = secs; r2_timer = secs; break;
     }
+
+    // --- Next change of the countdown: a whole second before phase_due ---
+    // (rounded up to the next 1ms tick, so the run it causes is not early)
+    tw_Start(&second_timer, (uint32_t)(((left - 1) % SECOND_US) / 1000) + 1, 0, second_tick, NULL);
 }
 
 /**
@@ -243,6 +408,7 @@ static void update_lcd_display() {
     int r1_light = -1; // -1=Off, 0=Red, 1=Yellow, 2=Green (Route 1 - Right)
     int r2_light = -1; // (Route 2 - Left)
     int blink_r = 0, blink_g = 0, blink_y = 0; // Flags to indicate which color should blink
+    PROF_ZONE("update_lcd_display");
 
     // 1. Determine light states and LCD text based on mode
     switch (current_mode) {
@@ -366,3 +532,77 @@ static void draw_traffic_lights(int r1_state, int r2_state, int blink_r, int bli
     lcd_DrawCircle(160, 130, (r1_y_on) ? YELLOW : BLACK, 20, 1); // R1 Yellow
     lcd_DrawCircle(160, 180, (r1_g_on) ? GREEN : BLACK,  20, 1); // R1 Green
 }
+
+/**
+ * @brief Draws the three touch keys (MODE, +, OK) along the bottom of the LCD.
+ */
+static void draw_touch_keys() {
+    static const char *labels[3] = { "MODE", " +", " OK" };
+    for (int i = 0; i < 3; i++) {
+        lcd_DrawRectangle(TKEY_X(i), TKEY_Y, TKEY_X(i) + TKEY_W - 1, TKEY_Y + TKEY_H - 1, WHITE);
+        lcd_ShowStr(TKEY_X(i) + 11, TKEY_Y + 8, (char *)labels[i], WHITE, BLACK, 24, 0);
+    }
+}
+
+/**
+ * @brief Drains the touch event queue and records which key (if any) was tapped.
+ * Only pen-down counts, so a tap acts like one button press.
+ */
+static void read_touch_keys() {
+    touch_Event_t ev;
+    touch_button = -1;
+    while (touch_GetEvent(&ev)) {
+        if (ev.type != TOUCH_DOWN) continue;
+        if (ev.y < TKEY_Y || ev.y >= TKEY_Y + TKEY_H) continue;
+        for (int i = 0; i < 3; i++) {
+            if (ev.x >= TKEY_X(i) && ev.x < TKEY_X(i) + TKEY_W) touch_button = i;
+        }
+    }
+}
+
+#if PHASE_STATS
+/**
+ * @brief Asks for the table at the next fsm_traffic_poll(); reset = 1 also
+ * clears it once printed.
+ */
+void fsm_traffic_request(uint8_t reset) {
+    rpt_Request(&phase_req, reset);
+}
+
+/**
+ * @brief Call from the main loop, after the FSM.
+ */
+void fsm_traffic_poll() {
+    uint8_t req = rpt_Take(&phase_req);
+    if (req == RPT_NONE) return;
+    fsm_traffic_report();
+    if (req == RPT_CLEAR) {
+        memset(phase_stats, 0, sizeof(phase_stats));
+        phase_drift_us = 0;
+    }
+}
+
+/**
+ * @brief Prints one row per state: transitions into it, how late they were
+ * applied (worst, mean) and the worst length error of its phase; then the
+ * drift a schedule restarted at each applied transition would have built up.
+ */
+void fsm_traffic_report() {
+    static const char *names[6] = {"G/R", "Y/R", "R/R", "R/G", "R/Y", "R/R2"};
+    char line[96];
+    uint16_t n;
+    int i;
+    n = sprintf(line, "\r\nPHASE  period s  count  late max us  late mean us  length err max us\r\n");
+    rpt_Write(line, n);
+    for (i = 0; i < 6; i++) {
+        Phase_Stats_t *p = &phase_stats[i];
+        n = sprintf(line, "%-6s %8d %6lu %12lu %13lu %18lu\r\n", names[i], phase_seconds((Traffic_State_t)i),
+                (unsigned long)p->count, (unsigned long)p->late_max_us,
+                (unsigned long)(p->count ? p->late_sum_us / p->count : 0), (unsigned long)p->len_err_max_us);
+        rpt_Write(line, n);
+    }
+    n = sprintf(line, "lateness summed %lu us: drift of a schedule counted from each pass\r\n",
+            (unsigned long)phase_drift_us);
+    rpt_Write(line, n);
+}
+#endif
@@ -0,0 +1,216 @@
+/*
+ * clock_main.c
+ *
+ *  Host entry point for Bai5_UART: system_init() and the main loop from
+ *  Core/Src/main.c without the CubeMX peripheral init
+ */
+
+#include "sim.h"
+#include "ds3231_model.h"
+#include "trace_replay.h"
+#include "bench.h"
+#include "software_timer.h"
+#include "led_7seg.h"
+#include "button.h"
+#include "lcd.h"
+#include "display_pm.h"
+#include "ds3231.h"
+#include "uart.h"
+#include "clock_fsm.h"
+#include "trace.h"
+#include "prof.h"
+#include "loopstat.h"
+#include "latency.h"
+#include "sched.h"
+#include "timer_wheel.h"
+#include "kernel.h"
+#include "evq.h"
+#include "bh.h"
+
+static const char *clock_State(void)
+{
+	static const char *mode[] = {"view", "set_time", "set_alarm", "uart_update", "message"};
+	uint8_t m = clock_fsm_mode();
+	return (m < 5) ? mode[m] : "?";
+}
+
+// The tasks of Core/Src/main.c
+static void task_Input(void)
+{
+	loop_Start();
+	trace_Tick();
+	button_Scan();
+#if TRACE_ENABLE
+	if(button_count[TRACE_DUMP_KEY] == 1) trace_Dump();
+#endif
+#if LAT_ENABLE
+	if(button_count[LAT_DUMP_KEY] == 1) lat_Report();
+#endif
+}
+
+static void task_Fsm(void)
+{
+#if EVQ_ENABLE
+	clock_fsm_dispatch();
+#else
+	clock_fsm_run();
+#endif
+#if LCD_USE_FRAMEBUFFER
+	lcd_Display();
+#endif
+	lat_EndPass();
+	loop_End();
+	loop_Poll();
+	evq_Poll();
+}
+
+static void task_Rtc(void)
+{
+	ds3231_ReadTime();
+}
+
+#if KERNEL_ENABLE
+// The threads of Core/Src/main.c; the render pass also ends a sim pass
+static k_Thread_t input_thread, uart_thread, render_thread, rtc_thread;
+K_STACK(input_stack, 256);
+K_STACK(uart_stack, 512);
+K_STACK(render_stack, 1024);
+K_STACK(rtc_stack, 256);
+static k_Sem_t render_sem = K_SEM_INIT(0, 1);
+static k_Sem_t io_sem = K_SEM_INIT(1, 1);
+
+static void thread_Input(void *arg)
+{
+	uint32_t last = k_ticks;
+	for(;;){
+		k_SleepUntil(&last, KERNEL_INPUT_MS);
+		task_Input();
+		k_SemGive(&render_sem);
+	}
+}
+
+static void thread_Uart(void *arg)
+{
+	for(;;){
+		k_SemTake(&uart_rx_sem, KERNEL_UART_MS);
+		clock_fsm_uart();
+		if(k_SemTake(&io_sem, 0) == 0){
+			prof_Poll();
+			k_Poll();
+			k_SemGive(&io_sem);
+		}
+	}
+}
+
+static void thread_Render(void *arg)
+{
+	for(;;){
+		k_SemTake(&render_sem, K_FOREVER);
+		k_SemTake(&io_sem, K_FOREVER);
+		tw_Run();
+		task_Fsm();
+		k_SemGive(&io_sem);
+		sim_EndPass();
+	}
+}
+
+static void thread_Rtc(void *arg)
+{
+	uint32_t last = k_ticks;
+	for(;;){
+		k_SleepUntil(&last, KERNEL_RTC_MS);
+		k_SemTake(&io_sem, K_FOREVER);
+		task_Rtc();
+		k_SemGive(&io_sem);
+	}
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	sim_Init(argc, argv, "clock_sim");
+	ds3231m_Reset();
+	if(ds3231m_Config(sim_dev_opts) != 0){
+		fprintf(stderr, "clock_sim: bad -D '%s'\n", sim_dev_opts);
+		return 2;
+	}
+	sim_I2cAttach(DS3231M_ADDR, sim_Replaying() ? &replay_rtc : &ds3231m_dev);
+	sim_SetState(clock_State);
+
+	bh_init();
+	timer_init();
+	led7_init();
+	button_init();
+	lcd_init();
+	dpm_init();
+	ds3231_init();
+	setTimer2(50);
+
+	lcd_Clear(BLACK);
+	trace_init();
+	prof_init();
+	loop_init();
+	lat_init();
+	ds3231_ReadTime();
+
+#if LCD_BENCH
+	bench_Run();
+#if LCD_USE_FRAMEBUFFER
+	return sim_BenchCheck("clock_fb");	// own baseline rows: only the flush is on the bus
+#else
+	return sim_BenchCheck("clock");
+#endif
+#endif
+
+#if SCHED_ENABLE
+	if(sim_Replaying()){
+		// A trace holds 50ms passes, the scheduler passes are 1ms ticks
+		fprintf(stderr, "clock_sim: -r needs the 50ms loop, build without SCHED_ENABLE\n");
+		return 2;
+	}
+	sched_init();
+	sched_Add("input", task_Input, SCHED_FSM_MS, 0, 0);
+	sched_Add("uart", clock_fsm_uart, SCHED_UART_MS, 1, 1);
+	sched_Add("fsm", task_Fsm, SCHED_FSM_MS, 0, 2);
+	sched_Add("rtc", task_Rtc, SCHED_RTC_MS, 25, 3);
+	setTimer2(SCHED_TICK_MS);
+	sched_Start();
+#endif
+
+#if KERNEL_ENABLE
+	if(sim_Replaying()){
+		fprintf(stderr, "clock_sim: -r needs the 50ms loop, build without KERNEL_ENABLE\n");
+		return 2;
+	}
+	k_Create(&input_thread, "input", 0, thread_Input, NULL, input_stack, sizeof(input_stack)/4);
+	k_Create(&uart_thread, "uart", 1, thread_Uart, NULL, uart_stack, sizeof(uart_stack)/4);
+	k_Create(&render_thread, "render", 2, thread_Render, NULL, render_stack, sizeof(render_stack)/4);
+	k_Create(&rtc_thread, "rtc", 3, thread_Rtc, NULL, rtc_stack, sizeof(rtc_stack)/4);
+	k_Start();				// returns once the idle thread ends the run
+#else
+	while(sim_Wait()){
+		tw_Run();
+		prof_Poll();
+#if SCHED_ENABLE
+		sched_Run();
+		sched_Poll();
+#else
+		PROF_ZONE("main_loop");
+		task_Input();
+		clock_fsm_uart();
+#if EVQ_ENABLE
+		task_Rtc();
+#endif
+		task_Fsm();
+#endif
+		sim_EndPass();
+	}
+#endif
+	lat_Report();
+	prof_Report();
+	loop_Report();
+	sched_Report();
+	k_Report();
+	evq_Report();
+	return sim_Finish();
+}
@@ -0,0 +1,280 @@
+/*
+ * ds3231_model.c
+ *
+ *  Software DS3231 behind the I2C stand-in in hal_sim.c
+ *
+ *  The register file follows the datasheet: BCD time and date with the
+ *  12/24h and century bits, both alarms with their mask bits, control,
+ *  status, aging offset and the temperature registers. Time moves with
+ *  sim_ms and is brought up to date at the start of every transfer, so a
+ *  burst read sees one consistent snapshot, as the chip's user buffer
+ *  gives. The host always powers the chip from VCC, so EOSC has no effect.
+ */
+
+#include "ds3231_model.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define REG_SEC		0x00
+#define REG_MIN		0x01
+#define REG_HOUR	0x02
+#define REG_DAY		0x03
+#define REG_DATE	0x04
+#define REG_MONTH	0x05
+#define REG_YEAR	0x06
+#define REG_A1SEC	0x07
+#define REG_A2MIN	0x0B
+#define REG_CTRL	0x0E
+#define REG_STAT	0x0F
+#define REG_AGING	0x10
+#define REG_TMSB	0x11
+#define REG_TLSB	0x12
+
+#define HOUR_12H	0x40
+#define HOUR_PM		0x20
+#define MONTH_CENT	0x80
+#define ALARM_MASK	0x80
+#define ALARM_DYDT	0x40
+
+#define CTRL_CONV	0x20
+#define CTRL_INTCN	0x04
+#define CTRL_A2IE	0x02
+#define CTRL_A1IE	0x01
+
+#define STAT_OSF	0x80
+#define STAT_EN32K	0x08
+#define STAT_BSY	0x04
+#define STAT_A2F	0x02
+#define STAT_A1F	0x01
+
+ds3231m_t ds3231m;
+
+static uint8_t bcd(uint8_t v)
+{
+	return (uint8_t)((v / 10) << 4 | (v % 10));
+}
+
+static uint8_t dec(uint8_t v)
+{
+	return (v >> 4) * 10 + (v & 0x0f);
+}
+
+static uint8_t rtc_DaysIn(uint8_t month, uint8_t year)
+{
+	static const uint8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	if(month == 2 && year % 4 == 0) return 29;		// 2000-2099
+	return days[(month - 1) % 12];
+}
+
+static void rtc_Convert(void)
+{
+	ds3231m.reg[REG_TMSB] = (uint8_t)(ds3231m.temp_q >> 2);
+	ds3231m.reg[REG_TLSB] = (uint8_t)((ds3231m.temp_q & 3) << 6);
+	ds3231m.reg[REG_CTRL] &= ~CTRL_CONV;
+	ds3231m.conv_s = 64;
+}
+
+// Hour register to 0..23
+static uint8_t rtc_Hour24(uint8_t r)
+{
+	uint8_t h;
+	if(!(r & HOUR_12H)) return dec(r & 0x3f);
+	h = dec(r & 0x1f) % 12;
+	return (r & HOUR_PM) ? h + 12 : h;
+}
+
+static uint8_t rtc_HourReg(uint8_t h24, uint8_t old)
+{
+	uint8_t h;
+	if(!(old & HOUR_12H)) return bcd(h24);
+	h = h24 % 12;
+	return HOUR_12H | ((h24 >= 12) ? HOUR_PM : 0) | bcd(h ? h : 12);
+}
+
+// Alarm registers against the time registers; mask bit set = don't care
+static uint8_t rtc_AlarmMatch(const uint8_t *a, uint8_t has_sec)
+{
+	const uint8_t *t = ds3231m.reg;
+	uint8_t d;
+	if(has_sec){
+		if(!(a[0] & ALARM_MASK) && (a[0] & 0x7f) != t[REG_SEC]) return 0;
+		a++;
+	} else if(t[REG_SEC] != 0) return 0;
+	if(!(a[0] & ALARM_MASK) && (a[0] & 0x7f) != t[REG_MIN]) return 0;
+	if(!(a[1] & ALARM_MASK) && rtc_Hour24(a[1]) != rtc_Hour24(t[REG_HOUR])) return 0;
+	if(!(a[2] & ALARM_MASK)){
+		d = (a[2] & ALARM_DYDT) ? t[REG_DAY] : t[REG_DATE];
+		if((a[2] & 0x3f) != d) return 0;
+	}
+	return 1;
+}
+
+// One second of the countdown chain
+static void rtc_Second(void)
+{
+	uint8_t *r = ds3231m.reg;
+	uint8_t s = dec(r[REG_SEC]), m = dec(r[REG_MIN]), h = rtc_Hour24(r[REG_HOUR]);
+	uint8_t day = r[REG_DAY] & 7, date = dec(r[REG_DATE] & 0x3f);
+	uint8_t month = dec(r[REG_MONTH] & 0x1f), year = dec(r[REG_YEAR]);
+	uint8_t cent = r[REG_MONTH] & MONTH_CENT;
+
+	if(++s == 60){
+		s = 0;
+		if(++m == 60){
+			m = 0;
+			if(++h == 24){
+				h = 0;
+				day = (day % 7) + 1;
+				if(++date > rtc_DaysIn(month, year)){
+					date = 1;
+					if(++month > 12){
+						month = 1;
+						if(++year == 100){
+							year = 0;
+							cent ^= MONTH_CENT;
+						}
+					}
+				}
+			}
+		}
+	}
+	r[REG_SEC] = bcd(s);
+	r[REG_MIN] = bcd(m);
+	r[REG_HOUR] = rtc_HourReg(h, r[REG_HOUR]);
+	r[REG_DAY] = day;
+	r[REG_DATE] = bcd(date);
+	r[REG_MONTH] = cent | bcd(month);
+	r[REG_YEAR] = bcd(year);
+
+	if(rtc_AlarmMatch(&r[REG_A1SEC], 1)) r[REG_STAT] |= STAT_A1F;
+	if(rtc_AlarmMatch(&r[REG_A2MIN], 0)) r[REG_STAT] |= STAT_A2F;
+	if(--ds3231m.conv_s == 0) rtc_Convert();
+}
+
+static void rtc_Sync(void)
+{
+	while(sim_ms - ds3231m.sec_ms >= 1000){
+		ds3231m.sec_ms += 1000;
+		rtc_Second();
+	}
+}
+
+void ds3231m_Reset(void)
+{
+	uint32_t byte_us = ds3231m.byte_us, stretch_us = ds3231m.stretch_us, nack = ds3231m.nack_every;
+	memset(&ds3231m, 0, sizeof(ds3231m));
+	ds3231m.byte_us = byte_us;
+	ds3231m.stretch_us = stretch_us;
+	ds3231m.nack_every = nack;
+	ds3231m.reg[REG_DAY] = 1;
+	ds3231m.reg[REG_DATE] = 1;
+	ds3231m.reg[REG_MONTH] = 1;
+	ds3231m.reg[REG_CTRL] = 0x1C;			// RS2, RS1, INTCN
+	ds3231m.reg[REG_STAT] = STAT_OSF | STAT_EN32K;
+	ds3231m.temp_q = 25*4;
+	ds3231m.sec_ms = sim_ms;
+	rtc_Convert();
+}
+
+// Bus side: NACK injection and the time the chip holds the bus
+static int rtc_Transfer(uint16_t n)
+{
+	ds3231m.xfers++;
+	if(ds3231m.nack_every && ds3231m.xfers % ds3231m.nack_every == 0) return -1;
+	sim_I2cStall(ds3231m.stretch_us + n*ds3231m.byte_us);
+	rtc_Sync();
+	return 0;
+}
+
+static int rtc_Read(void *ctx, uint16_t reg, uint8_t *buf, uint16_t n)
+{
+	if(rtc_Transfer(n) != 0) return -1;
+	while(n--){
+		*buf++ = (reg < DS3231M_NREGS) ? ds3231m.reg[reg] : 0xff;
+		reg = (reg + 1) % DS3231M_NREGS;	// the pointer wraps after 0x12
+	}
+	return 0;
+}
+
+static int rtc_Write(void *ctx, uint16_t reg, const uint8_t *buf, uint16_t n)
+{
+	uint8_t v;
+	if(rtc_Transfer(n) != 0) return -1;
+	while(n--){
+		v = *buf++;
+		switch(reg){
+		case REG_SEC:
+			// Writing seconds restarts the 1Hz countdown
+			ds3231m.sec_ms = sim_ms;
+			ds3231m.reg[reg] = v & 0x7f;
+			break;
+		case REG_STAT:
+			// OSF, A2F and A1F can only be cleared; BSY is read-only
+			ds3231m.reg[reg] = (ds3231m.reg[reg] & v & (STAT_OSF | STAT_A2F | STAT_A1F))
+					| (v & STAT_EN32K) | (ds3231m.reg[reg] & STAT_BSY);
+			break;
+		case REG_CTRL:
+			ds3231m.reg[reg] = v;
+			if(v & CTRL_CONV) rtc_Convert();
+			break;
+		case REG_TMSB:
+		case REG_TLSB:
+			break;
+		default:
+			if(reg < DS3231M_NREGS) ds3231m.reg[reg] = v;
+			break;
+		}
+		reg = (reg + 1) % DS3231M_NREGS;
+	}
+	return 0;
+}
+
+const sim_I2cDev_t ds3231m_dev = { rtc_Read, rtc_Write, NULL };
+
+int ds3231m_Config(const char *spec)
+{
+	char key[16];
+	unsigned a, b, c;
+	double t;
+	int len;
+	while(*spec){
+		if(sscanf(spec, "%15[^=]=%n", key, &len) != 1) return -1;
+		spec += len;
+		if(strcmp(key, "time") == 0 && sscanf(spec, "%u:%u:%u", &a, &b, &c) == 3){
+			ds3231m.reg[REG_HOUR] = bcd(a % 24);
+			ds3231m.reg[REG_MIN] = bcd(b % 60);
+			ds3231m.reg[REG_SEC] = bcd(c % 60);
+			ds3231m.sec_ms = sim_ms;
+		} else if(strcmp(key, "date") == 0 && sscanf(spec, "%u-%u-%u", &a, &b, &c) == 3){
+			ds3231m.reg[REG_YEAR] = bcd(a % 100);
+			ds3231m.reg[REG_MONTH] = bcd(b);
+			ds3231m.reg[REG_DATE] = bcd(c);
+		} else if(strcmp(key, "day") == 0 && sscanf(spec, "%u", &a) == 1 && a >= 1 && a <= 7){
+			ds3231m.reg[REG_DAY] = a;
+		} else if(strcmp(key, "temp") == 0 && sscanf(spec, "%lf", &t) == 1){
+			ds3231m.temp_q = (int16_t)(t*4);
+			rtc_Convert();
+		} else if(strcmp(key, "byte_us") == 0 && sscanf(spec, "%u", &a) == 1){
+			ds3231m.byte_us = a;
+		} else if(strcmp(key, "stretch_us") == 0 && sscanf(spec, "%u", &a) == 1){
+			ds3231m.stretch_us = a;
+		} else if(strcmp(key, "nack") == 0 && sscanf(spec, "%u", &a) == 1){
+			ds3231m.nack_every = a;
+		} else if(strcmp(key, "hz") == 0 && sscanf(spec, "%u", &a) == 1 && a > 0){
+			sim_i2c_hz = a;
+		} else return -1;
+		spec += strcspn(spec, ",");
+		if(*spec == ',') spec++;
+	}
+	return 0;
+}
+
+uint8_t ds3231m_IntPin(void)
+{
+	const uint8_t *r = ds3231m.reg;
+	rtc_Sync();
+	if(!(r[REG_CTRL] & CTRL_INTCN)) return (sim_ms - ds3231m.sec_ms) < 500;	// 1Hz, RS=00
+	if((r[REG_STAT] & STAT_A1F) && (r[REG_CTRL] & CTRL_A1IE)) return 0;
+	if((r[REG_STAT] & STAT_A2F) && (r[REG_CTRL] & CTRL_A2IE)) return 0;
+	return 1;
+}
@@ -0,0 +1,42 @@
+/*
+ * ds3231_model.h
+ *
+ *  Software DS3231 behind the I2C stand-in in hal_sim.c
+ */
+
+#ifndef HOST_SIM_DS3231_MODEL_H_
+#define HOST_SIM_DS3231_MODEL_H_
+
+#include "hal_sim.h"
+
+#define DS3231M_ADDR		(0x68 << 1)
+#define DS3231M_NREGS		0x13
+
+typedef struct {
+	uint8_t reg[DS3231M_NREGS];	// 0x00..0x12 as the chip has them
+	uint32_t sec_ms;			// sim_ms of the last 1Hz tick
+	uint32_t conv_s;			// seconds to the next temperature conversion
+	int16_t temp_q;				// die temperature in 1/4 degC
+	// Bus behaviour
+	uint32_t byte_us;			// extra time per data byte
+	uint32_t stretch_us;		// SCL held low once per transfer
+	uint32_t nack_every;		// every Nth transfer is NACKed, 0 = never
+	uint32_t xfers;
+} ds3231m_t;
+
+extern ds3231m_t ds3231m;
+extern const sim_I2cDev_t ds3231m_dev;
+
+// Power-on state: 00:00:00 Mon 01/01/00, OSF set, INTCN set
+void ds3231m_Reset(void);
+
+// Comma-separated key=value list:
+//   time=HH:MM:SS date=YY-MM-DD day=1..7 temp=degC
+//   byte_us=N stretch_us=N nack=N (every Nth transfer) hz=SCL rate
+// 0 on success
+int ds3231m_Config(const char *spec);
+
+// INT/SQW pin, 0 = asserted (alarm with INTCN=1) or the low half of 1Hz
+uint8_t ds3231m_IntPin(void);
+
+#endif /* HOST_SIM_DS3231_MODEL_H_ */
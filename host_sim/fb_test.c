@@ -0,0 +1,101 @@
+/*
+ * fb_test.c
+ *
+ *  Checks for the SRAM frame store of Bai5_UART (LCD_USE_FRAMEBUFFER=1):
+ *  flushes run one DMA chunk at a time (lcd_fb_async), the test plays the
+ *  transfer complete interrupts, some of them in the middle of a drawing
+ *  primitive, and after the next lcd_Display() the ILI9341 model's GRAM
+ *  has to match the frame store pixel for pixel. Prints one line per check,
+ *  exits 1 if any failed.
+ */
+
+#include "sim.h"
+#include "lcd.h"
+#include <stdlib.h>
+
+static uint8_t failed = 0;
+static uint32_t irq_after;			// pixels until the hook plays the interrupt, 0 = off
+
+static void check(uint8_t ok, const char *what)
+{
+	printf("%s  %s\n", ok ? "ok  " : "FAIL", what);
+	if(!ok) failed = 1;
+}
+
+// The DMA finishing its chunk while a primitive is writing pixels
+static void fb_Pixel(void)
+{
+	if(irq_after && --irq_after == 0) lcd_FbDmaIrq();
+}
+
+static void fb_Drain(void)
+{
+	while(lcd_DisplayBusy()) lcd_FbDmaIrq();
+}
+
+// Pixels where the panel and the frame store differ
+static uint32_t fb_Diff(void)
+{
+	const uint16_t *gram = ili9341_Gram();
+	uint32_t n = 0;
+	uint16_t x, y;
+	for(y = 0; y < ILI9341_H; y++){
+		for(x = 0; x < ILI9341_W; x++){
+			if(gram[y*ILI9341_W + x] != lcd_ReadPoint(x, y)) n++;
+		}
+	}
+	return n;
+}
+
+static void fb_Same(const char *what)
+{
+	char line[96];
+	uint32_t n = fb_Diff();
+	snprintf(line, sizeof(line), "%s (%u pixels differ)", what, n);
+	check(n == 0, line);
+}
+
+// Rows the running flush has not reached yet are drawn into; the interrupt
+// comes after 'after' pixels of that drawing
+static void test_DrawDuringFlush(uint16_t y, uint16_t fill_y, uint32_t after, const char *what)
+{
+	lcd_Fill(0, 0, 240, 10, RED);			// first chunk, on the bus
+	lcd_Fill(0, y, 240, y + 10, GREEN);
+	lcd_Display();
+	check(lcd_DisplayBusy(), "flush still running after lcd_Display()");
+	irq_after = after;
+	lcd_Fill(0, fill_y, 240, fill_y + 10, BLUE);
+	irq_after = 0;
+	fb_Drain();
+	lcd_Display();
+	fb_Drain();
+	fb_Same(what);
+}
+
+int main(int argc, char **argv)
+{
+	sim_Init(argc, argv, "fb_test");
+
+	lcd_init();
+	lcd_Clear(BLACK);
+	lcd_Display();
+	fb_Same("synchronous flush");
+
+	lcd_fb_async = 1;
+	lcd_fb_pixel_hook = fb_Pixel;
+	test_DrawDuringFlush(200, 100, 50, "rows outside the running flush, drawn across its interrupt");
+	test_DrawDuringFlush(100, 100, 50, "rows queued in the running flush, drawn across its interrupt");
+	test_DrawDuringFlush(100, 100, 1, "rows queued in the running flush, interrupt at the first pixel");
+
+	// Drawing right after lcd_Display() returns, all chunks still to come
+	lcd_Fill(0, 0, 240, 320, WHITE);
+	lcd_Display();
+	lcd_ShowStr(10, 150, "frame store", BLACK, WHITE, 24, 0);
+	fb_Drain();
+	lcd_Display();
+	fb_Drain();
+	fb_Same("text drawn over a whole-frame flush");
+
+	printf("fb_test: %s\n", failed ? "FAILED" : "ok");
+	return failed;
+}
@@ -0,0 +1,260 @@
+/*
+ * fsmc_model.c
+ *
+ *  Timing model for the LCD on FSMC bank 1
+ *
+ *  The timing fields are read from the CubeMX sources rather than copied,
+ *  so a change to MX_FSMC_Init() or SystemClock_Config() shows up in the
+ *  prediction without touching the simulator. Mode A access lengths
+ *  (RM0090, NOR/SRAM controller):
+ *
+ *    read  = ADDSET + DATAST     + BUSTURN  HCLK
+ *    write = ADDSET + DATAST + 1 + BUSTURN  HCLK
+ *
+ *  With ExtendedMode the write fields come from ExtTiming (BWTR). The
+ *  result is bus time only: it is a lower bound that assumes the core
+ *  keeps the FSMC busy, so CPU-bound primitives (glyphs, circles) take
+ *  longer on the board. Compare with DWT cycle counts from the target.
+ *
+ *  lcd.c is built with -finstrument-functions; the outermost lcd_*
+ *  function on the stack gets the bus cycles of its call.
+ */
+
+#define _GNU_SOURCE
+#include "fsmc_model.h"
+#include "ili9341.h"
+#include "main.h"
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FSMC_MAX_KEYS		128
+#define FSMC_MAX_PRIMS		64
+#define FSMC_FRAME_US		50000		// one pass of the 50ms main loop
+
+fsmc_Timing_t fsmc_timing;
+
+static struct {
+	char key[64];
+	char val[64];
+} keys[FSMC_MAX_KEYS];
+static int nkeys;
+
+/* Source parsing -------------------------------------------------------------*/
+
+// Collect every "lvalue = value;" line of a C file
+static int fsmc_ReadAssignments(const char *path)
+{
+	char line[256], *p;
+	FILE *f = fopen(path, "r");
+	if(f == NULL){
+		perror(path);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), f) != NULL && nkeys < FSMC_MAX_KEYS){
+		for(p = line; *p == ' ' || *p == '\t'; p++);
+		if(sscanf(p, "%63[A-Za-z0-9_.] = %63[^;];", keys[nkeys].key, keys[nkeys].val) == 2) nkeys++;
+	}
+	fclose(f);
+	return 0;
+}
+
+static const char *fsmc_Get(const char *key)
+{
+	int i;
+	for(i = nkeys - 1; i >= 0; i--){
+		if(strcmp(keys[i].key, key) == 0) return keys[i].val;
+	}
+	return NULL;
+}
+
+// Plain numbers, or the number at the end of a HAL constant (RCC_PLLP_DIV2)
+static long fsmc_Num(const char *key, long def)
+{
+	const char *v = fsmc_Get(key), *p;
+	char *end;
+	long n;
+	if(v == NULL) return def;
+	n = strtol(v, &end, 0);
+	if(end != v) return n;
+	for(p = v + strlen(v); p > v && p[-1] >= '0' && p[-1] <= '9'; p--);
+	return (*p != '\0') ? strtol(p, NULL, 10) : def;
+}
+
+static int fsmc_Is(const char *key, const char *val)
+{
+	const char *v = fsmc_Get(key);
+	return v != NULL && strcmp(v, val) == 0;
+}
+
+int fsmc_Load(const char *fsmc_c, const char *main_c)
+{
+	uint32_t src, sysclk;
+	nkeys = 0;
+	if(fsmc_ReadAssignments(fsmc_c) != 0 || fsmc_ReadAssignments(main_c) != 0) return -1;
+
+	src = fsmc_Is("RCC_OscInitStruct.PLL.PLLSource", "RCC_PLLSOURCE_HSE") ? HSE_VALUE : HSI_VALUE;
+	if(fsmc_Is("RCC_ClkInitStruct.SYSCLKSource", "RCC_SYSCLKSOURCE_PLLCLK")){
+		sysclk = (uint64_t)src * fsmc_Num("RCC_OscInitStruct.PLL.PLLN", 0)
+				/ fsmc_Num("RCC_OscInitStruct.PLL.PLLM", 1)
+				/ fsmc_Num("RCC_OscInitStruct.PLL.PLLP", 2);
+	} else if(fsmc_Is("RCC_ClkInitStruct.SYSCLKSource", "RCC_SYSCLKSOURCE_HSE")){
+		sysclk = HSE_VALUE;
+	} else {
+		sysclk = HSI_VALUE;
+	}
+	fsmc_timing.hclk = sysclk / fsmc_Num("RCC_ClkInitStruct.AHBCLKDivider", 1);
+
+	fsmc_timing.extended = fsmc_Is("hsram1.Init.ExtendedMode", "FSMC_EXTENDED_MODE_ENABLE");
+	fsmc_timing.rd_addset = fsmc_Num("Timing.AddressSetupTime", 15);
+	fsmc_timing.rd_datast = fsmc_Num("Timing.DataSetupTime", 255);
+	fsmc_timing.rd_busturn = fsmc_Num("Timing.BusTurnAroundDuration", 15);
+	if(fsmc_timing.extended){
+		fsmc_timing.wr_addset = fsmc_Num("ExtTiming.AddressSetupTime", 15);
+		fsmc_timing.wr_datast = fsmc_Num("ExtTiming.DataSetupTime", 255);
+		fsmc_timing.wr_busturn = fsmc_Num("ExtTiming.BusTurnAroundDuration", 15);
+	} else {
+		fsmc_timing.wr_addset = fsmc_timing.rd_addset;
+		fsmc_timing.wr_datast = fsmc_timing.rd_datast;
+		fsmc_timing.wr_busturn = fsmc_timing.rd_busturn;
+	}
+	if(fsmc_timing.hclk == 0){
+		fprintf(stderr, "%s: no HCLK in SystemClock_Config\n", main_c);
+		return -1;
+	}
+	return 0;
+}
+
+int fsmc_SetWrite(const char *spec)
+{
+	unsigned a, d, b = 0;
+	if(sscanf(spec, "%u:%u:%u", &a, &d, &b) < 2 || a > 15 || d < 1 || d > 255 || b > 15) return -1;
+	fsmc_timing.wr_addset = a;
+	fsmc_timing.wr_datast = d;
+	fsmc_timing.wr_busturn = b;
+	return 0;
+}
+
+uint32_t fsmc_WriteHclk(void)
+{
+	return fsmc_timing.wr_addset + fsmc_timing.wr_datast + 1 + fsmc_timing.wr_busturn;
+}
+
+uint32_t fsmc_ReadHclk(void)
+{
+	return fsmc_timing.rd_addset + fsmc_timing.rd_datast + fsmc_timing.rd_busturn;
+}
+
+// Bus time in ns of a number of writes and reads
+static double fsmc_Ns(uint64_t writes, uint64_t reads)
+{
+	return (writes * fsmc_WriteHclk() + reads * fsmc_ReadHclk()) * 1e9 / fsmc_timing.hclk;
+}
+
+/* Frames ---------------------------------------------------------------------*/
+
+static struct {
+	uint32_t count, over;
+	double sum_ns, max_ns;
+	uint32_t max_at;
+	ili9341_Stats_t last;
+} frames;
+
+extern uint32_t sim_ms;
+
+void fsmc_Start(void)
+{
+	memset(&frames, 0, sizeof(frames));
+	frames.last = ili9341_stats;
+}
+
+void fsmc_EndFrame(void)
+{
+	double ns = fsmc_Ns((ili9341_stats.reg_writes - frames.last.reg_writes)
+			+ (ili9341_stats.data_writes - frames.last.data_writes),
+			ili9341_stats.data_reads - frames.last.data_reads);
+	frames.last = ili9341_stats;
+	frames.count++;
+	frames.sum_ns += ns;
+	if(ns > frames.max_ns){
+		frames.max_ns = ns;
+		frames.max_at = sim_ms;
+	}
+	if(ns > FSMC_FRAME_US*1e3) frames.over++;
+}
+
+/* Primitives -----------------------------------------------------------------*/
+
+typedef struct {
+	void *fn;
+	uint32_t calls;
+	uint64_t writes, reads;
+} fsmc_Prim_t;
+
+static fsmc_Prim_t prims[FSMC_MAX_PRIMS];
+static int nprims;
+
+static int depth;
+static void *cur_fn;
+static ili9341_Stats_t cur_start;
+
+void __cyg_profile_func_enter(void *fn, void *site) __attribute__((no_instrument_function));
+void __cyg_profile_func_exit(void *fn, void *site) __attribute__((no_instrument_function));
+
+void __cyg_profile_func_enter(void *fn, void *site)
+{
+	if(depth++ > 0) return;
+	cur_fn = fn;
+	cur_start = ili9341_stats;
+}
+
+void __cyg_profile_func_exit(void *fn, void *site)
+{
+	int i;
+	if(--depth > 0) return;
+	for(i = 0; i < nprims && prims[i].fn != cur_fn; i++);
+	if(i == nprims){
+		if(nprims == FSMC_MAX_PRIMS) return;
+		prims[nprims++].fn = cur_fn;
+	}
+	prims[i].calls++;
+	prims[i].writes += (ili9341_stats.reg_writes - cur_start.reg_writes)
+			+ (ili9341_stats.data_writes - cur_start.data_writes);
+	prims[i].reads += ili9341_stats.data_reads - cur_start.data_reads;
+}
+
+static int fsmc_PrimCmp(const void *a, const void *b)
+{
+	const fsmc_Prim_t *pa = a, *pb = b;
+	double ta = fsmc_Ns(pa->writes, pa->reads);
+	double tb = fsmc_Ns(pb->writes, pb->reads);
+	return (ta < tb) - (ta > tb);
+}
+
+void fsmc_Report(FILE *out)
+{
+	Dl_info info;
+	double ns;
+	int i;
+	fprintf(out, "fsmc: HCLK %.1f MHz%s\n", fsmc_timing.hclk / 1e6,
+			fsmc_timing.extended ? ", extended mode" : "");
+	fprintf(out, "fsmc: write %u+%u+1+%u = %u HCLK (%.1f ns), read %u+%u+%u = %u HCLK (%.1f ns)\n",
+			fsmc_timing.wr_addset, fsmc_timing.wr_datast, fsmc_timing.wr_busturn, fsmc_WriteHclk(),
+			fsmc_Ns(1, 0), fsmc_timing.rd_addset, fsmc_timing.rd_datast, fsmc_timing.rd_busturn,
+			fsmc_ReadHclk(), fsmc_Ns(0, 1));
+	if(frames.count){
+		fprintf(out, "frames: %u, bus time avg %.1f us, max %.1f us (at %u ms), over %u ms: %u\n",
+				frames.count, frames.sum_ns / frames.count / 1e3, frames.max_ns / 1e3,
+				frames.max_at, FSMC_FRAME_US / 1000, frames.over);
+	}
+	qsort(prims, nprims, sizeof(prims[0]), fsmc_PrimCmp);
+	fprintf(out, "%-20s %8s %10s %6s %12s %10s\n", "primitive", "calls", "writes", "reads", "total us", "us/call");
+	for(i = 0; i < nprims; i++){
+		if(prims[i].writes == 0 && prims[i].reads == 0) continue;
+		ns = fsmc_Ns(prims[i].writes, prims[i].reads);
+		fprintf(out, "%-20s %8u %10llu %6llu %12.1f %10.2f\n",
+				(dladdr(prims[i].fn, &info) && info.dli_sname) ? info.dli_sname : "?",
+				prims[i].calls, (unsigned long long)prims[i].writes,
+				(unsigned long long)prims[i].reads, ns / 1e3, ns / 1e3 / prims[i].calls);
+	}
+}
@@ -0,0 +1,40 @@
+/*
+ * fsmc_model.h
+ *
+ *  Timing model for the LCD on FSMC bank 1: turns the ILI9341 bus counts
+ *  into predicted time per frame and per lcd_ primitive
+ */
+
+#ifndef HOST_SIM_FSMC_MODEL_H_
+#define HOST_SIM_FSMC_MODEL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct {
+	uint32_t hclk;				// Hz
+	uint8_t extended;			// writes use the ExtTiming (BWTR) fields
+	uint8_t rd_addset, rd_datast, rd_busturn;
+	uint8_t wr_addset, wr_datast, wr_busturn;
+} fsmc_Timing_t;
+
+extern fsmc_Timing_t fsmc_timing;
+
+// Read the FSMC fields from MX_FSMC_Init() in fsmc_c and HCLK from
+// SystemClock_Config() in main_c. 0 on success.
+int fsmc_Load(const char *fsmc_c, const char *main_c);
+
+// Override the write timing, "ADDSET:DATAST[:BUSTURN]". 0 on success.
+int fsmc_SetWrite(const char *spec);
+
+// HCLK cycles of one bus write / read
+uint32_t fsmc_WriteHclk(void);
+uint32_t fsmc_ReadHclk(void);
+
+// Start counting; frames end at every fsmc_EndFrame()
+void fsmc_Start(void);
+void fsmc_EndFrame(void);
+
+void fsmc_Report(FILE *out);
+
+#endif /* HOST_SIM_FSMC_MODEL_H_ */
@@ -0,0 +1,469 @@
+/*
+ * hal_sim.c
+ *
+ *  Host stand-ins for the HAL calls the application code makes
+ *
+ *  The real HAL headers are used for the types, only the functions are
+ *  replaced. SPI1 answers button_Scan with the keys in sim_keys and keeps
+ *  the last 7-segment word, I2C goes to devices attached with
+ *  sim_I2cAttach and takes as long as the bits on the wire at sim_i2c_hz,
+ *  USART1 writes TX to sim_uart_out and an optional pty and takes RX from
+ *  a wire paced at sim_uart_baud, and TIM2 fires from sim_TickMs: the
+ *  update interrupt every ms, or in the tickless mode the compare channels
+ *  in the ms their CCR is passed.
+ */
+
+#define _GNU_SOURCE				// posix_openpt, ptsname
+#include "hal_sim.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+uint32_t sim_ms = 0;
+uint16_t sim_keys = 0;
+uint16_t sim_led7_word = 0xffff;
+int32_t sim_button_raw = -1;
+uint8_t sim_in_irq = 0;
+void (*sim_irq_exit)(void) = NULL;
+uint32_t SystemCoreClock = 168000000;
+
+static TIM_TypeDef sim_tim1;		// CCR writes from __HAL_TIM_SET_COMPARE land here
+static TIM_TypeDef sim_tim2;		// counter and compares of the tickless mode
+
+TIM_HandleTypeDef htim1 = { .Instance = &sim_tim1 };
+// as MX_TIM2_Init: 1MHz counts in Bai5_UART, 100kHz in Bai3_Lcd_button
+#ifdef HAL_UART_MODULE_ENABLED
+TIM_HandleTypeDef htim2 = { .Instance = &sim_tim2, .Init = { .Prescaler = 84-1, .Period = 1000-1 } };
+#else
+TIM_HandleTypeDef htim2 = { .Instance = &sim_tim2, .Init = { .Prescaler = 840-1, .Period = 100-1 } };
+#endif
+SPI_HandleTypeDef hspi1 = { .Instance = SPI1 };
+SPI_HandleTypeDef hspi2 = { .Instance = SPI2 };
+#ifdef HAL_I2C_MODULE_ENABLED
+I2C_HandleTypeDef hi2c1 = { .Instance = I2C1 };
+#endif
+#ifdef HAL_UART_MODULE_ENABLED
+UART_HandleTypeDef huart1 = { .Instance = USART1, .RxState = HAL_UART_STATE_READY };
+#endif
+
+static uint8_t tim2_running = 0;
+static uint16_t gpio_odr[11];
+
+static void uart_Tick(void);
+static void tim2_Count(void);
+
+/* Core -----------------------------------------------------------------------*/
+
+void sim_TickMs(void)
+{
+	sim_ms++;
+	sim_in_irq = 1;
+	uart_Tick();
+	if(tim2_running) HAL_TIM_PeriodElapsedCallback(&htim2);
+	tim2_Count();
+	sim_in_irq = 0;
+	if(sim_irq_exit != NULL) sim_irq_exit();
+}
+
+uint32_t HAL_GetTick(void)
+{
+	return sim_ms;
+}
+
+static uint32_t frac_us = 0;
+
+void sim_BusyUs(uint32_t us)
+{
+	frac_us += us;
+	while(frac_us >= 1000){
+		frac_us -= 1000;
+		sim_TickMs();
+	}
+}
+
+uint32_t sim_SubMsUs(void)
+{
+	return frac_us;
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+	// HAL_Delay waits at least one extra tick
+	Delay++;
+	while(Delay--) sim_TickMs();
+}
+
+void Error_Handler(void)
+{
+	fprintf(stderr, "Error_Handler at %u ms\n", sim_ms);
+	abort();
+}
+
+/* GPIO -----------------------------------------------------------------------*/
+
+static uint16_t *gpio_Port(GPIO_TypeDef *port)
+{
+	uint32_t i = ((uintptr_t)port - GPIOA_BASE) / (GPIOB_BASE - GPIOA_BASE);
+	return (i < 11) ? &gpio_odr[i] : &gpio_odr[0];
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+	if(PinState != GPIO_PIN_RESET) *gpio_Port(GPIOx) |= GPIO_Pin;
+	else *gpio_Port(GPIOx) &= ~GPIO_Pin;
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+	return (*gpio_Port(GPIOx) & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+	*gpio_Port(GPIOx) ^= GPIO_Pin;
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init)
+{
+}
+
+/* TIM ------------------------------------------------------------------------*/
+
+HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef *htim)
+{
+	htim->Instance->PSC = htim->Init.Prescaler;
+	htim->Instance->ARR = htim->Init.Period;
+	htim->Instance->CNT = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_OC_Start_IT(TIM_HandleTypeDef *htim, uint32_t Channel)
+{
+	htim->Instance->DIER |= TIM_DIER_CC1IE << (Channel/4);		// and counts from here on
+	return HAL_OK;
+}
+
+__weak void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim)
+{
+}
+
+static void tim2_Compare(HAL_TIM_ActiveChannel ch)
+{
+	htim2.Channel = ch;
+	HAL_TIM_OC_DelayElapsedCallback(&htim2);
+	htim2.Channel = HAL_TIM_ACTIVE_CHANNEL_CLEARED;
+}
+
+// The counter runs at 84MHz/(PSC+1) up to ARR (all 32 bits when tickless);
+// a compare channel with its interrupt on fires in the ms that passes its
+// CCR, and one set behind the counter waits for the wrap as on the chip
+static void tim2_Count(void)
+{
+	uint32_t from = sim_tim2.CNT, n;
+	if(!(sim_tim2.DIER & (TIM_DIER_CC1IE | TIM_DIER_CC2IE | TIM_DIER_CC3IE))) return;
+	n = 84000/(sim_tim2.PSC + 1);
+	sim_tim2.CNT = (sim_tim2.ARR == 0xFFFFFFFF) ? from + n : (from + n)%(sim_tim2.ARR + 1);
+	if((sim_tim2.DIER & TIM_DIER_CC1IE) && sim_tim2.CCR1 - from - 1 < n) tim2_Compare(HAL_TIM_ACTIVE_CHANNEL_1);
+	if((sim_tim2.DIER & TIM_DIER_CC2IE) && sim_tim2.CCR2 - from - 1 < n) tim2_Compare(HAL_TIM_ACTIVE_CHANNEL_2);
+	if((sim_tim2.DIER & TIM_DIER_CC3IE) && sim_tim2.CCR3 - from - 1 < n) tim2_Compare(HAL_TIM_ACTIVE_CHANNEL_3);
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef *htim)
+{
+	if(htim == &htim2) tim2_running = 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef *htim, uint32_t Channel)
+{
+	return HAL_OK;
+}
+
+/* SPI ------------------------------------------------------------------------*/
+
+// Inverse of the bit order button_Scan() decodes: bit 15-i is button map[i]
+static uint16_t spi_ButtonWord(uint16_t keys)
+{
+	static const uint8_t map[16] = {4, 5, 6, 7, 3, 2, 1, 0, 12, 13, 14, 15, 11, 10, 9, 8};
+	uint16_t word = 0xffff;
+	uint8_t i;
+	for(i = 0; i < 16; i++){
+		if(keys & (1 << map[i])) word &= ~(0x8000 >> i);
+	}
+	return word;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	uint16_t word = (sim_button_raw >= 0) ? sim_button_raw : spi_ButtonWord(sim_keys);
+	if(hspi == &hspi1 && Size == 2) memcpy(pData, &word, 2);
+	else memset(pData, 0xff, Size);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	if(hspi == &hspi1 && Size == 2) memcpy(&sim_led7_word, pData, 2);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout)
+{
+	memset(pRxData, 0, Size);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size)
+{
+	memset(pRxData, 0, Size);
+	HAL_SPI_TxRxCpltCallback(hspi);
+	return HAL_OK;
+}
+
+__weak void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+}
+
+/* I2C ------------------------------------------------------------------------*/
+
+#define I2C_MAX_DEVS	4
+
+static struct {
+	uint16_t addr;
+	const sim_I2cDev_t *dev;
+} i2c_devs[I2C_MAX_DEVS];
+
+void sim_I2cAttach(uint16_t addr, const sim_I2cDev_t *dev)
+{
+	uint8_t i;
+	for(i = 0; i < I2C_MAX_DEVS; i++){
+		if(i2c_devs[i].dev == NULL || i2c_devs[i].addr == addr){
+			i2c_devs[i].addr = addr;
+			i2c_devs[i].dev = dev;
+			return;
+		}
+	}
+}
+
+static const sim_I2cDev_t *i2c_Find(uint16_t addr)
+{
+	uint8_t i;
+	for(i = 0; i < I2C_MAX_DEVS; i++){
+		if(i2c_devs[i].dev != NULL && i2c_devs[i].addr == (addr & 0xfe)) return i2c_devs[i].dev;
+	}
+	return NULL;
+}
+
+static uint8_t i2c_ram[256];
+
+static int i2c_RamRead(void *ctx, uint16_t reg, uint8_t *buf, uint16_t n)
+{
+	while(n--) *buf++ = i2c_ram[reg++ & 0xff];
+	return 0;
+}
+
+static int i2c_RamWrite(void *ctx, uint16_t reg, const uint8_t *buf, uint16_t n)
+{
+	while(n--) i2c_ram[reg++ & 0xff] = *buf++;
+	return 0;
+}
+
+const sim_I2cDev_t sim_i2c_ram = { i2c_RamRead, i2c_RamWrite, NULL };
+
+uint32_t sim_i2c_hz = 100000;
+sim_I2cStats_t sim_i2c_stats;
+
+static uint32_t i2c_stall_us;
+
+void sim_I2cStall(uint32_t us)
+{
+	i2c_stall_us += us;
+}
+
+#ifdef HAL_I2C_MODULE_ENABLED
+// Hold the CPU for a transfer of 'bits' SCL periods plus any stretching,
+// or for the timeout if the device held SCL longer than that
+static HAL_StatusTypeDef i2c_Finish(uint32_t bits, uint32_t Timeout, int nack)
+{
+	uint32_t us = (uint32_t)((uint64_t)bits*1000000/sim_i2c_hz) + i2c_stall_us;
+	HAL_StatusTypeDef ret = nack ? HAL_ERROR : HAL_OK;
+	i2c_stall_us = 0;
+	sim_i2c_stats.transactions++;
+	if(nack) sim_i2c_stats.nacks++;
+	if(us > Timeout*1000){
+		us = Timeout*1000;
+		sim_i2c_stats.timeouts++;
+		ret = HAL_TIMEOUT;
+	}
+	sim_i2c_stats.busy_us += us;
+	sim_BusyUs(us);
+	return ret;
+}
+
+HAL_StatusTypeDef HAL_I2C_IsDeviceReady(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint32_t Trials, uint32_t Timeout)
+{
+	// START, address, ACK bit, STOP per trial
+	if(i2c_Find(DevAddress)) return i2c_Finish(11, Timeout, 0);
+	i2c_Finish(11*Trials, Timeout, 1);
+	return HAL_ERROR;
+}
+
+// START, address+W, register, repeated START, address+R, n bytes, STOP
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	const sim_I2cDev_t *dev = i2c_Find(DevAddress);
+	if(dev == NULL || dev->read(dev->ctx, MemAddress, pData, Size) != 0) return i2c_Finish(9 + 2, Timeout, 1);
+	sim_i2c_stats.bytes += Size;
+	return i2c_Finish((3 + Size)*9 + 3, Timeout, 0);
+}
+
+// START, address+W, register, n bytes, STOP
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	const sim_I2cDev_t *dev = i2c_Find(DevAddress);
+	if(dev == NULL || dev->write(dev->ctx, MemAddress, pData, Size) != 0) return i2c_Finish(9 + 2, Timeout, 1);
+	sim_i2c_stats.bytes += Size;
+	return i2c_Finish((2 + Size)*9 + 2, Timeout, 0);
+}
+#endif
+
+/* UART -----------------------------------------------------------------------*/
+
+#define UART_WIRE_SIZE	1024
+
+FILE *sim_uart_out = NULL;
+uint32_t sim_uart_overruns = 0;
+uint32_t sim_uart_baud = 115200;
+void (*sim_uart_tx_hook)(const uint8_t *data, uint16_t n) = NULL;
+
+// Bytes sent to USART1 RX that are still on the wire
+static uint8_t uart_wire[UART_WIRE_SIZE];
+static uint16_t wire_head = 0, wire_tail = 0;
+static uint32_t wire_credit = 0;	// in 1/1000 bit
+static int uart_pty = -1;
+
+const char *sim_UartOpenPty(void)
+{
+	struct termios tio;
+	const char *name;
+	uart_pty = posix_openpt(O_RDWR | O_NOCTTY);
+	if(uart_pty < 0 || grantpt(uart_pty) != 0 || unlockpt(uart_pty) != 0) return NULL;
+	// No echo, no line editing: the firmware sees every byte the tool sends
+	if(tcgetattr(uart_pty, &tio) == 0){
+		cfmakeraw(&tio);
+		tcsetattr(uart_pty, TCSANOW, &tio);
+	}
+	fcntl(uart_pty, F_SETFL, O_NONBLOCK);
+	name = ptsname(uart_pty);
+	return name;
+}
+
+uint16_t sim_UartSend(const uint8_t *data, uint16_t n)
+{
+	uint16_t sent = 0, next;
+	while(sent < n){
+		next = (wire_head + 1) % UART_WIRE_SIZE;
+		if(next == wire_tail) break;
+		uart_wire[wire_head] = data[sent++];
+		wire_head = next;
+	}
+	return sent;
+}
+
+uint16_t sim_UartPending(void)
+{
+	return (wire_head + UART_WIRE_SIZE - wire_tail) % UART_WIRE_SIZE;
+}
+
+// One ms of line time: take what the pty has, deliver baud/10000 bytes
+static void uart_Tick(void)
+{
+	uint8_t buf[64];
+	ssize_t n;
+	uint16_t room;
+	if(uart_pty >= 0){
+		room = UART_WIRE_SIZE - 1 - sim_UartPending();
+		if(room > sizeof(buf)) room = sizeof(buf);
+		if(room > 0 && (n = read(uart_pty, buf, room)) > 0) sim_UartSend(buf, n);
+	}
+	if(wire_head == wire_tail){
+		wire_credit = 0;		// an idle line banks no time
+		return;
+	}
+	wire_credit += sim_uart_baud;
+	while(wire_credit >= 10000 && wire_head != wire_tail){
+		wire_credit -= 10000;	// start + 8 data + stop
+		sim_UartFeed(uart_wire[wire_tail]);
+		wire_tail = (wire_tail + 1) % UART_WIRE_SIZE;
+	}
+}
+
+#ifdef HAL_UART_MODULE_ENABLED
+// Blocks for the frames on the wire, as the polling HAL_UART_Transmit does
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	uint32_t us = (uint32_t)((uint64_t)Size*10*1000000/sim_uart_baud);
+	HAL_StatusTypeDef ret = HAL_OK;
+	if(us > Timeout*1000){
+		// Only what fit in the timeout went out
+		Size = (uint16_t)((uint64_t)Size*Timeout*1000/us);
+		us = Timeout*1000;
+		ret = HAL_TIMEOUT;
+	}
+	sim_BusyUs(us);
+	if(sim_uart_out != NULL){
+		fwrite(pData, 1, Size, sim_uart_out);
+		fflush(sim_uart_out);
+	}
+	if(uart_pty >= 0 && write(uart_pty, pData, Size) < 0){
+		// Nobody has the pty open: the bytes fall off the line
+	}
+	if(sim_uart_tx_hook != NULL) sim_uart_tx_hook(pData, Size);
+	return ret;
+}
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+	if(huart->RxState != HAL_UART_STATE_READY) return HAL_BUSY;
+	huart->pRxBuffPtr = pData;
+	huart->RxXferSize = Size;
+	huart->RxXferCount = Size;
+	huart->RxState = HAL_UART_STATE_BUSY_RX;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortReceive_IT(UART_HandleTypeDef *huart)
+{
+	huart->RxState = HAL_UART_STATE_READY;
+	return HAL_OK;
+}
+
+uint8_t sim_UartRxArmed(void)
+{
+	return huart1.RxState == HAL_UART_STATE_BUSY_RX;
+}
+
+void sim_UartFeed(uint8_t byte)
+{
+	if(!sim_UartRxArmed()){
+		sim_uart_overruns++;
+		return;
+	}
+	*huart1.pRxBuffPtr++ = byte;
+	if(--huart1.RxXferCount == 0){
+		huart1.RxState = HAL_UART_STATE_READY;
+		HAL_UART_RxCpltCallback(&huart1);
+	}
+}
+#else
+uint8_t sim_UartRxArmed(void)
+{
+	return 0;
+}
+
+void sim_UartFeed(uint8_t byte)
+{
+	sim_uart_overruns++;
+}
+#endif
@@ -0,0 +1,91 @@
+/*
+ * hal_sim.h
+ *
+ *  Host stand-ins for the HAL calls the application code makes, and the
+ *  knobs a simulation uses to drive them
+ */
+
+#ifndef HOST_SIM_HAL_SIM_H_
+#define HOST_SIM_HAL_SIM_H_
+
+#include "main.h"
+#include <stdio.h>
+
+// Simulated time in ms, what HAL_GetTick() returns
+extern uint32_t sim_ms;
+
+// Button i held down (same numbering as button_count[])
+extern uint16_t sim_keys;
+
+// Raw SPI1 word for button_Scan, overrides sim_keys when >= 0
+extern int32_t sim_button_raw;
+
+// Last word led7_Scan shifted out on SPI1
+extern uint16_t sim_led7_word;
+
+// Advance time by 1ms and run the TIM2 update interrupt once started
+void sim_TickMs(void);
+
+// 1 while sim_TickMs() runs the interrupt callbacks
+extern uint8_t sim_in_irq;
+
+// Called at the end of every sim_TickMs(), where the interrupts of that ms
+// return: the SysTick and PendSV of the kernel's host port
+extern void (*sim_irq_exit)(void);
+
+// The CPU is stuck in a blocking call for 'us'; ticks as whole ms add up
+void sim_BusyUs(uint32_t us);
+
+// Busy time not yet turned into a tick
+uint32_t sim_SubMsUs(void);
+
+/* I2C: devices answer by 8-bit bus address. Callbacks return 0 on ACK. */
+typedef struct {
+	int (*read)(void *ctx, uint16_t reg, uint8_t *buf, uint16_t n);
+	int (*write)(void *ctx, uint16_t reg, const uint8_t *buf, uint16_t n);
+	void *ctx;
+} sim_I2cDev_t;
+
+void sim_I2cAttach(uint16_t addr, const sim_I2cDev_t *dev);
+
+// A plain 256-byte register file, enough for ds3231.c to start
+extern const sim_I2cDev_t sim_i2c_ram;
+
+// Transfers block for their bits at this SCL rate (hi2c1 runs at 100kHz)
+extern uint32_t sim_i2c_hz;
+
+// Called from a device callback: SCL held low this long on top of the bits
+void sim_I2cStall(uint32_t us);
+
+typedef struct {
+	uint32_t transactions;
+	uint32_t bytes;				// data bytes, register address not included
+	uint32_t nacks;
+	uint32_t timeouts;
+	uint64_t busy_us;			// CPU time spent inside blocking I2C calls
+} sim_I2cStats_t;
+
+extern sim_I2cStats_t sim_i2c_stats;
+
+/* UART (huart1) */
+extern FILE *sim_uart_out;			// TX bytes go here, NULL to drop
+extern uint32_t sim_uart_overruns;	// RX bytes with no receive armed
+extern uint32_t sim_uart_baud;		// line rate for TX blocking and RX pacing, 8N1
+
+// Called with every TX chunk once it has left the wire
+extern void (*sim_uart_tx_hook)(const uint8_t *data, uint16_t n);
+
+// Hand one byte to the RX interrupt now, bypassing the wire
+void sim_UartFeed(uint8_t byte);
+uint8_t sim_UartRxArmed(void);
+
+// Queue bytes on the RX wire; they reach the interrupt at sim_uart_baud.
+// Returns how many fit.
+uint16_t sim_UartSend(const uint8_t *data, uint16_t n);
+uint16_t sim_UartPending(void);
+
+// Also carry USART1 over a pseudo-terminal; returns the slave path
+// (e.g. /dev/pts/3) for a terminal or script, NULL on failure
+const char *sim_UartOpenPty(void);
+
+#endif /* HOST_SIM_HAL_SIM_H_ */
@@ -0,0 +1,228 @@
+/*
+ * ili9341.c
+ *
+ *  Software ILI9341 on the 16-bit FSMC bus, for the host build
+ *
+ *  lcd.c calls ili9341_WriteReg/WriteData/ReadData instead of touching
+ *  LCD->LCD_REG/LCD_RAM when HOST_SIM is defined. The model keeps the
+ *  column/page window (0x2A/0x2B), the GRAM pointer for memory write
+ *  and read (0x2C/0x3C/0x2E), MADCTL (0x36), the ID read (0xD3) and the
+ *  display state commands, and counts bus cycles.
+ */
+
+#include "ili9341.h"
+#include <stdio.h>
+#include <string.h>
+
+#define MADCTL_MY	0x80
+#define MADCTL_MX	0x40
+#define MADCTL_MV	0x20
+
+ili9341_Stats_t ili9341_stats;
+
+static uint16_t gram[ILI9341_W*ILI9341_H];
+
+static struct {
+	uint8_t cmd;
+	uint8_t param[4];
+	uint8_t nparam;
+	uint16_t sc, ec, sp, ep;	// column/page window
+	uint16_t col, page;			// GRAM pointer
+	uint8_t madctl;
+	uint8_t mem_write;			// data words are pixels
+	uint8_t nread;				// reads since the last command
+	uint8_t rd_byte[3];			// 0x2E: bytes of the pixel being read
+	uint8_t rd_left;
+	uint8_t display_on, sleep, partial, idle;
+	uint16_t ptl_sr, ptl_er;
+} lcd;
+
+// Register defaults after power-on or 0x01; GRAM is left alone
+static void lcd_Defaults(void)
+{
+	memset(&lcd, 0, sizeof(lcd));
+	lcd.ec = ILI9341_W - 1;
+	lcd.ep = ILI9341_H - 1;
+	lcd.sleep = 1;
+	lcd.ptl_er = ILI9341_H - 1;
+}
+
+void ili9341_Reset(void)
+{
+	lcd_Defaults();
+	memset(&ili9341_stats, 0, sizeof(ili9341_stats));
+}
+
+// GRAM index of the pointer after MADCTL, or -1 outside the panel
+static int32_t lcd_Index(void)
+{
+	uint16_t x = lcd.col, y = lcd.page;
+	if(lcd.madctl & MADCTL_MV){ x = lcd.page; y = lcd.col; }
+	if(lcd.madctl & MADCTL_MX) x = ILI9341_W - 1 - x;
+	if(lcd.madctl & MADCTL_MY) y = ILI9341_H - 1 - y;
+	if(x >= ILI9341_W || y >= ILI9341_H) return -1;
+	return (int32_t)y*ILI9341_W + x;
+}
+
+static void lcd_Advance(void)
+{
+	if(lcd.col < lcd.ec){
+		lcd.col++;
+		return;
+	}
+	lcd.col = lcd.sc;
+	lcd.page = (lcd.page < lcd.ep) ? lcd.page + 1 : lcd.sp;
+}
+
+void ili9341_WriteReg(uint16_t reg)
+{
+	ili9341_stats.reg_writes++;
+	lcd.cmd = reg & 0xff;
+	lcd.nparam = 0;
+	lcd.nread = 0;
+	lcd.rd_left = 0;
+	lcd.mem_write = 0;
+	switch(lcd.cmd){
+	case 0x01: lcd_Defaults(); break;
+	case 0x10: lcd.sleep = 1; break;
+	case 0x11: lcd.sleep = 0; break;
+	case 0x12: lcd.partial = 1; break;
+	case 0x13: lcd.partial = 0; break;
+	case 0x28: lcd.display_on = 0; break;
+	case 0x29: lcd.display_on = 1; break;
+	case 0x38: lcd.idle = 0; break;
+	case 0x39: lcd.idle = 1; break;
+	case 0x2B: ili9341_stats.windows++; break;
+	case 0x2C:
+	case 0x2E:
+		lcd.col = lcd.sc;
+		lcd.page = lcd.sp;
+		lcd.mem_write = (lcd.cmd == 0x2C);
+		break;
+	case 0x3C: lcd.mem_write = 1; break;
+	}
+}
+
+void ili9341_WriteData(uint16_t data)
+{
+	int32_t i;
+	ili9341_stats.data_writes++;
+	if(lcd.mem_write){
+		ili9341_stats.pixels++;
+		i = lcd_Index();
+		if(i >= 0) gram[i] = data;
+		lcd_Advance();
+		return;
+	}
+	if(lcd.nparam < sizeof(lcd.param)) lcd.param[lcd.nparam] = data & 0xff;
+	lcd.nparam++;
+	switch(lcd.cmd){
+	case 0x2A:
+		if(lcd.nparam == 2) lcd.sc = lcd.param[0] << 8 | lcd.param[1];
+		if(lcd.nparam == 4) lcd.ec = lcd.param[2] << 8 | lcd.param[3];
+		break;
+	case 0x2B:
+		if(lcd.nparam == 2) lcd.sp = lcd.param[0] << 8 | lcd.param[1];
+		if(lcd.nparam == 4) lcd.ep = lcd.param[2] << 8 | lcd.param[3];
+		break;
+	case 0x30:
+		if(lcd.nparam == 2) lcd.ptl_sr = lcd.param[0] << 8 | lcd.param[1];
+		if(lcd.nparam == 4) lcd.ptl_er = lcd.param[2] << 8 | lcd.param[3];
+		break;
+	case 0x36:
+		if(lcd.nparam == 1) lcd.madctl = lcd.param[0];
+		break;
+	}
+}
+
+// 0x2E returns R, G, B bytes per pixel packed two to a 16-bit read
+static uint8_t lcd_ReadByte(void)
+{
+	int32_t i;
+	uint16_t c;
+	if(lcd.rd_left == 0){
+		i = lcd_Index();
+		c = (i >= 0) ? gram[i] : 0;
+		lcd.rd_byte[0] = (c >> 11) << 3;
+		lcd.rd_byte[1] = ((c >> 5) & 0x3f) << 2;
+		lcd.rd_byte[2] = (c & 0x1f) << 3;
+		lcd.rd_left = 3;
+		lcd_Advance();
+	}
+	return lcd.rd_byte[3 - lcd.rd_left--];
+}
+
+uint16_t ili9341_ReadData(void)
+{
+	static const uint8_t id4[4] = {0x00, 0x00, 0x93, 0x41};
+	uint16_t v = 0;
+	ili9341_stats.data_reads++;
+	if(lcd.nread++ == 0) return 0;	// dummy read
+	switch(lcd.cmd){
+	case 0xD3:
+		if(lcd.nread <= 4) v = id4[lcd.nread - 1];
+		break;
+	case 0x2E:
+		v = lcd_ReadByte() << 8;
+		v |= lcd_ReadByte();
+		break;
+	}
+	return v;
+}
+
+const uint16_t *ili9341_Gram(void)
+{
+	return gram;
+}
+
+static uint8_t lcd_RowShown(uint16_t y)
+{
+	if(!lcd.partial) return 1;
+	if(lcd.ptl_sr <= lcd.ptl_er) return y >= lcd.ptl_sr && y <= lcd.ptl_er;
+	return y >= lcd.ptl_sr || y <= lcd.ptl_er;
+}
+
+void ili9341_Render(uint8_t *rgb)
+{
+	uint32_t x, y;
+	uint16_t c;
+	uint8_t r, g, b;
+	for(y = 0; y < ILI9341_H; y++){
+		for(x = 0; x < ILI9341_W; x++){
+			c = gram[y*ILI9341_W + x];
+			r = (c >> 11) << 3;
+			g = ((c >> 5) & 0x3f) << 2;
+			b = (c & 0x1f) << 3;
+			if(!lcd.display_on || lcd.sleep || !lcd_RowShown(y)) r = g = b = 0;
+			else if(lcd.idle){
+				// 8 colours: only the MSB of each channel drives the pixel
+				r = (r & 0x80) ? 0xff : 0;
+				g = (g & 0x80) ? 0xff : 0;
+				b = (b & 0x80) ? 0xff : 0;
+			}
+			*rgb++ = r;
+			*rgb++ = g;
+			*rgb++ = b;
+		}
+	}
+}
+
+int ili9341_DumpPPM(const char *path, int shown)
+{
+	static uint8_t rgb[ILI9341_W*ILI9341_H*3];
+	FILE *f = fopen(path, "wb");
+	uint32_t i;
+	if(f == NULL) return -1;
+	if(shown) ili9341_Render(rgb);
+	else {
+		for(i = 0; i < ILI9341_W*ILI9341_H; i++){
+			rgb[i*3] = (gram[i] >> 11) << 3;
+			rgb[i*3+1] = ((gram[i] >> 5) & 0x3f) << 2;
+			rgb[i*3+2] = (gram[i] & 0x1f) << 3;
+		}
+	}
+	fprintf(f, "P6\n%d %d\n255\n", ILI9341_W, ILI9341_H);
+	fwrite(rgb, 1, sizeof(rgb), f);
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * ili9341.h
+ *
+ *  Software ILI9341 on the 16-bit FSMC bus, for the host build
+ */
+
+#ifndef HOST_SIM_ILI9341_H_
+#define HOST_SIM_ILI9341_H_
+
+#include <stdint.h>
+
+#define ILI9341_W	240
+#define ILI9341_H	320
+
+typedef struct {
+	uint32_t reg_writes;		// command cycles (D/C low)
+	uint32_t data_writes;		// data cycles (D/C high), pixels included
+	uint32_t data_reads;
+	uint32_t windows;			// 0x2A/0x2B pairs, counted on 0x2B
+	uint32_t pixels;			// data words written after 0x2C/0x3C
+} ili9341_Stats_t;
+
+extern ili9341_Stats_t ili9341_stats;
+
+void ili9341_Reset(void);
+void ili9341_WriteReg(uint16_t reg);
+void ili9341_WriteData(uint16_t data);
+uint16_t ili9341_ReadData(void);
+
+// GRAM contents, row-major RGB565, ILI9341_W x ILI9341_H
+const uint16_t *ili9341_Gram(void);
+
+// What the glass shows: partial area, idle colours and display off applied
+void ili9341_Render(uint8_t *rgb);
+
+// 1 = write what the glass shows, 0 = raw GRAM
+int ili9341_DumpPPM(const char *path, int shown);
+
+#endif /* HOST_SIM_ILI9341_H_ */
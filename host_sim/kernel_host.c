@@ -0,0 +1,101 @@
+/*
+ * kernel_host.c
+ *
+ *  Host port of the Bai5 kernel (Core/Src/kernel.c), so the scheduling,
+ *  semaphores and queues run unchanged in clock_sim
+ *
+ *  Each thread is a ucontext with a host-sized stack of its own; the
+ *  K_STACK() arrays are left alone, so the stack column of the report
+ *  means nothing here. A switch pended by a thread happens when it
+ *  unlocks, one pended from an interrupt callback at the end of that
+ *  sim_TickMs(), after k_Tick(), as PendSV tail-chains on the board. The
+ *  idle thread is what moves simulated time on: each k_PortIdle() is one
+ *  sim_Step(), and once the run is over it goes back to k_Start(), which
+ *  returns to main().
+ */
+
+#include "sim.h"
+#include "kernel.h"
+
+#if KERNEL_ENABLE
+
+#include <stdlib.h>
+#include <ucontext.h>
+
+#define HOST_STACK	(256*1024)
+
+static ucontext_t host_ctx[K_MAX_THREADS];
+static ucontext_t host_main;
+static uint8_t host_started = 0;
+static uint8_t host_pend = 0;
+static uint8_t host_locked = 0;
+
+static void host_Entry(void)
+{
+	k_Trampoline(k_cur);
+}
+
+uint32_t *k_PortStack(k_Thread_t *t)
+{
+	ucontext_t *c = &host_ctx[t->prio];
+	getcontext(c);
+	c->uc_stack.ss_sp = malloc(HOST_STACK);
+	c->uc_stack.ss_size = HOST_STACK;
+	c->uc_link = NULL;
+	if(c->uc_stack.ss_sp == NULL) abort();
+	makecontext(c, host_Entry, 0);
+	return t->stack;			// k_Switch() keeps it, nothing reads it
+}
+
+static void host_Switch(void)
+{
+	k_Thread_t *old = k_cur;
+	host_pend = 0;
+	k_Switch(NULL);
+	if(k_cur == old) return;
+	swapcontext((old != NULL) ? &host_ctx[old->prio] : &host_main, &host_ctx[k_cur->prio]);
+}
+
+// SysTick, then the pended switch, as the ms returns from its interrupts
+static void host_IrqExit(void)
+{
+	sim_in_irq = 1;
+	k_Tick();
+	sim_in_irq = 0;
+	if(host_pend && host_started && !host_locked) host_Switch();
+}
+
+void k_PortPend(void)
+{
+	host_pend = 1;
+}
+
+uint32_t k_PortLock(void)
+{
+	uint32_t pm = host_locked;
+	host_locked = 1;
+	return pm;
+}
+
+void k_PortUnlock(uint32_t pm)
+{
+	host_locked = pm;
+	if(!pm && host_pend && host_started && !sim_in_irq) host_Switch();
+}
+
+void k_PortStart(void)
+{
+	sim_irq_exit = host_IrqExit;
+	host_started = 1;
+	host_Switch();				// back here when the idle thread ends the run
+	sim_irq_exit = NULL;
+}
+
+void k_PortIdle(void)
+{
+	if(sim_Step()) return;
+	host_started = 0;
+	setcontext(&host_main);
+}
+
+#endif /* KERNEL_ENABLE */
@@ -0,0 +1,234 @@
+/*
+ * kernel_test.c
+ *
+ *  Checks for the Bai5 kernel (Core/Src/kernel.c) on its host port
+ *  (kernel_host.c): four threads play one scene per PHASE_MS of simulated
+ *  time, marking the order they run in and keeping what the calls
+ *  returned and how long they took; once k_Start() is back they are
+ *  compared with what the kernel promises. Prints one line per check,
+ *  exits 1 if any failed.
+ */
+
+#include "sim.h"
+#include "kernel.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PHASE_MS	100
+#define PHASES		7
+#define P(n, ms)	((n)*PHASE_MS + (ms))		// k_ticks 'ms' into phase n
+
+static uint8_t failed = 0;
+
+static k_Thread_t th_h, th_m, th_l, th_c;
+K_STACK(stack_h, 256);
+K_STACK(stack_m, 256);
+K_STACK(stack_l, 256);
+K_STACK(stack_c, 256);
+
+static k_Sem_t sem_go = K_SEM_INIT(0, 1);		// phase 1: given from a lower priority
+static k_Sem_t sem_none = K_SEM_INIT(0, 1);		// phase 2: timeouts
+static k_Sem_t sem_two = K_SEM_INIT(0, 2);		// phase 5: two waiters
+static uint8_t q_buf[2];
+static k_Queue_t q = K_QUEUE_INIT(q_buf, 1, 2);	// phases 3 and 4
+
+static char seq[PHASES][16];	// thread letters in the order they ran, per phase
+
+// What the calls returned ('ret'), ms they took ('ms'), message taken ('got')
+static struct {
+	int8_t take_ret, take0_ret, take_ok_ret;
+	uint32_t take_ms, take0_ms, take_ok_ms;
+	int8_t put_ret, put_full_ret;
+	uint32_t put_ms, put_full_ms;
+	uint8_t put_got;
+	int8_t get_ret, get_empty_ret;
+	uint32_t get_ms, get_empty_ms;
+	uint8_t get_got;
+	uint32_t waiting;
+	uint32_t until_ms, until_last, late_ms, late_last, next_ms;
+} r;
+
+static void check(uint8_t ok, const char *what)
+{
+	printf("%s  %s\n", ok ? "ok  " : "FAIL", what);
+	if(!ok) failed = 1;
+}
+
+static void mark(char c)
+{
+	char *s = seq[k_ticks/PHASE_MS];
+	size_t n = strlen(s);
+	if(n < sizeof(seq[0]) - 1) s[n] = c;
+}
+
+static void at(uint32_t t)
+{
+	if((int32_t)(t - k_ticks) > 0) k_Sleep(t - k_ticks);
+}
+
+// Priority 1: preempts the giver in phase 1, outranks an earlier waiter in 5
+static void thread_H(void *arg)
+{
+	mark('h');
+	at(P(1, 0));
+	k_SemTake(&sem_go, K_FOREVER);
+	mark('h');
+	at(P(5, 5));
+	k_SemTake(&sem_two, K_FOREVER);
+	mark('h');
+}
+
+// Priority 2: semaphore timeouts, the producer, k_SleepUntil()
+static void thread_M(void *arg)
+{
+	uint32_t t0, last;
+	uint8_t v;
+	mark('m');
+
+	at(P(2, 0));
+	t0 = k_ticks;
+	r.take_ret = k_SemTake(&sem_none, 20);
+	r.take_ms = k_ticks - t0;
+	t0 = k_ticks;
+	r.take0_ret = k_SemTake(&sem_none, 0);
+	r.take0_ms = k_ticks - t0;
+	k_SemGive(&sem_none);
+	t0 = k_ticks;
+	r.take_ok_ret = k_SemTake(&sem_none, 20);
+	r.take_ok_ms = k_ticks - t0;
+
+	at(P(3, 0));
+	v = 1; k_QueuePut(&q, &v, 0);
+	v = 2; k_QueuePut(&q, &v, 0);
+	v = 3;
+	t0 = k_ticks;
+	r.put_ret = k_QueuePut(&q, &v, 50);			// full until L takes one
+	r.put_ms = k_ticks - t0;
+	mark('m');
+	at(P(3, 20));
+	v = 4;
+	t0 = k_ticks;
+	r.put_full_ret = k_QueuePut(&q, &v, 30);	// nobody takes
+	r.put_full_ms = k_ticks - t0;
+
+	at(P(4, 10));
+	v = 7;
+	k_QueuePut(&q, &v, 0);						// L waits on the empty queue
+	mark('m');
+
+	at(P(6, 0));
+	last = k_ticks;
+	k_Sleep(3);
+	k_SleepUntil(&last, 10);
+	r.until_ms = k_ticks - P(6, 0);
+	r.until_last = last - P(6, 0);
+	k_Sleep(25);								// late for the next period
+	t0 = k_ticks;
+	k_SleepUntil(&last, 10);
+	r.late_ms = k_ticks - t0;
+	r.late_last = last - P(6, 0);
+	k_SleepUntil(&last, 10);
+	r.next_ms = k_ticks - P(6, 0);
+}
+
+// Priority 3: gives to H, the consumer, the earlier waiter in phase 5
+static void thread_L(void *arg)
+{
+	uint32_t t0;
+	uint8_t v;
+	mark('l');
+
+	at(P(1, 0));
+	mark('l');
+	k_SemGive(&sem_go);
+	mark('L');
+
+	at(P(3, 5));
+	k_QueueGet(&q, &r.put_got, 0);
+	mark('l');
+
+	at(P(4, 0));
+	k_QueueGet(&q, &v, 0);
+	k_QueueGet(&q, &v, 0);
+	t0 = k_ticks;
+	r.get_ret = k_QueueGet(&q, &r.get_got, K_FOREVER);
+	r.get_ms = k_ticks - t0;
+	mark('l');
+	at(P(4, 50));
+	t0 = k_ticks;
+	r.get_empty_ret = k_QueueGet(&q, &v, 25);
+	r.get_empty_ms = k_ticks - t0;
+
+	at(P(5, 0));
+	k_SemTake(&sem_two, K_FOREVER);
+	mark('l');
+}
+
+// Priority 4: gives sem_two twice with H and L waiting
+static void thread_C(void *arg)
+{
+	mark('c');
+	at(P(5, 10));
+	k_SemGive(&sem_two);
+	r.waiting = sem_two.waiting;
+	k_SemGive(&sem_two);
+}
+
+static void check_Ret(int8_t ret, int8_t want_ret, uint32_t ms, uint32_t want_ms, const char *what)
+{
+	char line[112];
+	snprintf(line, sizeof(line), "%s: %d after %u ms", what, ret, ms);
+	check(ret == want_ret && ms == want_ms, line);
+}
+
+static void check_Seq(uint8_t phase, const char *want, const char *what)
+{
+	char line[112];
+	snprintf(line, sizeof(line), "%s: ran \"%s\"", what, seq[phase]);
+	check(strcmp(seq[phase], want) == 0, line);
+}
+
+int main(int argc, char **argv)
+{
+	char line[112];
+
+	sim_Init(argc, argv, "kernel_test");
+
+	// Created lowest priority first, so the start order is the bitmap's
+	k_Create(&th_c, "c", 4, thread_C, NULL, stack_c, sizeof(stack_c)/4);
+	k_Create(&th_l, "l", 3, thread_L, NULL, stack_l, sizeof(stack_l)/4);
+	k_Create(&th_m, "m", 2, thread_M, NULL, stack_m, sizeof(stack_m)/4);
+	k_Create(&th_h, "h", 1, thread_H, NULL, stack_h, sizeof(stack_h)/4);
+	k_Start();				// returns once the idle thread ends the run
+
+	check_Seq(0, "hmlc", "ready threads start highest priority first");
+	check_Seq(1, "lhL", "k_SemGive() switches to the higher waiter before it returns");
+
+	check_Ret(r.take_ret, -1, r.take_ms, 20, "k_SemTake() on an empty semaphore, 20 ms");
+	check_Ret(r.take0_ret, -1, r.take0_ms, 0, "k_SemTake() on an empty semaphore, 0 ms");
+	check_Ret(r.take_ok_ret, 0, r.take_ok_ms, 0, "k_SemTake() after a give");
+
+	check_Ret(r.put_ret, 0, r.put_ms, 5, "k_QueuePut() on a full queue until a get");
+	check(r.put_got == 1, "the get took the oldest message");
+	check_Seq(3, "ml", "the blocked putter runs before the lower getter goes on");
+	check_Ret(r.put_full_ret, -1, r.put_full_ms, 30, "k_QueuePut() on a full queue, 30 ms");
+	check(q.drops == 1, "the timed out put counted in drops");
+
+	check_Ret(r.get_ret, 0, r.get_ms, 10, "k_QueueGet() on an empty queue until a put");
+	check(r.get_got == 7, "the get took the message put");
+	check_Seq(4, "ml", "the higher putter goes on before the woken getter");
+	check_Ret(r.get_empty_ret, -1, r.get_empty_ms, 25, "k_QueueGet() on an empty queue, 25 ms");
+
+	check_Seq(5, "hl", "k_SemGive() wakes the highest waiter, not the first");
+	check(r.waiting == 1UL << 3, "the lower waiter still waits after one give");
+
+	snprintf(line, sizeof(line), "k_SleepUntil() on time: woke at +%u, last +%u", r.until_ms, r.until_last);
+	check(r.until_ms == 10 && r.until_last == 10, line);
+	snprintf(line, sizeof(line), "k_SleepUntil() late: slept %u ms, last +%u", r.late_ms, r.late_last);
+	check(r.late_ms == 0 && r.late_last == 35, line);
+	snprintf(line, sizeof(line), "k_SleepUntil() after catching up: woke at +%u", r.next_ms);
+	check(r.next_ms == 45, line);
+
+	printf("kernel_test: %s at %u ms\n", failed ? "FAILED" : "ok", sim_ms);
+	return failed;
+}
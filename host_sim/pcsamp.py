@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""Symbolize a PC-sampler dump (Core/Src/pcsamp.c, PCS_ENABLE=1).
+
+    pcsamp.py dump.txt Debug/Bai5_UART.elf
+    pcsamp.py dump.txt Debug/Bai5_UART.map Debug/Bai5_UART.list -n 15
+
+dump.txt is what the board sent after "pcs" on USART1: a "PCS ..." header,
+"<pc> <count>" lines and "END"; other lines around it are skipped. Symbols
+come from the .elf symbol table, the .text.<name> entries of the .map
+(needs -ffunction-sections, the CubeIDE default) or the "<name>:" labels of
+the .list; give any mix. With a .list, -n also prints the hottest PCs with
+the source line and instruction they fall on.
+"""
+
+import argparse
+import bisect
+import re
+import struct
+import sys
+
+
+def read_dump(path):
+    head, samples, inside = None, {}, False
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.strip()
+            if line.startswith("PCS "):
+                head = [int(v) for v in line.split()[1:5]]
+                samples, inside = {}, True      # the last dump in the file wins
+            elif line == "END":
+                inside = False
+            elif inside:
+                pc, n = line.split()
+                samples[int(pc, 16)] = samples.get(int(pc, 16), 0) + int(n)
+    if head is None:
+        sys.exit("%s: no PCS dump" % path)
+    return head, samples
+
+
+def elf_symbols(path):
+    """STT_FUNC symbols from the ELF32 symbol table: (start, size, name)."""
+    data = open(path, "rb").read()
+    if data[:4] != b"\x7fELF" or data[4] != 1:
+        sys.exit("%s: not an ELF32 file" % path)
+    shoff, = struct.unpack_from("<I", data, 0x20)
+    shentsize, shnum = struct.unpack_from("<HH", data, 0x2E)
+    sections = [struct.unpack_from("<IIIIIIIIII", data, shoff + i * shentsize)
+                for i in range(shnum)]
+    out = []
+    for sh in sections:
+        if sh[1] != 2:                          # SHT_SYMTAB
+            continue
+        strtab = sections[sh[6]]
+        for off in range(sh[4], sh[4] + sh[5], 16):
+            name, value, size, info, _, _ = struct.unpack_from("<IIIBBH", data, off)
+            if info & 0xF != 2:                 # STT_FUNC
+                continue
+            end = data.index(b"\0", strtab[4] + name)
+            out.append((value & ~1, size, data[strtab[4] + name:end].decode()))
+    return out
+
+
+def map_symbols(path):
+    """.text.<name> input sections from a GNU ld map file."""
+    out, pending = [], None
+    pat = re.compile(r"^\s*0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s")
+    with open(path, errors="replace") as f:
+        for line in f:
+            m = re.match(r"^ \.text\.(\S+)(.*)$", line)
+            if m:
+                pending, line = m.group(1), m.group(2)
+            if pending is None:
+                continue
+            m = pat.match(line)
+            if m:
+                start, size = int(m.group(1), 16), int(m.group(2), 16)
+                if start and size:
+                    out.append((start, size, pending))
+                pending = None
+            elif line.strip():
+                pending = None
+    return out
+
+
+def list_symbols(path):
+    """Labels and source/instruction lines from objdump -S output."""
+    syms, insns, src = [], [], ""
+    label = re.compile(r"^([0-9a-f]{8}) <([^>]+)>:$")
+    insn = re.compile(r"^ ([0-9a-f]{7,8}):\t(.*)$")
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.rstrip("\n")
+            m = label.match(line)
+            if m:
+                syms.append((int(m.group(1), 16), 0, m.group(2)))
+                continue
+            m = insn.match(line)
+            if m:
+                insns.append((int(m.group(1), 16), src, m.group(2).expandtabs(1)))
+            elif line.strip() and not line.startswith(("Disassembly", "  *", "/*")):
+                src = line.strip()
+    return syms, insns
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("dump")
+    ap.add_argument("symbols", nargs="+", help=".elf, .map or .list of the sampled build")
+    ap.add_argument("-n", type=int, default=0, help="also list the N hottest PCs (needs a .list)")
+    args = ap.parse_args()
+
+    (period, total, handler, dropped), samples = read_dump(args.dump)
+    syms, insns = [], []
+    for path in args.symbols:
+        if path.endswith(".map"):
+            syms += map_symbols(path)
+        elif path.endswith(".list"):
+            s, i = list_symbols(path)
+            syms += s
+            insns += i
+        else:
+            syms += elf_symbols(path)
+    # One entry per start address; a known size beats a bare label
+    by_start = {}
+    for start, size, name in syms:
+        if start not in by_start or (size and not by_start[start][0]):
+            by_start[start] = (size, name)
+    starts = sorted(by_start)
+    insns.sort()
+    pcs = [a for a, _, _ in insns]
+
+    def lookup(pc):
+        i = bisect.bisect_right(starts, pc) - 1
+        if i < 0:
+            return None
+        size, name = by_start[starts[i]]
+        if size and pc >= starts[i] + size:
+            return None
+        return name
+
+    funcs = {}
+    for pc, n in samples.items():
+        name = lookup(pc) or "?"
+        funcs[name] = funcs.get(name, 0) + n
+    counted = sum(samples.values()) or 1
+
+    print("%d samples every %d us (%.2f s), %d in handlers, %d dropped"
+          % (total, period, total * period / 1e6, handler, dropped))
+    print("%8s %6s  %s" % ("samples", "%", "function"))
+    for name, n in sorted(funcs.items(), key=lambda kv: -kv[1]):
+        print("%8d %6.2f  %s" % (n, 100.0 * n / counted, name))
+
+    if args.n and pcs:
+        print("\n%8s %6s  %-8s  %s" % ("samples", "%", "pc", "source / instruction"))
+        for pc, n in sorted(samples.items(), key=lambda kv: -kv[1])[:args.n]:
+            i = bisect.bisect_right(pcs, pc) - 1
+            src, ins = (insns[i][1], insns[i][2]) if i >= 0 and pcs[i] == pc else ("", "")
+            print("%8d %6.2f  %08x  %s: %s" % (n, 100.0 * n / counted, pc, lookup(pc) or "?", src))
+            if ins:
+                print("%26s%s" % ("", ins))
+
+
+if __name__ == "__main__":
+    main()
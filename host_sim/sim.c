@@ -0,0 +1,430 @@
+/*
+ * sim.c
+ *
+ *  Shared main loop for the host builds
+ *
+ *  -t MS       run for MS of simulated time (default 10000, bench: no limit)
+ *  -o PREFIX   frame files are PREFIX_<ms>.ppm (default "frame")
+ *  -f MS       dump a frame every MS, 0 = only the last one (default 0)
+ *  -g          dump raw GRAM instead of what the glass shows
+ *  -k T:B[:D]  hold button B from T ms for D ms (default 100)
+ *  -u T:TEXT   send TEXT on USART1 RX at T ms, paced at the baud rate
+ *  -P T:X,Y[,up]  put the pen of the app's touch panel (sim_SetPen) on raw
+ *              ADC reading X,Y at T ms, a press or a move; ",up" lifts it
+ *              there instead. State changes are printed while a pen is scripted
+ *  -b BAUD     USART1 line rate (default 115200, as MX_USART1_UART_Init)
+ *  -p          also carry USART1 on a pty and run in real time; the pty
+ *              path is printed at start, runs until -t or ^C
+ *  -S FILE     run the expect/send script FILE (uart_script.h), stop when
+ *              it ends; the exit status says whether it passed
+ *  -r FILE     replay the trace_Dump() output in FILE (trace_replay.h) and
+ *              print render cost and state changes per pass
+ *  -q          drop USART1 TX instead of printing it
+ *  -m          print the FSMC timing model (fsmc_model.c) at exit
+ *  -W A:D[:B]  -m with write ADDSET:DATAST:BUSTURN instead of MX_FSMC_Init's
+ *  -B FILE     bench builds: compare against this baseline
+ *  -T PCT      bench builds: allowed growth over the baseline (default 0)
+ *  -D SPEC     options for the app's device models, e.g. the DS3231's
+ *              "time=23:59:50,byte_us=20,nack=100" (see ds3231_model.h)
+ */
+
+#include "sim.h"
+#include "software_timer.h"
+#include "bench.h"
+#include "fsmc_model.h"
+#include "uart_script.h"
+#include "trace_replay.h"
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#define SIM_MAX_KEYS	64
+#define SIM_MAX_LINES	16
+#define SIM_MAX_PENS	64
+
+static struct {
+	uint32_t t, d;
+	uint8_t b;
+} keys[SIM_MAX_KEYS];
+static uint8_t nkeys = 0;
+
+static struct {
+	uint32_t t;
+	const char *text;
+	uint8_t sent;
+} lines[SIM_MAX_LINES];
+static uint8_t nlines = 0;
+
+static struct {
+	uint32_t t;
+	uint16_t x, y;
+	uint8_t up, done;
+} pens[SIM_MAX_PENS];
+static uint8_t npens = 0;
+static void (*pen_fn)(uint16_t x, uint16_t y, uint8_t up) = NULL;
+
+static const char *sim_name;
+static const char *prefix = "frame";
+#if LCD_BENCH
+static uint32_t run_ms = 0xFFFFFFFF;	// the bench script decides
+#else
+static uint32_t run_ms = 10000;
+#endif
+static uint32_t frame_ms = 0;
+static uint32_t next_frame = 0;
+static int shown = 1;
+static const char *baseline = NULL;
+static uint32_t tolerance = 0;
+static int model = 0;
+static const char *model_write = NULL;
+static uint8_t realtime = 0;
+static uint8_t scripted = 0;
+static uint8_t replaying = 0;
+static const char *(*state_fn)(void) = NULL;
+static char last_state[48];
+static ili9341_Stats_t pass_start;
+static struct {
+	uint32_t passes, drawn, worst_pass, worst_data;
+} replay_sum;
+static struct timespec wall_start;
+const char *sim_dev_opts = "";
+
+static void sim_Usage(void)
+{
+	fprintf(stderr, "usage: %s [-t ms] [-o prefix] [-f ms] [-g] [-q] [-k t:button[:ms]]... [-u t:text]... [-P t:x,y[,up]]... [-b baud] [-p] [-S script] [-r trace] [-m] [-W addset:datast[:busturn]] [-B baseline] [-T pct] [-D device-options]\n", sim_name);
+	exit(2);
+}
+
+void sim_Init(int argc, char **argv, const char *name)
+{
+	int opt;
+	char *end;
+	uint8_t run_set = 0;
+	const char *pty;
+	sim_name = name;
+	sim_uart_out = stdout;
+	while((opt = getopt(argc, argv, "t:o:f:gqk:u:P:b:pS:r:mW:B:T:D:")) != -1){
+		switch(opt){
+		case 't': run_ms = strtoul(optarg, NULL, 0); run_set = 1; break;
+		case 'o': prefix = optarg; break;
+		case 'f': frame_ms = strtoul(optarg, NULL, 0); break;
+		case 'g': shown = 0; break;
+		case 'q': sim_uart_out = NULL; break;
+		case 'm': model = 1; break;
+		case 'W': model = 1; model_write = optarg; break;
+		case 'B': baseline = optarg; break;
+		case 'T': tolerance = strtoul(optarg, NULL, 0); break;
+		case 'D': sim_dev_opts = optarg; break;
+		case 'k':
+			if(nkeys == SIM_MAX_KEYS) sim_Usage();
+			keys[nkeys].t = strtoul(optarg, &end, 0);
+			if(*end != ':') sim_Usage();
+			keys[nkeys].b = strtoul(end + 1, &end, 0);
+			keys[nkeys].d = (*end == ':') ? strtoul(end + 1, NULL, 0) : 100;
+			if(keys[nkeys].b > 15) sim_Usage();
+			nkeys++;
+			break;
+		case 'u':
+			if(nlines == SIM_MAX_LINES) sim_Usage();
+			lines[nlines].t = strtoul(optarg, &end, 0);
+			if(*end != ':') sim_Usage();
+			lines[nlines].text = end + 1;
+			lines[nlines].sent = 0;
+			nlines++;
+			break;
+		case 'P':
+			if(npens == SIM_MAX_PENS) sim_Usage();
+			pens[npens].t = strtoul(optarg, &end, 0);
+			if(*end != ':') sim_Usage();
+			pens[npens].x = strtoul(end + 1, &end, 0);
+			if(*end != ',') sim_Usage();
+			pens[npens].y = strtoul(end + 1, &end, 0);
+			if(strcmp(end, ",up") == 0) pens[npens].up = 1;
+			else if(*end != 0) sim_Usage();
+			pens[npens].done = 0;
+			npens++;
+			break;
+		case 'b':
+			sim_uart_baud = strtoul(optarg, NULL, 0);
+			if(sim_uart_baud == 0) sim_Usage();
+			break;
+		case 'p':
+			if((pty = sim_UartOpenPty()) == NULL){
+				perror("pty");
+				exit(2);
+			}
+			fprintf(stderr, "%s: USART1 on %s\n", sim_name, pty);
+			realtime = 1;
+			break;
+		case 'S':
+			if(script_Load(optarg) != 0) exit(2);
+			scripted = 1;
+			break;
+		case 'r':
+			if(replay_Load(optarg) != 0) exit(2);
+			replaying = 1;
+			break;
+		default:
+			sim_Usage();
+		}
+	}
+	// The timing also clocks sim_Cycles(), so it is read even without -m
+	if(fsmc_Load(SIM_PROJECT "/Core/Src/fsmc.c", SIM_PROJECT "/Core/Src/main.c") == 0){
+		SystemCoreClock = fsmc_timing.hclk;
+	} else if(model) exit(2);
+	if(model_write != NULL && fsmc_SetWrite(model_write) != 0) sim_Usage();
+	// A pty session or a script ends on its own
+	if(!run_set && (realtime || scripted || replaying)) run_ms = 0xFFFFFFFF;
+	if(realtime) clock_gettime(CLOCK_MONOTONIC, &wall_start);
+	ili9341_Reset();
+	next_frame = frame_ms;
+}
+
+static void sim_Inputs(void)
+{
+	uint8_t i;
+	uint16_t held = 0;
+	for(i = 0; i < nkeys; i++){
+		if(sim_ms >= keys[i].t && sim_ms < keys[i].t + keys[i].d) held |= 1 << keys[i].b;
+	}
+	for(i = 0; i < npens; i++){
+		if(sim_ms >= pens[i].t && !pens[i].done){
+			fprintf(stderr, "pen: %7u ms %-4s raw %u,%u\n", sim_ms, pens[i].up ? "up" : "down", pens[i].x, pens[i].y);
+			pen_fn(pens[i].x, pens[i].y, pens[i].up);
+			pens[i].done = 1;
+		}
+	}
+	script_Step();
+	sim_keys = held | script_Keys();
+	for(i = 0; i < nlines; i++){
+		if(sim_ms >= lines[i].t && !lines[i].sent){
+			sim_UartSend((const uint8_t *)lines[i].text, strlen(lines[i].text));
+			lines[i].sent = 1;
+		}
+	}
+}
+
+// Pty sessions: hold each simulated ms back to wall-clock time
+static void sim_Realtime(void)
+{
+	struct timespec t = wall_start;
+	t.tv_sec += sim_ms/1000;
+	t.tv_nsec += (long)(sim_ms%1000)*1000000;
+	if(t.tv_nsec >= 1000000000){
+		t.tv_sec++;
+		t.tv_nsec -= 1000000000;
+	}
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+}
+
+static void sim_Started(void)
+{
+	static uint8_t started = 0;
+	if(!started){
+		if(npens && pen_fn == NULL){
+			fprintf(stderr, "%s: -P needs a touch panel\n", sim_name);
+			exit(2);
+		}
+		// Frames for the timing model are main loop passes
+		fsmc_Start();
+		started = 1;
+	}
+}
+
+uint8_t sim_Step(void)
+{
+	sim_Started();
+	if(sim_ms >= run_ms || script_Done()) return 0;
+	sim_Inputs();
+	sim_TickMs();
+	if(realtime) sim_Realtime();
+	return 1;
+}
+
+uint8_t sim_Wait(void)
+{
+	uint32_t t0;
+	sim_Started();
+	timer2_Wheel();			// tickless: the wheel runs at its own expiry
+	t0 = sim_Cycles();
+	while(!flag_timer2){
+		if(!sim_Step()) return 0;
+		timer2_Wheel();
+	}
+	timer2_Idle(t0);		// what timer2_Wait() does on the board
+	timer2_Take();
+	if(replaying && !replay_Tick()) return 0;
+	pass_start = ili9341_stats;
+	return 1;
+}
+
+uint32_t sim_Cycles(void)
+{
+	uint64_t c = (uint64_t)sim_ms*(SystemCoreClock/1000) + (uint64_t)sim_SubMsUs()*(SystemCoreClock/1000000);
+	c += (uint64_t)(ili9341_stats.reg_writes + ili9341_stats.data_writes)*fsmc_WriteHclk();
+	c += (uint64_t)ili9341_stats.data_reads*fsmc_ReadHclk();
+	return (uint32_t)c;
+}
+
+uint8_t sim_Replaying(void)
+{
+	return replaying;
+}
+
+void sim_SetState(const char *(*fn)(void))
+{
+	state_fn = fn;
+	if(fn != NULL) snprintf(last_state, sizeof(last_state), "%s", fn());
+}
+
+void sim_SetPen(void (*fn)(uint16_t x, uint16_t y, uint8_t up))
+{
+	pen_fn = fn;
+}
+
+// With a pen script: the FSM states the touches led to
+static void sim_StateRow(void)
+{
+	const char *state = state_fn ? state_fn() : "";
+	if(strcmp(state, last_state) == 0) return;
+	fprintf(stderr, "state: %7u ms %s -> %s\n", sim_ms, last_state, state);
+	snprintf(last_state, sizeof(last_state), "%s", state);
+}
+
+// One row per pass that drew something or changed state
+static void sim_ReplayRow(void)
+{
+	uint32_t reg = ili9341_stats.reg_writes - pass_start.reg_writes;
+	uint32_t data = ili9341_stats.data_writes - pass_start.data_writes;
+	const char *state = state_fn ? state_fn() : "";
+	uint8_t changed = strcmp(state, last_state) != 0;
+	replay_sum.passes++;
+	if(data > replay_sum.worst_data){
+		replay_sum.worst_data = data;
+		replay_sum.worst_pass = replay_pass;
+	}
+	if(reg == 0 && data == 0 && !changed) return;
+	if(reg || data) replay_sum.drawn++;
+	fprintf(stderr, "replay: pass %6u %7u ms  reg %5u data %7u windows %4u pixels %7u  %s%s%s\n",
+			replay_pass, sim_ms, reg, data, ili9341_stats.windows - pass_start.windows,
+			ili9341_stats.pixels - pass_start.pixels, changed ? last_state : state,
+			changed ? " -> " : "", changed ? state : "");
+	snprintf(last_state, sizeof(last_state), "%s", state);
+}
+
+static void sim_Dump(void)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s_%06u.ppm", prefix, sim_ms);
+	if(ili9341_DumpPPM(path, shown) != 0) perror(path);
+}
+
+void sim_EndPass(void)
+{
+	fsmc_EndFrame();
+	if(replaying) sim_ReplayRow();
+	else if(npens) sim_StateRow();
+	if(frame_ms == 0 || sim_ms < next_frame) return;
+	sim_Dump();
+	next_frame += frame_ms;
+}
+
+int sim_Finish(void)
+{
+	sim_Dump();
+	fprintf(stderr, "%s: %u ms, reg %u, data %u, reads %u, windows %u, pixels %u, uart overruns %u, TIM2 irqs %u\n",
+			sim_name, sim_ms, ili9341_stats.reg_writes, ili9341_stats.data_writes,
+			ili9341_stats.data_reads, ili9341_stats.windows, ili9341_stats.pixels,
+			sim_uart_overruns, timer2_irqs);
+	if(sim_i2c_stats.transactions){
+		fprintf(stderr, "%s: i2c %u transfers, %u bytes, %u nacks, %u timeouts, %llu us blocked (%.2f%% of run)\n",
+				sim_name, sim_i2c_stats.transactions, sim_i2c_stats.bytes, sim_i2c_stats.nacks,
+				sim_i2c_stats.timeouts, (unsigned long long)sim_i2c_stats.busy_us,
+				sim_ms ? sim_i2c_stats.busy_us/(10.0*sim_ms) : 0.0);
+	}
+	if(model) fsmc_Report(stderr);
+	if(replaying){
+		fprintf(stderr, "replay: %u passes, %u drew, heaviest pass %u (%u data cycles)\n",
+				replay_sum.passes, replay_sum.drawn, replay_sum.worst_pass, replay_sum.worst_data);
+	}
+	return script_Report(stderr);
+}
+
+#if LCD_BENCH
+#define BENCH_FIELDS	9
+
+static void bench_Fields(const bench_Result_t *r, uint32_t *v)
+{
+	v[0] = r->ticks;
+	v[1] = r->total.reg;
+	v[2] = r->total.data;
+	v[3] = r->total.windows;
+	v[4] = r->total.pixels;
+	v[5] = r->peak.reg;
+	v[6] = r->peak.data;
+	v[7] = r->peak.windows;
+	v[8] = r->peak.pixels;
+}
+
+// Baseline row for app/name, 0 if there is none
+static int bench_Baseline(FILE *f, const char *app, const char *name, uint32_t *v)
+{
+	char line[256], a[32], n[32];
+	rewind(f);
+	while(fgets(line, sizeof(line), f) != NULL){
+		if(line[0] == '#') continue;
+		if(sscanf(line, "%31s %31s %u %u %u %u %u %u %u %u %u", a, n, &v[0], &v[1], &v[2],
+				&v[3], &v[4], &v[5], &v[6], &v[7], &v[8]) != 2 + BENCH_FIELDS) continue;
+		if(strcmp(a, app) == 0 && strcmp(n, name) == 0) return 1;
+	}
+	return 0;
+}
+
+int sim_BenchCheck(const char *app)
+{
+	static const char *field[BENCH_FIELDS] = {
+		"ticks", "reg", "data", "windows", "pixels",
+		"peak_reg", "peak_data", "peak_windows", "peak_pixels"
+	};
+	FILE *f = NULL;
+	uint32_t cur[BENCH_FIELDS], base[BENCH_FIELDS];
+	uint8_t i, k;
+	int failed = 0;
+
+	if(baseline != NULL && (f = fopen(baseline, "r")) == NULL){
+		perror(baseline);
+		return 2;
+	}
+	for(i = 0; i < bench_count; i++){
+		bench_Fields(&bench_results[i], cur);
+		printf("%s %s", app, bench_results[i].name);
+		for(k = 0; k < BENCH_FIELDS; k++) printf(" %u", cur[k]);
+		printf("\n");
+		if(f == NULL) continue;
+		if(!bench_Baseline(f, app, bench_results[i].name, base)){
+			fprintf(stderr, "%s %s: no baseline row\n", app, bench_results[i].name);
+			failed = 1;
+			continue;
+		}
+		if(cur[0] != base[0]){
+			fprintf(stderr, "%s %s: %u ticks, baseline has %u (scenario changed)\n",
+					app, bench_results[i].name, cur[0], base[0]);
+			failed = 1;
+			continue;
+		}
+		for(k = 1; k < BENCH_FIELDS; k++){
+			if((uint64_t)cur[k]*100 > (uint64_t)base[k]*(100 + tolerance)){
+				fprintf(stderr, "%s %s: %s %u > baseline %u\n", app, bench_results[i].name,
+						field[k], cur[k], base[k]);
+				failed = 1;
+			}
+		}
+	}
+	if(f != NULL){
+		fclose(f);
+		fprintf(stderr, "%s: %s\n", app, failed ? "REGRESSION" : "ok");
+	}
+	return failed;
+}
+#endif
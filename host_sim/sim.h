@@ -0,0 +1,52 @@
+/*
+ * sim.h
+ *
+ *  Shared main loop for the host builds: command line, scripted inputs,
+ *  frame dumps and the bus counters at exit
+ */
+
+#ifndef HOST_SIM_SIM_H_
+#define HOST_SIM_SIM_H_
+
+#include "hal_sim.h"
+#include "ili9341.h"
+
+// -D: option string for the app's device models, "" when not given
+extern const char *sim_dev_opts;
+
+// Parse the command line; exits with usage on a bad option
+void sim_Init(int argc, char **argv, const char *name);
+
+// Run 1ms ticks, feeding scripted keys and UART bytes, until flag_timer2
+// is set (clears it) or the run is over. 0 = run is over. flag_timer2 comes
+// every 50ms, or every tick with the scheduler (sched.h).
+uint8_t sim_Wait(void);
+
+// One 1ms tick with its scripted inputs, for a caller that does its own
+// waiting (the kernel's idle thread). 0 = run is over.
+uint8_t sim_Step(void);
+
+// Call at the end of each loop pass: dumps a frame when one is due
+void sim_EndPass(void);
+
+// Virtual DWT->CYCCNT: simulated time plus the LCD bus time of the FSMC
+// model, at the HCLK SystemClock_Config() sets up
+uint32_t sim_Cycles(void);
+
+// -r: inputs come from a trace, devices should answer from it too
+uint8_t sim_Replaying(void);
+
+// Name of the app's FSM state, for the replay report
+void sim_SetState(const char *(*fn)(void));
+
+// -P: the app's touch panel; fn puts the pen on raw X,Y, or lifts it (up)
+void sim_SetPen(void (*fn)(uint16_t x, uint16_t y, uint8_t up));
+
+// Last frame and bus counters; returns the exit status (a -S script failed)
+int sim_Finish(void);
+
+// Bench builds: print bench_results as baseline rows tagged with app and
+// compare them with -B. Returns the exit status, 1 on a regression.
+int sim_BenchCheck(const char *app);
+
+#endif /* HOST_SIM_SIM_H_ */
@@ -0,0 +1,164 @@
+/*
+ * touch_test.c
+ *
+ *  Checks for the XPT2046 driver of Bai3_Lcd_button (Core/Src/touch.c) on
+ *  its HOST_SIM mock controller: the pen is scripted here, TIM2 runs
+ *  touch_Tick() as on the board, and the events touch_GetEvent() hands out
+ *  are compared with what the pen did. Prints one line per check, exits 1
+ *  if any failed.
+ */
+
+#include "sim.h"
+#include "software_timer.h"
+#include "led_7seg.h"
+#include "lcd.h"
+#include "touch.h"
+#include <stdlib.h>
+
+#define PEN_Z1		1000		// raw Z1 of a press, above TOUCH_Z_MIN
+#define FRAME_MS	50			// main loop pass, setTimer2() below
+
+static uint8_t failed = 0;
+
+static void check(uint8_t ok, const char *what)
+{
+	printf("%s  %s\n", ok ? "ok  " : "FAIL", what);
+	if(!ok) failed = 1;
+}
+
+// ms of simulated time, TIM2 and with it touch_Tick() running
+static void run(uint32_t ms)
+{
+	while(ms--){
+		if(!sim_Step()){
+			fprintf(stderr, "touch_test: out of run time at %u ms\n", sim_ms);
+			exit(2);
+		}
+	}
+}
+
+// Until the next main loop pass, as traffic_main.c waits for it
+static void pass(void)
+{
+	if(!sim_Wait()){
+		fprintf(stderr, "touch_test: out of run time at %u ms\n", sim_ms);
+		exit(2);
+	}
+}
+
+// Screen position the current calibration gives a raw reading: press, take
+// the DOWN, release and drain. 0 if no DOWN came within a burst period
+static uint8_t tap(uint16_t rx, uint16_t ry, uint16_t *x, uint16_t *y)
+{
+	touch_Event_t ev;
+	uint8_t got = 0;
+	touch_MockPress(rx, ry, PEN_Z1);
+	run(TOUCH_PERIOD_MS + 1);
+	if(touch_GetEvent(&ev) && ev.type == TOUCH_DOWN){
+		*x = ev.x;
+		*y = ev.y;
+		got = 1;
+	}
+	touch_MockRelease();
+	run(TOUCH_PERIOD_MS + 1);
+	while(touch_GetEvent(&ev));
+	return got;
+}
+
+static uint8_t near(uint16_t a, uint16_t b)
+{
+	return a + 1 >= b && a <= b + 1;
+}
+
+// Nothing is queued while no pen is down, before or after a press
+static void test_Idle(uint32_t ms, const char *what)
+{
+	uint32_t end = sim_ms + ms;
+	uint8_t quiet = 1;
+	while(sim_ms < end){
+		pass();
+		if(touch_Pending()) quiet = 0;
+	}
+	check(quiet, what);
+}
+
+// DOWN, MOVE, UP with their ticks, and DOWN in the pass after pen-down
+static void test_Sequence(void)
+{
+	touch_Event_t ev;
+	uint32_t t_down, t_move, t_up;
+	uint16_t x0, y0;
+	char what[96];
+
+	pass();
+	run(FRAME_MS/3);					// pen down mid-frame
+	t_down = sim_ms;
+	touch_MockPress(2000, 2000, PEN_Z1);
+	pass();
+	check(touch_GetEvent(&ev) && ev.type == TOUCH_DOWN, "DOWN first");
+	x0 = ev.x;
+	y0 = ev.y;
+	snprintf(what, sizeof(what), "DOWN stamped %d ms after pen-down, seen by the pass %u ms after",
+			(int)(ev.tick - t_down), sim_ms - t_down);
+	check(ev.tick >= t_down && sim_ms - t_down <= FRAME_MS, what);
+	check(x0 == 116 && y0 == 155, "DOWN at the default calibration's pixel");
+
+	run(5*TOUCH_PERIOD_MS);
+	check(!touch_Pending(), "no MOVE while the pen stays put");
+
+	t_move = sim_ms;
+	touch_MockPress(2400, 2000, PEN_Z1);
+	run(TOUCH_PERIOD_MS + 1);
+	check(touch_GetEvent(&ev) && ev.type == TOUCH_MOVE && ev.x > x0 && ev.y == y0, "MOVE to the right");
+	check(ev.tick >= t_move && ev.tick - t_move <= TOUCH_PERIOD_MS, "MOVE within a burst period");
+	x0 = ev.x;
+
+	t_up = sim_ms;
+	touch_MockRelease();
+	run(TOUCH_PERIOD_MS + 1);
+	check(touch_GetEvent(&ev) && ev.type == TOUCH_UP && ev.x == x0 && ev.y == y0, "UP at the last position");
+	check(ev.tick >= t_up && ev.tick - t_up <= TOUCH_PERIOD_MS, "UP within a burst period");
+	check(!touch_Pending(), "nothing after UP");
+}
+
+// Three reference points map back to their pixels, and so does their
+// centroid; collinear points are refused
+static void test_Calibration(void)
+{
+	static const uint16_t raw[3][2] = {{600, 500}, {3500, 1900}, {1800, 3600}};
+	static const uint16_t scr[3][2] = {{20, 20}, {220, 160}, {120, 300}};
+	static const uint16_t line[3][2] = {{500, 500}, {1000, 1000}, {1500, 1500}};
+	uint16_t x, y;
+	uint8_t i, ok = 1;
+	check(touch_Calibrate(raw, scr), "calibration from three points");
+	for(i = 0; i < 3; i++){
+		if(!tap(raw[i][0], raw[i][1], &x, &y) || !near(x, scr[i][0]) || !near(y, scr[i][1])){
+			printf("      point %u: raw %u,%u gave %u,%u for %u,%u\n", i, raw[i][0], raw[i][1], x, y, scr[i][0], scr[i][1]);
+			ok = 0;
+		}
+	}
+	check(ok, "reference points round-trip");
+	ok = tap((raw[0][0] + raw[1][0] + raw[2][0])/3, (raw[0][1] + raw[1][1] + raw[2][1])/3, &x, &y);
+	check(ok && near(x, (scr[0][0] + scr[1][0] + scr[2][0])/3) && near(y, (scr[0][1] + scr[1][1] + scr[2][1])/3),
+			"centroid maps to the centroid");
+	check(!touch_Calibrate(line, scr), "collinear points refused");
+}
+
+int main(int argc, char **argv)
+{
+	sim_Init(argc, argv, "touch_test");
+
+	timer_init();
+	led7_init();
+	lcd_init();
+	touch_init();
+	setTimer2(FRAME_MS);
+
+	test_Idle(500, "no events while idle");
+	test_Sequence();
+	test_Idle(500, "no events once the pen is up");
+	test_Calibration();
+
+	printf("touch_test: %s at %u ms\n", failed ? "FAILED" : "ok", sim_ms);
+	return failed;
+}
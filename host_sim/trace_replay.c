@@ -0,0 +1,115 @@
+/*
+ * trace_replay.c
+ *
+ *  Replays a trace from trace_Dump() one main loop pass at a time
+ *
+ *  A pass tag of n stands for n passes: the first n-1 had no new input and
+ *  the events after the tag belong to the last one. The button word holds
+ *  until the next button record and the time registers until the next RTC
+ *  record, as on the target where only changes are written.
+ */
+
+#include "trace_replay.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint8_t *buf;
+static uint32_t len, pos;
+static uint8_t idle;			// passes left in the current tag before its events
+static uint8_t rtc[7];
+
+uint32_t replay_pass = 0;
+
+static int replay_Rtc(void *ctx, uint16_t reg, uint8_t *out, uint16_t n)
+{
+	while(n--){
+		*out++ = (reg < 7) ? rtc[reg] : 0;
+		reg++;
+	}
+	return 0;
+}
+
+static int replay_RtcWrite(void *ctx, uint16_t reg, const uint8_t *data, uint16_t n)
+{
+	return 0;
+}
+
+const sim_I2cDev_t replay_rtc = { replay_Rtc, replay_RtcWrite, NULL };
+
+// Apply records up to the next pass tag
+static int replay_Events(void)
+{
+	uint8_t tag, n;
+	while(pos < len && (buf[pos] & 0xC0) != TRACE_TAG_PASS){
+		tag = buf[pos++];
+		if(tag == TRACE_TAG_BUTTONS && pos + 2 <= len){
+			sim_button_raw = buf[pos] | buf[pos + 1] << 8;
+			pos += 2;
+		} else if((tag & 0xF0) == TRACE_TAG_RX && (n = tag & 0x0F) > 0 && pos + n <= len){
+			while(n--) sim_UartFeed(buf[pos++]);
+		} else if(tag == TRACE_TAG_RTC && pos + 7 <= len){
+			memcpy(rtc, &buf[pos], 7);
+			pos += 7;
+		} else if(tag == TRACE_TAG_KEY && pos + 13 <= len){
+			replay_pass = buf[pos] | buf[pos + 1] << 8 | buf[pos + 2] << 16 | (uint32_t)buf[pos + 3] << 24;
+			sim_button_raw = buf[pos + 4] | buf[pos + 5] << 8;
+			memcpy(rtc, &buf[pos + 6], 7);
+			pos += 13;
+		} else {
+			fprintf(stderr, "replay: bad record 0x%02X at byte %u\n", tag, pos - 1);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int replay_Load(const char *path)
+{
+	char line[256];
+	uint32_t passes, bytes, i;
+	unsigned v;
+	int in = 0;
+	FILE *f = fopen(path, "r");
+	if(f == NULL){
+		perror(path);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), f) != NULL){
+		if(!in){
+			if(sscanf(line, "TRACE %u %u", &passes, &bytes) == 2){
+				free(buf);
+				buf = malloc(bytes ? bytes : 1);
+				len = 0;
+				in = 1;
+			}
+			continue;
+		}
+		if(strncmp(line, "END", 3) == 0){
+			in = 2;
+			break;
+		}
+		for(i = 0; line[2*i] && sscanf(&line[2*i], "%2x", &v) == 1 && len < bytes; i++) buf[len++] = v;
+	}
+	fclose(f);
+	if(in != 2 || len != bytes){
+		fprintf(stderr, "%s: no complete TRACE..END block\n", path);
+		return -1;
+	}
+	pos = 0;
+	idle = 0;
+	sim_button_raw = 0xffff;
+	fprintf(stderr, "replay: %u passes recorded, %u bytes\n", passes, len);
+	return replay_Events();
+}
+
+uint8_t replay_Tick(void)
+{
+	if(idle == 0){
+		if(pos >= len) return 0;
+		idle = buf[pos++] & 0x3F;
+	}
+	replay_pass++;
+	if(--idle == 0 && replay_Events() != 0) return 0;
+	return 1;
+}
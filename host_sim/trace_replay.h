@@ -0,0 +1,27 @@
+/*
+ * trace_replay.h
+ *
+ *  Replays a trace from trace_Dump() (Core/Src/trace.c) one main loop pass
+ *  at a time: button words through SPI1, RX bytes into the USART1
+ *  interrupt and time registers from replay_rtc at the DS3231 address
+ */
+
+#ifndef HOST_SIM_TRACE_REPLAY_H_
+#define HOST_SIM_TRACE_REPLAY_H_
+
+#include "hal_sim.h"
+
+// Reads the dump out of a terminal log: everything outside TRACE..END is
+// skipped. Applies the events from before the main loop. 0 on success.
+int replay_Load(const char *path);
+
+// Apply the inputs of the next pass; 0 once the trace is used up
+uint8_t replay_Tick(void);
+
+// Pass number on the target (continues from a key record)
+extern uint32_t replay_pass;
+
+// Answers time reads with the last recorded registers, ignores writes
+extern const sim_I2cDev_t replay_rtc;
+
+#endif /* HOST_SIM_TRACE_REPLAY_H_ */
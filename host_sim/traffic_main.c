@@ -0,0 +1,136 @@
+/*
+ * traffic_main.c
+ *
+ *  Host entry point for Bai3_Lcd_button: system_init() and the main loop
+ *  from Core/Src/main.c without the CubeMX peripheral init
+ */
+
+#include "sim.h"
+#include "bench.h"
+#include "software_timer.h"
+#include "led_7seg.h"
+#include "button.h"
+#include "lcd.h"
+#include "touch.h"
+#include "traffic_fsm.h"
+#include "trace.h"
+#include "prof.h"
+#include "loopstat.h"
+#include "timer_wheel.h"
+#include "evq.h"
+#include <string.h>
+
+static uint16_t pen_z1 = 1000;		// raw Z1 of a scripted press, above TOUCH_Z_MIN
+
+// -P: the mock XPT2046 in touch.c
+static void traffic_Pen(uint16_t x, uint16_t y, uint8_t up)
+{
+	if(up) touch_MockRelease();
+	else touch_MockPress(x, y, pen_z1);
+}
+
+// -D for the touch panel: z1=RAW, and cal=RX:RY:X:Y/RX:RY:X:Y/RX:RY:X:Y runs
+// touch_Calibrate() on three raw readings and the pixels they should map to
+static int traffic_Config(const char *spec)
+{
+	char key[16];
+	unsigned a;
+	uint16_t raw[3][2], scr[3][2];
+	int len;
+	uint8_t i;
+	while(*spec){
+		if(sscanf(spec, "%15[^=]=%n", key, &len) != 1) return -1;
+		spec += len;
+		if(strcmp(key, "z1") == 0 && sscanf(spec, "%u", &a) == 1 && a < 4096){
+			pen_z1 = a;
+		} else if(strcmp(key, "cal") == 0){
+			for(i = 0; i < 3; i++){
+				if(sscanf(spec, "%hu:%hu:%hu:%hu%n", &raw[i][0], &raw[i][1], &scr[i][0], &scr[i][1], &len) != 4) return -1;
+				spec += len;
+				if(i < 2 && *spec++ != '/') return -1;
+			}
+			if(!touch_Calibrate(raw, scr)) return -1;
+		} else return -1;
+		spec += strcspn(spec, ",");
+		if(*spec == ',') spec++;
+	}
+	return 0;
+}
+
+static const char *traffic_State(void)
+{
+	static const char *mode[] = {"?", "normal", "modify_red", "modify_green", "modify_yellow"};
+	static const char *state[] = {"G/R", "Y/R", "R/R", "R/G", "R/Y", "R/R2"};
+	static char name[32];
+	System_Mode_t m = fsm_traffic_mode();
+	Traffic_State_t s = fsm_traffic_state();
+	snprintf(name, sizeof(name), "%s %s", (m <= MODE_MODIFY_YELLOW) ? mode[m] : "?",
+			(s <= STATE_ALL_RED_2) ? state[s] : "?");
+	return name;
+}
+
+int main(int argc, char **argv)
+{
+	sim_Init(argc, argv, "traffic_sim");
+
+	timer_init();
+	led7_init();
+	button_init();
+	lcd_init();
+	touch_init();
+	if(traffic_Config(sim_dev_opts) != 0){
+		fprintf(stderr, "traffic_sim: bad -D '%s'\n", sim_dev_opts);
+		return 2;
+	}
+	sim_SetPen(traffic_Pen);
+	setTimer2(50);
+	fsm_traffic_init();
+	sim_SetState(traffic_State);
+
+#if LCD_BENCH
+	bench_Run();
+	return sim_BenchCheck("traffic");
+#endif
+	trace_init();
+	prof_init();
+	loop_init();
+
+	while(sim_Wait()){
+		tw_Run();
+		loop_Start();
+		prof_Poll();
+		PROF_ZONE("main_loop");
+		trace_Tick();
+		button_Scan();
+#if TRACE_ENABLE
+		if(button_count[TRACE_DUMP_KEY] == 1) trace_Dump();
+#endif
+#if PROF_ENABLE
+		if(button_count[PROF_DUMP_KEY] == 1) prof_Request(0);
+#endif
+#if LOOP_STATS
+		if(button_count[LOOP_DUMP_KEY] == 1) loop_Request(0);
+#endif
+#if EVQ_ENABLE
+		if(button_count[EVQ_DUMP_KEY] == 1) evq_Request(0);
+#endif
+#if PHASE_STATS
+		if(button_count[PHASE_DUMP_KEY] == 1) fsm_traffic_request(0);
+#endif
+#if EVQ_ENABLE
+		fsm_traffic_dispatch();
+#else
+		fsm_traffic_run();
+#endif
+		loop_End();
+		loop_Poll();
+		evq_Poll();
+		fsm_traffic_poll();
+		sim_EndPass();
+	}
+	prof_Report();
+	loop_Report();
+	evq_Report();
+	fsm_traffic_report();
+	return sim_Finish();
+}
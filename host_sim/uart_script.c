@@ -0,0 +1,244 @@
+/*
+ * uart_script.c
+ *
+ *  Expect/send scripts against USART1 for the host builds
+ *
+ *  Times are simulated ms, so a script gives the same latencies on every
+ *  run. TX is collected through sim_uart_tx_hook into a window that
+ *  expect searches from the end of its last match.
+ */
+
+#include "uart_script.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SCRIPT_MAX_STEPS	128
+#define SCRIPT_MAX_TEXT		64
+#define SCRIPT_TX_SIZE		4096
+
+typedef enum {
+	SCRIPT_KEY,
+	SCRIPT_SEND,
+	SCRIPT_EXPECT,
+	SCRIPT_SLEEP,
+	SCRIPT_MARK,
+	SCRIPT_LAP
+} script_Op_t;
+
+typedef struct {
+	script_Op_t op;
+	uint32_t arg;
+	char text[SCRIPT_MAX_TEXT];
+	uint16_t len;
+	uint16_t line;
+} script_Step_t;
+
+static script_Step_t steps[SCRIPT_MAX_STEPS];
+static uint16_t nsteps = 0;
+static uint16_t pc = 0;
+static uint8_t started = 0;		// steps[pc] has been started
+static uint8_t failed = 0;
+static uint32_t step_ms;		// when steps[pc] started
+static uint32_t send_ms;		// when the last send left the wire
+static uint8_t sent = 0;
+static uint32_t mark_ms;
+static uint16_t keys = 0;
+
+static char tx[SCRIPT_TX_SIZE + 1];
+static uint32_t tx_len = 0;
+static uint32_t tx_from = 0;	// expect searches from here
+
+static void script_Tx(const uint8_t *data, uint16_t n)
+{
+	uint16_t i;
+	uint32_t drop;
+	if(tx_len + n > SCRIPT_TX_SIZE){
+		// Keep the newest half; expect never looks further back than that
+		drop = tx_len + n - SCRIPT_TX_SIZE/2;
+		if(drop > tx_len) drop = tx_len;
+		memmove(tx, tx + drop, tx_len - drop);
+		tx_len -= drop;
+		tx_from = (tx_from > drop) ? tx_from - drop : 0;
+	}
+	for(i = 0; i < n && tx_len < SCRIPT_TX_SIZE; i++) tx[tx_len++] = data[i] ? data[i] : '.';
+	tx[tx_len] = '\0';
+}
+
+// Quoted string with C escapes into step->text; returns the rest of the line
+static char *script_Text(char *p, script_Step_t *step)
+{
+	char *end;
+	while(*p == ' ' || *p == '\t') p++;
+	if(*p++ != '"') return NULL;
+	step->len = 0;
+	while(*p != '"'){
+		if(*p == '\0' || step->len == SCRIPT_MAX_TEXT - 1) return NULL;
+		if(*p != '\\'){
+			step->text[step->len++] = *p++;
+			continue;
+		}
+		p++;
+		switch(*p){
+		case 'r': step->text[step->len++] = '\r'; p++; break;
+		case 'n': step->text[step->len++] = '\n'; p++; break;
+		case 't': step->text[step->len++] = '\t'; p++; break;
+		case 'x':
+			step->text[step->len++] = (char)strtoul(p + 1, &end, 16);
+			if(end == p + 1) return NULL;
+			p = end;
+			break;
+		default:
+			if(*p == '\0') return NULL;
+			step->text[step->len++] = *p++;
+			break;
+		}
+	}
+	step->text[step->len] = '\0';
+	return p + 1;
+}
+
+int script_Load(const char *path)
+{
+	char buf[256], cmd[16], *p;
+	uint16_t line = 0;
+	int n;
+	script_Step_t *s;
+	FILE *f = fopen(path, "r");
+	if(f == NULL){
+		perror(path);
+		return -1;
+	}
+	while(fgets(buf, sizeof(buf), f) != NULL){
+		line++;
+		if((p = strchr(buf, '\n')) != NULL) *p = '\0';
+		if(sscanf(buf, " %15s%n", cmd, &n) != 1 || cmd[0] == '#') continue;
+		if(nsteps == SCRIPT_MAX_STEPS){
+			fprintf(stderr, "%s:%u: more than %u steps\n", path, line, SCRIPT_MAX_STEPS);
+			break;
+		}
+		s = &steps[nsteps];
+		memset(s, 0, sizeof(*s));
+		s->line = line;
+		p = buf + n;
+		if(strcmp(cmd, "key") == 0){
+			s->op = SCRIPT_KEY;
+			s->arg = 100;
+			if(sscanf(p, "%hu %u", &s->len, &s->arg) < 1 || s->len > 15) p = NULL;
+		} else if(strcmp(cmd, "send") == 0){
+			s->op = SCRIPT_SEND;
+			p = script_Text(p, s);
+		} else if(strcmp(cmd, "expect") == 0){
+			s->op = SCRIPT_EXPECT;
+			s->arg = 15000;
+			if((p = script_Text(p, s)) != NULL) sscanf(p, "%u", &s->arg);
+		} else if(strcmp(cmd, "sleep") == 0){
+			s->op = SCRIPT_SLEEP;
+			if(sscanf(p, "%u", &s->arg) != 1) p = NULL;
+		} else if(strcmp(cmd, "mark") == 0){
+			s->op = SCRIPT_MARK;
+		} else if(strcmp(cmd, "lap") == 0){
+			s->op = SCRIPT_LAP;
+			if(sscanf(p, " %63s", s->text) != 1) p = NULL;
+		} else p = NULL;
+		if(p == NULL){
+			fprintf(stderr, "%s:%u: bad command '%s'\n", path, line, buf);
+			fclose(f);
+			return -1;
+		}
+		nsteps++;
+	}
+	fclose(f);
+	sim_uart_tx_hook = script_Tx;
+	return 0;
+}
+
+// Printable copy of a step's text for the log
+static const char *script_Show(const script_Step_t *s)
+{
+	static char out[SCRIPT_MAX_TEXT*4];
+	uint16_t i, o = 0;
+	for(i = 0; i < s->len; i++){
+		unsigned char c = s->text[i];
+		if(c == '\r') o += sprintf(out + o, "\\r");
+		else if(c == '\n') o += sprintf(out + o, "\\n");
+		else if(c < 0x20 || c >= 0x7f) o += sprintf(out + o, "\\x%02x", c);
+		else out[o++] = c;
+	}
+	out[o] = '\0';
+	return out;
+}
+
+// 1 = steps[pc] is finished
+static uint8_t script_Run(script_Step_t *s)
+{
+	char *hit;
+	switch(s->op){
+	case SCRIPT_KEY:
+		keys = (sim_ms - step_ms < s->arg) ? 1 << s->len : 0;
+		return keys == 0;
+	case SCRIPT_SEND:
+		if(!started && sim_UartSend((const uint8_t *)s->text, s->len) != s->len){
+			fprintf(stderr, "script:%u: RX wire full\n", s->line);
+		}
+		if(sim_UartPending() != 0) return 0;
+		send_ms = sim_ms;
+		sent = 1;
+		return 1;
+	case SCRIPT_EXPECT:
+		hit = strstr(tx + tx_from, s->text);
+		if(hit != NULL){
+			tx_from = hit - tx + s->len;
+			if(sent) fprintf(stderr, "script: %6u ms  expect \"%s\" +%u ms after send\n",
+					sim_ms, script_Show(s), sim_ms - send_ms);
+			else fprintf(stderr, "script: %6u ms  expect \"%s\"\n", sim_ms, script_Show(s));
+			return 1;
+		}
+		if(sim_ms - step_ms >= s->arg){
+			fprintf(stderr, "script:%u: %6u ms  expect \"%s\" timed out after %u ms\n",
+					s->line, sim_ms, script_Show(s), s->arg);
+			failed = 1;
+			return 0;
+		}
+		return 0;
+	case SCRIPT_SLEEP:
+		return sim_ms - step_ms >= s->arg;
+	case SCRIPT_MARK:
+		mark_ms = sim_ms;
+		return 1;
+	case SCRIPT_LAP:
+		fprintf(stderr, "script: %6u ms  lap %s %u ms\n", sim_ms, s->text, sim_ms - mark_ms);
+		return 1;
+	}
+	return 1;
+}
+
+void script_Step(void)
+{
+	while(pc < nsteps && !failed){
+		if(!started) step_ms = sim_ms;
+		if(!script_Run(&steps[pc])){
+			started = 1;
+			return;
+		}
+		started = 0;
+		pc++;
+	}
+}
+
+uint16_t script_Keys(void)
+{
+	return keys;
+}
+
+uint8_t script_Done(void)
+{
+	return nsteps > 0 && (failed || pc >= nsteps);
+}
+
+int script_Report(FILE *f)
+{
+	if(nsteps == 0) return 0;
+	fprintf(f, "script: %s at %u ms, %u/%u steps\n",
+			failed ? "FAILED" : (pc < nsteps ? "unfinished" : "ok"), sim_ms, pc, nsteps);
+	return failed || pc < nsteps;
+}
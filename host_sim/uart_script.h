@@ -0,0 +1,39 @@
+/*
+ * uart_script.h
+ *
+ *  Expect/send scripts against USART1 for the host builds
+ *
+ *  One command per line, '#' starts a comment, TEXT is a C-style quoted
+ *  string (\r \n \t \\ \" \xHH):
+ *
+ *    key B [MS]        hold button B for MS (default 100), then go on
+ *    send TEXT         put TEXT on the RX wire, go on once it is delivered
+ *    expect TEXT [MS]  wait up to MS (default 15000) for TEXT on TX
+ *    sleep MS
+ *    mark              start the stopwatch
+ *    lap NAME          print the stopwatch as NAME
+ *
+ *  Every expect prints how long after the last send it matched, which is
+ *  the response latency of the firmware. A failed expect stops the script.
+ */
+
+#ifndef HOST_SIM_UART_SCRIPT_H_
+#define HOST_SIM_UART_SCRIPT_H_
+
+#include "hal_sim.h"
+
+// 0 on success; errors name the line
+int script_Load(const char *path);
+
+// Once per ms, before the tick: runs commands until one has to wait
+void script_Step(void);
+
+// Buttons the script holds down, OR-ed into sim_keys
+uint16_t script_Keys(void);
+
+uint8_t script_Done(void);
+
+// Summary line; returns 1 if the script failed or did not finish
+int script_Report(FILE *f);
+
+#endif /* HOST_SIM_UART_SCRIPT_H_ */